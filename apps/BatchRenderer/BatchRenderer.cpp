@@ -0,0 +1,368 @@
+#include "BatchRenderer.hpp"
+#include "tinygltf/stb_image.h"
+#include "tinygltf/stb_image_write.h"
+#include <Eigen/Geometry>
+#include <RenderBoy/Camera.hpp>
+#include <RenderBoy/TextureCache.hpp>
+#include <RenderBoy/utils.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace std::chrono;
+using namespace Eigen;
+
+namespace RB {
+
+void BatchRenderer::process_cmd(int argc, const char **argv) {
+  const auto usage =
+      string("Usage: ") + argv[0] +
+      " /path/to/model [--cameras file | --orbit count[,elevation]]"
+      " [--size WxH] [--output dir] [--workers n] [--views n]"
+      " [--optimize on|off] [--compact-indices on|off]"
+      " [--share-assets on|off]"
+      " [--shading unlit|phong|gouraud|normal|pbr] [--point-lights n]"
+      " [--environment image] [--shadows on|off] [--deferred on|off]"
+      " [--transparency sorted|weighted] [--msaa 1|2|4|8]"
+      " [--exposure value] [--fxaa on|off] [--downscale n] [--vignette value]"
+      " [--srgb on|off]";
+  if (argc < 2) {
+    throw runtime_error(usage);
+  }
+
+  path = argv[1];
+  for (auto i = 2; i < argc; i++) {
+    const string option = argv[i];
+    if (i + 1 >= argc) {
+      throw runtime_error(usage);
+    }
+    const string value = argv[++i];
+    if (option == "--cameras") {
+      cameras_path = value;
+    } else if (option == "--orbit") {
+      if (sscanf(value.c_str(), "%u,%f", &orbit_count, &orbit_elevation) <
+          1) {
+        throw runtime_error("invalid orbit spec: " + value);
+      }
+    } else if (option == "--size") {
+      if (sscanf(value.c_str(), "%ux%u", &width, &height) != 2 ||
+          width == 0 || height == 0) {
+        throw runtime_error("invalid size: " + value);
+      }
+    } else if (option == "--output") {
+      output = value;
+    } else if (option == "--workers") {
+      workers = static_cast<uint32_t>(stoul(value));
+    } else if (option == "--views") {
+      views_per_pass = max(static_cast<uint32_t>(stoul(value)), 1u);
+    } else if (option == "--optimize" && (value == "on" || value == "off")) {
+      optimize_meshes = value == "on";
+    } else if (option == "--compact-indices" &&
+               (value == "on" || value == "off")) {
+      compact_indices = value == "on";
+    } else if (option == "--share-assets" &&
+               (value == "on" || value == "off")) {
+      share_assets = value == "on";
+    } else if (option == "--point-lights") {
+      point_lights = static_cast<uint32_t>(stoul(value));
+    } else if (option == "--shadows" && (value == "on" || value == "off")) {
+      shadows = value == "on";
+    } else if (option == "--deferred" && (value == "on" || value == "off")) {
+      deferred = value == "on";
+    } else if (option == "--transparency" && value == "sorted") {
+      transparency = Context::Transparency::Sorted;
+    } else if (option == "--transparency" && value == "weighted") {
+      transparency = Context::Transparency::WeightedBlended;
+    } else if (option == "--msaa") {
+      samples = static_cast<uint32_t>(stoul(value));
+    } else if (option == "--exposure") {
+      exposure = stof(value);
+    } else if (option == "--fxaa" && (value == "on" || value == "off")) {
+      fxaa = value == "on";
+    } else if (option == "--downscale") {
+      downscale = max(static_cast<uint32_t>(stoul(value)), 1u);
+    } else if (option == "--vignette") {
+      vignette = stof(value);
+    } else if (option == "--srgb" && (value == "on" || value == "off")) {
+      srgb = value == "on";
+    } else if (option == "--environment") {
+      environment_path = value;
+    } else if (option == "--shading") {
+      if (value == "unlit") {
+        shading = Material::Shading::Unlit;
+      } else if (value == "phong") {
+        shading = Material::Shading::Phong;
+      } else if (value == "gouraud") {
+        shading = Material::Shading::Gouraud;
+      } else if (value == "normal") {
+        shading = Material::Shading::Normal;
+      } else if (value == "pbr") {
+        shading = Material::Shading::MetallicRoughness;
+      } else {
+        throw runtime_error(usage);
+      }
+    } else {
+      throw runtime_error(usage);
+    }
+  }
+}
+
+auto BatchRenderer::load_cameras(const BoundingBox &extends) const
+    -> vector<CameraPose> {
+  vector<CameraPose> cameras;
+
+  if (!cameras_path.empty()) {
+    // one camera per line: position x y z, target x y z and optionally up
+    ifstream file(cameras_path);
+    if (!file) {
+      throw runtime_error("cannot open camera file " + cameras_path);
+    }
+    string line;
+    while (getline(file, line)) {
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      istringstream stream(line);
+      CameraPose camera{};
+      for (size_t i = 0; i < 3; i++) {
+        stream >> camera.position[i];
+      }
+      for (size_t i = 0; i < 3; i++) {
+        stream >> camera.target[i];
+      }
+      if (!stream) {
+        throw runtime_error("invalid camera: " + line);
+      }
+      Vector3f up;
+      if (stream >> up[0] >> up[1] >> up[2]) {
+        camera.up = up;
+      }
+      cameras.push_back(camera);
+    }
+    return cameras;
+  }
+
+  const Vector3f center = (extends.min + extends.max) / 2.0f;
+  const auto radius = (extends.max - extends.min).norm();
+  const auto elevation = orbit_elevation * PI / 180.0f;
+  for (uint32_t i = 0; i < orbit_count; i++) {
+    const auto azimuth = 2.0f * PI * static_cast<float>(i) /
+                         static_cast<float>(orbit_count);
+    CameraPose camera{};
+    camera.target = center;
+    camera.position =
+        center + radius * Vector3f(cosf(elevation) * sinf(azimuth),
+                                   sinf(elevation),
+                                   cosf(elevation) * cosf(azimuth));
+    cameras.push_back(camera);
+  }
+  return cameras;
+}
+
+void BatchRenderer::run() {
+  ModelLoader loader(path);
+  loader.set_optimize_meshes(optimize_meshes);
+  loader.set_compact_indices(compact_indices);
+  loader.set_share_assets(share_assets);
+  auto &model = loader.load();
+  if (optimize_meshes) {
+    auto stats = loader.get_vertex_cache_stats();
+    cout << "vertex cache: ACMR " << stats[0].acmr << " -> " << stats[1].acmr
+         << ", ATVR " << stats[0].atvr << " -> " << stats[1].atvr << endl;
+  }
+  auto extends = loader.get_extends();
+  auto cameras = load_cameras(extends);
+
+  const uint32_t frames_in_flight = 3;
+  Context context(Context::Type::SoftwareRasterizer);
+  // drawn `downscale` times larger, then averaged down to the output size
+  context.view_port(width * downscale, height * downscale);
+  context.set_frames_in_flight(frames_in_flight);
+  context.set_deferred(deferred);
+  context.set_transparency(transparency);
+  context.set_samples(samples);
+  vector<PostEffect> effects;
+  if (exposure > 0.0f) {
+    effects.push_back(PostEffect::ToneMapping(exposure));
+  }
+  if (fxaa) {
+    effects.push_back(PostEffect::FXAA());
+  }
+  effects.push_back(PostEffect::Downscale(downscale));
+  if (vignette > 0.0f) {
+    effects.push_back(PostEffect::Vignette(vignette));
+  }
+  if (srgb) {
+    effects.push_back(PostEffect::EncodeSRGB());
+  }
+  context.set_post_effects(effects);
+  auto handle = context.add(model);
+  const auto radius = (extends.max - extends.min).norm();
+  if (shading != Material::Shading::Unlit) {
+    uint32_t geometry_idx = 0;
+    for (auto &mesh : model.meshes) {
+      for (auto &geometry : mesh.geometries) {
+        auto material = geometry.material;
+        material.shading = shading;
+        context.update_material(handle, geometry_idx++, material);
+      }
+    }
+    // a dim ambient light and a sun from above the front of the model
+    auto ambient = Light::Ambient();
+    ambient.intensity = 0.2f;
+    auto sun = Light::Direction();
+    sun.direction = Vector3f(-0.3f, -1.0f, -0.5f).normalized();
+    sun.cast_shadows = shadows;
+    vector<Light> lights = {ambient, sun};
+
+    // small colored lights spread over the model, the same on every run
+    uint32_t seed = 1;
+    auto random = [&seed]() {
+      seed = seed * 1664525u + 22695477u;
+      return static_cast<float>(seed >> 8u) / 16777216.0f;
+    };
+    for (uint32_t i = 0; i < point_lights; i++) {
+      auto light = Light::Point();
+      for (size_t c = 0; c < 3; c++) {
+        light.position[c] =
+            extends.min[c] + random() * (extends.max[c] - extends.min[c]);
+        light.color[c] = random();
+      }
+      light.range = radius * 0.05f;
+      light.intensity = light.range * light.range;
+      lights.push_back(light);
+    }
+    context.set_lights(lights);
+  }
+  if (!environment_path.empty()) {
+    // an equirectangular image, its 8 bit colors taken as linear
+    int env_width = 0, env_height = 0, channels = 0;
+    auto pixels = stbi_load(environment_path.c_str(), &env_width,
+                            &env_height, &channels, 4);
+    if (pixels == nullptr) {
+      throw runtime_error("failed to load " + environment_path);
+    }
+    Texture texture;
+    texture.width = static_cast<uint32_t>(env_width);
+    texture.height = static_cast<uint32_t>(env_height);
+    texture.channels = 4;
+    texture.data = pixels;
+    context.set_environment(&texture);
+    stbi_image_free(pixels);
+  }
+
+  Camera camera{};
+  camera.setProjection(45.0f,
+                       static_cast<float>(width) / static_cast<float>(height),
+                       radius * 0.01f, radius * 100.0f);
+
+  // the frame's first row is the bottom of the image
+  stbi_flip_vertically_on_write(1);
+  ThreadPool encoders(workers != 0 ? workers
+                                   : thread::hardware_concurrency());
+  deque<future<void>> encodings;
+  deque<pair<uint64_t, size_t>> fences;
+
+  auto encode = [&](const vector<float> &colors, size_t idx) {
+    auto pixels = make_shared<vector<uint8_t>>(colors.size());
+    for (size_t i = 0; i < colors.size(); i++) {
+      auto value = min(max(colors[i], 0.0f), 1.0f);
+      (*pixels)[i] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "/frame_%04zu.png", idx);
+    auto file = output + name;
+    auto w = static_cast<int>(width);
+    auto h = static_cast<int>(height);
+    encodings.push_back(encoders.enqueue([file, pixels, w, h]() {
+      if (stbi_write_png(file.c_str(), w, h, 4, pixels->data(), w * 4) == 0) {
+        throw runtime_error("cannot write " + file);
+      }
+    }));
+    // bound the memory held by frames waiting for an encoder
+    while (encodings.size() > 2 * encoders.size()) {
+      encodings.front().get();
+      encodings.pop_front();
+    }
+  };
+
+  auto get_view_matrix = [&camera](const CameraPose &pose) -> Matrix4f {
+    camera.lookAt(pose.position, pose.target, pose.up);
+    return camera.getCullingProjectionMatrix() *
+           camera.getViewMatrix().inverse();
+  };
+
+  auto start = steady_clock::now();
+  if (views_per_pass > 1) {
+    // several cameras share each pass over the geometry
+    vector<Matrix4f> view_matrices;
+    vector<Frame> frames;
+    for (size_t first = 0; first < cameras.size(); first += views_per_pass) {
+      auto last = min(first + views_per_pass, cameras.size());
+      view_matrices.clear();
+      for (auto i = first; i < last; i++) {
+        view_matrices.push_back(get_view_matrix(cameras[i]));
+      }
+      context.draw_views(view_matrices, frames);
+      for (auto i = first; i < last; i++) {
+        encode(frames[i - first].getColors(), i);
+      }
+    }
+  } else {
+    for (size_t i = 0; i < cameras.size(); i++) {
+      context.set_view(get_view_matrix(cameras[i]));
+      fences.emplace_back(context.draw_async(), i);
+      if (fences.size() == frames_in_flight) {
+        encode(context.wait(fences.front().first), fences.front().second);
+        fences.pop_front();
+      }
+    }
+    while (!fences.empty()) {
+      encode(context.wait(fences.front().first), fences.front().second);
+      fences.pop_front();
+    }
+  }
+  auto rendered = steady_clock::now();
+
+  while (!encodings.empty()) {
+    encodings.front().get();
+    encodings.pop_front();
+  }
+  auto finished = steady_clock::now();
+
+  auto render_seconds = duration<double>(rendered - start).count();
+  auto total_seconds = duration<double>(finished - start).count();
+  cout << "rendered " << cameras.size() << " frames in " << render_seconds
+       << " s (" << static_cast<double>(cameras.size()) / render_seconds
+       << " fps), " << total_seconds << " s including encoding ("
+       << static_cast<double>(cameras.size()) / total_seconds << " fps)"
+       << endl;
+
+  // frames drawn with a texture that failed to decode are not trusted
+  auto errors = TextureCache::instance().take_errors();
+  if (!errors.empty()) {
+    rethrow_exception(errors.front());
+  }
+}
+
+} // namespace RB
+
+int main(int argc, const char **argv) {
+  try {
+    RB::BatchRenderer renderer;
+    renderer.process_cmd(argc, argv);
+    renderer.run();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
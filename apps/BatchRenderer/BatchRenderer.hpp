@@ -0,0 +1,54 @@
+#pragma once
+#include <Eigen/Core>
+#include <RenderBoy/Context.hpp>
+#include <RenderBoy/ModelLoader.hpp>
+#include <string>
+#include <vector>
+
+namespace RB {
+
+struct CameraPose {
+  Eigen::Vector3f position = {0.0f, 0.0f, 1.0f};
+  Eigen::Vector3f target = {0.0f, 0.0f, 0.0f};
+  Eigen::Vector3f up = {0.0f, 1.0f, 0.0f};
+};
+
+// Renders a model from a list of cameras without any window and writes one
+// PNG per camera, encoding on worker threads while the next views render.
+class BatchRenderer {
+public:
+  void process_cmd(int argc, const char **argv);
+  void run();
+
+private:
+  std::string path;
+  std::string cameras_path;
+  std::string output = ".";
+  uint32_t orbit_count = 36;
+  float orbit_elevation = 20.0f;
+  uint32_t width = 512;
+  uint32_t height = 512;
+  uint32_t workers = 0;
+  uint32_t views_per_pass = 1;
+  bool optimize_meshes = false;
+  bool compact_indices = false;
+  bool share_assets = false;
+  Material::Shading shading = Material::Shading::Unlit;
+  uint32_t point_lights = 0;
+  bool shadows = false;
+  bool deferred = false;
+  Context::Transparency transparency = Context::Transparency::Sorted;
+  uint32_t samples = 1;
+  // post effects, in this order; no tone mapping without an exposure
+  float exposure = 0.0f;
+  bool fxaa = false;
+  uint32_t downscale = 1;
+  float vignette = 0.0f;
+  bool srgb = false;
+  std::string environment_path;
+
+  auto load_cameras(const BoundingBox &extends) const
+      -> std::vector<CameraPose>;
+};
+
+} // namespace RB
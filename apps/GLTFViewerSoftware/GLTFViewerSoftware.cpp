@@ -24,21 +24,17 @@ void GLTFViewerSoftware::prepare() {
   auto width = window_size[0];
   auto height = window_size[1];
 
+  // geometry shows up while the textures are still decoding
   loader = make_unique<ModelLoader>(path);
-  model = loader->load();
-  auto extends = loader->get_extends();
+  stream = loader->load_async();
 
   context = make_unique<Context>(Context::Type::SoftwareRasterizer);
   context->view_port(width, height);
-  context->add(model);
+  context->set_frames_in_flight(2);
 
   camera.setProjection(45.0f,
                        static_cast<float>(width) / static_cast<float>(height),
                        0.01f, 1000.0f);
-  control.target = (extends.min + extends.max) / 2.0f;
-  control.position = control.target;
-  auto radius = (extends.max - extends.min).norm();
-  control.position[2] += radius;
 
   glViewport(0, 0, static_cast<int>(width), static_cast<int>(height));
   glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
@@ -58,13 +54,28 @@ void GLTFViewerSoftware::render() {
 
   glClear(GL_COLOR_BUFFER_BIT);
 
+  if (!loaded) {
+    auto all_meshes = stream->has_all_meshes();
+    loaded = stream->poll(*context);
+    if (all_meshes && !framed) {
+      auto extends = stream->get_extends();
+      control.target = (extends.min + extends.max) / 2.0f;
+      control.position = control.target;
+      auto radius = (extends.max - extends.min).norm();
+      control.position[2] += radius;
+      framed = true;
+    }
+  }
+
   camera.lookAt(control.position, control.target, control.up);
   const Matrix4f viewMatrix = camera.getViewMatrix().inverse();
   const Matrix4f &projectionMatrix = camera.getCullingProjectionMatrix();
   Matrix4f view_matrix = projectionMatrix * viewMatrix;
   context->set_view(view_matrix);
-  context->draw();
-  auto &colors = context->get_colors();
+  // show the previous frame while this one is binned and rasterized
+  auto fence = context->draw_async();
+  auto &colors = context->wait(previous_fence != 0 ? previous_fence : fence);
+  previous_fence = fence;
 
   glBindTexture(GL_TEXTURE_2D, texture);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT,
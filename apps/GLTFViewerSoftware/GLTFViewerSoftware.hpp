@@ -17,13 +17,16 @@ public:
   std::array<int32_t, 2> get_size() final { return {800, 600}; }
 
 private:
-  Model model;
   std::unique_ptr<ModelLoader> loader;
+  std::shared_ptr<ModelStream> stream;
+  bool framed = false;
+  bool loaded = false;
   int texture = 0;
   Camera camera = {};
   TrackballControl control;
   std::string path;
   std::unique_ptr<Context> context;
+  uint64_t previous_fence = 0;
 };
 
 } // namespace RB
\ No newline at end of file
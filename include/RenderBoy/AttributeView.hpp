@@ -0,0 +1,130 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace RB {
+
+enum class ComponentType : uint8_t {
+  Float,
+  UnsignedInt,
+  UnsignedShort,
+  UnsignedByte,
+  Short,
+  Byte,
+};
+
+inline auto component_size(ComponentType type) -> uint32_t {
+  switch (type) {
+  case ComponentType::Float:
+  case ComponentType::UnsignedInt:
+    return 4;
+  case ComponentType::UnsignedShort:
+  case ComponentType::Short:
+    return 2;
+  case ComponentType::UnsignedByte:
+  case ComponentType::Byte:
+    return 1;
+  }
+  return 0;
+}
+
+// how the components of one element are stored
+struct AttributeFormat {
+  ComponentType type = ComponentType::Float;
+  uint8_t components = 0;
+  bool normalized = false;
+};
+
+template <typename T>
+inline void read_components(const uint8_t *element, uint8_t components,
+                            float scale, float *out) {
+  for (uint8_t c = 0; c < components; c++) {
+    T value;
+    memcpy(&value, element + c * sizeof(T), sizeof(T));
+    out[c] = static_cast<float>(value) * scale;
+  }
+}
+
+// Reads the element at `element` into `out` as floats, mapping normalized
+// integers to [0, 1] or [-1, 1] the way glTF does.
+inline void read_element(const uint8_t *element, const AttributeFormat &format,
+                         float *out) {
+  auto n = format.normalized;
+  switch (format.type) {
+  case ComponentType::Float:
+    read_components<float>(element, format.components, 1.0f, out);
+    return;
+  case ComponentType::UnsignedInt:
+    read_components<uint32_t>(element, format.components, 1.0f, out);
+    return;
+  case ComponentType::UnsignedShort:
+    read_components<uint16_t>(element, format.components,
+                              n ? 1.0f / 65535.0f : 1.0f, out);
+    return;
+  case ComponentType::UnsignedByte:
+    read_components<uint8_t>(element, format.components,
+                             n ? 1.0f / 255.0f : 1.0f, out);
+    return;
+  case ComponentType::Short:
+    read_components<int16_t>(element, format.components,
+                             n ? 1.0f / 32767.0f : 1.0f, out);
+    break;
+  case ComponentType::Byte:
+    read_components<int8_t>(element, format.components,
+                            n ? 1.0f / 127.0f : 1.0f, out);
+    break;
+  }
+  // the most negative signed value also maps to -1
+  if (n) {
+    for (uint8_t c = 0; c < format.components; c++) {
+      out[c] = std::max(out[c], -1.0f);
+    }
+  }
+}
+
+// Typed, strided, read-only window over vertex or index data stored
+// elsewhere. `owner` keeps that storage alive for as long as the view is.
+struct AttributeView {
+  std::shared_ptr<const void> owner;
+  const uint8_t *data = nullptr;
+  uint32_t count = 0;
+  uint32_t stride = 0; // bytes from one element to the next
+  uint8_t components = 0;
+  ComponentType type = ComponentType::Float;
+  bool normalized = false;
+
+  explicit operator bool() const { return data != nullptr; }
+
+  auto element_size() const -> uint32_t {
+    return components * component_size(type);
+  }
+
+  auto format() const -> AttributeFormat {
+    return {type, components, normalized};
+  }
+
+  template <typename T> auto get(uint32_t idx) const -> const T * {
+    return reinterpret_cast<const T *>(data + static_cast<size_t>(idx) * stride);
+  }
+
+  // element `idx` as `components` floats, whatever its storage
+  void read(uint32_t idx, float *out) const {
+    read_element(data + static_cast<size_t>(idx) * stride, format(), out);
+  }
+
+  // element `idx` of an index view, whatever its width
+  auto get_index(uint32_t idx) const -> uint32_t {
+    switch (type) {
+    case ComponentType::UnsignedByte:
+      return *get<uint8_t>(idx);
+    case ComponentType::UnsignedShort:
+      return *get<uint16_t>(idx);
+    default:
+      return *get<uint32_t>(idx);
+    }
+  }
+};
+
+} // namespace RB
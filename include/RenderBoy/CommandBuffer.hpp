@@ -0,0 +1,105 @@
+#pragma once
+#include <Eigen/Core>
+#include <RenderBoy/Material.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace RB {
+
+// Records drawing commands without touching any context, so each thread can
+// fill its own buffer and the buffers are then submitted together, in order.
+//
+// Bound state does not carry over from one buffer to the next: until a
+// buffer binds a material or sets a transform, draws use the ones the model
+// was registered with.
+class CommandBuffer {
+public:
+  enum class Type : uint8_t {
+    Clear,
+    SetViewport,
+    BindMaterial,
+    SetTransform,
+    Draw,
+  };
+
+  struct Command {
+    Type type;
+    uint32_t payload; // index into the array holding this type's arguments
+  };
+
+  struct DrawArgs {
+    uint32_t handle;
+    uint32_t geometry_idx;
+  };
+
+  void clear(const Eigen::Vector4f &color = {0.0f, 0.0f, 0.0f, 1.0f}) {
+    commands.push_back({Type::Clear, static_cast<uint32_t>(colors.size())});
+    colors.push_back(color);
+  }
+
+  void set_viewport(uint32_t width, uint32_t height) {
+    commands.push_back(
+        {Type::SetViewport, static_cast<uint32_t>(viewports.size())});
+    viewports.push_back({width, height});
+  }
+
+  void bind_material(const Material &material) {
+    commands.push_back(
+        {Type::BindMaterial, static_cast<uint32_t>(materials.size())});
+    materials.push_back(material);
+  }
+
+  void set_transform(const Eigen::Matrix4f &transform) {
+    commands.push_back(
+        {Type::SetTransform, static_cast<uint32_t>(transforms.size())});
+    transforms.push_back(transform);
+  }
+
+  // draws one geometry of a model registered with Context::add
+  void draw(uint32_t handle, uint32_t geometry_idx) {
+    commands.push_back({Type::Draw, static_cast<uint32_t>(draws.size())});
+    draws.push_back({handle, geometry_idx});
+  }
+
+  void reset() {
+    commands.clear();
+    colors.clear();
+    viewports.clear();
+    materials.clear();
+    transforms.clear();
+    draws.clear();
+  }
+
+  auto get_commands() const -> const std::vector<Command> & {
+    return commands;
+  }
+
+  auto get_color(uint32_t idx) const -> const Eigen::Vector4f & {
+    return colors[idx];
+  }
+
+  auto get_viewport(uint32_t idx) const -> const std::array<uint32_t, 2> & {
+    return viewports[idx];
+  }
+
+  auto get_material(uint32_t idx) const -> const Material & {
+    return materials[idx];
+  }
+
+  auto get_transform(uint32_t idx) const -> const Eigen::Matrix4f & {
+    return transforms[idx];
+  }
+
+  auto get_draw(uint32_t idx) const -> const DrawArgs & { return draws[idx]; }
+
+private:
+  std::vector<Command> commands;
+  std::vector<Eigen::Vector4f> colors;
+  std::vector<std::array<uint32_t, 2>> viewports;
+  std::vector<Material> materials;
+  std::vector<Eigen::Matrix4f> transforms;
+  std::vector<DrawArgs> draws;
+};
+
+} // namespace RB
@@ -1,7 +1,10 @@
 #pragma once
 #include <Eigen/Core>
+#include <RenderBoy/CommandBuffer.hpp>
 #include <RenderBoy/Frame.hpp>
+#include <RenderBoy/Light.hpp>
 #include <RenderBoy/Model.hpp>
+#include <RenderBoy/PostEffect.hpp>
 #include <memory>
 
 namespace RB {
@@ -11,13 +14,65 @@ class IContextImpl;
 class Context {
 public:
   enum class Type : uint8_t { SoftwareRasterizer, OpenGL };
+  // How blended materials are composed: drawn one after the other from the
+  // farthest, each over what is behind it, or summed per pixel in any order
+  // with weights favoring nearer surfaces, which needs no sorting but only
+  // approximates overlaps.
+  enum class Transparency : uint8_t { Sorted, WeightedBlended };
 
   explicit Context(Type type);
   ~Context();
 
-  void add(const Model &model);
+  // the returned handle refers to every geometry of `model`, which must
+  // outlive its registration in the context
+  auto add(const Model &model) -> uint32_t;
+  void remove(uint32_t handle);
+  void update_transform(uint32_t handle, const Eigen::Matrix4f &transform);
+  // `geometry_idx` counts geometries across the model's meshes in order
+  void update_material(uint32_t handle, uint32_t geometry_idx,
+                       const Material &material);
   void draw();
+  // executes the buffers in order; they may have been recorded concurrently
+  void submit(const std::vector<CommandBuffer> &buffers);
+
+  // Starts drawing the current view and returns its fence at once, so the
+  // next view can be processed while this one is still being rasterized.
+  // A frame's colors stay valid until `frames in flight` newer frames have
+  // been started.
+  auto draw_async() -> uint64_t;
+  auto wait(uint64_t fence) -> const std::vector<float> &;
+  void set_frames_in_flight(uint32_t count);
+
+  // Draws the scene once per view matrix into `frames`, sharing vertex work
+  // between the views. Gouraud materials, lit per vertex, are lit as seen
+  // from the first view, and blended materials are always weighted, as no
+  // single order sorts them for every view. Only supported by the software
+  // rasterizer.
+  void draw_views(const std::vector<Eigen::Matrix4f> &view_matrices,
+                  std::vector<Frame> &frames);
   void set_view(const Eigen::Matrix4f &view_matrix);
+  // lights every later frame of materials with a lit shading; the list is
+  // copied, disabled lights are skipped
+  void set_lights(const std::vector<Light> &lights);
+  // distant lighting of metallic-roughness materials from an
+  // equirectangular image with linear colors; nullptr removes it. The
+  // texture is prefiltered right away and not kept.
+  void set_environment(const Texture *texture);
+  // With deferred lighting, Phong and metallic-roughness materials only
+  // write their surfaces while drawing, and each pixel is lit once after
+  // all draws. Only the software rasterizer defers; off by default.
+  void set_deferred(bool deferred);
+  // sorted by default; only the software rasterizer blends
+  void set_transparency(Transparency transparency);
+  // Antialiases the edges of later frames with 2, 4 or 8 samples per pixel,
+  // or turns it off with 1, the default. Lighting is not deferred while
+  // multisampling. Only the software rasterizer multisamples.
+  void set_samples(uint32_t count);
+  // Runs `effects` in order over every later frame once drawn; the colors
+  // and the frames of `draw_views` are their result, smaller after a
+  // downscale. Effects next to each other working pixel by pixel share one
+  // pass over the frame. Only the software rasterizer post-processes.
+  void set_post_effects(const std::vector<PostEffect> &effects);
   void view_port(uint32_t width, uint32_t height);
   auto get_colors() -> const std::vector<float> &;
 
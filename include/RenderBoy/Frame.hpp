@@ -43,6 +43,9 @@ public:
 
   auto getColors() const -> const std::vector<float> & { return colors; }
 
+  // RGBA, row after row from the bottom, for passes writing whole rows
+  auto getColors() -> std::vector<float> & { return colors; }
+
   void setColor(uint32_t idx, const Eigen::Vector4f &color) {
     idx = idx << 2u;
     colors[idx] = color[0];
@@ -63,6 +66,18 @@ public:
     }
   }
 
+  // clears the `w` x `h` rectangle starting at (`x`, `y`)
+  void clear(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+             const Eigen::Vector4f &color = {0.f, 0.f, 0.f, 1.0f},
+             float _z = -FLT_MAX) {
+    for (auto row = y; row < y + h; row++) {
+      for (auto i = x + row * width; i < x + w + row * width; i++) {
+        this->setZ(i, _z);
+        this->setColor(i, color);
+      }
+    }
+  }
+
 private:
   uint32_t width = 0;
   uint32_t height = 0;
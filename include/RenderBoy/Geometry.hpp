@@ -1,5 +1,6 @@
 #pragma once
 #include <Eigen/Core>
+#include <RenderBoy/AttributeView.hpp>
 #include <RenderBoy/Material.hpp>
 #include <RenderBoy/Primitive.hpp>
 #include <cfloat>
@@ -17,13 +18,29 @@ struct BoundingBox {
 };
 
 struct Geometry {
+  // storage for geometries built in memory, loaders fill the views instead
   std::vector<Vertex> buffers;
   std::vector<uint32_t> indices;
+  AttributeView position_view;
+  AttributeView normal_view;
+  AttributeView uv_view;
+  AttributeView index_view;
   uint32_t vertex_count = 0;
   uint32_t index_count = 0;
   BoundingBox box;
   Material material;
 
+  // the views the contexts read, falling back to the owned storage
+  auto get_positions() const -> AttributeView;
+  auto get_normals() const -> AttributeView;
+  auto get_uvs() const -> AttributeView;
+  auto get_indices() const -> AttributeView;
+
+  // Moves the owned storage behind the views, so that copies of the
+  // geometry, one per instance of its mesh, share it instead of each
+  // duplicating it.
+  void share_storage();
+
   static Geometry Box(float width = 1.0f, float height = 1.0f,
                       float depth = 1.0f);
 };
@@ -0,0 +1,43 @@
+#pragma once
+#include <Eigen/Core>
+
+namespace RB {
+
+struct Light {
+  enum class Type : uint8_t {
+    Ambient,
+    Point,
+    Direction,
+    Spot,
+    None,
+  };
+
+  Type type = Type::None;
+  float intensity = 1.0f;
+  Eigen::Vector3f color = {1.f, 1.f, 1.f};
+  Eigen::Vector3f position = {0.f, 0.f, 0.f};
+  // where directional and spot lights shine to
+  Eigen::Vector3f direction = {0.f, 0.f, -1.f};
+  // half angles of a spot's cone, in radians: full intensity inside the
+  // inner one, fading out up to the outer one
+  float inner_angle = 0.0f;
+  float outer_angle = 0.7853982f;
+  // distance beyond which a point or spot light has no effect, its falloff
+  // reaching 0 smoothly there; 0 lets it reach everything. Lights with a
+  // range are only shaded where they can reach.
+  float range = 0.0f;
+  // directional and spot lights only, through shadow maps rendered every
+  // frame
+  bool cast_shadows = false;
+  bool enabled = true;
+
+  static auto Ambient() -> Light { return {Light::Type::Ambient}; }
+
+  static auto Point() -> Light { return {Light::Type::Point}; }
+
+  static auto Direction() -> Light { return {Light::Type::Direction}; }
+
+  static auto Spot() -> Light { return {Light::Type::Spot}; }
+};
+
+} // namespace RB
@@ -6,13 +6,52 @@
 namespace RB {
 
 struct Material {
+  // how the context lights the surface: not at all, per pixel (Blinn-Phong),
+  // per vertex, by showing its normals as colors, or per pixel with the
+  // glTF metallic-roughness model
+  enum class Shading : uint8_t {
+    Unlit,
+    Phong,
+    Gouraud,
+    Normal,
+    MetallicRoughness,
+  };
+
+  // like glTF's alpha modes: opaque surfaces ignore alpha, masked ones are
+  // only drawn where it reaches the cutoff, and blended ones are drawn over
+  // what is behind them after every opaque draw
+  enum class AlphaMode : uint8_t {
+    Opaque,
+    Mask,
+    Blend,
+  };
+
+  Shading shading = Shading::Unlit;
+  AlphaMode alpha_mode = AlphaMode::Opaque;
   std::array<float, 4> base_color = {0.0f, 0.0f, 0.0f, 0.0f};
-  float AlphaCutoff = 1.0f;
+  float AlphaCutoff = 0.5f;
   float metallic = 1.0f;
   float roughness = 1.0f;
-  std::array<float, 4> emissive = {1.0f, 1.0f, 1.0f, 1.0f};
+  std::array<float, 4> emissive = {0.0f, 0.0f, 0.0f, 0.0f};
+
+  // lit shadings: the base color is the diffuse one
+  std::array<float, 3> specular = {1.0f, 1.0f, 1.0f};
+  float shininess = 20.0f;
+
+  // metallic-roughness: the factors above multiply these textures
+  float normal_scale = 1.0f;
+  float occlusion_strength = 1.0f;
 
   Texture *base_color_texture = nullptr;
+  // multiplies `specular` when set
+  Texture *specular_texture = nullptr;
+  // roughness in green, metalness in blue
+  Texture *metallic_roughness_texture = nullptr;
+  // in tangent space, applied by the software rasterizer only
+  Texture *normal_texture = nullptr;
+  Texture *emissive_texture = nullptr;
+  // in red
+  Texture *occlusion_texture = nullptr;
 };
 
 } // namespace RB
\ No newline at end of file
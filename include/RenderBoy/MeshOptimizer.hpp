@@ -0,0 +1,29 @@
+#pragma once
+#include <RenderBoy/Geometry.hpp>
+#include <cstdint>
+
+namespace RB {
+
+struct VertexCacheStats {
+  // transformed vertices per triangle, 0.5 at best and 3 at worst
+  float acmr = 0.0f;
+  // transformed vertices per unique vertex, 1 at best
+  float atvr = 0.0f;
+};
+
+// simulates a FIFO post-transform cache of `cache_size` vertices
+auto analyze_vertex_cache(const Geometry &geometry, uint32_t cache_size = 16)
+    -> VertexCacheStats;
+
+// Reorders the triangles of an indexed geometry for post-transform cache
+// reuse (Forsyth's algorithm), then its vertices in order of first use for
+// fetch locality. The geometry then owns its data, as interleaved floats.
+// Returns false, leaving it untouched, when it has no usable indices.
+auto optimize_vertex_cache(Geometry &geometry) -> bool;
+
+// Stores 32 bits indices as 16 bits ones when the geometry has at most
+// 65536 vertices, halving the index memory and bandwidth. Returns false,
+// leaving it untouched, when they are already narrower or don't fit.
+auto narrow_indices(Geometry &geometry) -> bool;
+
+} // namespace RB
@@ -1,5 +1,8 @@
 #pragma once
+#include <RenderBoy/MeshOptimizer.hpp>
 #include <RenderBoy/Model.hpp>
+#include <RenderBoy/ModelStream.hpp>
+#include <array>
 #include <memory>
 #include <string>
 
@@ -19,10 +22,44 @@ public:
 
   ~ModelLoader();
 
+  // On by default: textures are decoded the first time they are drawn and
+  // kept under the `TextureCache` budget. Call before loading.
+  void set_lazy_textures(bool enabled);
+
+  // Off by default: reorders triangles and vertices of every indexed
+  // geometry for the post-transform cache and vertex fetches, see
+  // `get_vertex_cache_stats`. Call before loading.
+  void set_optimize_meshes(bool enabled);
+
+  // Off by default: attributes quantized with KHR_mesh_quantization are kept
+  // as 8 or 16 bits integers instead of being converted to floats, which
+  // the contexts do as they fetch vertices. Call before loading.
+  void set_keep_quantized(bool enabled);
+
+  // Off by default: geometries with at most 65536 vertices get their 32
+  // bits indices narrowed to 16 bits. 8 and 16 bits indices of the source
+  // are kept as they are either way. Call before loading.
+  void set_compact_indices(bool enabled);
+
+  // Off by default: arrays and encoded images are hashed while loading and
+  // replaced with identical ones another loaded model already holds. This
+  // reads every byte up front, mapped geometry included. Instances of a
+  // mesh share their data either way. Call before loading.
+  void set_share_assets(bool enabled);
+
   auto load() -> Model &;
 
+  // Loads on a background thread and returns at once; poll the stream to
+  // add the model to a context piece by piece. Don't mix with `load`.
+  auto load_async() -> std::shared_ptr<ModelStream>;
+
   auto get_extends() const -> BoundingBox;
 
+  // With optimized meshes, the average statistics of the loaded geometries
+  // before then after their optimization, weighted by their triangles.
+  // Zeros otherwise, or before loading.
+  auto get_vertex_cache_stats() const -> std::array<VertexCacheStats, 2>;
+
 private:
   std::shared_ptr<IModelLoader> impl;
 };
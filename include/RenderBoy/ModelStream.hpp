@@ -0,0 +1,74 @@
+#pragma once
+#include <RenderBoy/Context.hpp>
+#include <RenderBoy/Model.hpp>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RB {
+
+// Model being loaded on a background thread, see `ModelLoader::load_async`.
+// Meshes arrive in chunks as soon as their geometry is ready, with
+// placeholder materials; textured materials follow once their images are
+// decoded.
+class ModelStream {
+public:
+  ModelStream() = default;
+  ModelStream(const ModelStream &) = delete;
+  auto operator=(const ModelStream &) -> ModelStream & = delete;
+  ~ModelStream();
+
+  // Adds the chunks that arrived since the last call to `context` and
+  // applies the materials that became ready. Returns true once the whole
+  // model has been delivered; rethrows the error a failed load ended with.
+  // A stream feeds a single context.
+  auto poll(Context &context) -> bool;
+
+  void wait();
+
+  // true once every mesh has arrived, textures may still be pending
+  auto has_all_meshes() const -> bool;
+
+  // world space bounds of the meshes that arrived so far
+  auto get_extends() const -> BoundingBox;
+
+  // one handle per chunk added by `poll`
+  auto get_handles() const -> const std::vector<uint32_t> & { return handles; }
+
+  // used by the loaders
+  void start(std::function<void(ModelStream &)> task);
+  void add_meshes(std::vector<Mesh> meshes);
+  void all_meshes_added();
+  // `geometry_idx` counts geometries across every mesh of every chunk and
+  // must belong to a chunk already added
+  void update_material(uint32_t geometry_idx, const Material &material);
+
+private:
+  struct MaterialUpdate {
+    uint32_t geometry_idx;
+    Material material;
+  };
+
+  mutable std::mutex mutex;
+  std::condition_variable finished;
+  std::vector<std::unique_ptr<Model>> chunks;
+  std::vector<uint32_t> first_geometries;
+  std::vector<MaterialUpdate> updates;
+  std::exception_ptr error;
+  bool meshes_complete = false;
+  bool done = false;
+
+  // only touched by the polling thread
+  std::vector<Model *> added;
+  std::vector<uint32_t> handles;
+  size_t applied_updates = 0;
+
+  std::function<void(ModelStream &)> loader;
+  std::thread worker;
+};
+
+} // namespace RB
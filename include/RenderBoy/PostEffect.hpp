@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+
+namespace RB {
+
+// A step of the chain run over each frame once drawn, see
+// `Context::set_post_effects`.
+struct PostEffect {
+  enum class Type : uint8_t {
+    // scales colors by `amount`, the exposure, then maps them to [0, 1]
+    // along the ACES filmic curve, as fitted by Narkowicz
+    ToneMapping,
+    // darkens towards the borders, colors losing `amount` at the corners
+    Vignette,
+    // fast approximate antialiasing: blends across the edges it finds in
+    // the luma of colors in [0, 1]
+    FXAA,
+    // averages each block of `amount` x `amount` pixels into one
+    Downscale,
+    // linear colors to sRGB
+    EncodeSRGB,
+  };
+
+  Type type = Type::EncodeSRGB;
+  float amount = 1.0f;
+
+  static auto ToneMapping(float exposure = 1.0f) -> PostEffect {
+    return {Type::ToneMapping, exposure};
+  }
+
+  static auto Vignette(float strength = 0.5f) -> PostEffect {
+    return {Type::Vignette, strength};
+  }
+
+  static auto FXAA() -> PostEffect { return {Type::FXAA}; }
+
+  static auto Downscale(uint32_t factor = 2) -> PostEffect {
+    return {Type::Downscale, static_cast<float>(factor)};
+  }
+
+  static auto EncodeSRGB() -> PostEffect { return {Type::EncodeSRGB}; }
+};
+
+} // namespace RB
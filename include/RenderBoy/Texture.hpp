@@ -1,14 +1,23 @@
 #pragma once
 #include <Eigen/Core>
 #include <algorithm>
+#include <memory>
 #include <string>
 
+namespace RB {
+struct LazyTexture;
+}
+
 struct Texture {
   uint32_t width = 0;
   uint32_t height = 0;
   uint8_t channels = 0;
   unsigned char *data = nullptr;
-  Eigen::Vector4f sample(float u, float v) {
+  // set for textures decoded on first use, whose `data` stays null; sample
+  // the texture returned by `RB::TextureCache::acquire` instead
+  std::shared_ptr<RB::LazyTexture> lazy;
+
+  Eigen::Vector4f sample(float u, float v) const {
     u = u - std::floor(u);
     v = v - std::floor(v);
     u = std::max(std::min(u, 1.0f), 0.0f);
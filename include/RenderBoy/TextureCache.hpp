@@ -0,0 +1,73 @@
+#pragma once
+#include <RenderBoy/Texture.hpp>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace RB {
+
+// fills `pixels` and the size and channels of `texture`, throws when it
+// cannot
+using TextureDecoder =
+    std::function<void(std::vector<unsigned char> &pixels, Texture &texture)>;
+
+struct LazyTexture {
+  TextureDecoder decoder;
+  std::mutex decoding;
+  std::shared_ptr<const Texture> resident;
+  // why the last decoding failed, if it did
+  std::exception_ptr error;
+  size_t bytes = 0;
+  bool listed = false;
+  std::list<LazyTexture *>::iterator position;
+
+  ~LazyTexture();
+};
+
+// Decodes lazy textures the first time they are acquired and keeps the
+// decoded pixels under a memory budget, evicting the least recently
+// acquired ones. Evicted pixels stay alive for as long as someone still
+// holds the texture `acquire` returned, so frames in flight are safe.
+class TextureCache {
+public:
+  static auto instance() -> TextureCache &;
+
+  void set_budget(size_t bytes);
+  auto get_budget() const -> size_t;
+  auto get_resident_bytes() const -> size_t;
+
+  // makes `texture` decode through `decoder` on first use
+  static void make_lazy(Texture &texture, TextureDecoder decoder);
+
+  // Returns a texture whose pixels are decoded. Eager textures are returned
+  // as they are, without taking ownership. Safe to call from any thread.
+  // Textures that fail to decode are replaced with a white pixel and their
+  // failure recorded, as acquiring happens while drawing.
+  auto acquire(const Texture &texture) -> std::shared_ptr<const Texture>;
+
+  // why acquiring `texture` last failed to decode it, if it did
+  auto get_error(const Texture &texture) const -> std::exception_ptr;
+
+  // the decoding failures recorded since the last call
+  auto take_errors() -> std::vector<std::exception_ptr>;
+
+private:
+  friend struct LazyTexture;
+
+  mutable std::mutex mutex;
+  // most recently acquired first
+  std::list<LazyTexture *> lru;
+  size_t budget = size_t(512) << 20u;
+  size_t resident_bytes = 0;
+  std::vector<std::exception_ptr> errors;
+
+  void touch(LazyTexture &lazy);
+  void evict();
+  void forget(LazyTexture &lazy);
+};
+
+} // namespace RB
@@ -1,6 +1,12 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -27,3 +33,72 @@ void ParallelForEach(T begin, T end, const Fn &callback) {
     t.join();
   }
 }
+
+// Long-lived workers consuming tasks in FIFO order; with a single worker the
+// tasks also finish in the order they were enqueued.
+class ThreadPool {
+public:
+  explicit ThreadPool(uint32_t count = std::thread::hardware_concurrency()) {
+    count = std::max(count, 1u);
+    for (auto threadId = 0u; threadId < count; threadId++) {
+      workers.emplace_back([this]() { this->run(); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+  auto operator=(const ThreadPool &) -> ThreadPool & = delete;
+  auto operator=(ThreadPool &&) -> ThreadPool & = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    condition.notify_all();
+    for (auto &t : workers) {
+      t.join();
+    }
+  }
+
+  template <typename Fn>
+  auto enqueue(Fn &&callback) -> std::future<decltype(callback())> {
+    using Result = decltype(callback());
+    auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::forward<Fn>(callback));
+    auto future = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.emplace_back([task]() { (*task)(); });
+    }
+    condition.notify_one();
+    return future;
+  }
+
+  auto size() const -> uint32_t {
+    return static_cast<uint32_t>(workers.size());
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool stopping = false;
+
+  void run() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+          return;
+        }
+        task = move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+};
@@ -21,14 +21,65 @@ Context::Context(Type type) {
 
 Context::~Context() = default;
 
-void Context::add(const Model &model) { impl->add(model); }
+auto Context::add(const Model &model) -> uint32_t { return impl->add(model); }
+
+void Context::remove(uint32_t handle) { impl->remove(handle); }
+
+void Context::update_transform(uint32_t handle,
+                               const Eigen::Matrix4f &transform) {
+  impl->update_transform(handle, transform);
+}
+
+void Context::update_material(uint32_t handle, uint32_t geometry_idx,
+                              const Material &material) {
+  impl->update_material(handle, geometry_idx, material);
+}
 
 void Context::draw() { impl->draw(); }
 
+void Context::submit(const std::vector<CommandBuffer> &buffers) {
+  impl->submit(buffers);
+}
+
+auto Context::draw_async() -> uint64_t { return impl->draw_async(); }
+
+auto Context::wait(uint64_t fence) -> const std::vector<float> & {
+  return impl->wait(fence);
+}
+
+void Context::set_frames_in_flight(uint32_t count) {
+  impl->set_frames_in_flight(count);
+}
+
+void Context::draw_views(const std::vector<Eigen::Matrix4f> &view_matrices,
+                         std::vector<Frame> &frames) {
+  impl->draw_views(view_matrices, frames);
+}
+
 void Context::set_view(const Eigen::Matrix4f &view_matrix) {
   impl->set_view(view_matrix);
 }
 
+void Context::set_lights(const std::vector<Light> &lights) {
+  impl->set_lights(lights);
+}
+
+void Context::set_environment(const Texture *texture) {
+  impl->set_environment(texture);
+}
+
+void Context::set_deferred(bool deferred) { impl->set_deferred(deferred); }
+
+void Context::set_transparency(Transparency transparency) {
+  impl->set_transparency(transparency);
+}
+
+void Context::set_samples(uint32_t count) { impl->set_samples(count); }
+
+void Context::set_post_effects(const std::vector<PostEffect> &effects) {
+  impl->set_post_effects(effects);
+}
+
 void Context::view_port(uint32_t width, uint32_t height) {
   impl->view_port(width, height);
 }
@@ -0,0 +1,113 @@
+#include "Context/DrawTable.hpp"
+#include <stdexcept>
+
+using namespace std;
+using namespace Eigen;
+
+namespace RB {
+
+auto DrawTable::allocate_slot() -> uint32_t {
+  if (!free_slots.empty()) {
+    auto slot = free_slots.back();
+    free_slots.pop_back();
+    return slot;
+  }
+
+  draws.emplace_back();
+  dirty.push_back(DirtyNone);
+  return static_cast<uint32_t>(draws.size() - 1);
+}
+
+auto DrawTable::get_record(uint32_t handle) -> Record & {
+  if (handle >= records.size() || !records[handle].active) {
+    throw runtime_error("invalid model handle");
+  }
+  return records[handle];
+}
+
+auto DrawTable::get_slots(uint32_t handle) const
+    -> const vector<uint32_t> & {
+  if (handle >= records.size() || !records[handle].active) {
+    throw runtime_error("invalid model handle");
+  }
+  return records[handle].slots;
+}
+
+auto DrawTable::get_slot(uint32_t handle, uint32_t geometry_idx) const
+    -> uint32_t {
+  auto &slots = get_slots(handle);
+  if (geometry_idx >= slots.size()) {
+    throw runtime_error("geometry index out of range");
+  }
+  return slots[geometry_idx];
+}
+
+void DrawTable::mark(uint32_t slot, uint8_t flags) {
+  if (dirty[slot] == DirtyNone) {
+    dirty_slots.push_back(slot);
+  }
+  dirty[slot] |= flags;
+}
+
+auto DrawTable::add(const Model &model) -> uint32_t {
+  uint32_t handle = 0;
+  if (!free_records.empty()) {
+    handle = free_records.back();
+    free_records.pop_back();
+  } else {
+    records.emplace_back();
+    handle = static_cast<uint32_t>(records.size() - 1);
+  }
+
+  auto &record = records[handle];
+  record.active = true;
+  record.slots.clear();
+
+  for (auto &mesh : model.meshes) {
+    for (auto &geometry : mesh.geometries) {
+      auto slot = allocate_slot();
+      auto &draw = draws[slot];
+      draw.geometry = &geometry;
+      draw.local_matrix = mesh.model_matrix;
+      draw.model_matrix = mesh.model_matrix;
+      draw.material = geometry.material;
+      draw.active = true;
+      // a recycled slot may still carry a pending removal, which is fine:
+      // the backend releases the old resources before creating new ones
+      mark(slot, DirtyAll);
+      record.slots.push_back(slot);
+    }
+  }
+
+  return handle;
+}
+
+void DrawTable::remove(uint32_t handle) {
+  auto &record = get_record(handle);
+  for (auto slot : record.slots) {
+    draws[slot] = Draw{};
+    mark(slot, DirtyRemoved);
+    free_slots.push_back(slot);
+  }
+  record.slots.clear();
+  record.active = false;
+  free_records.push_back(handle);
+}
+
+void DrawTable::update_transform(uint32_t handle, const Matrix4f &transform) {
+  auto &record = get_record(handle);
+  for (auto slot : record.slots) {
+    auto &draw = draws[slot];
+    draw.model_matrix = transform * draw.local_matrix;
+    mark(slot, DirtyTransform);
+  }
+}
+
+void DrawTable::update_material(uint32_t handle, uint32_t geometry_idx,
+                                const Material &material) {
+  auto slot = get_slot(handle, geometry_idx);
+  draws[slot].material = material;
+  mark(slot, DirtyMaterial);
+}
+
+} // namespace RB
@@ -0,0 +1,80 @@
+#pragma once
+#include <Eigen/Core>
+#include <RenderBoy/Model.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace RB {
+
+// Bookkeeping shared by the context backends: maps model handles to draw
+// slots, recycles freed slots and remembers which slots changed since the
+// backend last synchronized its own per-slot resources.
+class DrawTable {
+public:
+  enum Dirty : uint8_t {
+    DirtyNone = 0,
+    DirtyGeometry = 1u << 0u,
+    DirtyTransform = 1u << 1u,
+    DirtyMaterial = 1u << 2u,
+    DirtyRemoved = 1u << 3u,
+    DirtyAll = DirtyGeometry | DirtyTransform | DirtyMaterial,
+  };
+
+  struct Draw {
+    const Geometry *geometry = nullptr;
+    Eigen::Matrix4f local_matrix = Eigen::Matrix4f::Identity();
+    Eigen::Matrix4f model_matrix = Eigen::Matrix4f::Identity();
+    Material material;
+    bool active = false;
+  };
+
+  auto add(const Model &model) -> uint32_t;
+
+  void remove(uint32_t handle);
+
+  void update_transform(uint32_t handle, const Eigen::Matrix4f &transform);
+
+  void update_material(uint32_t handle, uint32_t geometry_idx,
+                       const Material &material);
+
+  // calls `callback(slot, flags)` for every slot changed since the last sync
+  template <typename Fn> void sync(const Fn &callback) {
+    for (auto slot : dirty_slots) {
+      auto flags = dirty[slot];
+      dirty[slot] = DirtyNone;
+      if (flags != DirtyNone) {
+        callback(slot, flags);
+      }
+    }
+    dirty_slots.clear();
+  }
+
+  auto capacity() const -> uint32_t {
+    return static_cast<uint32_t>(draws.size());
+  }
+
+  auto get(uint32_t slot) const -> const Draw & { return draws[slot]; }
+
+  auto get_slots(uint32_t handle) const -> const std::vector<uint32_t> &;
+
+  auto get_slot(uint32_t handle, uint32_t geometry_idx) const -> uint32_t;
+
+private:
+  struct Record {
+    std::vector<uint32_t> slots;
+    bool active = false;
+  };
+
+  std::vector<Draw> draws;
+  std::vector<uint8_t> dirty;
+  std::vector<uint32_t> dirty_slots;
+  std::vector<uint32_t> free_slots;
+  std::vector<Record> records;
+  std::vector<uint32_t> free_records;
+
+  auto allocate_slot() -> uint32_t;
+  auto get_record(uint32_t handle) -> Record &;
+  void mark(uint32_t slot, uint8_t flags);
+};
+
+} // namespace RB
@@ -1,17 +1,39 @@
 #pragma once
 #include <Eigen/Core>
+#include <RenderBoy/CommandBuffer.hpp>
+#include <RenderBoy/Context.hpp>
 #include <RenderBoy/Frame.hpp>
+#include <RenderBoy/Light.hpp>
 #include <RenderBoy/Model.hpp>
 
 namespace RB {
 
 class IContextImpl {
 public:
-  virtual void add(const Model &model) = 0;
+  virtual ~IContextImpl() = default;
+
+  virtual auto add(const Model &model) -> uint32_t = 0;
+  virtual void remove(uint32_t handle) = 0;
+  virtual void update_transform(uint32_t handle,
+                                const Eigen::Matrix4f &transform) = 0;
+  virtual void update_material(uint32_t handle, uint32_t geometry_idx,
+                               const Material &material) = 0;
   virtual void draw() = 0;
+  virtual void submit(const std::vector<CommandBuffer> &buffers) = 0;
+  virtual auto draw_async() -> uint64_t = 0;
+  virtual auto wait(uint64_t fence) -> const std::vector<float> & = 0;
+  virtual void set_frames_in_flight(uint32_t count) = 0;
+  virtual void draw_views(const std::vector<Eigen::Matrix4f> &view_matrices,
+                          std::vector<Frame> &frames) = 0;
   virtual void set_view(const Eigen::Matrix4f &view_matrix) = 0;
+  virtual void set_lights(const std::vector<Light> &lights) = 0;
+  virtual void set_environment(const Texture *texture) = 0;
+  virtual void set_deferred(bool deferred) = 0;
+  virtual void set_transparency(Context::Transparency transparency) = 0;
+  virtual void set_samples(uint32_t count) = 0;
+  virtual void set_post_effects(const std::vector<PostEffect> &effects) = 0;
   virtual void view_port(uint32_t width, uint32_t height) = 0;
   virtual auto get_colors() -> const std::vector<float> & = 0;
 };
 
-} // namespace RB
\ No newline at end of file
+} // namespace RB
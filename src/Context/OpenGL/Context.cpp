@@ -58,99 +58,312 @@ OpenGLContext::OpenGLContext() {
   glEnable(GL_CULL_FACE);
 };
 
-void OpenGLContext::add(const Model &model) {
-  auto origin_vao_num = vaos.size();
-  auto geometry_num = 0;
-  for (auto &mesh : model.meshes) {
-    geometry_num += mesh.geometries.size();
-  }
-
-  vaos.resize(origin_vao_num + geometry_num);
-  model_matrixs.resize(origin_vao_num + geometry_num);
-  counts.resize(origin_vao_num + geometry_num);
-  textures.resize(origin_vao_num + geometry_num);
-  use_textures.resize(origin_vao_num + geometry_num);
-  base_colors.resize(origin_vao_num + geometry_num);
-  glGenVertexArrays(geometry_num, vaos.data() + origin_vao_num);
-
-  auto idx = origin_vao_num;
-  for (auto &mesh : model.meshes) {
-    auto &model_matrix = mesh.model_matrix;
-    for (auto &geometry : mesh.geometries) {
-      glBindVertexArray(vaos[idx]);
-      model_matrixs[idx] = model_matrix;
-      if (geometry.material.base_color_texture == nullptr) {
-        use_textures[idx] = false;
-        base_colors[idx] = geometry.material.base_color;
-      } else {
-        use_textures[idx] = true;
-        textures[idx] = create_texture(*geometry.material.base_color_texture);
-      }
-      auto &material = geometry.material;
-      if (geometry.index_count != 0) {
-        GLuint buffer;
-        glGenBuffers(1, &buffer);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                     geometry.index_count * sizeof(uint32_t),
-                     geometry.indices.data(), GL_STATIC_DRAW);
-        counts[idx] = geometry.index_count;
-      }
+OpenGLContext::~OpenGLContext() {
+  for (uint32_t slot = 0; slot < vaos.size(); slot++) {
+    release(slot);
+  }
+  release_bound_textures();
+  glDeleteProgram(program);
+}
+
+auto OpenGLContext::add(const Model &model) -> uint32_t {
+  return table.add(model);
+}
+
+void OpenGLContext::remove(uint32_t handle) { table.remove(handle); }
+
+void OpenGLContext::update_transform(uint32_t handle,
+                                     const Eigen::Matrix4f &transform) {
+  table.update_transform(handle, transform);
+}
+
+void OpenGLContext::update_material(uint32_t handle, uint32_t geometry_idx,
+                                    const Material &material) {
+  table.update_material(handle, geometry_idx, material);
+}
+
+void OpenGLContext::upload_geometry(uint32_t slot, const Geometry &geometry) {
+  glGenVertexArrays(1, &vaos[slot]);
+  glBindVertexArray(vaos[slot]);
+
+  counts[slot] = 0;
+  auto indices = geometry.get_indices();
+  if (indices) {
+    // indices keep their width, a 16 bit mesh halves the element buffer
+    element_buffers[slot] = acquire_buffer(
+        GL_ELEMENT_ARRAY_BUFFER, indices.data,
+        static_cast<size_t>(indices.count) * indices.element_size());
+    counts[slot] = indices.count;
+    index_types[slot] = get_gl_type(indices.type);
+  }
+
+  // every attribute is uploaded straight from its view, stride and
+  // quantization included; absent ones read the default generic attribute
+  // value instead
+  const AttributeView views[] = {geometry.get_positions(),
+                                 geometry.get_normals(), geometry.get_uvs()};
+  for (GLuint location = 0; location < 3; location++) {
+    auto &view = views[location];
+    if (!view) {
+      glDisableVertexAttribArray(location);
+      continue;
+    }
+    auto size = static_cast<size_t>(view.count - 1) * view.stride +
+                view.element_size();
+    vertex_buffers[slot][location] =
+        acquire_buffer(GL_ARRAY_BUFFER, view.data, size);
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, view.components, get_gl_type(view.type),
+                          view.normalized, view.stride, nullptr);
+  }
+  glBindVertexArray(0);
+}
+
+void OpenGLContext::upload_texture(uint32_t slot, const Texture *texture) {
+  if (texture_sources[slot] == texture) {
+    return;
+  }
+  if (textures[slot] != 0) {
+    glDeleteTextures(1, &textures[slot]);
+    textures[slot] = 0;
+  }
+  if (texture != nullptr) {
+    textures[slot] = create_texture(*texture);
+  }
+  texture_sources[slot] = texture;
+}
+
+auto OpenGLContext::acquire_buffer(GLenum target, const uint8_t *data,
+                                   size_t size) -> GLuint {
+  auto &shared = shared_buffers[make_pair(data, size)];
+  if (shared.users++ == 0) {
+    glGenBuffers(1, &shared.buffer);
+    glBindBuffer(target, shared.buffer);
+    glBufferData(target, size, data, GL_STATIC_DRAW);
+    buffer_sources[shared.buffer] = make_pair(data, size);
+  } else {
+    glBindBuffer(target, shared.buffer);
+  }
+  return shared.buffer;
+}
+
+void OpenGLContext::release_buffer(GLuint &buffer) {
+  if (buffer == 0) {
+    return;
+  }
+  auto source = buffer_sources.find(buffer);
+  auto shared = shared_buffers.find(source->second);
+  if (--shared->second.users == 0) {
+    glDeleteBuffers(1, &buffer);
+    shared_buffers.erase(shared);
+    buffer_sources.erase(source);
+  }
+  buffer = 0;
+}
+
+void OpenGLContext::release(uint32_t slot) {
+  if (vaos[slot] != 0) {
+    glDeleteVertexArrays(1, &vaos[slot]);
+    vaos[slot] = 0;
+  }
+  for (auto &buffer : vertex_buffers[slot]) {
+    release_buffer(buffer);
+  }
+  release_buffer(element_buffers[slot]);
+  upload_texture(slot, nullptr);
+  counts[slot] = 0;
+}
+
+void OpenGLContext::release_bound_textures() {
+  for (auto &bound : bound_textures) {
+    if (bound.second != 0) {
+      glDeleteTextures(1, &bound.second);
+    }
+  }
+  bound_textures.clear();
+}
+
+void OpenGLContext::sync() {
+  auto capacity = table.capacity();
+  vaos.resize(capacity, 0);
+  vertex_buffers.resize(capacity, {0, 0, 0});
+  element_buffers.resize(capacity, 0);
+  counts.resize(capacity, 0);
+  index_types.resize(capacity, GL_UNSIGNED_INT);
+  textures.resize(capacity, 0);
+  texture_sources.resize(capacity, nullptr);
+
+  table.sync([this](uint32_t slot, uint8_t flags) {
+    auto &draw = table.get(slot);
+    if ((flags & (DrawTable::DirtyGeometry | DrawTable::DirtyRemoved)) != 0) {
+      release(slot);
+    }
+    if (!draw.active) {
+      return;
+    }
+    if ((flags & DrawTable::DirtyGeometry) != 0) {
+      upload_geometry(slot, *draw.geometry);
+    }
+    if ((flags & DrawTable::DirtyMaterial) != 0) {
+      upload_texture(slot, draw.material.base_color_texture);
+    }
+  });
+}
 
-      auto vertex_num = geometry.vertex_count;
-      GLuint buffer;
-      glGenBuffers(1, &buffer);
-      glBindBuffer(GL_ARRAY_BUFFER, buffer);
-      glBufferData(GL_ARRAY_BUFFER, vertex_num * sizeof(Vertex),
-                   geometry.buffers.data(), GL_STATIC_DRAW);
-
-      glEnableVertexAttribArray(0);
-      glVertexAttribPointer(0, 3, GL_FLOAT, false, 8 * sizeof(float), nullptr);
-      glEnableVertexAttribArray(1);
-      glVertexAttribPointer(1, 3, GL_FLOAT, false, 8 * sizeof(float),
-                            reinterpret_cast<void *>(3 * sizeof(float)));
-      glEnableVertexAttribArray(2);
-      glVertexAttribPointer(2, 2, GL_FLOAT, false, 8 * sizeof(float),
-                            reinterpret_cast<void *>(6 * sizeof(float)));
-
-      idx += 1;
+void OpenGLContext::draw_slot(uint32_t slot, const Eigen::Matrix4f &model_matrix,
+                              const Material &material) {
+  if (counts[slot] == 0) {
+    return;
+  }
+
+  auto texture = textures[slot];
+  if (material.base_color_texture != texture_sources[slot]) {
+    // materials bound through a command buffer may bring their own texture
+    auto it = bound_textures.find(material.base_color_texture);
+    if (it == bound_textures.end()) {
+      auto gl_texture = material.base_color_texture == nullptr
+                            ? 0
+                            : create_texture(*material.base_color_texture);
+      it = bound_textures.emplace(material.base_color_texture, gl_texture)
+               .first;
     }
+    texture = it->second;
   }
+
+  if (texture != 0) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glUniform1i(use_texture_location, 1);
+    glUniform1i(texture_location, 0);
+  } else {
+    glUniform1i(use_texture_location, 0);
+    glUniform4fv(base_color_location, 1, material.base_color.data());
+  }
+  glUniformMatrix4fv(model_matrix_location, 1, false, model_matrix.data());
+  glBindVertexArray(vaos[slot]);
+  glDrawElements(GL_TRIANGLES, counts[slot], index_types[slot], nullptr);
 }
 
 void OpenGLContext::draw() {
+  sync();
+
   glUseProgram(program);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  for (size_t i = 0; i < vaos.size(); i++) {
-    auto vao = vaos[i];
-    auto &model_matrix = model_matrixs[i];
-    if (use_textures[i]) {
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, textures[i]);
-      glUniform1i(use_texture_location, 1);
-      glUniform1i(texture_location, 0);
-    } else {
-      glUniform1i(use_texture_location, 0);
-      glUniform4fv(base_color_location, 1, base_colors[i].data());
+  for (uint32_t slot = 0; slot < table.capacity(); slot++) {
+    auto &draw = table.get(slot);
+    if (draw.active) {
+      draw_slot(slot, draw.model_matrix, draw.material);
     }
-    glUniformMatrix4fv(model_matrix_location, 1, false, model_matrix.data());
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, counts[i], GL_UNSIGNED_INT, nullptr);
   }
 }
 
+void OpenGLContext::submit(const vector<CommandBuffer> &buffers) {
+  sync();
+
+  // GL calls must come from this thread, so buffers are replayed in order
+  glUseProgram(program);
+  for (auto &buffer : buffers) {
+    const Material *material = nullptr;
+    const Eigen::Matrix4f *transform = nullptr;
+    for (auto &command : buffer.get_commands()) {
+      switch (command.type) {
+      case CommandBuffer::Type::Clear: {
+        auto &color = buffer.get_color(command.payload);
+        glClearColor(color[0], color[1], color[2], color[3]);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        break;
+      }
+      case CommandBuffer::Type::SetViewport: {
+        auto &size = buffer.get_viewport(command.payload);
+        view_port(size[0], size[1]);
+        break;
+      }
+      case CommandBuffer::Type::BindMaterial: {
+        material = &buffer.get_material(command.payload);
+        break;
+      }
+      case CommandBuffer::Type::SetTransform: {
+        transform = &buffer.get_transform(command.payload);
+        break;
+      }
+      case CommandBuffer::Type::Draw: {
+        auto &args = buffer.get_draw(command.payload);
+        auto slot = table.get_slot(args.handle, args.geometry_idx);
+        auto &draw = table.get(slot);
+        draw_slot(slot, transform != nullptr ? *transform : draw.model_matrix,
+                  material != nullptr ? *material : draw.material);
+        break;
+      }
+      }
+    }
+  }
+  release_bound_textures();
+}
+
+auto OpenGLContext::draw_async() -> uint64_t {
+  // the driver already queues GL work, so recording is all there is to do
+  draw();
+  return next_fence++;
+}
+
+auto OpenGLContext::wait(uint64_t fence) -> const vector<float> & {
+  if (fence == 0 || fence >= next_fence) {
+    throw runtime_error("frame is not available");
+  }
+  glFinish();
+  return get_colors();
+}
+
+void OpenGLContext::set_frames_in_flight(uint32_t count) {
+  if (count < 1 || count > 3) {
+    throw runtime_error("between 1 and 3 frames can be in flight");
+  }
+}
+
+void OpenGLContext::draw_views(
+    const vector<Eigen::Matrix4f> & /*view_matrices*/,
+    vector<Frame> & /*frames*/) {
+  throw runtime_error("multi-view drawing needs the software rasterizer");
+}
+
 void OpenGLContext::set_view(const Eigen::Matrix4f &view_matrix) {
   glUseProgram(program);
   glUniformMatrix4fv(view_matrix_location, 1, false, view_matrix.data());
 }
 
+void OpenGLContext::set_lights(const vector<Light> & /*lights*/) {
+  // the GL program draws every material unlit for now
+}
+
+void OpenGLContext::set_environment(const Texture * /*texture*/) {
+  // no lit material is drawn here either, see set_lights
+}
+
+void OpenGLContext::set_deferred(bool /*deferred*/) {
+  // everything is drawn unlit, there is nothing to defer
+}
+
+void OpenGLContext::set_transparency(
+    Context::Transparency /*transparency*/) {
+  // blending is not enabled, every material is drawn opaque
+}
+
+void OpenGLContext::set_samples(uint32_t /*count*/) {
+  // the default framebuffer is created single sampled
+}
+
+void OpenGLContext::set_post_effects(
+    const vector<PostEffect> & /*effects*/) {
+  // frames are presented as drawn
+}
+
 void OpenGLContext::view_port(uint32_t width, uint32_t height) {
   glViewport(0, 0, width, height);
 }
 
 auto OpenGLContext::get_colors() -> const vector<float> & {
   // TODO
-  return {};
+  return colors;
 }
 
 } // namespace RB
\ No newline at end of file
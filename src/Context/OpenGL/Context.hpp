@@ -1,7 +1,10 @@
 #pragma once
+#include "Context/DrawTable.hpp"
 #include "Context/IContextImp.hpp"
 #include <array>
 #include <glad/glad.h>
+#include <map>
+#include <utility>
 #include <vector>
 
 namespace RB {
@@ -9,26 +12,72 @@ namespace RB {
 class OpenGLContext : public IContextImpl {
 public:
   OpenGLContext();
+  ~OpenGLContext() override;
 
-  void add(const Model &model) override;
+  auto add(const Model &model) -> uint32_t override;
+  void remove(uint32_t handle) override;
+  void update_transform(uint32_t handle,
+                        const Eigen::Matrix4f &transform) override;
+  void update_material(uint32_t handle, uint32_t geometry_idx,
+                       const Material &material) override;
   void draw() override;
+  void submit(const std::vector<CommandBuffer> &buffers) override;
+  auto draw_async() -> uint64_t override;
+  auto wait(uint64_t fence) -> const std::vector<float> & override;
+  void set_frames_in_flight(uint32_t count) override;
+  void draw_views(const std::vector<Eigen::Matrix4f> &view_matrices,
+                  std::vector<Frame> &frames) override;
   void set_view(const Eigen::Matrix4f &view_matrix) override;
+  void set_lights(const std::vector<Light> &lights) override;
+  void set_environment(const Texture *texture) override;
+  void set_deferred(bool deferred) override;
+  void set_transparency(Context::Transparency transparency) override;
+  void set_samples(uint32_t count) override;
+  void set_post_effects(const std::vector<PostEffect> &effects) override;
   void view_port(uint32_t width, uint32_t height) override;
   auto get_colors() -> const std::vector<float> & override;
 
 private:
+  DrawTable table;
   std::vector<GLuint> vaos;
+  std::vector<std::array<GLuint, 3>> vertex_buffers;
+  std::vector<GLuint> element_buffers;
   std::vector<uint32_t> counts;
-  std::vector<Eigen::Matrix4f> model_matrixs;
+  std::vector<GLenum> index_types;
+  // buffers by the bytes they hold, so that geometries sharing an array,
+  // like the instances of a mesh, share one GL buffer too
+  struct SharedBuffer {
+    GLuint buffer = 0;
+    uint32_t users = 0;
+  };
+  std::map<std::pair<const uint8_t *, size_t>, SharedBuffer> shared_buffers;
+  std::map<GLuint, std::pair<const uint8_t *, size_t>> buffer_sources;
   std::vector<GLuint> textures;
-  std::vector<bool> use_textures;
-  std::vector<std::array<float, 4>> base_colors;
+  std::vector<const Texture *> texture_sources;
+  // textures of the materials bound through command buffers, kept only
+  // while the buffers are replayed: nothing tells when the caller frees
+  // them, and a new texture could then take the address of an old one
+  std::map<const Texture *, GLuint> bound_textures;
+  std::vector<float> colors;
+  uint64_t next_fence = 1;
   GLuint program;
   GLint model_matrix_location;
   GLint view_matrix_location;
   GLint texture_location;
   GLint use_texture_location;
   GLint base_color_location;
+
+  void sync();
+  void upload_geometry(uint32_t slot, const Geometry &geometry);
+  void upload_texture(uint32_t slot, const Texture *texture);
+  void release(uint32_t slot);
+  void release_bound_textures();
+  // binds to `target` the buffer holding `size` bytes of `data`
+  auto acquire_buffer(GLenum target, const uint8_t *data, size_t size)
+      -> GLuint;
+  void release_buffer(GLuint &buffer);
+  void draw_slot(uint32_t slot, const Eigen::Matrix4f &model_matrix,
+                 const Material &material);
 };
 
 } // namespace RB
\ No newline at end of file
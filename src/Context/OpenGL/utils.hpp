@@ -1,5 +1,7 @@
 #pragma once
 #include <glad/glad.h>
+#include <RenderBoy/AttributeView.hpp>
+#include <RenderBoy/TextureCache.hpp>
 #include <stdexcept>
 #include <string>
 
@@ -38,7 +40,29 @@ inline GLuint create_program(GLuint vertex_shader, GLuint fragment_shader) {
   return program;
 }
 
-inline GLuint create_texture(const Texture &texture) {
+inline GLenum get_gl_type(ComponentType type) {
+  switch (type) {
+  case ComponentType::Float:
+    return GL_FLOAT;
+  case ComponentType::UnsignedInt:
+    return GL_UNSIGNED_INT;
+  case ComponentType::UnsignedShort:
+    return GL_UNSIGNED_SHORT;
+  case ComponentType::UnsignedByte:
+    return GL_UNSIGNED_BYTE;
+  case ComponentType::Short:
+    return GL_SHORT;
+  case ComponentType::Byte:
+    return GL_BYTE;
+  }
+  throw std::runtime_error("unknown component type");
+}
+
+inline GLuint create_texture(const Texture &source) {
+  // the GL copy is all we need, lazy pixels may be evicted right after
+  auto resident = TextureCache::instance().acquire(source);
+  auto &texture = *resident;
+
   GLuint gl_texture;
   glGenTextures(1, &gl_texture);
   glBindTexture(GL_TEXTURE_2D, gl_texture);
@@ -1,112 +1,1504 @@
 #include "Context/SoftwareRasterizer/Context.hpp"
 #include "Context/SoftwareRasterizer/Rasterizer.hpp"
+#include <Eigen/Geometry>
+#include <Eigen/LU>
+#include <algorithm>
 
 using namespace std;
 using namespace Eigen;
 
 namespace RB {
 
+// whether the rasterizer drops a fragment of `material` with `alpha`, when
+// the material is `masked`
+static auto is_discarded(bool masked, const Material &material, float alpha)
+    -> bool {
+  return masked && alpha < material.AlphaCutoff;
+}
+
+// NDC depth of the world position (x, y, z) through `matrix`
+static auto get_depth(const Matrix4f &matrix, float x, float y, float z)
+    -> float {
+  const Vector4f position(x, y, z, 1.0f);
+  return matrix.row(2).dot(position) / matrix.row(3).dot(position);
+}
+
 SoftwareRasterizerContext::SoftwareRasterizerContext() {
-  auto &uniforms = rasterizer.uniform;
-  auto vertex_shader = [&uniforms](const Attributes &attributes,
-                                   Varyings &varyings, Vector4f &position) {
-    const auto a_position = get<0>(attributes);
-    auto &a_normal = get<1>(attributes);
-    auto &a_uv = get<2>(attributes);
+  auto vertex_shader = [](const Uniforms &uniforms,
+                          const Attributes &attributes, Varyings &varyings,
+                          Vector4f &position) {
+    float a_position[3], a_normal[3], a_uv[2];
+    read_element(get<0>(attributes), uniforms.formats[0], a_position);
+    read_element(get<1>(attributes), uniforms.formats[1], a_normal);
+    read_element(get<2>(attributes), uniforms.formats[2], a_uv);
 
     auto &v_position = get<0>(varyings);
     auto &v_normal = get<1>(varyings);
     auto &v_uv = get<2>(varyings);
+    auto &v_tangent = get<3>(varyings);
 
-    position = uniforms.matrix * uniforms.model *
-               Vector4f(a_position[0], a_position[1], a_position[2], 1.0f);
+    const Vector4f world =
+        uniforms.model *
+        Vector4f(a_position[0], a_position[1], a_position[2], 1.0f);
+    position = uniforms.matrix * world;
+    const Vector3f normal = uniforms.normal_matrix *
+                            Vector3f(a_normal[0], a_normal[1], a_normal[2]);
 
-    v_position = {position[0], position[1], position[2]};
-    v_normal = {a_normal[0], a_normal[1], a_normal[2]};
+    v_position = {world[0], world[1], world[2]};
+    v_normal = {normal[0], normal[1], normal[2]};
     v_uv = {a_uv[0], a_uv[1]};
-  };
-
-  auto fragment_shader = [&uniforms](const Varyings &varyings,
-                                     Vector4f &color) {
-    auto &v_normal = get<1>(varyings);
-    auto &v_uv = get<2>(varyings);
+    v_tangent = {0.0f, 0.0f, 0.0f, 0.0f};
+    if (uniforms.normal_texture != nullptr) {
+      // tangents follow the surface, unlike normals
+      auto a_tangent = reinterpret_cast<const float *>(get<3>(attributes));
+      const Vector3f tangent =
+          uniforms.model.topLeftCorner<3, 3>() *
+          Vector3f(a_tangent[0], a_tangent[1], a_tangent[2]);
+      v_tangent = {tangent[0], tangent[1], tangent[2], a_tangent[3]};
+    }
 
     auto &material = uniforms.material;
-    if (material.base_color_texture != nullptr) {
-      color = material.base_color_texture->sample(v_uv[0], v_uv[1]);
-    } else {
-      color = Vector4f(material.base_color[0], material.base_color[1],
-                       material.base_color[2], material.base_color[3]);
+    if (material.shading == Material::Shading::Gouraud) {
+      // lit per vertex, a texture then modulates the interpolated color
+      SurfaceBatch surface;
+      surface.px[0] = world[0];
+      surface.py[0] = world[1];
+      surface.pz[0] = world[2];
+      surface.nx[0] = normal[0];
+      surface.ny[0] = normal[1];
+      surface.nz[0] = normal[2];
+      auto textured = uniforms.base_color_texture != nullptr;
+      surface.diffuse_r[0] = textured ? 1.0f : material.base_color[0];
+      surface.diffuse_g[0] = textured ? 1.0f : material.base_color[1];
+      surface.diffuse_b[0] = textured ? 1.0f : material.base_color[2];
+      surface.specular_r[0] = material.specular[0];
+      surface.specular_g[0] = material.specular[1];
+      surface.specular_b[0] = material.specular[2];
+      // vertices belong to no tile, every local light is shaded; they
+      // are lit once for every view, as seen from the first
+      auto &frame_lights = *uniforms.lights;
+      shade_blinn_phong(*frame_lights.buffer, nullptr,
+                        &frame_lights.shadow_maps, frame_lights.eyes[0],
+                        material.shininess, surface, 1);
+      v_normal = {surface.r[0], surface.g[0], surface.b[0]};
     }
   };
+
+  auto fragment_shader = [](const Uniforms &uniforms, uint32_t view,
+                            uint32_t tile, const Varyings *varyings,
+                            const size_t *pixels, uint32_t count,
+                            Vector4f *colors) {
+    uniforms.shade(uniforms, view, tile, varyings, pixels, count, colors);
+  };
   rasterizer.set_vertex_shader(move(vertex_shader));
   rasterizer.set_fragment_shader(move(fragment_shader));
 
   rasterizer.set_frame(&frame);
+
+  // shadow casters only need their positions
+  shadow_rasterizer.set_vertex_shader(
+      [](const Uniforms &uniforms, const Attributes &attributes,
+         Varyings & /*varyings*/, Vector4f &position) {
+        float a_position[3];
+        read_element(get<0>(attributes), uniforms.formats[0], a_position);
+        position = uniforms.matrix *
+                   Vector4f(a_position[0], a_position[1], a_position[2], 1.0f);
+        // the maps' depth is not divided by w, see ShadowMap
+        position[2] *= position[3];
+      });
+  shadow_rasterizer.view_port(ShadowMap::Size, ShadowMap::Size);
+  // open meshes cast shadows from both sides
+  shadow_rasterizer.set_cull_back_faces(false);
+}
+
+SoftwareRasterizerContext::~SoftwareRasterizerContext() { wait_idle(); }
+
+auto SoftwareRasterizerContext::add(const Model &model) -> uint32_t {
+  wait_binning();
+  return table.add(model);
+}
+
+void SoftwareRasterizerContext::remove(uint32_t handle) {
+  wait_binning();
+  table.remove(handle);
+}
+
+void SoftwareRasterizerContext::update_transform(
+    uint32_t handle, const Eigen::Matrix4f &transform) {
+  wait_binning();
+  table.update_transform(handle, transform);
+}
+
+void SoftwareRasterizerContext::update_material(uint32_t handle,
+                                                uint32_t geometry_idx,
+                                                const Material &material) {
+  wait_binning();
+  table.update_material(handle, geometry_idx, material);
+}
+
+constexpr auto
+SoftwareRasterizerContext::get_permutation(Material::Shading shading,
+                                           uint32_t features) -> uint32_t {
+  uint32_t used = Deferred | AlphaMask;
+  switch (shading) {
+  case Material::Shading::Unlit:
+  case Material::Shading::Gouraud:
+    used |= BaseColorMap;
+    break;
+  case Material::Shading::Phong:
+    used |= BaseColorMap | SurfaceMap | NormalMap;
+    break;
+  case Material::Shading::Normal:
+    // colors are opaque, nothing is ever masked
+    used = Deferred | NormalMap;
+    break;
+  case Material::Shading::MetallicRoughness:
+    used = PermutationCount - 1;
+    break;
+  }
+  // the rasterizer masks what it draws itself
+  if ((features & Deferred) == 0) {
+    used &= ~static_cast<uint32_t>(AlphaMask);
+  }
+  return features & used;
+}
+
+template <uint32_t... Features>
+auto SoftwareRasterizerContext::get_shaders(
+    integer_sequence<uint32_t, Features...>)
+    -> array<array<Shade, 5>, sizeof...(Features)> {
+  using Shading = Material::Shading;
+  return {{{{
+      shade<shade_unlit<get_permutation(Shading::Unlit, Features)>,
+            get_permutation(Shading::Unlit, Features)>,
+      shade<shade_phong<get_permutation(Shading::Phong, Features)>,
+            get_permutation(Shading::Phong, Features)>,
+      shade<shade_gouraud<get_permutation(Shading::Gouraud, Features)>,
+            get_permutation(Shading::Gouraud, Features)>,
+      shade<shade_normal<get_permutation(Shading::Normal, Features)>,
+            get_permutation(Shading::Normal, Features)>,
+      shade<shade_metallic_roughness<get_permutation(
+                Shading::MetallicRoughness, Features)>,
+            get_permutation(Shading::MetallicRoughness, Features)>,
+  }}...}};
+}
+
+auto SoftwareRasterizerContext::get_shader(Material::Shading shading,
+                                           uint32_t features) -> Shade {
+  static const auto shaders =
+      get_shaders(make_integer_sequence<uint32_t, PermutationCount>());
+  return shaders[features][static_cast<size_t>(shading)];
+}
+
+template <SoftwareRasterizerContext::Shade Function, uint32_t Features>
+void SoftwareRasterizerContext::shade(const Uniforms &uniforms, uint32_t view,
+                                      uint32_t tile, const Varyings *varyings,
+                                      const size_t *pixels, uint32_t count,
+                                      Vector4f *colors) {
+  Function(uniforms, view, tile, varyings, pixels, count, colors);
+  if ((Features & Deferred) != 0) {
+    // what the rasterizer keeps hides the surfaces deferred below
+    auto &model = uniforms.gbuffers[view].model;
+    for (uint32_t i = 0; i < count; i++) {
+      if (!is_discarded((Features & AlphaMask) != 0, uniforms.material,
+                        colors[i][3])) {
+        model[pixels[i]] = uniforms.lighting;
+      }
+    }
+  }
+}
+
+template <uint32_t Features>
+void SoftwareRasterizerContext::shade_unlit(
+    const Uniforms &uniforms, uint32_t /*view*/, uint32_t /*tile*/,
+    const Varyings *varyings, const size_t * /*pixels*/, uint32_t count,
+    Vector4f *colors) {
+  auto &material = uniforms.material;
+  for (uint32_t i = 0; i < count; i++) {
+    auto &v_uv = get<2>(varyings[i]);
+    if ((Features & BaseColorMap) != 0) {
+      colors[i] = uniforms.base_color_texture->sample(v_uv[0], v_uv[1]);
+    } else {
+      colors[i] = Vector4f(material.base_color[0], material.base_color[1],
+                           material.base_color[2], material.base_color[3]);
+    }
+  }
+}
+
+template <uint32_t Features>
+auto SoftwareRasterizerContext::get_normal(const Uniforms &uniforms,
+                                           const Varyings &varyings)
+    -> Vector3f {
+  auto &v_normal = get<1>(varyings);
+  const Vector3f normal(v_normal[0], v_normal[1], v_normal[2]);
+  if ((Features & NormalMap) == 0) {
+    return normal;
+  }
+
+  // the tangent frame of glTF, orthonormalized after interpolation
+  auto &v_uv = get<2>(varyings);
+  auto &v_tangent = get<3>(varyings);
+  const Vector3f n = normal.normalized();
+  const Vector3f tangent(v_tangent[0], v_tangent[1], v_tangent[2]);
+  const Vector3f t = (tangent - n * n.dot(tangent)).normalized();
+  const Vector3f b = n.cross(t) * v_tangent[3];
+  auto texel = uniforms.normal_texture->sample(v_uv[0], v_uv[1]);
+  auto scale = uniforms.material.normal_scale;
+  return (t * ((texel[0] * 2.0f - 1.0f) * scale) +
+          b * ((texel[1] * 2.0f - 1.0f) * scale) + n * (texel[2] * 2.0f - 1.0f))
+      .normalized();
+}
+
+template <uint32_t Features>
+void SoftwareRasterizerContext::get_surfaces(const Uniforms &uniforms,
+                                             const Varyings *varyings,
+                                             uint32_t count,
+                                             SurfaceBatch &surfaces,
+                                             float *alphas) {
+  auto &material = uniforms.material;
+  for (uint32_t i = 0; i < count; i++) {
+    auto &v_position = get<0>(varyings[i]);
+    auto &v_uv = get<2>(varyings[i]);
+    const Vector3f normal = get_normal<Features>(uniforms, varyings[i]);
+    surfaces.px[i] = v_position[0];
+    surfaces.py[i] = v_position[1];
+    surfaces.pz[i] = v_position[2];
+    surfaces.nx[i] = normal[0];
+    surfaces.ny[i] = normal[1];
+    surfaces.nz[i] = normal[2];
+
+    Vector4f diffuse(material.base_color[0], material.base_color[1],
+                     material.base_color[2], material.base_color[3]);
+    if ((Features & BaseColorMap) != 0) {
+      diffuse = uniforms.base_color_texture->sample(v_uv[0], v_uv[1]);
+    }
+    surfaces.diffuse_r[i] = diffuse[0];
+    surfaces.diffuse_g[i] = diffuse[1];
+    surfaces.diffuse_b[i] = diffuse[2];
+    alphas[i] = diffuse[3];
+
+    Vector3f specular(material.specular[0], material.specular[1],
+                      material.specular[2]);
+    if ((Features & SurfaceMap) != 0) {
+      specular = specular.cwiseProduct(
+          uniforms.specular_texture->sample(v_uv[0], v_uv[1]).head<3>());
+    }
+    surfaces.specular_r[i] = specular[0];
+    surfaces.specular_g[i] = specular[1];
+    surfaces.specular_b[i] = specular[2];
+  }
+}
+
+template <uint32_t Features>
+void SoftwareRasterizerContext::shade_phong(const Uniforms &uniforms,
+                                            uint32_t view, uint32_t tile,
+                                            const Varyings *varyings,
+                                            const size_t *pixels,
+                                            uint32_t count, Vector4f *colors) {
+  SurfaceBatch surfaces;
+  float alphas[SurfaceBatch::Size];
+  get_surfaces<Features>(uniforms, varyings, count, surfaces, alphas);
+
+  if ((Features & Deferred) != 0) {
+    auto &gbuffer = uniforms.gbuffers[view];
+    auto &matrix = uniforms.lights->matrices[view];
+    auto shininess = uniforms.material.shininess / 255.0f;
+    for (uint32_t i = 0; i < count; i++) {
+      // lit later, only the alpha matters to the rasterizer
+      colors[i] = {0.0f, 0.0f, 0.0f, alphas[i]};
+      if (is_discarded((Features & AlphaMask) != 0, uniforms.material,
+                       alphas[i])) {
+        continue;
+      }
+      auto pixel = pixels[i];
+      gbuffer.depth[pixel] =
+          get_depth(matrix, surfaces.px[i], surfaces.py[i], surfaces.pz[i]);
+      gbuffer.normal[pixel] =
+          encode_octahedral(surfaces.nx[i], surfaces.ny[i], surfaces.nz[i]);
+      gbuffer.albedo[pixel] =
+          pack_unorm8(surfaces.diffuse_r[i], surfaces.diffuse_g[i],
+                      surfaces.diffuse_b[i], alphas[i]);
+      gbuffer.surface[pixel] =
+          pack_unorm8(surfaces.specular_r[i], surfaces.specular_g[i],
+                      surfaces.specular_b[i], shininess);
+    }
+    return;
+  }
+
+  auto &frame_lights = *uniforms.lights;
+  auto local_lights = frame_lights.views.empty()
+                          ? nullptr
+                          : &frame_lights.views[view].tiles[tile];
+  shade_blinn_phong(*frame_lights.buffer, local_lights,
+                    &frame_lights.shadow_maps, frame_lights.eyes[view],
+                    uniforms.material.shininess, surfaces, count);
+  for (uint32_t i = 0; i < count; i++) {
+    colors[i] = {surfaces.r[i], surfaces.g[i], surfaces.b[i], alphas[i]};
+  }
+}
+
+template <uint32_t Features>
+void SoftwareRasterizerContext::shade_gouraud(
+    const Uniforms &uniforms, uint32_t /*view*/, uint32_t /*tile*/,
+    const Varyings *varyings, const size_t * /*pixels*/, uint32_t count,
+    Vector4f *colors) {
+  auto &material = uniforms.material;
+  for (uint32_t i = 0; i < count; i++) {
+    auto &v_color = get<1>(varyings[i]);
+    auto &v_uv = get<2>(varyings[i]);
+    colors[i] = {v_color[0], v_color[1], v_color[2], material.base_color[3]};
+    if ((Features & BaseColorMap) != 0) {
+      auto texel = uniforms.base_color_texture->sample(v_uv[0], v_uv[1]);
+      colors[i] << colors[i].head<3>().cwiseProduct(texel.head<3>()),
+          texel[3];
+    }
+  }
+}
+
+template <uint32_t Features>
+void SoftwareRasterizerContext::shade_normal(
+    const Uniforms &uniforms, uint32_t /*view*/, uint32_t /*tile*/,
+    const Varyings *varyings, const size_t * /*pixels*/, uint32_t count,
+    Vector4f *colors) {
+  for (uint32_t i = 0; i < count; i++) {
+    const Vector3f normal =
+        get_normal<Features>(uniforms, varyings[i]).normalized();
+    colors[i] = {normal[0] * 0.5f + 0.5f, normal[1] * 0.5f + 0.5f,
+                 normal[2] * 0.5f + 0.5f, 1.0f};
+  }
+}
+
+template <uint32_t Features>
+void SoftwareRasterizerContext::get_surfaces(const Uniforms &uniforms,
+                                             const Varyings *varyings,
+                                             uint32_t count,
+                                             MetallicRoughnessBatch &surfaces,
+                                             float *alphas) {
+  auto &material = uniforms.material;
+  for (uint32_t i = 0; i < count; i++) {
+    auto &v_position = get<0>(varyings[i]);
+    auto &v_uv = get<2>(varyings[i]);
+    const Vector3f normal = get_normal<Features>(uniforms, varyings[i]);
+    surfaces.px[i] = v_position[0];
+    surfaces.py[i] = v_position[1];
+    surfaces.pz[i] = v_position[2];
+    surfaces.nx[i] = normal[0];
+    surfaces.ny[i] = normal[1];
+    surfaces.nz[i] = normal[2];
+
+    // the factors scale the textures, as glTF has it
+    Vector4f albedo(material.base_color[0], material.base_color[1],
+                    material.base_color[2], material.base_color[3]);
+    if ((Features & BaseColorMap) != 0) {
+      albedo = albedo.cwiseProduct(
+          uniforms.base_color_texture->sample(v_uv[0], v_uv[1]));
+    }
+    surfaces.albedo_r[i] = albedo[0];
+    surfaces.albedo_g[i] = albedo[1];
+    surfaces.albedo_b[i] = albedo[2];
+    alphas[i] = albedo[3];
+
+    auto metallic = material.metallic;
+    auto roughness = material.roughness;
+    if ((Features & SurfaceMap) != 0) {
+      auto texel =
+          uniforms.metallic_roughness_texture->sample(v_uv[0], v_uv[1]);
+      roughness *= texel[1];
+      metallic *= texel[2];
+    }
+    surfaces.metallic[i] = metallic;
+    surfaces.roughness[i] = roughness;
+
+    surfaces.occlusion[i] = 1.0f;
+    if ((Features & OcclusionMap) != 0) {
+      auto texel = uniforms.occlusion_texture->sample(v_uv[0], v_uv[1]);
+      surfaces.occlusion[i] =
+          1.0f + material.occlusion_strength * (texel[0] - 1.0f);
+    }
+
+    Vector3f emissive(material.emissive[0], material.emissive[1],
+                      material.emissive[2]);
+    if ((Features & EmissiveMap) != 0) {
+      emissive = emissive.cwiseProduct(
+          uniforms.emissive_texture->sample(v_uv[0], v_uv[1]).head<3>());
+    }
+    surfaces.emissive_r[i] = emissive[0];
+    surfaces.emissive_g[i] = emissive[1];
+    surfaces.emissive_b[i] = emissive[2];
+  }
+}
+
+template <uint32_t Features>
+void SoftwareRasterizerContext::shade_metallic_roughness(
+    const Uniforms &uniforms, uint32_t view, uint32_t tile,
+    const Varyings *varyings, const size_t *pixels, uint32_t count,
+    Vector4f *colors) {
+  MetallicRoughnessBatch surfaces;
+  float alphas[MetallicRoughnessBatch::Size];
+  get_surfaces<Features>(uniforms, varyings, count, surfaces, alphas);
+
+  if ((Features & Deferred) != 0) {
+    auto &gbuffer = uniforms.gbuffers[view];
+    auto &matrix = uniforms.lights->matrices[view];
+    for (uint32_t i = 0; i < count; i++) {
+      colors[i] = {0.0f, 0.0f, 0.0f, alphas[i]};
+      if (is_discarded((Features & AlphaMask) != 0, uniforms.material,
+                       alphas[i])) {
+        continue;
+      }
+      auto pixel = pixels[i];
+      gbuffer.depth[pixel] =
+          get_depth(matrix, surfaces.px[i], surfaces.py[i], surfaces.pz[i]);
+      gbuffer.normal[pixel] =
+          encode_octahedral(surfaces.nx[i], surfaces.ny[i], surfaces.nz[i]);
+      gbuffer.albedo[pixel] =
+          pack_unorm8(surfaces.albedo_r[i], surfaces.albedo_g[i],
+                      surfaces.albedo_b[i], alphas[i]);
+      gbuffer.surface[pixel] =
+          pack_unorm8(surfaces.metallic[i], surfaces.roughness[i],
+                      surfaces.occlusion[i], 0.0f);
+      gbuffer.emissive[pixel] =
+          pack_unorm8(surfaces.emissive_r[i], surfaces.emissive_g[i],
+                      surfaces.emissive_b[i], 0.0f);
+    }
+    return;
+  }
+
+  auto &frame_lights = *uniforms.lights;
+  auto local_lights = frame_lights.views.empty()
+                          ? nullptr
+                          : &frame_lights.views[view].tiles[tile];
+  RB::shade_metallic_roughness(
+      *frame_lights.buffer, local_lights, &frame_lights.shadow_maps,
+      frame_lights.environment.get(), frame_lights.eyes[view], surfaces,
+      count);
+  for (uint32_t i = 0; i < count; i++) {
+    colors[i] = {surfaces.r[i], surfaces.g[i], surfaces.b[i], alphas[i]};
+  }
 }
 
-void SoftwareRasterizerContext::add(const Model &model) {
+void SoftwareRasterizerContext::wait_binning() {
+  for (auto &in_flight_frame : in_flight) {
+    if (in_flight_frame->binned.valid()) {
+      in_flight_frame->binned.wait();
+    }
+  }
+}
+
+void SoftwareRasterizerContext::wait_idle() {
+  for (auto &in_flight_frame : in_flight) {
+    if (in_flight_frame->done.valid()) {
+      in_flight_frame->done.wait();
+    }
+  }
+}
+
+// Per vertex tangents of a triangle list, along which u grows, as glTF
+// defines them: orthogonal to the normals, w the handedness of the
+// bitangent, along which v grows. Each vertex averages those of the
+// triangles around it. Empty without normals or uvs.
+static auto get_tangents(const Geometry &geometry)
+    -> vector<array<float, 4>> {
+  auto positions = geometry.get_positions();
+  auto normals = geometry.get_normals();
+  auto uvs = geometry.get_uvs();
+  if (!positions || !normals || !uvs) {
+    return {};
+  }
+
+  auto vertex_count = geometry.vertex_count;
+  vector<Vector3f> u_tangents(vertex_count, Vector3f::Zero());
+  vector<Vector3f> v_tangents(vertex_count, Vector3f::Zero());
+  auto indices = geometry.get_indices();
+  auto count = indices ? indices.count : vertex_count;
+  for (uint32_t first = 0; first + 2 < count; first += 3) {
+    uint32_t corners[3];
+    Vector3f p[3];
+    Vector2f uv[3];
+    for (uint32_t k = 0; k < 3; k++) {
+      corners[k] = indices ? indices.get_index(first + k) : first + k;
+      positions.read(corners[k], p[k].data());
+      uvs.read(corners[k], uv[k].data());
+    }
+    const Vector3f e1 = p[1] - p[0];
+    const Vector3f e2 = p[2] - p[0];
+    const Vector2f d1 = uv[1] - uv[0];
+    const Vector2f d2 = uv[2] - uv[0];
+    auto det = d1[0] * d2[1] - d2[0] * d1[1];
+    if (std::abs(det) < 1e-12f) {
+      continue;
+    }
+    const Vector3f u_tangent = (e1 * d2[1] - e2 * d1[1]) / det;
+    const Vector3f v_tangent = (e2 * d1[0] - e1 * d2[0]) / det;
+    for (auto corner : corners) {
+      u_tangents[corner] += u_tangent;
+      v_tangents[corner] += v_tangent;
+    }
+  }
+
+  vector<array<float, 4>> tangents(vertex_count);
+  for (uint32_t idx = 0; idx < vertex_count; idx++) {
+    Vector3f normal;
+    normals.read(idx, normal.data());
+    normal.normalize();
+    Vector3f tangent =
+        u_tangents[idx] - normal * normal.dot(u_tangents[idx]);
+    if (tangent.squaredNorm() < 1e-12f) {
+      // no uv gradient, any tangent will do
+      tangent = normal.unitOrthogonal();
+    }
+    tangent.normalize();
+    auto w = normal.cross(tangent).dot(v_tangents[idx]) < 0.0f ? -1.0f : 1.0f;
+    tangents[idx] = {tangent[0], tangent[1], tangent[2], w};
+  }
+  return tangents;
+}
+
+void SoftwareRasterizerContext::sync() {
+  wait_binning();
+
+  // vertex arrays are tied to draw slots, so a recycled slot reuses its own
   auto origin_vao_num = vaos.size();
-  auto geometry_num = 0;
-  for (auto &mesh : model.meshes) {
-    geometry_num += mesh.geometries.size();
+  auto capacity = table.capacity();
+  vaos.resize(capacity);
+  counts.resize(capacity, 0);
+  formats.resize(capacity);
+  tangents.resize(capacity);
+  for (auto idx = origin_vao_num; idx < capacity; idx++) {
+    vaos[idx] = rasterizer.gen_vertex_array();
+  }
+
+  table.sync([this](uint32_t slot, uint8_t flags) {
+    auto &draw = table.get(slot);
+    if (!draw.active) {
+      counts[slot] = 0;
+      return;
+    }
+    if ((flags & (DrawTable::DirtyGeometry | DrawTable::DirtyMaterial)) == 0) {
+      // transforms are read straight from the table
+      return;
+    }
+
+    auto &geometry = *draw.geometry;
+    rasterizer.bind_vertex_array(vaos[slot]);
+    if ((flags & DrawTable::DirtyGeometry) != 0) {
+      bind_geometry(slot, geometry);
+    }
+
+    // tangents are only generated once a material needs them
+    auto &slot_tangents = tangents[slot];
+    if (draw.material.normal_texture == nullptr || !slot_tangents.empty()) {
+      return;
+    }
+    slot_tangents = get_tangents(geometry);
+    if (!slot_tangents.empty()) {
+      auto attributes = rasterizer.get_vertex_array(vaos[slot]).attributes;
+      get<3>(attributes) =
+          reinterpret_cast<const uint8_t *>(slot_tangents.data());
+      rasterizer.vertex_attributes(attributes, geometry.vertex_count);
+      rasterizer.vertex_attributes_pointer(3, 4, sizeof(slot_tangents[0]), 0);
+    }
+  });
+}
+
+void SoftwareRasterizerContext::bind_geometry(uint32_t slot,
+                                              const Geometry &geometry) {
+  auto indices = geometry.get_indices();
+  if (indices) {
+    // 8 and 16 bit indices are read in place, in their own width
+    rasterizer.element_buffer_data(
+        indices.data, static_cast<uint8_t>(indices.element_size()));
+    counts[slot] = indices.count;
+  } else {
+    rasterizer.element_buffer_data(nullptr);
+    counts[slot] = geometry.vertex_count;
   }
 
-  vaos.resize(origin_vao_num + geometry_num);
-  model_matrixs.resize(origin_vao_num + geometry_num);
-  counts.resize(origin_vao_num + geometry_num);
-  materials.resize(origin_vao_num + geometry_num);
+  // read the attributes in place, wherever and however they are stored;
+  // the vertex shader converts quantized ones
+  static const float zeros[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  const AttributeView views[] = {geometry.get_positions(),
+                                 geometry.get_normals(), geometry.get_uvs()};
+  const uint8_t *pointers[3];
+  for (uint32_t location = 0; location < 3; location++) {
+    auto &view = views[location];
+    auto &format = formats[slot][location];
+    if (view) {
+      pointers[location] = view.data;
+      format = view.format();
+      rasterizer.vertex_attributes_pointer(location, view.components,
+                                           view.stride, 0);
+    } else {
+      pointers[location] = reinterpret_cast<const uint8_t *>(zeros);
+      format = AttributeFormat{};
+      format.components = location == 2 ? 2 : 3;
+      rasterizer.vertex_attributes_pointer(location, format.components, 0,
+                                           0);
+    }
+  }
+  // tangents stay zero until generated
+  rasterizer.vertex_attributes(
+      Attributes{pointers[0], pointers[1], pointers[2],
+                 reinterpret_cast<const uint8_t *>(zeros)},
+      geometry.vertex_count);
+  rasterizer.vertex_attributes_pointer(3, 4, 0, 0);
+  tangents[slot].clear();
+}
 
-  auto idx = origin_vao_num;
-  for (const auto &mesh : model.meshes) {
-    auto &model_matrix = mesh.model_matrix;
-    for (auto &geometry : mesh.geometries) {
-      auto vao = rasterizer.gen_vertex_array();
-      vaos[idx] = vao;
-      rasterizer.bind_vertex_array(vao);
+// false when the box is entirely outside the view of `matrix`
+static auto is_visible(const BoundingBox &box, const Matrix4f &matrix) -> bool {
+  if (box.min[0] > box.max[0]) {
+    // geometries built in memory may come without bounds
+    return true;
+  }
 
-      auto &material = geometry.material;
-      materials[idx] = material;
-      model_matrixs[idx] = model_matrix;
+  // counts the corners outside of each clip plane, and behind the eye
+  array<int, 5> outside = {0, 0, 0, 0, 0};
+  for (uint32_t corner = 0; corner < 8; corner++) {
+    const Vector4f position =
+        matrix * Vector4f((corner & 1u) != 0 ? box.max[0] : box.min[0],
+                          (corner & 2u) != 0 ? box.max[1] : box.min[1],
+                          (corner & 4u) != 0 ? box.max[2] : box.min[2], 1.0f);
+    outside[0] += position[0] < -position[3] ? 1 : 0;
+    outside[1] += position[0] > position[3] ? 1 : 0;
+    outside[2] += position[1] < -position[3] ? 1 : 0;
+    outside[3] += position[1] > position[3] ? 1 : 0;
+    outside[4] += position[3] <= 0.0f ? 1 : 0;
+  }
+  return std::find(outside.begin(), outside.end(), 8) == outside.end();
+}
 
-      rasterizer.element_buffer_data(geometry.indices.data());
-      counts[idx] = geometry.index_count;
+// the point `view` projects to clip x = y = w = 0, or one far behind the
+// view for orthographic projections
+static auto get_eye(const Matrix4f &view) -> Vector3f {
+  const Vector4f eye = view.inverse() * Vector4f(0.0f, 0.0f, 1.0f, 0.0f);
+  if (std::abs(eye[3]) > 1e-6f * eye.head<3>().norm()) {
+    return eye.head<3>() / eye[3];
+  }
+  return -eye.head<3>().normalized() * 1e6f;
+}
 
-      rasterizer.vertex_attributes(
-          Attributes{reinterpret_cast<const float *>(geometry.buffers.data()),
-                     reinterpret_cast<const float *>(geometry.buffers.data()),
-                     reinterpret_cast<const float *>(geometry.buffers.data())});
+auto SoftwareRasterizerContext::cull_lights(const vector<Matrix4f> &views) const
+    -> shared_ptr<const FrameLights> {
+  auto frame_lights = make_shared<FrameLights>();
+  frame_lights->buffer = lights;
+  frame_lights->environment = environment;
+  for (auto &view : views) {
+    frame_lights->eyes.push_back(get_eye(view));
+    frame_lights->matrices.push_back(view);
+  }
+  render_shadows(views, *frame_lights);
+  if (lights->local.size() == 0) {
+    return frame_lights;
+  }
+  for (auto &view : views) {
+    frame_lights->views.push_back(RB::cull_lights(
+        *lights, view, frame.getWidth(), frame.getHeight(),
+        SoftwareRasterizer::TileSize));
+  }
+  return frame_lights;
+}
 
-      rasterizer.vertex_attributes_pointer(0, 3, 5, 0); // position
-      rasterizer.vertex_attributes_pointer(1, 3, 5, 3); // normal
-      rasterizer.vertex_attributes_pointer(2, 2, 6, 6); // uv
+void SoftwareRasterizerContext::render_shadows(const vector<Matrix4f> &views,
+                                               FrameLights &frame_lights) const {
+  auto &shadowed = lights->shadowed;
+  if (shadowed.empty() || views.empty()) {
+    return;
+  }
 
-      idx += 1;
+  // the world bounds of the scene limit how far the maps reach
+  BoundingBox scene;
+  for (uint32_t slot = 0; slot < table.capacity(); slot++) {
+    auto &draw = table.get(slot);
+    if (!draw.active || draw.geometry == nullptr) {
+      continue;
+    }
+    auto &box = draw.geometry->box;
+    if (box.min[0] > box.max[0]) {
+      continue;
+    }
+    for (uint32_t corner = 0; corner < 8; corner++) {
+      const Vector4f position =
+          draw.model_matrix *
+          Vector4f((corner & 1u) != 0 ? box.max[0] : box.min[0],
+                   (corner & 2u) != 0 ? box.max[1] : box.min[1],
+                   (corner & 4u) != 0 ? box.max[2] : box.min[2], 1.0f);
+      scene.min = scene.min.cwiseMin(position.head<3>());
+      scene.max = scene.max.cwiseMax(position.head<3>());
     }
   }
+
+  // maps that cannot be fitted stay empty and shadow nothing
+  auto &maps = frame_lights.shadow_maps;
+  vector<uint8_t> fitted;
+  for (auto &light : shadowed) {
+    if (light.type == Light::Type::Direction) {
+      array<ShadowMap, ShadowCascades> cascades;
+      auto res = fit_cascades(light.direction, views, scene, cascades);
+      for (auto &cascade : cascades) {
+        maps.push_back(cascade);
+        fitted.push_back(res ? 1 : 0);
+      }
+    } else {
+      maps.emplace_back();
+      fitted.push_back(fit_spot(light, scene, maps.back()) ? 1 : 0);
+    }
+  }
+
+  // each map culls and bins the scene on its own, then all their tiles are
+  // rasterized together
+  vector<SoftwareRasterizer::Binner> shadow_binners(maps.size());
+  ParallelForEach(static_cast<size_t>(0), maps.size(), [&](size_t idx) {
+    if (fitted[idx] == 0) {
+      return;
+    }
+    for (uint32_t slot = 0; slot < table.capacity(); slot++) {
+      auto &draw = table.get(slot);
+      if (!draw.active || counts[slot] == 0) {
+        continue;
+      }
+      Uniforms uniforms;
+      uniforms.matrix = maps[idx].matrix * draw.model_matrix;
+      if (!is_visible(draw.geometry->box, uniforms.matrix)) {
+        continue;
+      }
+      uniforms.formats = formats[slot];
+      shadow_rasterizer.bin(shadow_binners[idx],
+                            rasterizer.get_vertex_array(vaos[slot]),
+                            counts[slot], uniforms);
+    }
+  });
+  vector<vector<float>> depths;
+  shadow_rasterizer.rasterize_depth(shadow_binners, depths);
+  for (size_t idx = 0; idx < maps.size(); idx++) {
+    if (fitted[idx] != 0) {
+      maps[idx].depth = move(depths[idx]);
+    }
+  }
+}
+
+auto SoftwareRasterizerContext::make_uniforms(
+    const Matrix4f &matrix, const Matrix4f *views, size_t view_count,
+    uint32_t slot, const Matrix4f &model_matrix, const Material &material,
+    const shared_ptr<const FrameLights> &frame_lights, GBuffer *gbuffers,
+    Uniforms &uniforms) const -> bool {
+  if (counts[slot] == 0) {
+    return false;
+  }
+
+  // skip what no view sees, so its texture is never even decoded
+  auto &box = table.get(slot).geometry->box;
+  auto visible = false;
+  for (size_t idx = 0; idx < view_count; idx++) {
+    if (is_visible(box, views[idx] * model_matrix)) {
+      visible = true;
+      break;
+    }
+  }
+  if (!visible) {
+    return false;
+  }
+
+  // blended surfaces are drawn over lit pixels, they cannot be deferred
+  if (material.alpha_mode == Material::AlphaMode::Blend) {
+    gbuffers = nullptr;
+  }
+  uniforms.matrix = matrix;
+  uniforms.model = model_matrix;
+  uniforms.material = material;
+  uniforms.formats = formats[slot];
+  uniforms.gbuffers = gbuffers;
+  uniforms.normal_matrix =
+      model_matrix.topLeftCorner<3, 3>().inverse().transpose();
+
+  auto acquire = [](const Texture *texture) {
+    return texture == nullptr ? nullptr
+                              : TextureCache::instance().acquire(*texture);
+  };
+  uniforms.base_color_texture = acquire(material.base_color_texture);
+  switch (material.shading) {
+  case Material::Shading::Phong:
+    uniforms.specular_texture = acquire(material.specular_texture);
+    uniforms.lighting = GBuffer::Phong;
+    break;
+  case Material::Shading::MetallicRoughness:
+    uniforms.metallic_roughness_texture =
+        acquire(material.metallic_roughness_texture);
+    uniforms.emissive_texture = acquire(material.emissive_texture);
+    uniforms.occlusion_texture = acquire(material.occlusion_texture);
+    uniforms.lighting = GBuffer::MetallicRoughness;
+    break;
+  default:
+    break;
+  }
+  if (material.shading == Material::Shading::Phong ||
+      material.shading == Material::Shading::Gouraud ||
+      material.shading == Material::Shading::MetallicRoughness) {
+    uniforms.lights = frame_lights;
+  }
+  // normal maps are left out on geometries without tangents, see sync
+  if (material.shading != Material::Shading::Unlit &&
+      material.shading != Material::Shading::Gouraud &&
+      !tangents[slot].empty()) {
+    uniforms.normal_texture = acquire(material.normal_texture);
+  }
+
+  uint32_t features = 0;
+  features |= uniforms.base_color_texture != nullptr ? BaseColorMap : 0u;
+  features |= uniforms.specular_texture != nullptr ||
+                      uniforms.metallic_roughness_texture != nullptr
+                  ? SurfaceMap
+                  : 0u;
+  features |= uniforms.occlusion_texture != nullptr ? OcclusionMap : 0u;
+  features |= uniforms.emissive_texture != nullptr ? EmissiveMap : 0u;
+  features |= uniforms.normal_texture != nullptr ? NormalMap : 0u;
+  features |= gbuffers != nullptr ? Deferred : 0u;
+  features |= material.alpha_mode == Material::AlphaMode::Mask ? AlphaMask : 0u;
+  uniforms.shade = get_shader(material.shading, features);
+  return true;
+}
+
+// what the rasterizer does with the alpha of the material's fragments
+static auto get_blending(const Material &material,
+                         Context::Transparency transparency) -> Blending {
+  Blending blending;
+  switch (material.alpha_mode) {
+  case Material::AlphaMode::Opaque:
+    break;
+  case Material::AlphaMode::Mask:
+    blending.mode = Blending::Mode::Mask;
+    blending.cutoff = material.AlphaCutoff;
+    break;
+  case Material::AlphaMode::Blend:
+    blending.mode = transparency == Context::Transparency::Sorted
+                        ? Blending::Mode::Blend
+                        : Blending::Mode::Accumulate;
+    break;
+  }
+  return blending;
+}
+
+void SoftwareRasterizerContext::bin(
+    SoftwareRasterizer::Binner &binner, const Eigen::Matrix4f &view,
+    uint32_t slot, const Eigen::Matrix4f &model_matrix,
+    const Material &material, const shared_ptr<const FrameLights> &frame_lights,
+    GBuffer *gbuffers) const {
+  Uniforms uniforms;
+  if (make_uniforms(view, &view, 1, slot, model_matrix, material,
+                    frame_lights, gbuffers, uniforms)) {
+    rasterizer.bin(binner, rasterizer.get_vertex_array(vaos[slot]),
+                   counts[slot], uniforms,
+                   get_blending(material, transparency));
+  }
+}
+
+void SoftwareRasterizerContext::bin(
+    SoftwareRasterizer::Binner &binner, const vector<Matrix4f> &views,
+    uint32_t slot, const Matrix4f &model_matrix, const Material &material,
+    const shared_ptr<const FrameLights> &frame_lights,
+    GBuffer *gbuffers) const {
+  if (views.size() == 1) {
+    bin(binner, views[0], slot, model_matrix, material, frame_lights,
+        gbuffers);
+    return;
+  }
+  // the shader outputs world space, each view is applied by the rasterizer
+  Uniforms uniforms;
+  if (make_uniforms(Matrix4f::Identity(), views.data(), views.size(), slot,
+                    model_matrix, material, frame_lights, gbuffers,
+                    uniforms)) {
+    // the views share one draw order, which cannot be back to front for
+    // all of them, so their blended draws are weighted instead
+    rasterizer.bin(binner, views, rasterizer.get_vertex_array(vaos[slot]),
+                   counts[slot], uniforms,
+                   get_blending(material,
+                                Context::Transparency::WeightedBlended));
+  }
+}
+
+void SoftwareRasterizerContext::bin_transparent(
+    vector<SoftwareRasterizer::Binner> &target, const vector<Matrix4f> &views,
+    vector<TransparentDraw> &draws,
+    const shared_ptr<const FrameLights> &frame_lights) const {
+  if (draws.empty()) {
+    return;
+  }
+  if (transparency == Context::Transparency::Sorted && views.size() == 1) {
+    // whole draws from back to front, by the centers of their boxes
+    for (auto &draw : draws) {
+      auto &box = table.get(draw.slot).geometry->box;
+      Vector4f center(0.0f, 0.0f, 0.0f, 1.0f);
+      if (box.min[0] <= box.max[0]) {
+        center.head<3>() = (box.min + box.max) * 0.5f;
+      }
+      const Vector4f position = views[0] * *draw.model_matrix * center;
+      draw.depth = position[2] / position[3];
+    }
+    stable_sort(draws.begin(), draws.end(),
+                [](const TransparentDraw &a, const TransparentDraw &b) {
+                  return a.depth > b.depth;
+                });
+  }
+
+  // tiles go through the binners in order, so contiguous runs keep it
+  const auto draw_num = static_cast<uint32_t>(draws.size());
+  const auto chunk_num = std::max(
+      1u, std::min(std::thread::hardware_concurrency(), draw_num));
+  target.resize(std::max<size_t>(target.size(), chunk_num));
+  ParallelForEach(0u, chunk_num, [&](uint32_t chunk) {
+    const auto begin = draw_num * chunk / chunk_num;
+    const auto end = draw_num * (chunk + 1) / chunk_num;
+    for (auto idx = begin; idx < end; idx++) {
+      auto &draw = draws[idx];
+      this->bin(target[chunk], views, draw.slot, *draw.model_matrix,
+                *draw.material, frame_lights, nullptr);
+    }
+  });
+}
+
+auto SoftwareRasterizerContext::bin_all(
+    vector<SoftwareRasterizer::Binner> &target,
+    vector<SoftwareRasterizer::Binner> &transparent_target,
+    const vector<Matrix4f> &views, GBuffer *gbuffers) const
+    -> shared_ptr<const FrameLights> {
+  auto frame_lights = cull_lights(views);
+
+  // split the draw slots into contiguous chunks binned in parallel
+  const auto capacity = table.capacity();
+  const auto chunk_num = std::max(
+      1u, std::min(std::thread::hardware_concurrency(), capacity));
+  target.resize(std::max<size_t>(target.size(), chunk_num));
+  vector<vector<TransparentDraw>> transparent_chunks(chunk_num);
+  ParallelForEach(0u, chunk_num, [&](uint32_t chunk) {
+    const auto begin = capacity * chunk / chunk_num;
+    const auto end = capacity * (chunk + 1) / chunk_num;
+    for (auto slot = begin; slot < end; slot++) {
+      auto &draw = table.get(slot);
+      if (!draw.active) {
+        continue;
+      }
+      if (draw.material.alpha_mode == Material::AlphaMode::Blend) {
+        transparent_chunks[chunk].push_back(
+            {slot, &draw.model_matrix, &draw.material, 0.0f});
+        continue;
+      }
+      this->bin(target[chunk], views, slot, draw.model_matrix, draw.material,
+                frame_lights, gbuffers);
+    }
+  });
+
+  vector<TransparentDraw> transparent_draws;
+  for (auto &chunk : transparent_chunks) {
+    transparent_draws.insert(transparent_draws.end(), chunk.begin(),
+                             chunk.end());
+  }
+  bin_transparent(transparent_target, views, transparent_draws,
+                  frame_lights);
+  return frame_lights;
+}
+
+auto SoftwareRasterizerContext::get_gbuffers(size_t count) -> GBuffer * {
+  // a G-buffer holds one surface per pixel, edges would lose the others
+  if (!deferred || samples > 1) {
+    return nullptr;
+  }
+  gbuffers.resize(std::max(gbuffers.size(), count));
+  for (auto &gbuffer : gbuffers) {
+    gbuffer.resize(frame.getSize());
+  }
+  return gbuffers.data();
+}
+
+auto SoftwareRasterizerContext::get_samples(size_t count) -> SampleBuffer * {
+  if (samples == 1) {
+    return nullptr;
+  }
+  sample_buffers.resize(std::max(sample_buffers.size(), count));
+  for (auto &buffer : sample_buffers) {
+    buffer.resize(frame.getSize(), rasterizer.get_tile_count(), samples);
+  }
+  return sample_buffers.data();
+}
+
+void SoftwareRasterizerContext::post_process() {
+  post_processed = post_processor != nullptr;
+  if (post_processed) {
+    post_processor->apply(frame, post_frame, post_scratch);
+  }
+}
+
+void SoftwareRasterizerContext::light(GBuffer *gbuffers, Frame *targets,
+                                      const vector<Matrix4f> &views,
+                                      const FrameLights &frame_lights) const {
+  const auto tile_size = SoftwareRasterizer::TileSize;
+  const auto width = static_cast<int>(frame.getWidth());
+  const auto height = static_cast<int>(frame.getHeight());
+  const auto tiles_x = (width + tile_size - 1) / tile_size;
+  const auto tile_count = rasterizer.get_tile_count();
+  vector<Matrix4f> inverses;
+  for (auto &view : views) {
+    inverses.push_back(view.inverse());
+  }
+  auto &eyes = frame_lights.eyes;
+
+  // tiles own disjoint pixels, and match those of the culled lights
+  const auto task_count = static_cast<uint32_t>(tile_count * views.size());
+  ParallelForEach(0u, task_count, [&](uint32_t task) {
+    const auto v = task / tile_count;
+    const auto idx = task % tile_count;
+    auto &gbuffer = gbuffers[v];
+    auto &target = targets[v];
+    auto &lights = *frame_lights.buffer;
+    auto local_lights = frame_lights.views.empty()
+                            ? nullptr
+                            : &frame_lights.views[v].tiles[idx];
+
+    // pixels are gathered per model into batches, Phong ones of a single
+    // shininess, and shaded a batch at a time like fragments
+    SurfaceBatch phong;
+    MetallicRoughnessBatch pbr;
+    float phong_alphas[SurfaceBatch::Size];
+    float pbr_alphas[MetallicRoughnessBatch::Size];
+    size_t phong_pixels[SurfaceBatch::Size];
+    size_t pbr_pixels[MetallicRoughnessBatch::Size];
+    uint32_t phong_count = 0, pbr_count = 0;
+    auto shininess = 0.0f;
+    auto shade_phong = [&]() {
+      shade_blinn_phong(lights, local_lights, &frame_lights.shadow_maps,
+                        eyes[v], shininess, phong, phong_count);
+      for (uint32_t i = 0; i < phong_count; i++) {
+        target.setColor(phong_pixels[i], {phong.r[i], phong.g[i],
+                                          phong.b[i], phong_alphas[i]});
+      }
+      phong_count = 0;
+    };
+    auto shade_pbr = [&]() {
+      RB::shade_metallic_roughness(lights, local_lights,
+                                   &frame_lights.shadow_maps,
+                                   frame_lights.environment.get(), eyes[v],
+                                   pbr, pbr_count);
+      for (uint32_t i = 0; i < pbr_count; i++) {
+        target.setColor(pbr_pixels[i],
+                        {pbr.r[i], pbr.g[i], pbr.b[i], pbr_alphas[i]});
+      }
+      pbr_count = 0;
+    };
+    // the world position back from the depth, at the pixel's center, and
+    // the normal
+    auto set_geometry = [&](auto &batch, uint32_t i, int x, int y,
+                            size_t pixel) {
+      const Vector4f position =
+          inverses[v] * Vector4f((2.0f * x + 1.0f) / width - 1.0f,
+                                 (2.0f * y + 1.0f) / height - 1.0f,
+                                 gbuffer.depth[pixel], 1.0f);
+      const Vector3f normal = decode_octahedral(gbuffer.normal[pixel]);
+      batch.px[i] = position[0] / position[3];
+      batch.py[i] = position[1] / position[3];
+      batch.pz[i] = position[2] / position[3];
+      batch.nx[i] = normal[0];
+      batch.ny[i] = normal[1];
+      batch.nz[i] = normal[2];
+    };
+
+    const auto x0 = static_cast<int>(idx % tiles_x) * tile_size;
+    const auto y0 = static_cast<int>(idx / tiles_x) * tile_size;
+    const auto x1 = std::min(x0 + tile_size, width);
+    const auto y1 = std::min(y0 + tile_size, height);
+    for (auto y = y0; y < y1; y++) {
+      for (auto x = x0; x < x1; x++) {
+        const auto pixel = static_cast<size_t>(x + y * width);
+        const auto model = gbuffer.model[pixel];
+        if (model == GBuffer::Forward) {
+          continue;
+        }
+        gbuffer.model[pixel] = GBuffer::Forward;
+        const auto albedo = gbuffer.albedo[pixel];
+        const auto surface = gbuffer.surface[pixel];
+
+        if (model == GBuffer::Phong) {
+          auto pixel_shininess = static_cast<float>(surface >> 24u);
+          if (phong_count > 0 && pixel_shininess != shininess) {
+            shade_phong();
+          }
+          shininess = pixel_shininess;
+          const auto i = phong_count;
+          set_geometry(phong, i, x, y, pixel);
+          phong.diffuse_r[i] = unpack_unorm8(albedo, 0);
+          phong.diffuse_g[i] = unpack_unorm8(albedo, 1);
+          phong.diffuse_b[i] = unpack_unorm8(albedo, 2);
+          phong_alphas[i] = unpack_unorm8(albedo, 3);
+          phong.specular_r[i] = unpack_unorm8(surface, 0);
+          phong.specular_g[i] = unpack_unorm8(surface, 1);
+          phong.specular_b[i] = unpack_unorm8(surface, 2);
+          phong_pixels[i] = pixel;
+          if (++phong_count == SurfaceBatch::Size) {
+            shade_phong();
+          }
+        } else {
+          const auto emissive = gbuffer.emissive[pixel];
+          const auto i = pbr_count;
+          set_geometry(pbr, i, x, y, pixel);
+          pbr.albedo_r[i] = unpack_unorm8(albedo, 0);
+          pbr.albedo_g[i] = unpack_unorm8(albedo, 1);
+          pbr.albedo_b[i] = unpack_unorm8(albedo, 2);
+          pbr_alphas[i] = unpack_unorm8(albedo, 3);
+          pbr.metallic[i] = unpack_unorm8(surface, 0);
+          pbr.roughness[i] = unpack_unorm8(surface, 1);
+          pbr.occlusion[i] = unpack_unorm8(surface, 2);
+          pbr.emissive_r[i] = unpack_unorm8(emissive, 0);
+          pbr.emissive_g[i] = unpack_unorm8(emissive, 1);
+          pbr.emissive_b[i] = unpack_unorm8(emissive, 2);
+          pbr_pixels[i] = pixel;
+          if (++pbr_count == MetallicRoughnessBatch::Size) {
+            shade_pbr();
+          }
+        }
+      }
+    }
+    if (phong_count > 0) {
+      shade_phong();
+    }
+    if (pbr_count > 0) {
+      shade_pbr();
+    }
+  });
 }
 
 void SoftwareRasterizerContext::draw() {
-  frame.clear();
-  for (size_t i = 0; i < 6; i++) {
-    rasterizer.bind_vertex_array(vaos[i]);
-    rasterizer.uniform.model = model_matrixs[i];
-    rasterizer.uniform.material = materials[i];
-    rasterizer.drawElements(counts[i]);
+  sync();
+
+  auto gbuffer = get_gbuffers(1);
+  auto target_samples = get_samples(1);
+  auto frame_lights =
+      bin_all(binners, transparent_binners, {view_matrix}, gbuffer);
+  const Vector4f clear_color = {0.f, 0.f, 0.f, 1.0f};
+  rasterizer.rasterize(binners, frame, &clear_color, target_samples);
+  if (gbuffer != nullptr) {
+    light(gbuffer, &frame, {view_matrix}, *frame_lights);
+  }
+  rasterizer.rasterize(transparent_binners, frame, nullptr, target_samples);
+  post_process();
+}
+
+void SoftwareRasterizerContext::draw_views(const vector<Matrix4f> &view_matrices,
+                                           vector<Frame> &frames) {
+  sync();
+
+  frames.resize(view_matrices.size());
+  for (auto &target : frames) {
+    target.resize(frame.getWidth(), frame.getHeight());
+  }
+  if (view_matrices.empty()) {
+    return;
+  }
+
+  auto gbuffers = get_gbuffers(view_matrices.size());
+  auto target_samples = get_samples(view_matrices.size());
+  auto frame_lights =
+      bin_all(binners, transparent_binners, view_matrices, gbuffers);
+  const Vector4f clear_color = {0.f, 0.f, 0.f, 1.0f};
+  rasterizer.rasterize(binners, frames.data(), frames.size(), &clear_color,
+                       target_samples);
+  if (gbuffers != nullptr) {
+    light(gbuffers, frames.data(), view_matrices, *frame_lights);
+  }
+  rasterizer.rasterize(transparent_binners, frames.data(), frames.size(),
+                       nullptr, target_samples);
+  if (post_processor != nullptr) {
+    // through a frame of its own, leaving post_frame to the last draw()
+    Frame processed;
+    for (auto &target : frames) {
+      post_processor->apply(target, processed, post_scratch);
+      std::swap(target, processed);
+    }
+  }
+}
+
+auto SoftwareRasterizerContext::draw_async() -> uint64_t {
+  sync();
+
+  if (geometry_queue == nullptr) {
+    geometry_queue = make_unique<ThreadPool>(1);
+    raster_queue = make_unique<ThreadPool>(1);
+  }
+  if (in_flight.empty()) {
+    set_frames_in_flight(2);
+  }
+
+  // the oldest frame hands its storage over once it has been rasterized
+  const auto fence = next_fence++;
+  auto &target = *in_flight[fence % in_flight.size()];
+  if (target.done.valid()) {
+    target.done.wait();
+  }
+  target.fence = fence;
+  target.view_matrix = view_matrix;
+  target.frame.resize(frame.getWidth(), frame.getHeight());
+  GBuffer *gbuffer = nullptr;
+  if (deferred && samples == 1) {
+    target.gbuffer.resize(frame.getSize());
+    gbuffer = &target.gbuffer;
+  }
+  SampleBuffer *target_samples = nullptr;
+  if (samples > 1) {
+    target.samples.resize(frame.getSize(), rasterizer.get_tile_count(),
+                          samples);
+    target_samples = &target.samples;
+  }
+
+  target.post_processor = post_processor;
+
+  InFlightFrame *current = &target;
+  target.binned = geometry_queue
+                      ->enqueue([this, current, gbuffer]() {
+                        current->lights = this->bin_all(
+                            current->binners, current->transparent_binners,
+                            {current->view_matrix}, gbuffer);
+                      })
+                      .share();
+  target.done = raster_queue
+                    ->enqueue([this, current, gbuffer, target_samples]() {
+                      current->binned.get();
+                      const Vector4f clear_color = {0.f, 0.f, 0.f, 1.0f};
+                      rasterizer.rasterize(current->binners, current->frame,
+                                           &clear_color, target_samples);
+                      if (gbuffer != nullptr) {
+                        light(gbuffer, &current->frame,
+                              {current->view_matrix}, *current->lights);
+                      }
+                      rasterizer.rasterize(current->transparent_binners,
+                                           current->frame, nullptr,
+                                           target_samples);
+                      if (current->post_processor != nullptr) {
+                        current->post_processor->apply(current->frame,
+                                                       current->output,
+                                                       current->scratch);
+                      }
+                      // shadow maps are freed with the frame's lights
+                      current->lights.reset();
+                    })
+                    .share();
+  return fence;
+}
+
+auto SoftwareRasterizerContext::wait(uint64_t fence)
+    -> const std::vector<float> & {
+  if (fence < first_fence || fence >= next_fence ||
+      fence + in_flight.size() < next_fence) {
+    throw runtime_error("frame is not available");
+  }
+  auto &target = *in_flight[fence % in_flight.size()];
+  target.done.get();
+  return target.post_processor != nullptr ? target.output.getColors()
+                                          : target.frame.getColors();
+}
+
+void SoftwareRasterizerContext::set_frames_in_flight(uint32_t count) {
+  if (count < 1 || count > 3) {
+    throw runtime_error("between 1 and 3 frames can be in flight");
+  }
+  wait_idle();
+  // earlier fences become unavailable once the ring is rebuilt
+  first_fence = next_fence;
+  in_flight.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    in_flight.emplace_back(make_unique<InFlightFrame>());
+  }
+}
+
+void SoftwareRasterizerContext::bin(
+    SoftwareRasterizer::Binner &binner, const CommandRange &range,
+    const shared_ptr<const FrameLights> &frame_lights, GBuffer *gbuffers,
+    vector<TransparentDraw> &transparent_draws) {
+  auto material = range.material;
+  auto transform = range.transform;
+  auto &buffer = *range.buffer;
+  auto &commands = buffer.get_commands();
+  for (auto idx = range.begin; idx < range.end; idx++) {
+    auto &command = commands[idx];
+    switch (command.type) {
+    case CommandBuffer::Type::BindMaterial: {
+      material = &buffer.get_material(command.payload);
+      break;
+    }
+    case CommandBuffer::Type::SetTransform: {
+      transform = &buffer.get_transform(command.payload);
+      break;
+    }
+    case CommandBuffer::Type::Draw: {
+      auto &args = buffer.get_draw(command.payload);
+      auto slot = table.get_slot(args.handle, args.geometry_idx);
+      auto &draw = table.get(slot);
+      auto &model_matrix =
+          transform != nullptr ? *transform : draw.model_matrix;
+      auto &draw_material = material != nullptr ? *material : draw.material;
+      if (draw_material.alpha_mode == Material::AlphaMode::Blend) {
+        transparent_draws.push_back(
+            {slot, &model_matrix, &draw_material, 0.0f});
+        break;
+      }
+      bin(binner, view_matrix, slot, model_matrix, draw_material,
+          frame_lights, gbuffers);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+void SoftwareRasterizerContext::flush() {
+  if (ranges.empty()) {
+    return;
+  }
+  binners.resize(std::max(binners.size(), ranges.size()));
+  auto gbuffer = get_gbuffers(1);
+  auto target_samples = get_samples(1);
+  auto frame_lights = cull_lights({view_matrix});
+  vector<vector<TransparentDraw>> transparent_ranges(ranges.size());
+  ParallelForEach(static_cast<size_t>(0), ranges.size(), [&](size_t idx) {
+    this->bin(binners[idx], ranges[idx], frame_lights, gbuffer,
+              transparent_ranges[idx]);
+  });
+  // blended draws of every range are sorted together
+  vector<TransparentDraw> transparent_draws;
+  for (auto &range : transparent_ranges) {
+    transparent_draws.insert(transparent_draws.end(), range.begin(),
+                             range.end());
+  }
+  bin_transparent(transparent_binners, {view_matrix}, transparent_draws,
+                  frame_lights);
+  rasterizer.rasterize(binners, frame, nullptr, target_samples);
+  if (gbuffer != nullptr) {
+    light(gbuffer, &frame, {view_matrix}, *frame_lights);
+  }
+  rasterizer.rasterize(transparent_binners, frame, nullptr, target_samples);
+  ranges.clear();
+}
+
+void SoftwareRasterizerContext::submit(const vector<CommandBuffer> &buffers) {
+  sync();
+  ranges.clear();
+
+  // Validate the draws and cut the buffers at clears and viewport changes up
+  // front. The ranges between two such barriers are then binned in parallel
+  // and rasterized together, and binning never has to throw from a worker.
+  for (auto &buffer : buffers) {
+    auto &commands = buffer.get_commands();
+    const Material *material = nullptr;
+    const Matrix4f *transform = nullptr;
+    CommandRange range{&buffer, 0, 0, material, transform};
+    for (size_t idx = 0; idx < commands.size(); idx++) {
+      auto &command = commands[idx];
+      switch (command.type) {
+      case CommandBuffer::Type::BindMaterial: {
+        material = &buffer.get_material(command.payload);
+        break;
+      }
+      case CommandBuffer::Type::SetTransform: {
+        transform = &buffer.get_transform(command.payload);
+        break;
+      }
+      case CommandBuffer::Type::Draw: {
+        auto &args = buffer.get_draw(command.payload);
+        table.get_slot(args.handle, args.geometry_idx);
+        break;
+      }
+      case CommandBuffer::Type::Clear:
+      case CommandBuffer::Type::SetViewport: {
+        range.end = idx;
+        if (range.begin < range.end) {
+          ranges.push_back(range);
+        }
+        flush();
+        if (command.type == CommandBuffer::Type::Clear) {
+          auto &color = buffer.get_color(command.payload);
+          frame.clear(color);
+          auto target_samples = get_samples(1);
+          if (target_samples != nullptr) {
+            target_samples->clear();
+          }
+        } else {
+          auto &size = buffer.get_viewport(command.payload);
+          view_port(size[0], size[1]);
+        }
+        range = {&buffer, idx + 1, 0, material, transform};
+        break;
+      }
+      }
+    }
+    range.end = commands.size();
+    if (range.begin < range.end) {
+      ranges.push_back(range);
+    }
   }
+  flush();
+  post_process();
 }
 
 void SoftwareRasterizerContext::set_view(const Eigen::Matrix4f &view_matrix) {
-  rasterizer.uniform.matrix = view_matrix;
+  // frames in flight took their own copy of the view
+  this->view_matrix = view_matrix;
+}
+
+void SoftwareRasterizerContext::set_lights(const vector<Light> &lights) {
+  // binning reads the buffer, frames binned already keep their own
+  wait_binning();
+  this->lights = make_shared<LightBuffer>(lights);
+}
+
+void SoftwareRasterizerContext::set_environment(const Texture *texture) {
+  wait_binning();
+  if (texture == nullptr) {
+    environment.reset();
+    return;
+  }
+  // lazy textures are decoded for the prefiltering only
+  auto resident = TextureCache::instance().acquire(*texture);
+  environment = make_shared<Environment>(*resident);
+}
+
+void SoftwareRasterizerContext::set_deferred(bool deferred) {
+  // frames in flight light their pixels the way they were binned
+  wait_binning();
+  this->deferred = deferred;
+  if (!deferred) {
+    gbuffers.clear();
+  }
+}
+
+void SoftwareRasterizerContext::set_transparency(
+    Context::Transparency transparency) {
+  wait_binning();
+  this->transparency = transparency;
+}
+
+void SoftwareRasterizerContext::set_samples(uint32_t count) {
+  if (count != 1 && count != 2 && count != 4 && count != 8) {
+    throw runtime_error("1, 2, 4 or 8 samples per pixel are supported");
+  }
+  // frames in flight keep the samples they were started with
+  this->samples = count;
+  if (count == 1) {
+    sample_buffers.clear();
+  }
+}
+
+void SoftwareRasterizerContext::set_post_effects(
+    const vector<PostEffect> &effects) {
+  // frames in flight keep the chain they were started with
+  auto chain = make_shared<const PostProcessor>(effects);
+  post_processor = chain->empty() ? nullptr : chain;
 }
 
 void SoftwareRasterizerContext::view_port(uint32_t width, uint32_t height) {
+  wait_idle();
   frame.resize(width, height);
   rasterizer.view_port(width, height);
 }
 
 auto SoftwareRasterizerContext::get_colors() -> const std::vector<float> & {
-  return frame.getColors();
+  return post_processed ? post_frame.getColors() : frame.getColors();
 };
 
 } // namespace RB
\ No newline at end of file
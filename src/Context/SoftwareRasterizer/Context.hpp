@@ -1,34 +1,299 @@
+#include "Context/DrawTable.hpp"
 #include "Context/IContextImp.hpp"
+#include "Context/SoftwareRasterizer/GBuffer.hpp"
+#include "Context/SoftwareRasterizer/PostProcessor.hpp"
 #include "Context/SoftwareRasterizer/Rasterizer.hpp"
+#include "Context/SoftwareRasterizer/SampleBuffer.hpp"
+#include "Material/Lighting.hpp"
+#include <RenderBoy/TextureCache.hpp>
 
 namespace RB {
 
 class SoftwareRasterizerContext : public IContextImpl {
 public:
   SoftwareRasterizerContext();
+  ~SoftwareRasterizerContext() override;
 
-  void add(const Model &model) override;
+  auto add(const Model &model) -> uint32_t override;
+  void remove(uint32_t handle) override;
+  void update_transform(uint32_t handle,
+                        const Eigen::Matrix4f &transform) override;
+  void update_material(uint32_t handle, uint32_t geometry_idx,
+                       const Material &material) override;
   void draw() override;
+  void submit(const std::vector<CommandBuffer> &buffers) override;
+  auto draw_async() -> uint64_t override;
+  auto wait(uint64_t fence) -> const std::vector<float> & override;
+  void set_frames_in_flight(uint32_t count) override;
+  void draw_views(const std::vector<Eigen::Matrix4f> &view_matrices,
+                  std::vector<Frame> &frames) override;
   void set_view(const Eigen::Matrix4f &view_matrix) override;
+  void set_lights(const std::vector<Light> &lights) override;
+  void set_environment(const Texture *texture) override;
+  void set_deferred(bool deferred) override;
+  void set_transparency(Context::Transparency transparency) override;
+  void set_samples(uint32_t count) override;
+  void set_post_effects(const std::vector<PostEffect> &effects) override;
   void view_port(uint32_t width, uint32_t height) override;
   auto get_colors() -> const std::vector<float> & override;
 
 private:
+  // world space position, normal, uv and tangent, whose w is the
+  // handedness of the bitangent; Gouraud draws carry their lit color in
+  // place of the normal
+  using Varyings = std::tuple<std::array<float, 3>, std::array<float, 3>,
+                              std::array<float, 2>, std::array<float, 4>>;
+  struct Uniforms;
+  using Shade = void (*)(const Uniforms &, uint32_t, uint32_t,
+                         const Varyings *, const size_t *, uint32_t,
+                         Eigen::Vector4f *);
+
+  // The features fragment shaders are specialized on. Each shading is
+  // instantiated once per combination of those it uses, and draws bind the
+  // one matching their material, so no pixel tests them.
+  enum Permutation : uint32_t {
+    BaseColorMap = 1u << 0u,
+    // the specular texture of Phong materials, the metallic-roughness one
+    // of metallic-roughness ones
+    SurfaceMap = 1u << 1u,
+    OcclusionMap = 1u << 2u,
+    EmissiveMap = 1u << 3u,
+    NormalMap = 1u << 4u,
+    // lighting is deferred, surfaces are written to the G-buffer
+    Deferred = 1u << 5u,
+    // masked fragments must not reach the G-buffer
+    AlphaMask = 1u << 6u,
+    PermutationCount = 1u << 7u,
+  };
+
   struct Uniforms {
     Eigen::Matrix4f matrix;
     Eigen::Matrix4f model;
+    // inverse transpose of the model's rotation and scale
+    Eigen::Matrix3f normal_matrix;
     Material material;
+    // resident pixels of the material's textures for the frame's duration
+    std::shared_ptr<const Texture> base_color_texture;
+    std::shared_ptr<const Texture> specular_texture;
+    std::shared_ptr<const Texture> metallic_roughness_texture;
+    std::shared_ptr<const Texture> emissive_texture;
+    std::shared_ptr<const Texture> occlusion_texture;
+    // only set when the geometry has tangents
+    std::shared_ptr<const Texture> normal_texture;
+    std::shared_ptr<const FrameLights> lights;
+    // the permutation of the material's fragment shader, picked per draw
+    Shade shade;
+    // one per view when lighting is deferred, null otherwise, and the model
+    // the draw leaves in their pixels
+    GBuffer *gbuffers = nullptr;
+    GBuffer::Model lighting = GBuffer::Forward;
+    // storage of the position, normal and uv, converted while fetching
+    std::array<AttributeFormat, 3> formats;
+  };
+  // bytes of each attribute, as described by the uniforms' formats, then
+  // the tangents, always 4 floats
+  using Attributes = std::tuple<const uint8_t *, const uint8_t *,
+                                const uint8_t *, const uint8_t *>;
+  using SoftwareRasterizer = Rasterizer<Uniforms, Attributes, Varyings>;
+
+  // a run of commands from one buffer holding no clear or viewport change
+  struct CommandRange {
+    const CommandBuffer *buffer;
+    size_t begin;
+    size_t end;
+    const Material *material;
+    const Eigen::Matrix4f *transform;
   };
-  using Attributes = std::tuple<const float *, const float *, const float *>;
-  using Varyings = std::tuple<std::array<float, 3>, std::array<float, 3>,
-                              std::array<float, 2>>;
 
-  Rasterizer<Uniforms, Attributes, Varyings> rasterizer;
+  // a draw of a blended material, binned after the others
+  struct TransparentDraw {
+    uint32_t slot;
+    const Eigen::Matrix4f *model_matrix;
+    const Material *material;
+    // of its center in the first view, larger farther
+    float depth;
+  };
+
+  struct InFlightFrame {
+    Frame frame;
+    std::vector<SoftwareRasterizer::Binner> binners;
+    std::vector<SoftwareRasterizer::Binner> transparent_binners;
+    Eigen::Matrix4f view_matrix = Eigen::Matrix4f::Identity();
+    GBuffer gbuffer;
+    SampleBuffer samples;
+    // the effects as of when the frame was started, null without any, and
+    // where they write
+    std::shared_ptr<const PostProcessor> post_processor;
+    Frame output;
+    Frame scratch;
+    // kept from binning until the deferred lighting pass
+    std::shared_ptr<const FrameLights> lights;
+    uint64_t fence = 0;
+    std::shared_future<void> binned;
+    std::shared_future<void> done;
+  };
+
+  SoftwareRasterizer rasterizer;
+  // depth only, reading the vertex arrays of `rasterizer`
+  SoftwareRasterizer shadow_rasterizer;
+  std::vector<SoftwareRasterizer::Binner> binners;
+  // rasterized once the others are, and lit in deferred mode
+  std::vector<SoftwareRasterizer::Binner> transparent_binners;
+  std::vector<CommandRange> ranges;
+  DrawTable table;
   std::vector<uint32_t> counts;
-  std::vector<Eigen::Matrix4f> model_matrixs;
-  std::vector<Material> materials;
   std::vector<uint32_t> vaos;
+  std::vector<std::array<AttributeFormat, 3>> formats;
+  // generated for the geometries of materials with a normal map, empty for
+  // the others
+  std::vector<std::vector<std::array<float, 4>>> tangents;
+  Eigen::Matrix4f view_matrix = Eigen::Matrix4f::Identity();
+  std::shared_ptr<const LightBuffer> lights =
+      std::make_shared<LightBuffer>(std::vector<Light>());
+  std::shared_ptr<const Environment> environment;
+  bool deferred = false;
+  Context::Transparency transparency = Context::Transparency::Sorted;
+  uint32_t samples = 1;
+  // of the frames drawn synchronously, one per view
+  std::vector<GBuffer> gbuffers;
+  std::vector<SampleBuffer> sample_buffers;
   Frame frame;
+  // null without effects; shared with the frames in flight started with it
+  std::shared_ptr<const PostProcessor> post_processor;
+  // the colors of the last frame drawn synchronously once post-processed,
+  // if it was
+  Frame post_frame;
+  Frame post_scratch;
+  bool post_processed = false;
+  std::vector<std::unique_ptr<InFlightFrame>> in_flight;
+  uint64_t first_fence = 1;
+  uint64_t next_fence = 1;
+  std::unique_ptr<ThreadPool> geometry_queue;
+  std::unique_ptr<ThreadPool> raster_queue;
+
+  // the fragment shader of `shading` specialized on `features`
+  static auto get_shader(Material::Shading shading, uint32_t features)
+      -> Shade;
+  // `features` less those `shading` ignores, so that permutations only
+  // differing by them share their instantiation
+  static constexpr auto get_permutation(Material::Shading shading,
+                                        uint32_t features) -> uint32_t;
+  // a row per permutation, of a shader per shading
+  template <uint32_t... Features>
+  static auto get_shaders(std::integer_sequence<uint32_t, Features...>)
+      -> std::array<std::array<Shade, 5>, sizeof...(Features)>;
+  // runs `Function`, then marks the pixels it covered in the G-buffer of
+  // deferred permutations
+  template <Shade Function, uint32_t Features>
+  static void shade(const Uniforms &uniforms, uint32_t view, uint32_t tile,
+                    const Varyings *varyings, const size_t *pixels,
+                    uint32_t count, Eigen::Vector4f *colors);
+  template <uint32_t Features>
+  static void shade_unlit(const Uniforms &uniforms, uint32_t view,
+                          uint32_t tile, const Varyings *varyings,
+                          const size_t *pixels, uint32_t count,
+                          Eigen::Vector4f *colors);
+  // deferred permutations of lit shadings write the G-buffer of the view in
+  // place of colors, see GBuffer
+  template <uint32_t Features>
+  static void shade_phong(const Uniforms &uniforms, uint32_t view,
+                          uint32_t tile, const Varyings *varyings,
+                          const size_t *pixels, uint32_t count,
+                          Eigen::Vector4f *colors);
+  template <uint32_t Features>
+  static void shade_gouraud(const Uniforms &uniforms, uint32_t view,
+                            uint32_t tile, const Varyings *varyings,
+                            const size_t *pixels, uint32_t count,
+                            Eigen::Vector4f *colors);
+  template <uint32_t Features>
+  static void shade_normal(const Uniforms &uniforms, uint32_t view,
+                           uint32_t tile, const Varyings *varyings,
+                           const size_t *pixels, uint32_t count,
+                           Eigen::Vector4f *colors);
+  template <uint32_t Features>
+  static void shade_metallic_roughness(const Uniforms &uniforms,
+                                       uint32_t view, uint32_t tile,
+                                       const Varyings *varyings,
+                                       const size_t *pixels, uint32_t count,
+                                       Eigen::Vector4f *colors);
+  // the world space normal of a fragment, bent by the normal map of
+  // permutations with one; only normalized then
+  template <uint32_t Features>
+  static auto get_normal(const Uniforms &uniforms, const Varyings &varyings)
+      -> Eigen::Vector3f;
+  // the surfaces of `count` fragments and their alphas, before lighting
+  template <uint32_t Features>
+  static void get_surfaces(const Uniforms &uniforms, const Varyings *varyings,
+                           uint32_t count, SurfaceBatch &surfaces,
+                           float *alphas);
+  template <uint32_t Features>
+  static void get_surfaces(const Uniforms &uniforms, const Varyings *varyings,
+                           uint32_t count, MetallicRoughnessBatch &surfaces,
+                           float *alphas);
+
+  void sync();
+  // points the vertex array of `slot`, bound, at the attributes of
+  // `geometry`
+  void bind_geometry(uint32_t slot, const Geometry &geometry);
+  void wait_binning();
+  void wait_idle();
+  // the lights of a frame drawn through `views`, culled per tile, with their
+  // shadow maps
+  auto cull_lights(const std::vector<Eigen::Matrix4f> &views) const
+      -> std::shared_ptr<const FrameLights>;
+  // renders a map per cascade or spot light, each in parallel, of the draws
+  // inside of its frustum; directional ones follow the first of `views`
+  void render_shadows(const std::vector<Eigen::Matrix4f> &views,
+                      FrameLights &frame_lights) const;
+  // false when the draw is outside of every view and can be skipped; lit
+  // materials write to `gbuffers` instead of being shaded unless it is null
+  auto make_uniforms(const Eigen::Matrix4f &matrix,
+                     const Eigen::Matrix4f *views, size_t view_count,
+                     uint32_t slot, const Eigen::Matrix4f &model_matrix,
+                     const Material &material,
+                     const std::shared_ptr<const FrameLights> &frame_lights,
+                     GBuffer *gbuffers, Uniforms &uniforms) const -> bool;
+  void bin(SoftwareRasterizer::Binner &binner, const Eigen::Matrix4f &view,
+           uint32_t slot, const Eigen::Matrix4f &model_matrix,
+           const Material &material,
+           const std::shared_ptr<const FrameLights> &frame_lights,
+           GBuffer *gbuffers) const;
+  void bin(SoftwareRasterizer::Binner &binner,
+           const std::vector<Eigen::Matrix4f> &views, uint32_t slot,
+           const Eigen::Matrix4f &model_matrix, const Material &material,
+           const std::shared_ptr<const FrameLights> &frame_lights,
+           GBuffer *gbuffers) const;
+  // Bins blended draws into `target` in the order they must be drawn in,
+  // from the farthest when sorted with a single view. Contiguous runs of
+  // them are binned in parallel.
+  void bin_transparent(std::vector<SoftwareRasterizer::Binner> &target,
+                       const std::vector<Eigen::Matrix4f> &views,
+                       std::vector<TransparentDraw> &draws,
+                       const std::shared_ptr<const FrameLights> &frame_lights)
+      const;
+  // returns the lights the draws were binned with
+  auto bin_all(std::vector<SoftwareRasterizer::Binner> &target,
+               std::vector<SoftwareRasterizer::Binner> &transparent_target,
+               const std::vector<Eigen::Matrix4f> &views,
+               GBuffer *gbuffers) const -> std::shared_ptr<const FrameLights>;
+  // blended draws are left to `transparent_draws`
+  void bin(SoftwareRasterizer::Binner &binner, const CommandRange &range,
+           const std::shared_ptr<const FrameLights> &frame_lights,
+           GBuffer *gbuffers, std::vector<TransparentDraw> &transparent_draws);
+  void flush();
+  // `count` G-buffers sized to the viewport when lighting is deferred,
+  // null otherwise
+  auto get_gbuffers(size_t count) -> GBuffer *;
+  // `count` sample buffers sized to the viewport when multisampling, null
+  // otherwise
+  auto get_samples(size_t count) -> SampleBuffer *;
+  // runs the effects over `frame` into `post_frame`, if there are any
+  void post_process();
+  // the lighting pass: shades the deferred pixels of view `i` from
+  // `gbuffers[i]` into `targets[i]`, all tiles of all views in parallel
+  void light(GBuffer *gbuffers, Frame *targets,
+             const std::vector<Eigen::Matrix4f> &views,
+             const FrameLights &frame_lights) const;
 };
 
-} // namespace RB
\ No newline at end of file
+} // namespace RB
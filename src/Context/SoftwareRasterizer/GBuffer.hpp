@@ -0,0 +1,93 @@
+#pragma once
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace RB {
+
+// Surface attributes of the pixels of one view drawn in deferred mode, each
+// attachment in its own plane. The lighting pass
+// shades the pixels whose model is not Forward, then marks them Forward
+// again, so a buffer is clear again between frames.
+struct GBuffer {
+  enum Model : uint8_t {
+    // holds the pixel's final color already
+    Forward,
+    Phong,
+    MetallicRoughness,
+  };
+
+  std::vector<uint8_t> model;
+  // NDC depth of the surface, which the frame's is not: the rasterizer
+  // interpolates it with perspective-corrected weights
+  std::vector<float> depth;
+  // octahedral encoding, two 16 bit signed normalized coordinates
+  std::vector<uint32_t> normal;
+  // RGBA8: the base or diffuse color and alpha
+  std::vector<uint32_t> albedo;
+  // RGBA8: metallic, roughness and occlusion, or for Phong the specular
+  // color and the shininess, up to 255
+  std::vector<uint32_t> surface;
+  // RGBA8: emissive color of metallic-roughness surfaces
+  std::vector<uint32_t> emissive;
+
+  void resize(size_t size) {
+    model.resize(size, Forward);
+    depth.resize(size);
+    normal.resize(size);
+    albedo.resize(size);
+    surface.resize(size);
+    emissive.resize(size);
+  }
+};
+
+// four values in [0, 1], rounded to 8 bits each, the first in the low byte
+inline auto pack_unorm8(float a, float b, float c, float d) -> uint32_t {
+  auto quantize = [](float value) {
+    return static_cast<uint32_t>(
+        std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+  };
+  return quantize(a) | quantize(b) << 8u | quantize(c) << 16u |
+         quantize(d) << 24u;
+}
+
+inline auto unpack_unorm8(uint32_t packed, uint32_t idx) -> float {
+  return static_cast<float>((packed >> (idx * 8u)) & 0xffu) / 255.0f;
+}
+
+// Maps a direction, which need not be normalized, onto the octahedron
+// |x| + |y| + |z| = 1 unfolded over the square [-1, 1]^2.
+inline auto encode_octahedral(float x, float y, float z) -> uint32_t {
+  const auto sum = std::abs(x) + std::abs(y) + std::abs(z);
+  auto u = sum > 0.0f ? x / sum : 0.0f;
+  auto v = sum > 0.0f ? y / sum : 0.0f;
+  if (z < 0.0f) {
+    // the lower half folds over the corners
+    const auto folded_u = std::copysign(1.0f - std::abs(v), u);
+    v = std::copysign(1.0f - std::abs(u), v);
+    u = folded_u;
+  }
+  auto quantize = [](float value) {
+    return static_cast<uint32_t>(static_cast<uint16_t>(
+        static_cast<int16_t>(std::lround(value * 32767.0f))));
+  };
+  return quantize(u) | quantize(v) << 16u;
+}
+
+// the unit direction `encode_octahedral` stored
+inline auto decode_octahedral(uint32_t packed) -> Eigen::Vector3f {
+  auto u = static_cast<float>(static_cast<int16_t>(packed & 0xffffu)) /
+           32767.0f;
+  auto v = static_cast<float>(static_cast<int16_t>(packed >> 16u)) / 32767.0f;
+  const auto z = 1.0f - std::abs(u) - std::abs(v);
+  if (z < 0.0f) {
+    const auto unfolded_u = std::copysign(1.0f - std::abs(v), u);
+    v = std::copysign(1.0f - std::abs(u), v);
+    u = unfolded_u;
+  }
+  return Eigen::Vector3f(u, v, z).normalized();
+}
+
+} // namespace RB
@@ -0,0 +1,304 @@
+#include "Context/SoftwareRasterizer/PostProcessor.hpp"
+#include <Eigen/Core>
+#include <RenderBoy/utils.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+using namespace Eigen;
+
+namespace RB {
+
+namespace {
+
+// FXAA's quality settings: the least contrast an edge has, relative to the
+// brightest neighbor and absolute, how much subpixel aliasing is smoothed,
+// and the steps of the walk along edges
+constexpr float EdgeThreshold = 0.166f;
+constexpr float EdgeThresholdMin = 0.0833f;
+constexpr float SubpixelQuality = 0.75f;
+constexpr array<float, 8> EdgeSteps = {1.0f, 1.5f, 2.0f, 2.0f,
+                                       2.0f, 2.0f, 4.0f, 8.0f};
+
+auto get_luma(const float *color) -> float {
+  return 0.299f * color[0] + 0.587f * color[1] + 0.114f * color[2];
+}
+
+// Reads frames of `width` x `height` RGBA pixels, clamping to their
+// borders. Positions are in pixels, the centers of pixels on halves.
+struct Sampler {
+  const float *colors;
+  int width;
+  int height;
+
+  auto fetch(int x, int y) const -> const float * {
+    x = std::min(std::max(x, 0), width - 1);
+    y = std::min(std::max(y, 0), height - 1);
+    return colors + static_cast<size_t>(x + y * width) * 4;
+  }
+
+  auto luma(int x, int y) const -> float { return get_luma(fetch(x, y)); }
+
+  auto sample(float x, float y) const -> Vector4f {
+    const auto left = floorf(x - 0.5f);
+    const auto bottom = floorf(y - 0.5f);
+    const auto fx = x - 0.5f - left;
+    const auto fy = y - 0.5f - bottom;
+    const auto x0 = static_cast<int>(left);
+    const auto y0 = static_cast<int>(bottom);
+    const Map<const Vector4f> c00(fetch(x0, y0)), c10(fetch(x0 + 1, y0));
+    const Map<const Vector4f> c01(fetch(x0, y0 + 1));
+    const Map<const Vector4f> c11(fetch(x0 + 1, y0 + 1));
+    return (c00 * (1.0f - fx) + c10 * fx) * (1.0f - fy) +
+           (c01 * (1.0f - fx) + c11 * fx) * fy;
+  }
+
+  auto sample_luma(float x, float y) const -> float {
+    const Vector4f color = sample(x, y);
+    return get_luma(color.data());
+  }
+};
+
+// Timothy Lottes' FXAA 3.11, quality variant, for the pixel at (x, y)
+auto fxaa(const Sampler &input, int x, int y) -> Vector4f {
+  const auto lumaM = input.luma(x, y);
+  const auto lumaN = input.luma(x, y - 1);
+  const auto lumaS = input.luma(x, y + 1);
+  const auto lumaW = input.luma(x - 1, y);
+  const auto lumaE = input.luma(x + 1, y);
+  const auto brightest =
+      std::max(std::max(std::max(lumaN, lumaS), std::max(lumaW, lumaE)),
+               lumaM);
+  const auto darkest =
+      std::min(std::min(std::min(lumaN, lumaS), std::min(lumaW, lumaE)),
+               lumaM);
+  const auto range = brightest - darkest;
+  const auto px = static_cast<float>(x) + 0.5f;
+  const auto py = static_cast<float>(y) + 0.5f;
+  if (range < std::max(EdgeThresholdMin, brightest * EdgeThreshold)) {
+    return Map<const Vector4f>(input.fetch(x, y));
+  }
+
+  const auto lumaNW = input.luma(x - 1, y - 1);
+  const auto lumaNE = input.luma(x + 1, y - 1);
+  const auto lumaSW = input.luma(x - 1, y + 1);
+  const auto lumaSE = input.luma(x + 1, y + 1);
+
+  // the edge runs along the axis across which luma changes most
+  const auto edgeHorizontal = std::abs(lumaNW + lumaSW - 2.0f * lumaW) +
+                              std::abs(lumaN + lumaS - 2.0f * lumaM) * 2.0f +
+                              std::abs(lumaNE + lumaSE - 2.0f * lumaE);
+  const auto edgeVertical = std::abs(lumaNW + lumaNE - 2.0f * lumaN) +
+                            std::abs(lumaW + lumaE - 2.0f * lumaM) * 2.0f +
+                            std::abs(lumaSW + lumaSE - 2.0f * lumaS);
+  const auto horizontal = edgeHorizontal >= edgeVertical;
+
+  // how much the pixel stands out of its neighborhood, for thin features
+  const auto average = (2.0f * (lumaN + lumaS + lumaW + lumaE) + lumaNW +
+                        lumaNE + lumaSW + lumaSE) /
+                       12.0f;
+  const auto contrast =
+      std::min(std::max(std::abs(average - lumaM) / range, 0.0f), 1.0f);
+  const auto smooth = (-2.0f * contrast + 3.0f) * contrast * contrast;
+  const auto subpixel = smooth * smooth * SubpixelQuality;
+
+  // the side of the pixel with the steeper gradient is the edge
+  const auto luma1 = horizontal ? lumaN : lumaW;
+  const auto luma2 = horizontal ? lumaS : lumaE;
+  const auto gradient1 = std::abs(luma1 - lumaM);
+  const auto gradient2 = std::abs(luma2 - lumaM);
+  const auto first = gradient1 >= gradient2;
+  const auto across = first ? -1.0f : 1.0f;
+  const auto edge_luma = 0.5f * ((first ? luma1 : luma2) + lumaM);
+  const auto threshold = std::max(gradient1, gradient2) * 0.25f;
+
+  // walks both ways along the edge, halfway across it, until the luma
+  // there no longer is the edge's
+  const auto ex = horizontal ? px : px + across * 0.5f;
+  const auto ey = horizontal ? py + across * 0.5f : py;
+  const auto ax = horizontal ? 1.0f : 0.0f;
+  const auto ay = horizontal ? 0.0f : 1.0f;
+  auto get_end = [&](float offset) {
+    return input.sample_luma(ex + ax * offset, ey + ay * offset) - edge_luma;
+  };
+  auto offset_n = -EdgeSteps[0];
+  auto offset_p = EdgeSteps[0];
+  auto end_n = get_end(offset_n);
+  auto end_p = get_end(offset_p);
+  auto done_n = std::abs(end_n) >= threshold;
+  auto done_p = std::abs(end_p) >= threshold;
+  for (size_t i = 1; i < EdgeSteps.size() && !(done_n && done_p); i++) {
+    if (!done_n) {
+      offset_n -= EdgeSteps[i];
+      end_n = get_end(offset_n);
+      done_n = std::abs(end_n) >= threshold;
+    }
+    if (!done_p) {
+      offset_p += EdgeSteps[i];
+      end_p = get_end(offset_p);
+      done_p = std::abs(end_p) >= threshold;
+    }
+  }
+
+  // Pixels nearer an end of the edge take more from across it, like the
+  // coverage of the edge's line. That end must turn the other way than the
+  // pixel's luma, else the pixel lies outside of the step.
+  const auto distance_n = -offset_n;
+  const auto distance_p = offset_p;
+  const auto nearer_n = distance_n < distance_p;
+  const auto distance = std::min(distance_n, distance_p);
+  const auto below = lumaM - edge_luma < 0.0f;
+  const auto good = ((nearer_n ? end_n : end_p) < 0.0f) != below;
+  const auto edge_offset =
+      good ? 0.5f - distance / (distance_n + distance_p) : 0.0f;
+  const auto offset = std::max(edge_offset, subpixel) * across;
+  return horizontal ? input.sample(px, py + offset)
+                    : input.sample(px + offset, py);
+}
+
+// runs a per pixel effect over `count` pixels of row `y`, from column `x`
+void apply_effect(const PostEffect &effect, float *row, int count, int x,
+                  int y, int width, int height) {
+  switch (effect.type) {
+  case PostEffect::Type::ToneMapping:
+    for (auto i = 0; i < count; i++) {
+      for (auto c = 0; c < 3; c++) {
+        const auto value = row[i * 4 + c] * effect.amount;
+        const auto mapped = value * (2.51f * value + 0.03f) /
+                            (value * (2.43f * value + 0.59f) + 0.14f);
+        row[i * 4 + c] = std::min(std::max(mapped, 0.0f), 1.0f);
+      }
+    }
+    break;
+  case PostEffect::Type::Vignette: {
+    // by the squared distance to the center, 1 at the corners
+    auto get_offset = [](int idx, int size) {
+      return (static_cast<float>(idx) + 0.5f) / static_cast<float>(size) *
+                 2.0f -
+             1.0f;
+    };
+    const auto dy = get_offset(y, height);
+    for (auto i = 0; i < count; i++) {
+      const auto dx = get_offset(x + i, width);
+      const auto factor =
+          std::max(1.0f - effect.amount * 0.5f * (dx * dx + dy * dy), 0.0f);
+      for (auto c = 0; c < 3; c++) {
+        row[i * 4 + c] *= factor;
+      }
+    }
+    break;
+  }
+  case PostEffect::Type::EncodeSRGB:
+    for (auto i = 0; i < count; i++) {
+      for (auto c = 0; c < 3; c++) {
+        const auto value = std::min(std::max(row[i * 4 + c], 0.0f), 1.0f);
+        row[i * 4 + c] = value <= 0.0031308f
+                             ? value * 12.92f
+                             : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+} // namespace
+
+PostProcessor::PostProcessor(const vector<PostEffect> &effects) {
+  auto add_sweep = [this](Sweep::Source source, uint32_t factor) {
+    Sweep sweep;
+    sweep.source = source;
+    sweep.factor = factor;
+    sweeps.push_back(sweep);
+  };
+  for (auto &effect : effects) {
+    switch (effect.type) {
+    case PostEffect::Type::FXAA:
+      add_sweep(Sweep::Source::FXAA, 1);
+      break;
+    case PostEffect::Type::Downscale: {
+      auto factor = static_cast<uint32_t>(std::max(effect.amount, 1.0f));
+      if (factor > 1) {
+        add_sweep(Sweep::Source::Downscale, factor);
+      }
+      break;
+    }
+    default:
+      if (sweeps.empty()) {
+        add_sweep(Sweep::Source::Copy, 1);
+      }
+      sweeps.back().effects.push_back(effect);
+      break;
+    }
+  }
+}
+
+void PostProcessor::apply(const Frame &source, Frame &output,
+                          Frame &scratch) const {
+  // sweeps alternate between the two frames, so that the last one writes
+  // to `output`
+  const Frame *input = &source;
+  for (size_t idx = 0; idx < sweeps.size(); idx++) {
+    auto &target = (sweeps.size() - 1 - idx) % 2 == 0 ? output : scratch;
+    run(sweeps[idx], *input, target);
+    input = &target;
+  }
+}
+
+void PostProcessor::run(const Sweep &sweep, const Frame &input,
+                        Frame &target) const {
+  const auto factor = static_cast<int>(sweep.factor);
+  const auto in_width = static_cast<int>(input.getWidth());
+  const auto in_height = static_cast<int>(input.getHeight());
+  const auto width = in_width / factor;
+  const auto height = in_height / factor;
+  target.resize(static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+  const Sampler sampler{input.getColors().data(), in_width, in_height};
+  auto *colors = target.getColors().data();
+
+  const auto tiles_x = (width + TileSize - 1) / TileSize;
+  const auto tiles_y = (height + TileSize - 1) / TileSize;
+  ParallelForEach(0, tiles_x * tiles_y, [&](int tile) {
+    const auto x0 = (tile % tiles_x) * TileSize;
+    const auto y0 = (tile / tiles_x) * TileSize;
+    const auto count = std::min(x0 + TileSize, width) - x0;
+    array<float, TileSize * 4> row;
+    for (auto y = y0; y < std::min(y0 + TileSize, height); y++) {
+      switch (sweep.source) {
+      case Sweep::Source::Copy:
+        memcpy(row.data(), sampler.fetch(x0, y), sizeof(float) * count * 4);
+        break;
+      case Sweep::Source::FXAA:
+        for (auto i = 0; i < count; i++) {
+          Map<Vector4f>(row.data() + i * 4) = fxaa(sampler, x0 + i, y);
+        }
+        break;
+      case Sweep::Source::Downscale: {
+        std::fill(row.begin(), row.begin() + count * 4, 0.0f);
+        for (auto fy = 0; fy < factor; fy++) {
+          const auto *source = sampler.fetch(x0 * factor, y * factor + fy);
+          for (auto i = 0; i < count * factor; i++) {
+            for (auto c = 0; c < 4; c++) {
+              row[(i / factor) * 4 + c] += source[i * 4 + c];
+            }
+          }
+        }
+        const auto weight = 1.0f / static_cast<float>(factor * factor);
+        for (auto i = 0; i < count * 4; i++) {
+          row[i] *= weight;
+        }
+        break;
+      }
+      }
+      for (auto &effect : sweep.effects) {
+        apply_effect(effect, row.data(), count, x0, y, width, height);
+      }
+      memcpy(colors + static_cast<size_t>(x0 + y * width) * 4, row.data(),
+             sizeof(float) * count * 4);
+    }
+  });
+}
+
+} // namespace RB
@@ -0,0 +1,43 @@
+#pragma once
+#include <RenderBoy/Frame.hpp>
+#include <RenderBoy/PostEffect.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace RB {
+
+// A chain of post effects, cut into sweeps over the frame. Effects working
+// pixel by pixel are fused: a sweep reads each row of a tile once, runs all
+// of them over it while it stays in cache, and writes it once. FXAA and
+// downscales read neighbors, so each starts a sweep of its own over what
+// the previous one wrote, which the effects after them then join.
+class PostProcessor {
+public:
+  static constexpr int TileSize = 64;
+
+  PostProcessor() = default;
+  explicit PostProcessor(const std::vector<PostEffect> &effects);
+
+  auto empty() const -> bool { return sweeps.empty(); }
+
+  // runs the chain over `source`, left untouched, into `output`, resized to
+  // the result; `scratch` holds what lies between two sweeps
+  void apply(const Frame &source, Frame &output, Frame &scratch) const;
+
+private:
+  struct Sweep {
+    enum class Source : uint8_t { Copy, FXAA, Downscale };
+
+    Source source = Source::Copy;
+    uint32_t factor = 1;
+    // per pixel, run in order over each row
+    std::vector<PostEffect> effects;
+  };
+
+  std::vector<Sweep> sweeps;
+
+  void run(const Sweep &sweep, const Frame &input, Frame &target) const;
+};
+
+} // namespace RB
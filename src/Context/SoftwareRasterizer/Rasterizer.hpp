@@ -1,5 +1,6 @@
 #pragma once
 #include <Eigen/Core>
+#include "Context/SoftwareRasterizer/SampleBuffer.hpp"
 #include <RenderBoy/Frame.hpp>
 #include <array>
 #include <cassert>
@@ -9,33 +10,133 @@
 
 namespace RB {
 
+// `stride` and `offset` count elements of the attribute pointers, which the
+// vertex shader interprets; a zero stride makes every vertex read the same
+// value, which is how absent attributes are bound
 struct AttributeObject {
   uint8_t components = 1;
   uint32_t stride = 0;
   uint32_t offset = 0;
 };
 
+// How the fragments of a draw reach their pixels. Opaque ones replace them.
+// Masked ones too, unless their alpha is below `cutoff`: those are dropped
+// after shading, before writing depth. Blended ones are drawn over the
+// pixels in draw order. Accumulated ones are summed per pixel, weighted by
+// alpha and depth, then resolved over the pixels at the end of each tile,
+// whatever their order. Neither of the last two writes depth.
+struct Blending {
+  enum class Mode : uint8_t { Opaque, Mask, Blend, Accumulate };
+
+  Mode mode = Mode::Opaque;
+  float cutoff = 0.5f;
+};
+
 template <typename Uniforms, typename Attributes, typename Varyings>
 class Rasterizer {
-  struct VertexAttributeArray {
+public:
+  struct VertexArray {
     std::vector<AttributeObject> attributes_pointers;
     Attributes attributes;
-    const uint32_t *indices = nullptr;
+    const void *indices = nullptr;
+    uint8_t index_size = 4; // bytes per index: 1, 2 or 4
+    uint32_t vertex_count = 0;
   };
-  using VertexShader =
-      std::function<void(const Attributes &, Varyings &, Eigen::Vector4f &)>;
-  using FragmentShader =
-      std::function<void(const Varyings &, Eigen::Vector4f &)>;
 
-public:
+  // Output of the geometry stage for one thread: shaded vertices, and for
+  // each view the set-up triangles and, per screen tile, the triangles
+  // overlapping it. Varyings are shared by all views.
+  class Binner {
+    friend class Rasterizer;
+
+    struct Triangle {
+      std::array<uint32_t, 3> vertices;
+      uint32_t draw;
+      std::array<int, 4> bounds; // min x, min y, max x, max y
+    };
+
+    struct View {
+      std::vector<float> homo;
+      std::vector<float> depth;
+      std::vector<std::array<int, 2>> screen_coords;
+      std::vector<Triangle> triangles;
+      std::vector<std::vector<uint32_t>> tiles;
+    };
+
+    std::vector<Uniforms> draws;
+    std::vector<Blending> blendings;
+    std::vector<Varyings> varyings;
+    std::vector<View> views;
+
+    void clear();
+  };
+
+  using VertexShader = std::function<void(const Uniforms &, const Attributes &,
+                                          Varyings &, Eigen::Vector4f &)>;
+  // shades `count` fragments of one draw at once, so that the shader can
+  // loop over them and its per-draw setup is paid once per batch; they all
+  // lie in tile `tile` of view `view`, at indices `pixels` of its target
+  using FragmentShader = std::function<void(
+      const Uniforms &, uint32_t view, uint32_t tile, const Varyings *,
+      const size_t *pixels, uint32_t count, Eigen::Vector4f *colors)>;
+
+  static constexpr int TileSize = 64;
+  static constexpr uint32_t FragmentBatch = 16;
+  // sample counts are 1, 2, 4 or 8
+  static constexpr uint32_t MaxSamples = 8;
+
   Rasterizer() = default;
 
   void drawArray(uint32_t count);
 
   void drawElements(uint32_t count);
 
-  void traverse_triangle(uint32_t v0_index, uint32_t v1_index,
-                         uint32_t v2_index);
+  // Shades the vertices of `vao` and bins its triangles. Safe to call from
+  // several threads at once as long as each uses its own binner.
+  void bin(Binner &binner, const VertexArray &vao, uint32_t count,
+           const Uniforms &uniforms, const Blending &blending = {}) const;
+
+  // Like `bin`, but for several views at once: vertices are fetched and
+  // shaded once, then the shader's position is transformed by each of
+  // `view_matrices` and binned for that view.
+  void bin(Binner &binner, const std::vector<Eigen::Matrix4f> &view_matrices,
+           const VertexArray &vao, uint32_t count, const Uniforms &uniforms,
+           const Blending &blending = {}) const;
+
+  // Rasterizes every binned triangle tile by tile, in binner order, then
+  // empties the binners for the next batch. With `clear_color` set, each
+  // tile is cleared right before its triangles are drawn.
+  //
+  // With `samples`, sized to the viewport and holding more than one sample
+  // per pixel, the target is multisampled: coverage and depth are tested
+  // per sample, each triangle shades a pixel once, at the first sample it
+  // covers, and writes the samples it covers. Every tile is resolved into
+  // the target once drawn.
+  void rasterize(std::vector<Binner> &binners, Frame &target,
+                 const Eigen::Vector4f *clear_color = nullptr,
+                 SampleBuffer *samples = nullptr) const {
+    rasterize(binners, &target, 1, clear_color, samples);
+  }
+
+  // rasterizes view `i` of the binners into `targets[i]`, with `samples[i]`
+  // if set, all tiles of all views being scheduled together
+  void rasterize(std::vector<Binner> &binners, Frame *targets,
+                 size_t view_count,
+                 const Eigen::Vector4f *clear_color = nullptr,
+                 SampleBuffer *samples = nullptr) const;
+
+  // Depth-only variant, for shadow maps: rasterizes the first view of
+  // binner `i` into `depths[i]`, sized to the viewport, without shading
+  // anything. Depths are larger nearer, like in frames. The tiles of all
+  // binners are scheduled together, then the binners are emptied.
+  void rasterize_depth(std::vector<Binner> &binners,
+                       std::vector<std::vector<float>> &depths) const;
+
+  void rasterize(std::vector<Binner> &binners) {
+    if (frame != nullptr) {
+      rasterize(binners, *frame);
+    }
+  }
 
   uint32_t gen_vertex_array() {
     vertex_attribute_arrays.emplace_back();
@@ -49,9 +150,18 @@ public:
     current_vao = idx;
   }
 
-  void element_buffer_data(const uint32_t *data) {
+  auto get_vertex_array(uint32_t idx) const -> const VertexArray & {
+    assert(idx < vertex_attribute_arrays.size());
+    return vertex_attribute_arrays[idx];
+  }
+
+  // `data` holds indices of `index_size` bytes, like GL_UNSIGNED_BYTE,
+  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT; they are read in that width
+  void element_buffer_data(const void *data, uint8_t index_size = 4) {
+    assert(index_size == 1 || index_size == 2 || index_size == 4);
     auto &target = vertex_attribute_arrays[current_vao];
     target.indices = data;
+    target.index_size = index_size;
   }
 
   void vertex_attributes_pointer(uint32_t location, uint8_t components,
@@ -60,9 +170,10 @@ public:
     target.attributes_pointers[location] = {components, stride, offset};
   }
 
-  void vertex_attributes(Attributes attributes) {
+  void vertex_attributes(Attributes attributes, uint32_t vertex_count = 0) {
     auto &vao = vertex_attribute_arrays[current_vao];
     vao.attributes = move(attributes);
+    vao.vertex_count = vertex_count;
     auto size = std::tuple_size<std::decay_t<Attributes>>::value;
     vao.attributes_pointers.resize(size);
   }
@@ -77,24 +188,95 @@ public:
 
   void set_frame(Frame *_frame) { this->frame = _frame; }
 
+  // back faces are dropped by default; otherwise both sides are drawn
+  void set_cull_back_faces(bool cull) { this->cull_back_faces = cull; }
+
   void view_port(uint32_t width, uint32_t height) {
     this->screen[0] = width;
     this->screen[1] = height;
   }
 
+  auto get_tile_count() const -> uint32_t {
+    return ((screen[0] + TileSize - 1) / TileSize) *
+           ((screen[1] + TileSize - 1) / TileSize);
+  }
+
   Uniforms uniform;
 
 private:
   Frame *frame = nullptr;
   uint32_t current_vao = 0;
-  std::vector<Rasterizer::VertexAttributeArray> vertex_attribute_arrays;
-  std::vector<Varyings> all_varyings;
+  std::vector<VertexArray> vertex_attribute_arrays;
+  std::vector<Binner> immediate_binners = std::vector<Binner>(1);
   VertexShader vertex_shader;
   FragmentShader fragment_shader;
   std::array<uint32_t, 2> screen = {0, 0};
-  std::vector<float> homo;
-  std::vector<float> depth;
-  std::vector<std::array<int, 2>> screen_coords;
+  bool cull_back_faces = true;
+
+  void bin_view(Binner &binner, typename Binner::View &view, uint32_t base,
+                const VertexArray &vao, uint32_t count) const;
+
+  template <typename Index>
+  void bin_triangles(Binner &binner, typename Binner::View &view,
+                     uint32_t base, const Index *indices,
+                     uint32_t count) const;
+
+  void project(typename Binner::View &view, size_t idx,
+               const Eigen::Vector4f &position) const;
+
+  // calls `fragment(idx, clip, depth)` for the pixels of `tile` the
+  // triangle covers inside the depth range, with the pixel's index, its
+  // perspective correct barycentric coordinates and depth
+  template <typename Fragment>
+  void for_each_fragment(const typename Binner::View &view,
+                         const typename Binner::Triangle &triangle,
+                         const std::array<int, 4> &tile,
+                         const Fragment &fragment) const;
+
+  // calls `fragment(idx, clip, covered, depths)` for the pixels of `tile`
+  // the triangle covers a sample of inside the depth range: `covered` has
+  // a bit per such sample, `depths` their depths, and `clip` holds the
+  // barycentric coordinates of the first one
+  template <typename Fragment>
+  void for_each_sampled_fragment(const typename Binner::View &view,
+                                 const typename Binner::Triangle &triangle,
+                                 const std::array<int, 4> &tile,
+                                 uint32_t sample_count,
+                                 const Fragment &fragment) const;
+
+  // weighted sums of the accumulated fragments of a tile and the part of
+  // each pixel they let through, allocated by the first one
+  struct Accumulation {
+    std::vector<std::array<float, 4>> sums;
+    std::vector<float> revealage;
+  };
+
+  void traverse_triangle(const Binner &binner, uint32_t view_idx,
+                         uint32_t tile_idx,
+                         const typename Binner::Triangle &triangle,
+                         const std::array<int, 4> &tile, Frame &target,
+                         Accumulation &accumulation) const;
+
+  // the multisampled variant, `samples` holding the target's samples
+  void traverse_samples(const Binner &binner, uint32_t view_idx,
+                        uint32_t tile_idx,
+                        const typename Binner::Triangle &triangle,
+                        const std::array<int, 4> &tile, Frame &target,
+                        SampleBuffer &samples,
+                        Accumulation &accumulation) const;
+
+  // composites the accumulated fragments over every sample of their pixels
+  void resolve(const Accumulation &accumulation, uint32_t tile_idx,
+               const std::array<int, 4> &tile, Frame &target,
+               SampleBuffer *samples) const;
+
+  void clear(SampleBuffer &samples, uint32_t tile_idx,
+             const std::array<int, 4> &tile) const;
+
+  // averages the samples of the tile's edge pixels into the target, and
+  // gives each pixel the depth of its nearest sample
+  void resolve(const SampleBuffer &samples, uint32_t tile_idx,
+               const std::array<int, 4> &tile, Frame &target) const;
 };
 
 } // namespace RB
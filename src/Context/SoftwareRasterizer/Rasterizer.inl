@@ -67,7 +67,7 @@ auto extract_attribute_helper(Attributes &attribute,
   using expand = bool[];
   (void)expand{(std::get<I>(attribute) =
                     std::get<I>(all_attributes) + usages[I].offset +
-                    count * (usages[I].components + usages[I].stride),
+                    count * usages[I].stride,
                 true)...};
 }
 
@@ -95,59 +95,392 @@ inline auto min3(int a, int b, int c) -> int {
   return c < tmp ? c : tmp;
 }
 
+// The usual positions of 2, 4 and 8 samples, in sixteenths of a pixel
+// around the pixel's own sample point, each rotated so that no two share a
+// row or a column.
+inline auto get_sample_offsets(uint32_t count) -> const std::array<int, 2> * {
+  static const std::array<int, 2> two[] = {{4, 4}, {-4, -4}};
+  static const std::array<int, 2> four[] = {
+      {-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+  static const std::array<int, 2> eight[] = {{1, -3}, {-1, 3}, {5, 1},
+                                             {-3, -5}, {-5, 5}, {-7, -1},
+                                             {3, 7},  {7, -7}};
+  switch (count) {
+  case 2:
+    return two;
+  case 4:
+    return four;
+  default:
+    return eight;
+  }
+}
+
+inline auto blend_over(const Eigen::Vector4f &color,
+                       const Eigen::Vector4f &below) -> Eigen::Vector4f {
+  const auto alpha = color[3];
+  return {color[0] * alpha + below[0] * (1.0f - alpha),
+          color[1] * alpha + below[1] * (1.0f - alpha),
+          color[2] * alpha + below[2] * (1.0f - alpha),
+          alpha + below[3] * (1.0f - alpha)};
+}
+
+// adds a fragment to the sums of its pixel or sample
+inline void accumulate(std::array<float, 4> &sum, float &revealage,
+                       const Eigen::Vector4f &color, float depth) {
+  // nearer fragments weigh more, depth going from 1 near to -1 far
+  const auto alpha = color[3];
+  const auto distance = (1.0f - depth) * 0.5f;
+  const auto closeness = 1.0f - distance;
+  const auto weight =
+      alpha *
+      std::min(std::max(3e3f * closeness * closeness * closeness, 1e-2f),
+               3e3f);
+  sum[0] += color[0] * weight;
+  sum[1] += color[1] * weight;
+  sum[2] += color[2] * weight;
+  sum[3] += weight;
+  revealage *= 1.0f - alpha;
+}
+
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::Binner::clear() {
+  draws.clear();
+  blendings.clear();
+  varyings.clear();
+  for (auto &view : views) {
+    view.homo.clear();
+    view.depth.clear();
+    view.screen_coords.clear();
+    view.triangles.clear();
+    for (auto &tile : view.tiles) {
+      tile.clear();
+    }
+  }
+}
+
 template <typename Uniforms, typename Attributes, typename Varyings>
 void Rasterizer<Uniforms, Attributes, Varyings>::drawArray(uint32_t count) {
-  const uint8_t components = 3; // only support triangle now
+  auto vao = vertex_attribute_arrays[current_vao];
+  vao.indices = nullptr;
+  bin(immediate_binners[0], vao, count, uniform);
+  rasterize(immediate_binners);
+}
+
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::drawElements(
+    uint32_t index_count) {
+  bin(immediate_binners[0], vertex_attribute_arrays[current_vao], index_count,
+      uniform);
+  rasterize(immediate_binners);
+}
+
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::project(
+    typename Binner::View &view, size_t idx,
+    const Eigen::Vector4f &position) const {
+  view.depth[idx] = position[2] / position[3];
+  view.homo[idx] = position[3];
+  view.screen_coords[idx] = {
+      static_cast<int>((position[0] / position[3] + 1.f) * screen[0] / 2.0f),
+      static_cast<int>((position[1] / position[3] + 1.f) * screen[1] / 2.0f)};
+}
+
+// Calls `fn` with `indices` cast to its actual index type, so that loops
+// over indices are instantiated once per width instead of branching on it
+// for every index.
+template <typename Fn>
+auto with_indices(const void *indices, uint8_t index_size, Fn &&fn) {
+  switch (index_size) {
+  case 1:
+    return fn(static_cast<const uint8_t *>(indices));
+  case 2:
+    return fn(static_cast<const uint16_t *>(indices));
+  default:
+    return fn(static_cast<const uint32_t *>(indices));
+  }
+}
 
-  homo.resize(count);
-  depth.resize(count);
-  screen_coords.resize(count);
-  all_varyings.resize(count);
+template <typename VertexArray>
+auto get_vertex_count(const VertexArray &vao, uint32_t count) -> uint32_t {
+  if (vao.vertex_count != 0) {
+    return vao.vertex_count;
+  }
+  if (vao.indices == nullptr) {
+    return count;
+  }
+  return with_indices(vao.indices, vao.index_size, [count](auto indices) {
+    uint32_t vertex_count = 0;
+    for (size_t i = 0; i < count; i++) {
+      vertex_count =
+          std::max(vertex_count, static_cast<uint32_t>(indices[i]) + 1);
+    }
+    return vertex_count;
+  });
+}
 
-  auto &vao = vertex_attribute_arrays[current_vao];
-  auto &all_attributes = vao.attributes;
-  auto &attributes_pointers = vao.attributes_pointers;
-  for (size_t i = 0; i < count; i++) {
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::bin(
+    Binner &binner, const VertexArray &vao, uint32_t count,
+    const Uniforms &uniforms, const Blending &blending) const {
+  binner.views.resize(1);
+  auto &view = binner.views[0];
+  const auto vertex_count = get_vertex_count(vao, count);
+
+  // vertex stage: every vertex is shaded once, whatever its index count
+  const auto base = static_cast<uint32_t>(binner.varyings.size());
+  binner.varyings.resize(base + vertex_count);
+  view.homo.resize(base + vertex_count);
+  view.depth.resize(base + vertex_count);
+  view.screen_coords.resize(base + vertex_count);
+
+  for (uint32_t i = 0; i < vertex_count; i++) {
     Attributes attributes;
-    extract_attribute(attributes, all_attributes, attributes_pointers, i);
+    extract_attribute(attributes, vao.attributes, vao.attributes_pointers, i);
 
     Eigen::Vector4f value{};
-    vertex_shader(attributes, all_varyings[i], value);
+    vertex_shader(uniforms, attributes, binner.varyings[base + i], value);
+    project(view, base + i, value);
+  }
 
-    depth[i] = value[2] / value[3];
-    homo[i] = value[3];
-    screen_coords[i] = {
-        static_cast<int>((value[0] / value[3] + 1.f) * screen[0] / 2.0f),
-        static_cast<int>((value[1] / value[3] + 1.f) * screen[1] / 2.0f)};
+  binner.draws.push_back(uniforms);
+  binner.blendings.push_back(blending);
+  bin_view(binner, view, base, vao, count);
+}
+
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::bin(
+    Binner &binner, const std::vector<Eigen::Matrix4f> &view_matrices,
+    const VertexArray &vao, uint32_t count, const Uniforms &uniforms,
+    const Blending &blending) const {
+  binner.views.resize(view_matrices.size());
+  const auto vertex_count = get_vertex_count(vao, count);
+
+  const auto base = static_cast<uint32_t>(binner.varyings.size());
+  binner.varyings.resize(base + vertex_count);
+  for (auto &view : binner.views) {
+    view.homo.resize(base + vertex_count);
+    view.depth.resize(base + vertex_count);
+    view.screen_coords.resize(base + vertex_count);
   }
 
+  // attributes are fetched and shaded once, only the projection is per view
+  for (uint32_t i = 0; i < vertex_count; i++) {
+    Attributes attributes;
+    extract_attribute(attributes, vao.attributes, vao.attributes_pointers, i);
+
+    Eigen::Vector4f value{};
+    vertex_shader(uniforms, attributes, binner.varyings[base + i], value);
+    for (size_t v = 0; v < view_matrices.size(); v++) {
+      project(binner.views[v], base + i, view_matrices[v] * value);
+    }
+  }
+
+  binner.draws.push_back(uniforms);
+  binner.blendings.push_back(blending);
+  for (auto &view : binner.views) {
+    bin_view(binner, view, base, vao, count);
+  }
+}
+
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::bin_view(
+    Binner &binner, typename Binner::View &view, uint32_t base,
+    const VertexArray &vao, uint32_t count) const {
+  view.tiles.resize(get_tile_count());
+  if (vao.indices == nullptr) {
+    bin_triangles<uint32_t>(binner, view, base, nullptr, count);
+    return;
+  }
+  with_indices(vao.indices, vao.index_size, [&](auto indices) {
+    this->bin_triangles(binner, view, base, indices, count);
+  });
+}
+
+template <typename Uniforms, typename Attributes, typename Varyings>
+template <typename Index>
+void Rasterizer<Uniforms, Attributes, Varyings>::bin_triangles(
+    Binner &binner, typename Binner::View &view, uint32_t base,
+    const Index *indices, uint32_t count) const {
+  const uint8_t components = 3; // only support triangle now
+
+  const auto width = static_cast<int>(screen[0]);
+  const auto height = static_cast<int>(screen[1]);
+  const auto tiles_x = (width + TileSize - 1) / TileSize;
+  const auto draw = static_cast<uint32_t>(binner.draws.size() - 1);
+
+  // triangle setup and binning
   const uint32_t triangle_num = count / components;
-  ParallelForEach(static_cast<uint32_t>(0), triangle_num, [this](auto i) {
-    uint32_t start = i * 3;
-    this->traverse_triangle(start, start + 1, start + 2);
+  for (uint32_t i = 0; i < triangle_num; i++) {
+    const uint32_t start = i * 3;
+    typename Binner::Triangle triangle{};
+    for (uint32_t v = 0; v < 3; v++) {
+      triangle.vertices[v] =
+          base + (indices != nullptr ? indices[start + v] : start + v);
+    }
+    triangle.draw = draw;
+
+    const auto v0 = triangle.vertices[0];
+    const auto v1 = triangle.vertices[1];
+    const auto v2 = triangle.vertices[2];
+    // no clipping yet, drop triangles reaching behind the eye
+    if (view.homo[v0] <= 0.f || view.homo[v1] <= 0.f ||
+        view.homo[v2] <= 0.f) {
+      continue;
+    }
+
+    const auto &c0 = view.screen_coords[v0];
+    const auto &c1 = view.screen_coords[v1];
+    const auto &c2 = view.screen_coords[v2];
+    // back-facing and degenerate triangles never pass the coverage test,
+    // unless back faces are turned around
+    const auto area = orient2d(c0, c1, c2);
+    if (area == 0 || (area < 0 && cull_back_faces)) {
+      continue;
+    }
+    if (area < 0) {
+      std::swap(triangle.vertices[1], triangle.vertices[2]);
+    }
+
+    triangle.bounds = {std::max(min3(c0[0], c1[0], c2[0]), 0),
+                       std::max(min3(c0[1], c1[1], c2[1]), 0),
+                       std::min(max3(c0[0], c1[0], c2[0]), width - 1),
+                       std::min(max3(c0[1], c1[1], c2[1]), height - 1)};
+    if (triangle.bounds[0] > triangle.bounds[2] ||
+        triangle.bounds[1] > triangle.bounds[3]) {
+      continue;
+    }
+
+    const auto id = static_cast<uint32_t>(view.triangles.size());
+    view.triangles.push_back(triangle);
+    for (auto ty = triangle.bounds[1] / TileSize;
+         ty <= triangle.bounds[3] / TileSize; ty++) {
+      for (auto tx = triangle.bounds[0] / TileSize;
+           tx <= triangle.bounds[2] / TileSize; tx++) {
+        view.tiles[tx + ty * tiles_x].push_back(id);
+      }
+    }
+  }
+}
+
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::rasterize(
+    std::vector<Binner> &binners, Frame *targets, size_t view_count,
+    const Eigen::Vector4f *clear_color, SampleBuffer *samples) const {
+  const auto width = static_cast<int>(screen[0]);
+  const auto height = static_cast<int>(screen[1]);
+  const auto tiles_x = (width + TileSize - 1) / TileSize;
+  const auto tile_count = get_tile_count();
+
+  // tiles own disjoint pixels and pools, so no two threads touch the same
+  // sample
+  const auto task_count = static_cast<uint32_t>(tile_count * view_count);
+  ParallelForEach(0u, task_count, [&](uint32_t task) {
+    const auto v = task / tile_count;
+    const auto idx = task % tile_count;
+    auto &target = targets[v];
+    const auto x = static_cast<int>(idx % tiles_x) * TileSize;
+    const auto y = static_cast<int>(idx / tiles_x) * TileSize;
+    const std::array<int, 4> tile = {x, y, std::min(x + TileSize, width) - 1,
+                                     std::min(y + TileSize, height) - 1};
+    auto *target_samples =
+        samples != nullptr && samples[v].count > 1 ? &samples[v] : nullptr;
+    if (clear_color != nullptr) {
+      target.clear(tile[0], tile[1], tile[2] - tile[0] + 1,
+                   tile[3] - tile[1] + 1, *clear_color);
+      if (target_samples != nullptr) {
+        this->clear(*target_samples, idx, tile);
+      }
+    }
+    Accumulation accumulation;
+    for (auto &binner : binners) {
+      if (v >= binner.views.size() || idx >= binner.views[v].tiles.size()) {
+        continue;
+      }
+      auto &view = binner.views[v];
+      for (auto id : view.tiles[idx]) {
+        if (target_samples != nullptr) {
+          this->traverse_samples(binner, v, idx, view.triangles[id], tile,
+                                 target, *target_samples, accumulation);
+        } else {
+          this->traverse_triangle(binner, v, idx, view.triangles[id], tile,
+                                  target, accumulation);
+        }
+      }
+    }
+    if (!accumulation.revealage.empty()) {
+      this->resolve(accumulation, idx, tile, target, target_samples);
+    }
+    if (target_samples != nullptr) {
+      this->resolve(*target_samples, idx, tile, target);
+    }
   });
+
+  for (auto &binner : binners) {
+    binner.clear();
+  }
 }
 
 template <typename Uniforms, typename Attributes, typename Varyings>
-void Rasterizer<Uniforms, Attributes, Varyings>::traverse_triangle(
-    uint32_t v0_index, uint32_t v1_index, uint32_t v2_index) {
+void Rasterizer<Uniforms, Attributes, Varyings>::rasterize_depth(
+    std::vector<Binner> &binners,
+    std::vector<std::vector<float>> &depths) const {
   const auto width = static_cast<int>(screen[0]);
   const auto height = static_cast<int>(screen[1]);
+  const auto tiles_x = (width + TileSize - 1) / TileSize;
+  const auto tile_count = get_tile_count();
+  depths.resize(binners.size());
+  for (auto &depth : depths) {
+    depth.assign(screen[0] * screen[1], -FLT_MAX);
+  }
+
+  const auto task_count = static_cast<uint32_t>(tile_count * binners.size());
+  ParallelForEach(0u, task_count, [&](uint32_t task) {
+    const auto b = task / tile_count;
+    const auto idx = task % tile_count;
+    auto &binner = binners[b];
+    if (binner.views.empty() || idx >= binner.views[0].tiles.size()) {
+      return;
+    }
+    const auto x = static_cast<int>(idx % tiles_x) * TileSize;
+    const auto y = static_cast<int>(idx / tiles_x) * TileSize;
+    const std::array<int, 4> tile = {x, y, std::min(x + TileSize, width) - 1,
+                                     std::min(y + TileSize, height) - 1};
+    auto &view = binner.views[0];
+    auto &depth = depths[b];
+    for (auto id : view.tiles[idx]) {
+      this->for_each_fragment(
+          view, view.triangles[id], tile,
+          [&depth](size_t pixel, const std::array<float, 3> &, float z) {
+            depth[pixel] = std::max(depth[pixel], z);
+          });
+    }
+  });
+
+  for (auto &binner : binners) {
+    binner.clear();
+  }
+}
+
+template <typename Uniforms, typename Attributes, typename Varyings>
+template <typename Fragment>
+void Rasterizer<Uniforms, Attributes, Varyings>::for_each_fragment(
+    const typename Binner::View &view,
+    const typename Binner::Triangle &triangle, const std::array<int, 4> &tile,
+    const Fragment &fragment) const {
+  const auto width = static_cast<int>(screen[0]);
 
-  const auto v0_screen_coords = screen_coords[v0_index];
-  const auto v1_screen_coords = screen_coords[v1_index];
-  const auto v2_screen_coords = screen_coords[v2_index];
-  // compute bounding box and clip against screen bounds
-  auto minX = fmaxf(
-      min3(v0_screen_coords[0], v1_screen_coords[0], v2_screen_coords[0]), 0);
-  auto minY = fmaxf(
-      min3(v0_screen_coords[1], v1_screen_coords[1], v2_screen_coords[1]), 0);
-  auto maxX =
-      fmin(max3(v0_screen_coords[0], v1_screen_coords[0], v2_screen_coords[0]),
-           width - 1);
-  auto maxY =
-      fminf(max3(v0_screen_coords[1], v1_screen_coords[1], v2_screen_coords[1]),
-            height - 1);
+  const auto v0_index = triangle.vertices[0];
+  const auto v1_index = triangle.vertices[1];
+  const auto v2_index = triangle.vertices[2];
+
+  const auto v0_screen_coords = view.screen_coords[v0_index];
+  const auto v1_screen_coords = view.screen_coords[v1_index];
+  const auto v2_screen_coords = view.screen_coords[v2_index];
+  // clip the triangle bounding box against the tile
+  const auto minX = std::max(triangle.bounds[0], tile[0]);
+  const auto minY = std::max(triangle.bounds[1], tile[1]);
+  const auto maxX = std::min(triangle.bounds[2], tile[2]);
+  const auto maxY = std::min(triangle.bounds[3], tile[3]);
 
   // increment for weight on rows and columns
   const Eigen::Vector3i A = {v1_screen_coords[1] - v2_screen_coords[1],
@@ -157,21 +490,27 @@ void Rasterizer<Uniforms, Attributes, Varyings>::traverse_triangle(
                              v0_screen_coords[0] - v2_screen_coords[0],
                              v1_screen_coords[0] - v0_screen_coords[0]};
 
-  std::array<int, 2> screen_coord = {static_cast<int>(minX),
-                                     static_cast<int>(minY)};
+  // a pixel on an edge belongs to one of the two triangles sharing it, the
+  // one the edge faces the same way for, so that blending hits it once
+  const Eigen::Vector3i bias = {
+      A[0] > 0 || (A[0] == 0 && B[0] > 0) ? 0 : -1,
+      A[1] > 0 || (A[1] == 0 && B[1] > 0) ? 0 : -1,
+      A[2] > 0 || (A[2] == 0 && B[2] > 0) ? 0 : -1};
+
+  std::array<int, 2> screen_coord = {minX, minY};
 
   Eigen::Vector3i rowWeight = {
       orient2d(v1_screen_coords, v2_screen_coords, screen_coord),
       orient2d(v2_screen_coords, v0_screen_coords, screen_coord),
       orient2d(v0_screen_coords, v1_screen_coords, screen_coord)};
 
-  const auto v0_homo = homo[v0_index];
-  const auto v1_homo = homo[v1_index];
-  const auto v2_homo = homo[v2_index];
+  const auto v0_homo = view.homo[v0_index];
+  const auto v1_homo = view.homo[v1_index];
+  const auto v2_homo = view.homo[v2_index];
 
-  const auto v0_depth = depth[v0_index];
-  const auto v1_depth = depth[v1_index];
-  const auto v2_depth = depth[v2_index];
+  const auto v0_depth = view.depth[v0_index];
+  const auto v1_depth = view.depth[v1_index];
+  const auto v2_depth = view.depth[v2_index];
 
   for (screen_coord[1] = minY; screen_coord[1] <= maxY;
        screen_coord[1]++, rowWeight += B) {
@@ -180,7 +519,8 @@ void Rasterizer<Uniforms, Attributes, Varyings>::traverse_triangle(
     const auto sum = weight.sum();
     for (screen_coord[0] = minX; screen_coord[0] <= maxX;
          screen_coord[0]++, weight += A) {
-      if (weight[0] < 0 || weight[1] < 0 || weight[2] < 0 || sum == 0) {
+      if (weight[0] + bias[0] < 0 || weight[1] + bias[1] < 0 ||
+          weight[2] + bias[2] < 0 || sum == 0) {
         continue;
       }
 
@@ -198,71 +538,418 @@ void Rasterizer<Uniforms, Attributes, Varyings>::traverse_triangle(
         continue;
       }
 
-      const auto idx =
-          static_cast<size_t>(screen_coord[0] + screen_coord[1] * width);
+      fragment(static_cast<size_t>(screen_coord[0] + screen_coord[1] * width),
+               clip, current_depth);
+    }
+  }
+}
 
-      if (current_depth <= frame->getZ(idx)) {
-        continue;
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::traverse_triangle(
+    const Binner &binner, uint32_t view_idx, uint32_t tile_idx,
+    const typename Binner::Triangle &triangle, const std::array<int, 4> &tile,
+    Frame &target, Accumulation &accumulation) const {
+  using Mode = Blending::Mode;
+  const auto &view = binner.views[view_idx];
+  const auto &uniforms = binner.draws[triangle.draw];
+  const auto &blending = binner.blendings[triangle.draw];
+  const auto &v1_varying = binner.varyings[triangle.vertices[0]];
+  const auto &v2_varying = binner.varyings[triangle.vertices[1]];
+  const auto &v3_varying = binner.varyings[triangle.vertices[2]];
+  const auto width = static_cast<size_t>(screen[0]);
+
+  if (blending.mode == Mode::Accumulate && accumulation.revealage.empty()) {
+    accumulation.sums.assign(TileSize * TileSize, {0.0f, 0.0f, 0.0f, 0.0f});
+    accumulation.revealage.assign(TileSize * TileSize, 1.0f);
+  }
+
+  // fragments passing the depth test, shaded a batch at a time; a triangle
+  // covers each pixel once, so writing depth first or last changes nothing
+  // but for masked fragments, which may still be dropped
+  std::array<Varyings, FragmentBatch> varyings;
+  std::array<size_t, FragmentBatch> indices;
+  std::array<float, FragmentBatch> depths;
+  std::array<Eigen::Vector4f, FragmentBatch> colors;
+  uint32_t count = 0;
+  auto shade = [&]() {
+    fragment_shader(uniforms, view_idx, tile_idx, varyings.data(),
+                    indices.data(), count, colors.data());
+    for (uint32_t i = 0; i < count; i++) {
+      const auto idx = indices[i];
+      auto &color = colors[i];
+      switch (blending.mode) {
+      case Mode::Opaque:
+        target.setColor(idx, color);
+        break;
+      case Mode::Mask:
+        if (color[3] >= blending.cutoff) {
+          target.setZ(idx, depths[i]);
+          target.setColor(idx, color);
+        }
+        break;
+      case Mode::Blend:
+        target.setColor(idx, blend_over(color, target.getColor(idx)));
+        break;
+      case Mode::Accumulate: {
+        const auto local = (idx % width - tile[0]) +
+                           (idx / width - tile[1]) * TileSize;
+        accumulate(accumulation.sums[local], accumulation.revealage[local],
+                   color, depths[i]);
+        break;
       }
-      frame->setZ(idx, current_depth);
+      }
+    }
+    count = 0;
+  };
+
+  for_each_fragment(
+      view, triangle, tile,
+      [&](size_t idx, const std::array<float, 3> &clip, float depth) {
+        if (depth <= target.getZ(idx)) {
+          return;
+        }
+        if (blending.mode == Mode::Opaque) {
+          target.setZ(idx, depth);
+        }
+
+        varyings[count] =
+            interpolate(clip, v1_varying, v2_varying, v3_varying);
+        indices[count] = idx;
+        depths[count] = depth;
+        if (++count == FragmentBatch) {
+          shade();
+        }
+      });
+  if (count > 0) {
+    shade();
+  }
+}
 
-      const auto &v1_varying = all_varyings[v0_index];
-      const auto &v2_varying = all_varyings[v1_index];
-      const auto &v3_varying = all_varyings[v2_index];
+template <typename Uniforms, typename Attributes, typename Varyings>
+template <typename Fragment>
+void Rasterizer<Uniforms, Attributes, Varyings>::for_each_sampled_fragment(
+    const typename Binner::View &view,
+    const typename Binner::Triangle &triangle, const std::array<int, 4> &tile,
+    uint32_t sample_count, const Fragment &fragment) const {
+  const auto width = static_cast<int>(screen[0]);
+  const std::array<uint32_t, 3> vertices = triangle.vertices;
+  const auto &c0 = view.screen_coords[vertices[0]];
+  const auto &c1 = view.screen_coords[vertices[1]];
+  const auto &c2 = view.screen_coords[vertices[2]];
+  // vertices sit on pixel points, so no pixel outside of the bounds has a
+  // sample inside
+  const auto minX = std::max(triangle.bounds[0], tile[0]);
+  const auto minY = std::max(triangle.bounds[1], tile[1]);
+  const auto maxX = std::min(triangle.bounds[2], tile[2]);
+  const auto maxY = std::min(triangle.bounds[3], tile[3]);
+
+  const Eigen::Vector3i A = {c1[1] - c2[1], c2[1] - c0[1], c0[1] - c1[1]};
+  const Eigen::Vector3i B = {c2[0] - c1[0], c0[0] - c2[0], c1[0] - c0[0]};
+  const Eigen::Vector3i bias = {
+      A[0] > 0 || (A[0] == 0 && B[0] > 0) ? 0 : -1,
+      A[1] > 0 || (A[1] == 0 && B[1] > 0) ? 0 : -1,
+      A[2] > 0 || (A[2] == 0 && B[2] > 0) ? 0 : -1};
+
+  // weights are kept in sixteenths, those of a sample are the pixel's
+  // plus its offset along the edges
+  const auto offsets = get_sample_offsets(sample_count);
+  std::array<Eigen::Vector3i, MaxSamples> deltas;
+  deltas.fill(Eigen::Vector3i::Zero());
+  for (uint32_t s = 0; s < sample_count; s++) {
+    deltas[s] = A * offsets[s][0] + B * offsets[s][1];
+  }
+  Eigen::Vector3i reach = deltas[0];
+  for (uint32_t s = 1; s < sample_count; s++) {
+    reach = reach.cwiseMax(deltas[s]);
+  }
 
-      // for each varying, do interpolating, maybe we can use SIMD
-      auto varyings = interpolate(clip, v1_varying, v2_varying, v3_varying);
+  const std::array<int, 2> first = {minX, minY};
+  Eigen::Vector3i rowWeight = {orient2d(c1, c2, first) * 16,
+                               orient2d(c2, c0, first) * 16,
+                               orient2d(c0, c1, first) * 16};
+  const Eigen::Vector3i stepX = A * 16;
+  const Eigen::Vector3i stepY = B * 16;
+  const std::array<float, 3> homo = {view.homo[vertices[0]],
+                                     view.homo[vertices[1]],
+                                     view.homo[vertices[2]]};
+  const std::array<float, 3> depth = {view.depth[vertices[0]],
+                                      view.depth[vertices[1]],
+                                      view.depth[vertices[2]]};
+
+  std::array<float, MaxSamples> depths;
+  for (auto y = minY; y <= maxY; y++, rowWeight += stepY) {
+    Eigen::Vector3i weight = rowWeight;
+    for (auto x = minX; x <= maxX; x++, weight += stepX) {
+      // no sample of the pixel can be inside
+      if (weight[0] + reach[0] + bias[0] < 0 ||
+          weight[1] + reach[1] + bias[1] < 0 ||
+          weight[2] + reach[2] + bias[2] < 0) {
+        continue;
+      }
 
-      Eigen::Vector4f color = {0.0f, 0.0f, 0.0f, 0.0f};
-      fragment_shader(varyings, color);
-      frame->setColor(idx, color);
+      uint32_t covered = 0;
+      std::array<float, 3> clip{};
+      for (uint32_t s = 0; s < sample_count; s++) {
+        const Eigen::Vector3i sample = weight + deltas[s];
+        if (sample[0] + bias[0] < 0 || sample[1] + bias[1] < 0 ||
+            sample[2] + bias[2] < 0) {
+          continue;
+        }
+        std::array<float, 3> coef = {static_cast<float>(sample[0]) / homo[0],
+                                     static_cast<float>(sample[1]) / homo[1],
+                                     static_cast<float>(sample[2]) / homo[2]};
+        const auto sum = coef[0] + coef[1] + coef[2];
+        if (sum == 0.0f) {
+          continue;
+        }
+        coef = coef / sum;
+        const auto sample_depth =
+            -(coef[0] * depth[0] + coef[1] * depth[1] + coef[2] * depth[2]);
+        if (sample_depth < -1.f || sample_depth > 1.f) {
+          continue;
+        }
+        if (covered == 0) {
+          clip = coef;
+        }
+        covered |= 1u << s;
+        depths[s] = sample_depth;
+      }
+      if (covered != 0) {
+        fragment(static_cast<size_t>(x + y * width), clip, covered, depths);
+      }
     }
   }
 }
 
 template <typename Uniforms, typename Attributes, typename Varyings>
-void Rasterizer<Uniforms, Attributes, Varyings>::drawElements(
-    uint32_t index_count) {
-  const uint8_t components = 3; // only support triangle now
-
-  if (frame == nullptr)
-    return;
-
-  homo.resize(index_count);
-  depth.resize(index_count);
-  screen_coords.resize(index_count);
-  all_varyings.resize(index_count);
-
-  auto &vao = vertex_attribute_arrays[current_vao];
-  auto &all_attributes = vao.attributes;
-  auto &attributes_pointers = vao.attributes_pointers;
-  auto indices = vao.indices;
-  for (size_t i = 0; i < index_count; i++) {
-    auto vertex_idx = indices[i];
-    Attributes attributes;
-    extract_attribute(attributes, all_attributes, attributes_pointers,
-                      vertex_idx);
+void Rasterizer<Uniforms, Attributes, Varyings>::traverse_samples(
+    const Binner &binner, uint32_t view_idx, uint32_t tile_idx,
+    const typename Binner::Triangle &triangle, const std::array<int, 4> &tile,
+    Frame &target, SampleBuffer &samples, Accumulation &accumulation) const {
+  using Mode = Blending::Mode;
+  const auto &view = binner.views[view_idx];
+  const auto &uniforms = binner.draws[triangle.draw];
+  const auto &blending = binner.blendings[triangle.draw];
+  const auto &v1_varying = binner.varyings[triangle.vertices[0]];
+  const auto &v2_varying = binner.varyings[triangle.vertices[1]];
+  const auto &v3_varying = binner.varyings[triangle.vertices[2]];
+  const auto width = static_cast<size_t>(screen[0]);
+  const auto sample_count = samples.count;
+  const auto all = (1u << sample_count) - 1u;
+
+  // accumulated per sample
+  if (blending.mode == Mode::Accumulate && accumulation.revealage.empty()) {
+    accumulation.sums.assign(TileSize * TileSize * sample_count,
+                             {0.0f, 0.0f, 0.0f, 0.0f});
+    accumulation.revealage.assign(TileSize * TileSize * sample_count, 1.0f);
+  }
 
-    Eigen::Vector4f value{};
-    vertex_shader(attributes, all_varyings[vertex_idx], value);
+  // writes `color` to the samples of pixel `idx` in `mask`, or blends it
+  // over them; a pixel stays or becomes shared when all of its samples
+  // get the same color
+  auto write = [&](size_t idx, uint32_t mask, const Eigen::Vector4f &color,
+                   bool blend) {
+    auto &slot = samples.slots[idx];
+    if (mask == all && (!blend || slot == SampleBuffer::Shared)) {
+      target.setColor(idx, blend ? blend_over(color, target.getColor(idx))
+                                 : color);
+      slot = SampleBuffer::Shared;
+      return;
+    }
+    auto *run = samples.expand(tile_idx, idx, target.getColor(idx));
+    for (uint32_t s = 0; s < sample_count; s++) {
+      if ((mask >> s & 1u) == 0) {
+        continue;
+      }
+      Eigen::Vector4f value = color;
+      if (blend) {
+        value = blend_over(color, {run[s], run[s + sample_count],
+                                   run[s + sample_count * 2],
+                                   run[s + sample_count * 3]});
+      }
+      for (uint32_t channel = 0; channel < 4; channel++) {
+        run[s + sample_count * channel] = value[channel];
+      }
+    }
+  };
+
+  std::array<Varyings, FragmentBatch> varyings;
+  std::array<size_t, FragmentBatch> indices;
+  std::array<uint32_t, FragmentBatch> masks;
+  std::array<std::array<float, MaxSamples>, FragmentBatch> depths;
+  std::array<Eigen::Vector4f, FragmentBatch> colors;
+  uint32_t count = 0;
+  auto shade = [&]() {
+    fragment_shader(uniforms, view_idx, tile_idx, varyings.data(),
+                    indices.data(), count, colors.data());
+    for (uint32_t i = 0; i < count; i++) {
+      const auto idx = indices[i];
+      const auto mask = masks[i];
+      auto &color = colors[i];
+      switch (blending.mode) {
+      case Mode::Opaque:
+        write(idx, mask, color, false);
+        break;
+      case Mode::Mask:
+        if (color[3] >= blending.cutoff) {
+          for (uint32_t s = 0; s < sample_count; s++) {
+            if ((mask >> s & 1u) != 0) {
+              samples.depth[idx * sample_count + s] = depths[i][s];
+            }
+          }
+          write(idx, mask, color, false);
+        }
+        break;
+      case Mode::Blend:
+        write(idx, mask, color, true);
+        break;
+      case Mode::Accumulate: {
+        const auto local = (idx % width - tile[0]) +
+                           (idx / width - tile[1]) * TileSize;
+        for (uint32_t s = 0; s < sample_count; s++) {
+          if ((mask >> s & 1u) != 0) {
+            const auto sample = local * sample_count + s;
+            accumulate(accumulation.sums[sample],
+                       accumulation.revealage[sample], color, depths[i][s]);
+          }
+        }
+        break;
+      }
+      }
+    }
+    count = 0;
+  };
+
+  for_each_sampled_fragment(
+      view, triangle, tile, sample_count,
+      [&](size_t idx, const std::array<float, 3> &clip, uint32_t covered,
+          const std::array<float, MaxSamples> &sample_depths) {
+        auto *stored = &samples.depth[idx * sample_count];
+        uint32_t mask = 0;
+        for (uint32_t s = 0; s < sample_count; s++) {
+          if ((covered >> s & 1u) != 0 && sample_depths[s] > stored[s]) {
+            mask |= 1u << s;
+          }
+        }
+        if (mask == 0) {
+          return;
+        }
+        if (blending.mode == Mode::Opaque) {
+          for (uint32_t s = 0; s < sample_count; s++) {
+            if ((mask >> s & 1u) != 0) {
+              stored[s] = sample_depths[s];
+            }
+          }
+        }
+
+        varyings[count] =
+            interpolate(clip, v1_varying, v2_varying, v3_varying);
+        indices[count] = idx;
+        masks[count] = mask;
+        depths[count] = sample_depths;
+        if (++count == FragmentBatch) {
+          shade();
+        }
+      });
+  if (count > 0) {
+    shade();
+  }
+}
 
-    depth[vertex_idx] = value[2] / value[3];
-    homo[vertex_idx] = value[3];
-    screen_coords[vertex_idx] = {
-        static_cast<int>((value[0] / value[3] + 1.f) * screen[0] / 2.0f),
-        static_cast<int>((value[1] / value[3] + 1.f) * screen[1] / 2.0f)};
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::resolve(
+    const Accumulation &accumulation, uint32_t tile_idx,
+    const std::array<int, 4> &tile, Frame &target,
+    SampleBuffer *samples) const {
+  const auto width = static_cast<int>(screen[0]);
+  const auto count = samples != nullptr ? samples->count : 1u;
+  // the weighted average color covers what the fragments hide
+  auto composite = [&accumulation](size_t sample,
+                                   const Eigen::Vector4f &below)
+      -> Eigen::Vector4f {
+    const auto &sum = accumulation.sums[sample];
+    const auto revealage = accumulation.revealage[sample];
+    const auto weights = std::max(sum[3], 1e-5f);
+    const auto coverage = 1.0f - revealage;
+    return {sum[0] / weights * coverage + below[0] * revealage,
+            sum[1] / weights * coverage + below[1] * revealage,
+            sum[2] / weights * coverage + below[2] * revealage,
+            coverage + below[3] * revealage};
+  };
+  for (auto y = tile[1]; y <= tile[3]; y++) {
+    for (auto x = tile[0]; x <= tile[2]; x++) {
+      const auto first = static_cast<size_t>(
+          ((x - tile[0]) + (y - tile[1]) * TileSize) * count);
+      auto touched = false;
+      auto same = true;
+      for (auto sample = first; sample < first + count; sample++) {
+        touched = touched || accumulation.revealage[sample] < 1.0f;
+        same = same && accumulation.sums[sample] == accumulation.sums[first] &&
+               accumulation.revealage[sample] ==
+                   accumulation.revealage[first];
+      }
+      if (!touched) {
+        continue;
+      }
+      const auto idx = static_cast<size_t>(x + y * width);
+      if (samples == nullptr ||
+          (same && samples->slots[idx] == SampleBuffer::Shared)) {
+        target.setColor(idx, composite(first, target.getColor(idx)));
+        continue;
+      }
+      auto *run = samples->expand(tile_idx, idx, target.getColor(idx));
+      for (uint32_t s = 0; s < count; s++) {
+        const Eigen::Vector4f value = composite(
+            first + s,
+            {run[s], run[s + count], run[s + count * 2], run[s + count * 3]});
+        for (uint32_t channel = 0; channel < 4; channel++) {
+          run[s + count * channel] = value[channel];
+        }
+      }
+    }
   }
+}
 
-  const uint32_t triangle_num = index_count / components;
-  ParallelForEach(static_cast<uint32_t>(0), triangle_num,
-                  [this, indices](auto i) {
-                    uint32_t start = i * 3;
-                    auto v0_index = indices[start];
-                    auto v1_index = indices[start + 1];
-                    auto v2_index = indices[start + 2];
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::clear(
+    SampleBuffer &samples, uint32_t tile_idx,
+    const std::array<int, 4> &tile) const {
+  const auto width = static_cast<int>(screen[0]);
+  const auto count = samples.count;
+  for (auto y = tile[1]; y <= tile[3]; y++) {
+    const auto begin = static_cast<size_t>(tile[0] + y * width);
+    const auto end = static_cast<size_t>(tile[2] + y * width) + 1;
+    std::fill(samples.slots.begin() + begin, samples.slots.begin() + end,
+              static_cast<int32_t>(SampleBuffer::Shared));
+    std::fill(samples.depth.begin() + begin * count,
+              samples.depth.begin() + end * count, -FLT_MAX);
+  }
+  samples.pools[tile_idx].clear();
+}
 
-                    this->traverse_triangle(v0_index, v1_index, v2_index);
-                  });
+template <typename Uniforms, typename Attributes, typename Varyings>
+void Rasterizer<Uniforms, Attributes, Varyings>::resolve(
+    const SampleBuffer &samples, uint32_t tile_idx,
+    const std::array<int, 4> &tile, Frame &target) const {
+  const auto width = static_cast<int>(screen[0]);
+  const auto count = samples.count;
+  const auto &pool = samples.pools[tile_idx];
+  for (auto y = tile[1]; y <= tile[3]; y++) {
+    for (auto x = tile[0]; x <= tile[2]; x++) {
+      const auto idx = static_cast<size_t>(x + y * width);
+      target.setZ(idx, Eigen::Map<const Eigen::VectorXf>(
+                           samples.depth.data() + idx * count, count)
+                           .maxCoeff());
+      const auto slot = samples.slots[idx];
+      if (slot == SampleBuffer::Shared) {
+        continue;
+      }
+      // a column per channel, averaged in one vectorized pass
+      const Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, 4>> run(
+          pool.data() + slot, count, 4);
+      target.setColor(idx, run.colwise().mean().transpose());
+    }
+  }
 }
 
-} // namespace RB
\ No newline at end of file
+} // namespace RB
@@ -0,0 +1,63 @@
+#pragma once
+#include <Eigen/Core>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+namespace RB {
+
+// The samples of a multisampled frame, `count` per pixel. Depth is kept per
+// sample, colors are compressed: a pixel whose samples all share a color,
+// like most pixels inside of triangles, keeps it in the frame alone. Pixels
+// along edges get a run of their sample colors in the pool of their tile,
+// one channel after the other, and the frame holds their average once the
+// tile is resolved. Runs are only freed by clears.
+struct SampleBuffer {
+  // the slot of pixels whose samples share the frame's color
+  enum : int32_t { Shared = -1 };
+
+  uint32_t count = 1;
+  std::vector<float> depth;
+  // per pixel, where its run starts in the pool of its tile
+  std::vector<int32_t> slots;
+  std::vector<std::vector<float>> pools;
+
+  // cleared when the size or the sample count changes
+  void resize(size_t size, uint32_t tile_count, uint32_t samples) {
+    if (count == samples && slots.size() == size &&
+        pools.size() == tile_count) {
+      return;
+    }
+    count = samples;
+    depth.assign(size * samples, -FLT_MAX);
+    slots.assign(size, Shared);
+    pools.assign(tile_count, {});
+  }
+
+  // the run of `pixel` in the pool of `tile`, made of `shared`, the frame's
+  // color, if the pixel had none; valid until the pool grows
+  auto expand(uint32_t tile, size_t pixel, const Eigen::Vector4f &shared)
+      -> float * {
+    auto &pool = pools[tile];
+    auto &slot = slots[pixel];
+    if (slot == Shared) {
+      slot = static_cast<int32_t>(pool.size());
+      for (auto channel = 0; channel < 4; channel++) {
+        pool.insert(pool.end(), count, shared[channel]);
+      }
+    }
+    return pool.data() + slot;
+  }
+
+  // every pixel back to the frame's color, at no depth
+  void clear() {
+    std::fill(depth.begin(), depth.end(), -FLT_MAX);
+    std::fill(slots.begin(), slots.end(), static_cast<int32_t>(Shared));
+    for (auto &pool : pools) {
+      pool.clear();
+    }
+  }
+};
+
+} // namespace RB
@@ -4,3 +4,79 @@ using namespace std;
 using namespace Eigen;
 using vec3 = Eigen::Vector3f;
 using vec2 = Eigen::Vector2f;
+
+namespace RB {
+
+static auto vertex_view(const vector<Vertex> &buffers, size_t offset,
+                        uint8_t components) -> AttributeView {
+  AttributeView view{};
+  if (buffers.empty()) {
+    return view;
+  }
+  view.data = reinterpret_cast<const uint8_t *>(buffers.data()) + offset;
+  view.count = static_cast<uint32_t>(buffers.size());
+  view.stride = sizeof(Vertex);
+  view.components = components;
+  view.type = ComponentType::Float;
+  return view;
+}
+
+auto Geometry::get_positions() const -> AttributeView {
+  if (position_view) {
+    return position_view;
+  }
+  return vertex_view(buffers, 0, 3);
+}
+
+auto Geometry::get_normals() const -> AttributeView {
+  if (normal_view || position_view) {
+    return normal_view;
+  }
+  return vertex_view(buffers, 3 * sizeof(float), 3);
+}
+
+auto Geometry::get_uvs() const -> AttributeView {
+  if (uv_view || position_view) {
+    return uv_view;
+  }
+  return vertex_view(buffers, 6 * sizeof(float), 2);
+}
+
+auto Geometry::get_indices() const -> AttributeView {
+  if (index_view) {
+    return index_view;
+  }
+  AttributeView view{};
+  if (indices.empty()) {
+    return view;
+  }
+  view.data = reinterpret_cast<const uint8_t *>(indices.data());
+  view.count = static_cast<uint32_t>(indices.size());
+  view.stride = sizeof(uint32_t);
+  view.components = 1;
+  view.type = ComponentType::UnsignedInt;
+  return view;
+}
+
+void Geometry::share_storage() {
+  if (!buffers.empty() && !position_view) {
+    auto storage = make_shared<const vector<Vertex>>(move(buffers));
+    buffers = {};
+    position_view = vertex_view(*storage, 0, 3);
+    normal_view = vertex_view(*storage, 3 * sizeof(float), 3);
+    uv_view = vertex_view(*storage, 6 * sizeof(float), 2);
+    position_view.owner = normal_view.owner = uv_view.owner = storage;
+  }
+  if (!indices.empty() && !index_view) {
+    auto storage = make_shared<const vector<uint32_t>>(move(indices));
+    indices = {};
+    index_view.data = reinterpret_cast<const uint8_t *>(storage->data());
+    index_view.count = static_cast<uint32_t>(storage->size());
+    index_view.stride = sizeof(uint32_t);
+    index_view.components = 1;
+    index_view.type = ComponentType::UnsignedInt;
+    index_view.owner = storage;
+  }
+}
+
+} // namespace RB
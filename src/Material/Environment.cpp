@@ -0,0 +1,314 @@
+#include "Material/Environment.hpp"
+#include <Eigen/Geometry>
+#include <RenderBoy/Geometry.hpp>
+#include <RenderBoy/utils.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+using namespace Eigen;
+
+namespace RB {
+
+namespace {
+
+using Image = Environment::Image;
+
+// the i-th of `count` points of the Hammersley set on the unit square
+auto hammersley(uint32_t i, uint32_t count) -> array<float, 2> {
+  auto bits = i;
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xaaaaaaaau) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xccccccccu) >> 2u);
+  bits = ((bits & 0x0f0f0f0fu) << 4u) | ((bits & 0xf0f0f0f0u) >> 4u);
+  bits = ((bits & 0x00ff00ffu) << 8u) | ((bits & 0xff00ff00u) >> 8u);
+  return {static_cast<float>(i) / static_cast<float>(count),
+          static_cast<float>(bits) * 2.3283064e-10f};
+}
+
+// a half vector around `normal` distributed like GGX with `roughness`
+auto sample_ggx(const array<float, 2> &xi, float roughness,
+                const Vector3f &normal) -> Vector3f {
+  auto alpha = roughness * roughness;
+  auto phi = 2.0f * PI * xi[0];
+  auto cos_theta =
+      sqrtf((1.0f - xi[1]) / (1.0f + (alpha * alpha - 1.0f) * xi[1]));
+  auto sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+
+  const Vector3f up = fabsf(normal[2]) < 0.999f ? Vector3f(0.0f, 0.0f, 1.0f)
+                                                : Vector3f(1.0f, 0.0f, 0.0f);
+  const Vector3f tangent = up.cross(normal).normalized();
+  const Vector3f bitangent = normal.cross(tangent);
+  return (tangent * (sin_theta * cosf(phi)) +
+          bitangent * (sin_theta * sinf(phi)) + normal * cos_theta)
+      .normalized();
+}
+
+auto to_direction(float u, float v) -> Vector3f {
+  auto phi = (u - 0.5f) * 2.0f * PI;
+  auto theta = v * PI;
+  return {sinf(theta) * sinf(phi), cosf(theta), -sinf(theta) * cosf(phi)};
+}
+
+auto make_image(uint32_t width, uint32_t height) -> Image {
+  Image image;
+  image.width = width;
+  image.height = height;
+  image.rgb.resize(static_cast<size_t>(width) * height * 3);
+  return image;
+}
+
+// box filters `texture` down to `width` by `height`
+auto resample(const Texture &texture, uint32_t width, uint32_t height)
+    -> Image {
+  auto image = make_image(width, height);
+  const auto channels = static_cast<size_t>(texture.channels);
+  ParallelForEach(0u, height, [&](uint32_t y) {
+    const auto y0 = y * texture.height / height;
+    const auto y1 = std::max((y + 1) * texture.height / height, y0 + 1);
+    for (uint32_t x = 0; x < width; x++) {
+      const auto x0 = x * texture.width / width;
+      const auto x1 = std::max((x + 1) * texture.width / width, x0 + 1);
+      Vector3f sum = Vector3f::Zero();
+      for (auto sy = y0; sy < y1; sy++) {
+        for (auto sx = x0; sx < x1; sx++) {
+          auto texel = texture.data +
+                       (static_cast<size_t>(sy) * texture.width + sx) *
+                           channels;
+          for (size_t c = 0; c < 3; c++) {
+            sum[c] += static_cast<float>(texel[std::min(c, channels - 1)]);
+          }
+        }
+      }
+      sum /= static_cast<float>((x1 - x0) * (y1 - y0)) * 255.0f;
+      auto out = &image.rgb[(static_cast<size_t>(y) * width + x) * 3];
+      out[0] = sum[0];
+      out[1] = sum[1];
+      out[2] = sum[2];
+    }
+  });
+  return image;
+}
+
+auto halve(const Image &source) -> Image {
+  auto image = make_image(std::max(source.width / 2, 1u),
+                          std::max(source.height / 2, 1u));
+  for (uint32_t y = 0; y < image.height; y++) {
+    for (uint32_t x = 0; x < image.width; x++) {
+      for (size_t c = 0; c < 3; c++) {
+        float sum = 0.0f;
+        for (uint32_t dy = 0; dy < 2; dy++) {
+          for (uint32_t dx = 0; dx < 2; dx++) {
+            auto sx = std::min(x * 2 + dx, source.width - 1);
+            auto sy = std::min(y * 2 + dy, source.height - 1);
+            sum += source.rgb[(static_cast<size_t>(sy) * source.width + sx) *
+                                  3 +
+                              c];
+          }
+        }
+        image.rgb[(static_cast<size_t>(y) * image.width + x) * 3 + c] =
+            sum / 4.0f;
+      }
+    }
+  }
+  return image;
+}
+
+// the GGX lobe of `roughness` around each texel's direction, by importance
+// sampling `source` with the reflection and view along that direction
+auto prefilter_specular(const Image &source, float roughness, uint32_t width,
+                        uint32_t height) -> Image {
+  const uint32_t SampleCount = 64;
+  auto image = make_image(width, height);
+  ParallelForEach(0u, height, [&](uint32_t y) {
+    for (uint32_t x = 0; x < width; x++) {
+      const Vector3f normal =
+          to_direction((static_cast<float>(x) + 0.5f) / width,
+                       (static_cast<float>(y) + 0.5f) / height);
+      Vector3f sum = Vector3f::Zero();
+      float weight = 0.0f;
+      for (uint32_t i = 0; i < SampleCount; i++) {
+        auto half = sample_ggx(hammersley(i, SampleCount), roughness, normal);
+        const Vector3f light = 2.0f * normal.dot(half) * half - normal;
+        auto n_dot_l = normal.dot(light);
+        if (n_dot_l > 0.0f) {
+          sum += source.sample(light) * n_dot_l;
+          weight += n_dot_l;
+        }
+      }
+      const Vector3f value = weight > 0.0f ? Vector3f(sum / weight) : sum;
+      auto out = &image.rgb[(static_cast<size_t>(y) * width + x) * 3];
+      out[0] = value[0];
+      out[1] = value[1];
+      out[2] = value[2];
+    }
+  });
+  return image;
+}
+
+// the cosine weighted mean of `source` around each texel's direction
+auto prefilter_diffuse(const Image &source, uint32_t width, uint32_t height)
+    -> Image {
+  // directions and solid angles of the source texels
+  const auto count = static_cast<size_t>(source.width) * source.height;
+  vector<Vector3f> directions(count);
+  vector<float> solid_angles(count);
+  for (uint32_t y = 0; y < source.height; y++) {
+    auto v = (static_cast<float>(y) + 0.5f) / source.height;
+    for (uint32_t x = 0; x < source.width; x++) {
+      auto idx = static_cast<size_t>(y) * source.width + x;
+      directions[idx] =
+          to_direction((static_cast<float>(x) + 0.5f) / source.width, v);
+      solid_angles[idx] = sinf(v * PI);
+    }
+  }
+
+  auto image = make_image(width, height);
+  ParallelForEach(0u, height, [&](uint32_t y) {
+    for (uint32_t x = 0; x < width; x++) {
+      const Vector3f normal =
+          to_direction((static_cast<float>(x) + 0.5f) / width,
+                       (static_cast<float>(y) + 0.5f) / height);
+      Vector3f sum = Vector3f::Zero();
+      float weight = 0.0f;
+      for (size_t idx = 0; idx < count; idx++) {
+        auto cosine = normal.dot(directions[idx]);
+        if (cosine > 0.0f) {
+          auto w = cosine * solid_angles[idx];
+          sum += Map<const Vector3f>(&source.rgb[idx * 3]) * w;
+          weight += w;
+        }
+      }
+      const Vector3f value = weight > 0.0f ? Vector3f(sum / weight) : sum;
+      auto out = &image.rgb[(static_cast<size_t>(y) * width + x) * 3];
+      out[0] = value[0];
+      out[1] = value[1];
+      out[2] = value[2];
+    }
+  });
+  return image;
+}
+
+} // namespace
+
+auto BRDFLut::instance() -> const BRDFLut & {
+  static const BRDFLut lut;
+  return lut;
+}
+
+BRDFLut::BRDFLut() : scales(Size * Size), biases(Size * Size) {
+  const uint32_t SampleCount = 128;
+  const Vector3f normal(0.0f, 0.0f, 1.0f);
+  for (uint32_t j = 0; j < Size; j++) {
+    auto roughness = (static_cast<float>(j) + 0.5f) / Size;
+    // the geometry term of image based lighting, k = alpha / 2
+    auto k = roughness * roughness / 2.0f;
+    for (uint32_t i = 0; i < Size; i++) {
+      auto n_dot_v = (static_cast<float>(i) + 0.5f) / Size;
+      const Vector3f view(sqrtf(1.0f - n_dot_v * n_dot_v), 0.0f, n_dot_v);
+      float scale = 0.0f;
+      float bias = 0.0f;
+      for (uint32_t s = 0; s < SampleCount; s++) {
+        auto half = sample_ggx(hammersley(s, SampleCount), roughness, normal);
+        auto v_dot_h = view.dot(half);
+        const Vector3f light = 2.0f * v_dot_h * half - view;
+        auto n_dot_l = light[2];
+        if (n_dot_l <= 0.0f) {
+          continue;
+        }
+        auto g = n_dot_l / (n_dot_l * (1.0f - k) + k) * n_dot_v /
+                 (n_dot_v * (1.0f - k) + k);
+        auto visibility = g * v_dot_h / (half[2] * n_dot_v);
+        auto fresnel = powf(1.0f - v_dot_h, 5.0f);
+        scale += (1.0f - fresnel) * visibility;
+        bias += fresnel * visibility;
+      }
+      scales[j * Size + i] = scale / SampleCount;
+      biases[j * Size + i] = bias / SampleCount;
+    }
+  }
+}
+
+void BRDFLut::sample(float n_dot_v, float roughness, float &scale,
+                     float &bias) const {
+  // bilinear between texel centers
+  auto x = std::min(std::max(n_dot_v * Size - 0.5f, 0.0f), Size - 1.0f);
+  auto y = std::min(std::max(roughness * Size - 0.5f, 0.0f), Size - 1.0f);
+  auto x0 = std::min(static_cast<uint32_t>(x), Size - 2);
+  auto y0 = std::min(static_cast<uint32_t>(y), Size - 2);
+  auto fx = x - static_cast<float>(x0);
+  auto fy = y - static_cast<float>(y0);
+  auto lerp = [&](const vector<float> &table) {
+    auto row0 = &table[y0 * Size + x0];
+    auto row1 = row0 + Size;
+    return (row0[0] * (1.0f - fx) + row0[1] * fx) * (1.0f - fy) +
+           (row1[0] * (1.0f - fx) + row1[1] * fx) * fy;
+  };
+  scale = lerp(scales);
+  bias = lerp(biases);
+}
+
+Environment::Environment(const Texture &texture) {
+  if (texture.data == nullptr || texture.width == 0 || texture.height == 0) {
+    throw runtime_error("the environment texture is not decoded");
+  }
+
+  // a pyramid of the image, each level being sampled by the lobes about as
+  // wide as its texels
+  array<Image, Levels> pyramid;
+  pyramid[0] = resample(texture, 256, 128);
+  for (uint32_t level = 1; level < Levels; level++) {
+    pyramid[level] = halve(pyramid[level - 1]);
+  }
+
+  levels[0] = pyramid[0];
+  for (uint32_t level = 1; level < Levels; level++) {
+    auto roughness = static_cast<float>(level) / (Levels - 1);
+    auto &source = pyramid[level - 1];
+    levels[level] =
+        prefilter_specular(source, roughness, std::max(source.width / 2, 8u),
+                           std::max(source.height / 2, 4u));
+  }
+  diffuse = prefilter_diffuse(pyramid[3], 32, 16);
+}
+
+auto Environment::radiance(const Vector3f &direction, float roughness) const
+    -> Vector3f {
+  auto level = std::min(std::max(roughness, 0.0f), 1.0f) * (Levels - 1);
+  auto lower = std::min(static_cast<uint32_t>(level), Levels - 2);
+  auto t = level - static_cast<float>(lower);
+  return levels[lower].sample(direction) * (1.0f - t) +
+         levels[lower + 1].sample(direction) * t;
+}
+
+auto Environment::irradiance(const Vector3f &normal) const -> Vector3f {
+  return diffuse.sample(normal);
+}
+
+auto Environment::Image::sample(const Vector3f &direction) const
+    -> Vector3f {
+  // bilinear, wrapping around horizontally
+  auto u = atan2f(direction[0], -direction[2]) / (2.0f * PI) + 0.5f;
+  auto v = acosf(std::min(std::max(direction[1], -1.0f), 1.0f)) / PI;
+  auto x = u * width - 0.5f;
+  auto y = std::min(std::max(v * height - 0.5f, 0.0f), height - 1.0f);
+  auto x_floor = floorf(x);
+  auto fx = x - x_floor;
+  auto x0 = (static_cast<int>(x_floor) % static_cast<int>(width) +
+             static_cast<int>(width)) %
+            static_cast<int>(width);
+  auto x1 = (x0 + 1) % static_cast<int>(width);
+  auto y0 = static_cast<uint32_t>(y);
+  auto y1 = std::min(y0 + 1, height - 1);
+  auto fy = y - static_cast<float>(y0);
+  auto texel = [this](int tx, uint32_t ty) {
+    return Map<const Vector3f>(
+        &rgb[(static_cast<size_t>(ty) * width + static_cast<uint32_t>(tx)) *
+             3]);
+  };
+  return (texel(x0, y0) * (1.0f - fx) + texel(x1, y0) * fx) * (1.0f - fy) +
+         (texel(x0, y1) * (1.0f - fx) + texel(x1, y1) * fx) * fy;
+}
+
+} // namespace RB
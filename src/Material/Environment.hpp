@@ -0,0 +1,62 @@
+#pragma once
+#include <Eigen/Core>
+#include <RenderBoy/Texture.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace RB {
+
+// The split-sum approximation of the GGX specular integral: reflectance is
+// F0 * scale + bias, by the cosine between normal and view and by
+// roughness. Integrated once, on first use.
+class BRDFLut {
+public:
+  static constexpr uint32_t Size = 32;
+
+  static auto instance() -> const BRDFLut &;
+
+  void sample(float n_dot_v, float roughness, float &scale,
+              float &bias) const;
+
+private:
+  std::vector<float> scales;
+  std::vector<float> biases;
+
+  BRDFLut();
+};
+
+// Distant lighting from an equirectangular image, +y up, prefiltered for
+// GGX reflections at several roughnesses and for diffuse irradiance. The
+// images are float RGB, linear like the lights.
+class Environment {
+public:
+  static constexpr uint32_t Levels = 6;
+
+  // prefilters the decoded `texture`, in parallel over rows
+  explicit Environment(const Texture &texture);
+
+  // radiance reflected along the unit `direction` by a surface of
+  // `roughness`, interpolated between the prefiltered levels
+  auto radiance(const Eigen::Vector3f &direction, float roughness) const
+      -> Eigen::Vector3f;
+
+  // cosine weighted mean radiance around the unit `normal`, which times the
+  // albedo is the diffuse reflection
+  auto irradiance(const Eigen::Vector3f &normal) const -> Eigen::Vector3f;
+
+  struct Image {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<float> rgb;
+
+    auto sample(const Eigen::Vector3f &direction) const -> Eigen::Vector3f;
+  };
+
+private:
+  // level `i` is prefiltered for roughness i / (Levels - 1)
+  std::array<Image, Levels> levels;
+  Image diffuse;
+};
+
+} // namespace RB
@@ -0,0 +1,478 @@
+#include "Material/Lighting.hpp"
+#include <RenderBoy/utils.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+using namespace Eigen;
+
+namespace RB {
+
+namespace {
+
+void push(LightArrays &arrays, const Vector3f &position,
+          const Vector3f &radiance, const Vector3f &towards_light,
+          float cone_scale, float cone_offset, float range, int32_t shadow) {
+  arrays.x.push_back(position[0]);
+  arrays.y.push_back(position[1]);
+  arrays.z.push_back(position[2]);
+  arrays.r.push_back(radiance[0]);
+  arrays.g.push_back(radiance[1]);
+  arrays.b.push_back(radiance[2]);
+  arrays.dx.push_back(towards_light[0]);
+  arrays.dy.push_back(towards_light[1]);
+  arrays.dz.push_back(towards_light[2]);
+  arrays.cone_scale.push_back(cone_scale);
+  arrays.cone_offset.push_back(cone_offset);
+  range = std::max(range, 0.0f);
+  arrays.range.push_back(range);
+  arrays.inv_range2.push_back(range > 0.0f ? 1.0f / (range * range) : 0.0f);
+  arrays.shadow.push_back(shadow);
+}
+
+// Screen bounds in pixels, inclusive, of the cube around a light's range
+// seen through `matrix`; false when it is out of view. Like the culling of
+// draws, corners outside of one clip plane reject it and corners behind the
+// eye make it cover everything.
+auto get_screen_bounds(const Vector3f &center, float range,
+                       const Matrix4f &matrix, uint32_t width,
+                       uint32_t height, array<int, 4> &bounds) -> bool {
+  bounds = {0, 0, static_cast<int>(width) - 1, static_cast<int>(height) - 1};
+  if (range <= 0.0f) {
+    return true;
+  }
+
+  array<int, 5> outside = {0, 0, 0, 0, 0};
+  float min_x = 1.0f, min_y = 1.0f, max_x = -1.0f, max_y = -1.0f;
+  for (uint32_t corner = 0; corner < 8; corner++) {
+    const Vector4f position =
+        matrix * Vector4f(center[0] + ((corner & 1u) != 0 ? range : -range),
+                          center[1] + ((corner & 2u) != 0 ? range : -range),
+                          center[2] + ((corner & 4u) != 0 ? range : -range),
+                          1.0f);
+    outside[0] += position[0] < -position[3] ? 1 : 0;
+    outside[1] += position[0] > position[3] ? 1 : 0;
+    outside[2] += position[1] < -position[3] ? 1 : 0;
+    outside[3] += position[1] > position[3] ? 1 : 0;
+    outside[4] += position[3] <= 0.0f ? 1 : 0;
+    if (position[3] > 0.0f) {
+      min_x = std::min(min_x, position[0] / position[3]);
+      max_x = std::max(max_x, position[0] / position[3]);
+      min_y = std::min(min_y, position[1] / position[3]);
+      max_y = std::max(max_y, position[1] / position[3]);
+    }
+  }
+  if (std::find(outside.begin(), outside.end(), 8) != outside.end()) {
+    return false;
+  }
+  if (outside[4] > 0) {
+    return true;
+  }
+
+  // the pixel mapping of the rasterizer, widened by a pixel for rounding
+  auto to_pixel = [](float ndc, uint32_t size) {
+    return static_cast<int>(floorf((ndc + 1.0f) * static_cast<float>(size) /
+                                   2.0f));
+  };
+  bounds = {std::max(to_pixel(min_x, width) - 1, 0),
+            std::max(to_pixel(min_y, height) - 1, 0),
+            std::min(to_pixel(max_x, width) + 1, bounds[2]),
+            std::min(to_pixel(max_y, height) + 1, bounds[3])};
+  return bounds[0] <= bounds[2] && bounds[1] <= bounds[3];
+}
+
+// log2 and exp2 to about 1e-5, from the float's bits and polynomials
+// fitted on [0, 1], which unlike calls to powf the compiler vectorizes
+inline auto fast_log2(float x) -> float {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  auto exponent = static_cast<float>(static_cast<int32_t>(bits >> 23u) - 127);
+  bits = (bits & 0x007fffffu) | 0x3f800000u;
+  float t;
+  memcpy(&t, &bits, sizeof(t));
+  t -= 1.0f;
+  return exponent +
+         t * (1.4418255f +
+              t * (-0.7086789f +
+                   t * (0.4154112f + t * (-0.1944083f + t * 0.0458790f))));
+}
+
+inline auto fast_exp2(float x) -> float {
+  x = std::max(x, -126.0f);
+  auto integer = static_cast<int32_t>(x);
+  integer -= x < static_cast<float>(integer) ? 1 : 0;
+  auto t = x - static_cast<float>(integer);
+  auto fraction =
+      1.0000073f +
+      t * (0.6929314f + t * (0.2417100f + t * (0.0516670f + t * 0.0136766f)));
+  auto bits = static_cast<uint32_t>(integer + 127) << 23u;
+  float scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return scale * fraction;
+}
+
+// x^n for x in [0, 1]; 0 becomes a denormal rather than a branch
+inline auto fast_pow(float x, float n) -> float {
+  return fast_exp2(n * fast_log2(std::max(x, 1e-30f)));
+}
+
+// the visibility of lights casting no shadow
+struct Unshadowed {
+  auto operator[](uint32_t) const -> float { return 1.0f; }
+};
+
+// Calls `accumulate(arrays, l, i, x, y, z, attenuation)` for light `l` of
+// `arrays` and each of the first `count` surfaces `i` of `batch`, with the
+// unit direction towards the light and the unit normals `nx, ny, nz`. The
+// loops run over surfaces for each light so that, `accumulate` being
+// inlined, they vectorize; shadow maps are sampled in a scalar loop first.
+template <typename Batch, typename Accumulate>
+void for_each_light(const LightBuffer &lights,
+                    const vector<uint32_t> *local_lights,
+                    const vector<ShadowMap> *shadow_maps, const Batch &batch,
+                    uint32_t count, const float *nx, const float *ny,
+                    const float *nz, const Accumulate &accumulate) {
+  float shadows[Batch::Size];
+  // the visibility of light `l` from each surface, through its `maps` maps
+  auto get_shadows = [&](const LightArrays &arrays, size_t l, uint32_t maps) {
+    for (uint32_t i = 0; i < count; i++) {
+      shadows[i] = get_shadow(
+          *shadow_maps, static_cast<uint32_t>(arrays.shadow[l]), maps,
+          Vector3f(batch.px[i], batch.py[i], batch.pz[i]),
+          Vector3f(nx[i], ny[i], nz[i]));
+    }
+  };
+  auto is_shadowed = [shadow_maps](const LightArrays &arrays, size_t l) {
+    return shadow_maps != nullptr && arrays.shadow[l] >= 0;
+  };
+
+  auto &directional = lights.directional;
+  auto shade_directional = [&](size_t l, const auto &visibility) {
+    for (uint32_t i = 0; i < count; i++) {
+      accumulate(directional, l, i, directional.x[l], directional.y[l],
+                 directional.z[l], visibility[i]);
+    }
+  };
+  for (size_t l = 0; l < directional.size(); l++) {
+    if (is_shadowed(directional, l)) {
+      get_shadows(directional, l, ShadowCascades);
+      shade_directional(l, shadows);
+    } else {
+      shade_directional(l, Unshadowed());
+    }
+  }
+
+  auto &local = lights.local;
+  auto shade_local = [&](size_t l, const auto &visibility) {
+    for (uint32_t i = 0; i < count; i++) {
+      auto x = local.x[l] - batch.px[i];
+      auto y = local.y[l] - batch.py[i];
+      auto z = local.z[l] - batch.pz[i];
+      auto d2 = x * x + y * y + z * z + 1e-12f;
+      // (1 - (d / range)^4)^2, reaching 0 at the range
+      auto inv_range4 = local.inv_range2[l] * local.inv_range2[l];
+      auto window = std::max(1.0f - d2 * d2 * inv_range4, 0.0f);
+      auto inv_d = 1.0f / std::sqrt(d2);
+      x *= inv_d;
+      y *= inv_d;
+      z *= inv_d;
+      auto cone = (x * local.dx[l] + y * local.dy[l] + z * local.dz[l]) *
+                      local.cone_scale[l] +
+                  local.cone_offset[l];
+      cone = std::min(std::max(cone, 0.0f), 1.0f);
+      accumulate(local, l, i, x, y, z,
+                 cone * window * window / d2 * visibility[i]);
+    }
+  };
+  const auto local_count =
+      local_lights != nullptr ? local_lights->size() : local.size();
+  for (size_t k = 0; k < local_count; k++) {
+    const auto l = local_lights != nullptr ? (*local_lights)[k] : k;
+    if (is_shadowed(local, l)) {
+      get_shadows(local, l, 1);
+      shade_local(l, shadows);
+    } else {
+      shade_local(l, Unshadowed());
+    }
+  }
+}
+
+// unit normals and views of the first `count` surfaces of `batch`; a
+// missing normal lights nothing. The epsilons are added rather than taken as
+// maxima, which the compiler would turn back into branches around the
+// divisions.
+template <typename Batch>
+void normalize_surfaces(const Batch &batch, uint32_t count,
+                        const Vector3f &eye, float *nx, float *ny, float *nz,
+                        float *vx, float *vy, float *vz) {
+  const auto eye_x = eye[0];
+  const auto eye_y = eye[1];
+  const auto eye_z = eye[2];
+  for (uint32_t i = 0; i < count; i++) {
+    auto n2 = batch.nx[i] * batch.nx[i] + batch.ny[i] * batch.ny[i] +
+              batch.nz[i] * batch.nz[i];
+    auto n_scale = 1.0f / std::sqrt(n2 + 1e-30f);
+    nx[i] = batch.nx[i] * n_scale;
+    ny[i] = batch.ny[i] * n_scale;
+    nz[i] = batch.nz[i] * n_scale;
+
+    auto x = eye_x - batch.px[i];
+    auto y = eye_y - batch.py[i];
+    auto z = eye_z - batch.pz[i];
+    auto v_scale = 1.0f / std::sqrt(x * x + y * y + z * z + 1e-12f);
+    vx[i] = x * v_scale;
+    vy[i] = y * v_scale;
+    vz[i] = z * v_scale;
+  }
+}
+
+} // namespace
+
+LightBuffer::LightBuffer(const vector<Light> &lights) {
+  int32_t shadow_maps = 0;
+  // the first map of `light` when it casts shadows through `count` maps
+  auto add_shadow = [&](const Light &light, uint32_t count) {
+    if (!light.cast_shadows) {
+      return -1;
+    }
+    shadowed.push_back(light);
+    shadow_maps += static_cast<int32_t>(count);
+    return shadow_maps - static_cast<int32_t>(count);
+  };
+
+  for (auto &light : lights) {
+    if (!light.enabled) {
+      continue;
+    }
+    const Vector3f radiance = light.color * light.intensity;
+    const Vector3f towards = -light.direction.normalized();
+    switch (light.type) {
+    case Light::Type::Ambient:
+      ambient += radiance;
+      break;
+    case Light::Type::Direction:
+      push(directional, towards, radiance, towards, 0.0f, 1.0f, 0.0f,
+           add_shadow(light, ShadowCascades));
+      break;
+    case Light::Type::Point:
+      push(local, light.position, radiance, towards, 0.0f, 1.0f, light.range,
+           -1);
+      break;
+    case Light::Type::Spot: {
+      auto cos_inner = cosf(light.inner_angle);
+      auto cos_outer = cosf(std::max(light.outer_angle, light.inner_angle));
+      auto scale = 1.0f / std::max(cos_inner - cos_outer, 1e-4f);
+      push(local, light.position, radiance, towards, scale,
+           -cos_outer * scale, light.range, add_shadow(light, 1));
+      break;
+    }
+    case Light::Type::None:
+      break;
+    }
+  }
+}
+
+auto cull_lights(const LightBuffer &lights, const Matrix4f &matrix,
+                 uint32_t width, uint32_t height, uint32_t tile_size)
+    -> TiledLights {
+  auto &local = lights.local;
+  const auto light_count = static_cast<uint32_t>(local.size());
+  vector<array<int, 4>> bounds(light_count);
+  vector<uint8_t> visible(light_count);
+  ParallelForEach(0u, light_count, [&](uint32_t l) {
+    const Vector3f center(local.x[l], local.y[l], local.z[l]);
+    visible[l] = get_screen_bounds(center, local.range[l], matrix, width,
+                                   height, bounds[l])
+                     ? 1
+                     : 0;
+  });
+
+  // each row of tiles scans the lights on its own, keeping them in order
+  const auto columns = (width + tile_size - 1) / tile_size;
+  const auto rows = (height + tile_size - 1) / tile_size;
+  TiledLights tiled;
+  tiled.tiles.resize(columns * rows);
+  ParallelForEach(0u, rows, [&](uint32_t row) {
+    const auto top = static_cast<int>(row * tile_size);
+    const auto bottom = top + static_cast<int>(tile_size) - 1;
+    for (uint32_t l = 0; l < light_count; l++) {
+      auto &box = bounds[l];
+      if (visible[l] == 0 || box[1] > bottom || box[3] < top) {
+        continue;
+      }
+      const auto first = static_cast<uint32_t>(box[0]) / tile_size;
+      const auto last = static_cast<uint32_t>(box[2]) / tile_size;
+      for (auto column = first; column <= last; column++) {
+        tiled.tiles[column + row * columns].push_back(l);
+      }
+    }
+  });
+  return tiled;
+}
+
+void shade_blinn_phong(const LightBuffer &lights,
+                       const vector<uint32_t> *local_lights,
+                       const vector<ShadowMap> *shadow_maps,
+                       const Vector3f &eye, float shininess,
+                       SurfaceBatch &batch, uint32_t count) {
+  const uint32_t Size = SurfaceBatch::Size;
+  count = std::min(count, Size);
+
+  float nx[Size], ny[Size], nz[Size], vx[Size], vy[Size], vz[Size];
+  normalize_surfaces(batch, count, eye, nx, ny, nz, vx, vy, vz);
+
+  float diffuse_r[Size], diffuse_g[Size], diffuse_b[Size];
+  float specular_r[Size], specular_g[Size], specular_b[Size];
+  for (uint32_t i = 0; i < count; i++) {
+    diffuse_r[i] = lights.ambient[0];
+    diffuse_g[i] = lights.ambient[1];
+    diffuse_b[i] = lights.ambient[2];
+    specular_r[i] = specular_g[i] = specular_b[i] = 0.0f;
+  }
+
+  // accumulates light `l` of `arrays` arriving from `lx, ly, lz`, already
+  // scaled by its attenuation
+  auto accumulate = [&](const LightArrays &arrays, size_t l, uint32_t i,
+                        float lx, float ly, float lz, float attenuation) {
+    auto n_dot_l = nx[i] * lx + ny[i] * ly + nz[i] * lz;
+    auto hx = lx + vx[i];
+    auto hy = ly + vy[i];
+    auto hz = lz + vz[i];
+    auto h_scale = 1.0f / std::sqrt(hx * hx + hy * hy + hz * hz + 1e-12f);
+    auto n_dot_h = (nx[i] * hx + ny[i] * hy + nz[i] * hz) * h_scale;
+    auto facing = static_cast<float>(n_dot_l > 0.0f);
+    auto diffuse = std::max(n_dot_l, 0.0f) * attenuation;
+    auto specular =
+        fast_pow(std::max(n_dot_h, 0.0f), shininess) * facing * attenuation;
+    diffuse_r[i] += diffuse * arrays.r[l];
+    diffuse_g[i] += diffuse * arrays.g[l];
+    diffuse_b[i] += diffuse * arrays.b[l];
+    specular_r[i] += specular * arrays.r[l];
+    specular_g[i] += specular * arrays.g[l];
+    specular_b[i] += specular * arrays.b[l];
+  };
+
+  for_each_light(lights, local_lights, shadow_maps, batch, count, nx, ny, nz,
+                 accumulate);
+
+  for (uint32_t i = 0; i < count; i++) {
+    batch.r[i] = std::min(diffuse_r[i] * batch.diffuse_r[i] +
+                              specular_r[i] * batch.specular_r[i],
+                          1.0f);
+    batch.g[i] = std::min(diffuse_g[i] * batch.diffuse_g[i] +
+                              specular_g[i] * batch.specular_g[i],
+                          1.0f);
+    batch.b[i] = std::min(diffuse_b[i] * batch.diffuse_b[i] +
+                              specular_b[i] * batch.specular_b[i],
+                          1.0f);
+  }
+}
+
+void shade_metallic_roughness(const LightBuffer &lights,
+                              const vector<uint32_t> *local_lights,
+                              const vector<ShadowMap> *shadow_maps,
+                              const Environment *environment,
+                              const Vector3f &eye,
+                              MetallicRoughnessBatch &batch, uint32_t count) {
+  const uint32_t Size = MetallicRoughnessBatch::Size;
+  count = std::min(count, Size);
+
+  float nx[Size], ny[Size], nz[Size], vx[Size], vy[Size], vz[Size];
+  normalize_surfaces(batch, count, eye, nx, ny, nz, vx, vy, vz);
+
+  // the glTF BRDF inputs: diffuse color, reflectance at normal incidence,
+  // alpha squared and the k of Schlick-GGX for direct lights
+  float diffuse_r[Size], diffuse_g[Size], diffuse_b[Size];
+  float f0_r[Size], f0_g[Size], f0_b[Size];
+  float alpha2[Size], k[Size], n_dot_v[Size];
+  // accumulated on the stack, where stores cannot alias the lights
+  float out_r[Size], out_g[Size], out_b[Size];
+  for (uint32_t i = 0; i < count; i++) {
+    auto metallic = std::min(std::max(batch.metallic[i], 0.0f), 1.0f);
+    auto dielectric = 1.0f - metallic;
+    diffuse_r[i] = batch.albedo_r[i] * dielectric;
+    diffuse_g[i] = batch.albedo_g[i] * dielectric;
+    diffuse_b[i] = batch.albedo_b[i] * dielectric;
+    f0_r[i] = 0.04f * dielectric + batch.albedo_r[i] * metallic;
+    f0_g[i] = 0.04f * dielectric + batch.albedo_g[i] * metallic;
+    f0_b[i] = 0.04f * dielectric + batch.albedo_b[i] * metallic;
+    // perfectly smooth surfaces would reflect lights as infinitely thin
+    // peaks
+    auto roughness = std::min(std::max(batch.roughness[i], 0.045f), 1.0f);
+    batch.roughness[i] = roughness;
+    auto alpha = roughness * roughness;
+    alpha2[i] = alpha * alpha;
+    k[i] = (roughness + 1.0f) * (roughness + 1.0f) / 8.0f;
+    n_dot_v[i] =
+        std::max(nx[i] * vx[i] + ny[i] * vy[i] + nz[i] * vz[i], 1e-4f);
+    out_r[i] = out_g[i] = out_b[i] = 0.0f;
+  }
+
+  // direct lights, pi * BRDF * cosine, the pi of the lights' convention
+  // cancelling the one of the Lambertian and of the GGX distribution
+  auto accumulate = [&](const LightArrays &arrays, size_t l, uint32_t i,
+                        float lx, float ly, float lz, float attenuation) {
+    auto n_dot_l = nx[i] * lx + ny[i] * ly + nz[i] * lz;
+    auto hx = lx + vx[i];
+    auto hy = ly + vy[i];
+    auto hz = lz + vz[i];
+    auto h_scale = 1.0f / std::sqrt(hx * hx + hy * hy + hz * hz + 1e-12f);
+    auto n_dot_h = std::max((nx[i] * hx + ny[i] * hy + nz[i] * hz) * h_scale,
+                            0.0f);
+    auto v_dot_h = std::max((vx[i] * hx + vy[i] * hy + vz[i] * hz) * h_scale,
+                            0.0f);
+    auto facing = static_cast<float>(n_dot_l > 0.0f);
+    n_dot_l = std::max(n_dot_l, 0.0f);
+
+    auto d = n_dot_h * n_dot_h * (alpha2[i] - 1.0f) + 1.0f;
+    auto distribution = alpha2[i] / (d * d);
+    auto visibility = 0.25f / ((n_dot_l * (1.0f - k[i]) + k[i]) *
+                               (n_dot_v[i] * (1.0f - k[i]) + k[i]));
+    auto weight = n_dot_l * attenuation;
+    auto specular = distribution * visibility * weight * facing;
+    auto m = 1.0f - v_dot_h;
+    auto fresnel = m * m * m * m * m;
+
+    auto f_r = f0_r[i] + (1.0f - f0_r[i]) * fresnel;
+    auto f_g = f0_g[i] + (1.0f - f0_g[i]) * fresnel;
+    auto f_b = f0_b[i] + (1.0f - f0_b[i]) * fresnel;
+    out_r[i] += arrays.r[l] *
+                ((1.0f - f_r) * diffuse_r[i] * weight + f_r * specular);
+    out_g[i] += arrays.g[l] *
+                ((1.0f - f_g) * diffuse_g[i] * weight + f_g * specular);
+    out_b[i] += arrays.b[l] *
+                ((1.0f - f_b) * diffuse_b[i] * weight + f_b * specular);
+  };
+  for_each_light(lights, local_lights, shadow_maps, batch, count, nx, ny, nz,
+                 accumulate);
+
+  // the environment and ambient lights, split-sum, and emission; texture
+  // lookups do not vectorize, this loop is the scalar part
+  auto &lut = BRDFLut::instance();
+  for (uint32_t i = 0; i < count; i++) {
+    Vector3f radiance = lights.ambient;
+    Vector3f irradiance = lights.ambient;
+    if (environment != nullptr) {
+      const Vector3f normal(nx[i], ny[i], nz[i]);
+      const Vector3f view(vx[i], vy[i], vz[i]);
+      const Vector3f reflected = 2.0f * n_dot_v[i] * normal - view;
+      radiance += environment->radiance(reflected, batch.roughness[i]);
+      irradiance += environment->irradiance(normal);
+    }
+    float scale, bias;
+    lut.sample(n_dot_v[i], batch.roughness[i], scale, bias);
+    const Vector3f ambient =
+        (radiance.array() *
+             (Array3f(f0_r[i], f0_g[i], f0_b[i]) * scale + bias) +
+         irradiance.array() * Array3f(diffuse_r[i], diffuse_g[i], diffuse_b[i]))
+            .matrix() *
+        batch.occlusion[i];
+    batch.r[i] = out_r[i] + ambient[0] + batch.emissive_r[i];
+    batch.g[i] = out_g[i] + ambient[1] + batch.emissive_g[i];
+    batch.b[i] = out_b[i] + ambient[2] + batch.emissive_b[i];
+  }
+}
+
+} // namespace RB
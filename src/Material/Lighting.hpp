@@ -0,0 +1,122 @@
+#pragma once
+#include "Material/Environment.hpp"
+#include "Material/Shadows.hpp"
+#include <Eigen/Core>
+#include <RenderBoy/Light.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace RB {
+
+// One kind of light in structure-of-arrays form, so that shading reads each
+// component of consecutive lights contiguously.
+struct LightArrays {
+  // positions for point and spot lights, unit directions towards the light
+  // for directional ones
+  std::vector<float> x, y, z;
+  // color times intensity
+  std::vector<float> r, g, b;
+  // spot cones: -direction of the spot, and the factor is
+  // clamp(cos * cone_scale + cone_offset, 0, 1), 1 for point lights
+  std::vector<float> dx, dy, dz;
+  std::vector<float> cone_scale, cone_offset;
+  // 0 for lights reaching everything
+  std::vector<float> range, inv_range2;
+  // first shadow map of the light in the frame's, -1 without shadows
+  std::vector<int32_t> shadow;
+
+  auto size() const -> size_t { return x.size(); }
+};
+
+// The enabled lights of a frame, built once when they change and read by
+// every draw.
+struct LightBuffer {
+  Eigen::Vector3f ambient = Eigen::Vector3f::Zero();
+  LightArrays directional;
+  // point and spot lights
+  LightArrays local;
+  // the lights casting shadows, in the order of their maps
+  std::vector<Light> shadowed;
+
+  explicit LightBuffer(const std::vector<Light> &lights);
+};
+
+// The local lights reaching each screen tile of one view, tiles being
+// numbered row by row from the bottom left.
+struct TiledLights {
+  std::vector<std::vector<uint32_t>> tiles;
+};
+
+// Assigns the local lights of `lights` to the tiles of `tile_size` pixels
+// of a `width` by `height` view through `matrix`, by the screen bounds of
+// their range. Lights without a range go to every tile. Runs in parallel.
+auto cull_lights(const LightBuffer &lights, const Eigen::Matrix4f &matrix,
+                 uint32_t width, uint32_t height, uint32_t tile_size)
+    -> TiledLights;
+
+// The lights of a frame, per view their tiles, empty without local lights,
+// and the shadow maps rendered for it.
+struct FrameLights {
+  std::shared_ptr<const LightBuffer> buffer;
+  // where each view is seen from, in world space
+  std::vector<Eigen::Vector3f> eyes;
+  // the views themselves, from world to clip space
+  std::vector<Eigen::Matrix4f> matrices;
+  std::vector<TiledLights> views;
+  std::vector<ShadowMap> shadow_maps;
+  // may be null
+  std::shared_ptr<const Environment> environment;
+};
+
+// Inputs and outputs of Blinn-Phong shading for a batch of pixels or
+// vertices, in structure-of-arrays form.
+struct SurfaceBatch {
+  static constexpr uint32_t Size = 16;
+
+  float px[Size], py[Size], pz[Size];
+  float nx[Size], ny[Size], nz[Size]; // need not be normalized
+  float diffuse_r[Size], diffuse_g[Size], diffuse_b[Size];
+  float specular_r[Size], specular_g[Size], specular_b[Size];
+  float r[Size], g[Size], b[Size];
+};
+
+// Lights the first `count` surfaces of `batch` as seen from `eye` and writes
+// the clamped colors to its r, g and b. Of the local lights, only those
+// listed in `local_lights` are shaded, every one when it is null. Lights
+// casting shadows are filtered through `shadow_maps` unless it is null. The
+// loops run over the batch for each light, so the compiler vectorizes them
+// across surfaces.
+void shade_blinn_phong(const LightBuffer &lights,
+                       const std::vector<uint32_t> *local_lights,
+                       const std::vector<ShadowMap> *shadow_maps,
+                       const Eigen::Vector3f &eye, float shininess,
+                       SurfaceBatch &batch, uint32_t count);
+
+// Inputs and outputs of glTF metallic-roughness shading for a batch of
+// pixels, in structure-of-arrays form.
+struct MetallicRoughnessBatch {
+  static constexpr uint32_t Size = 16;
+
+  float px[Size], py[Size], pz[Size];
+  float nx[Size], ny[Size], nz[Size]; // need not be normalized
+  float albedo_r[Size], albedo_g[Size], albedo_b[Size];
+  float metallic[Size], roughness[Size], occlusion[Size];
+  float emissive_r[Size], emissive_g[Size], emissive_b[Size];
+  float r[Size], g[Size], b[Size];
+};
+
+// Shades the first `count` surfaces of `batch` with the GGX microfacet
+// model of glTF, the lights being selected and shadowed like for
+// Blinn-Phong. The environment, if any, and the ambient lights are
+// integrated with the split-sum approximation. Colors are left unclamped. A
+// light of color c lights a white diffuse surface facing it to c, like with
+// Blinn-Phong.
+void shade_metallic_roughness(const LightBuffer &lights,
+                              const std::vector<uint32_t> *local_lights,
+                              const std::vector<ShadowMap> *shadow_maps,
+                              const Environment *environment,
+                              const Eigen::Vector3f &eye,
+                              MetallicRoughnessBatch &batch, uint32_t count);
+
+} // namespace RB
@@ -0,0 +1,214 @@
+#include "Material/Shadows.hpp"
+#include <Eigen/Geometry>
+#include <Eigen/LU>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace Eigen;
+
+namespace RB {
+
+namespace {
+
+auto get_corner(const BoundingBox &box, uint32_t corner) -> Vector3f {
+  return {(corner & 1u) != 0 ? box.max[0] : box.min[0],
+          (corner & 2u) != 0 ? box.max[1] : box.min[1],
+          (corner & 4u) != 0 ? box.max[2] : box.min[2]};
+}
+
+// rows of a light's view space, its z axis pointing back to the light
+auto get_light_axes(const Vector3f &direction) -> Matrix3f {
+  const Vector3f z = -direction.normalized();
+  const Vector3f up = std::abs(z[1]) < 0.99f ? Vector3f(0.0f, 1.0f, 0.0f)
+                                              : Vector3f(1.0f, 0.0f, 0.0f);
+  const Vector3f x = up.cross(z).normalized();
+  const Vector3f y = z.cross(x);
+  Matrix3f axes;
+  axes << x.transpose(), y.transpose(), z.transpose();
+  return axes;
+}
+
+// the cascade seeing the sphere of `radius` around `center`, its depth
+// reaching the nearest of the scene corners to the light
+auto fit_sphere(const Matrix3f &axes, const Vector3f &center, float radius,
+                const BoundingBox &scene, ShadowMap &map) {
+  map.texel_size = 2.0f * radius / static_cast<float>(ShadowMap::Size);
+  map.perspective = false;
+
+  // moving by whole texels only, the edges of still shadows do not crawl
+  Vector3f light_center = axes * center;
+  light_center[0] = floorf(light_center[0] / map.texel_size) * map.texel_size;
+  light_center[1] = floorf(light_center[1] / map.texel_size) * map.texel_size;
+  auto nearest = light_center[2] + radius;
+  for (uint32_t corner = 0; corner < 8; corner++) {
+    nearest = std::max(nearest, axes.row(2).dot(get_corner(scene, corner)));
+  }
+  auto farthest = light_center[2] - radius;
+  auto depth = std::max(nearest - farthest, 1e-6f);
+
+  // the nearest depth maps to -1, like the near plane of the views
+  map.matrix = Matrix4f::Identity();
+  map.matrix.block<1, 3>(0, 0) = axes.row(0) / radius;
+  map.matrix(0, 3) = -light_center[0] / radius;
+  map.matrix.block<1, 3>(1, 0) = axes.row(1) / radius;
+  map.matrix(1, 3) = -light_center[1] / radius;
+  map.matrix.block<1, 3>(2, 0) = axes.row(2) * (-2.0f / depth);
+  map.matrix(2, 3) = (nearest + farthest) / depth;
+}
+
+} // namespace
+
+auto fit_cascades(const Vector3f &direction, const vector<Matrix4f> &views,
+                  const BoundingBox &scene,
+                  array<ShadowMap, ShadowCascades> &cascades) -> bool {
+  if (scene.min[0] > scene.max[0]) {
+    return false;
+  }
+
+  // the corners of every view's slice of each cascade
+  array<vector<Vector3f>, ShadowCascades> slices;
+  for (auto &view : views) {
+    // the frustum's corners on the near plane, and its edges through the
+    // middle depth, which stays finite with infinite far planes
+    const Matrix4f inverse = view.inverse();
+    auto unproject = [&inverse](float x, float y, float z) -> Vector3f {
+      const Vector4f position = inverse * Vector4f(x, y, z, 1.0f);
+      return position.head<3>() / position[3];
+    };
+    array<Vector3f, 4> near_corners, edges;
+    for (uint32_t corner = 0; corner < 4; corner++) {
+      auto x = (corner & 1u) != 0 ? 1.0f : -1.0f;
+      auto y = (corner & 2u) != 0 ? 1.0f : -1.0f;
+      near_corners[corner] = unproject(x, y, -1.0f);
+      edges[corner] = unproject(x, y, 0.0f) - near_corners[corner];
+    }
+    const Vector3f near_center = unproject(0.0f, 0.0f, -1.0f);
+    const Vector3f forward =
+        (unproject(0.0f, 0.0f, 0.0f) - near_center).normalized();
+
+    // the shadowed distance ends behind the farthest corner of the scene
+    auto distance = 0.0f;
+    for (uint32_t corner = 0; corner < 8; corner++) {
+      distance = std::max(
+          distance, forward.dot(get_corner(scene, corner) - near_center));
+    }
+    if (distance <= 0.0f) {
+      continue;
+    }
+
+    // halfway between even and logarithmic splits
+    auto get_split = [distance](uint32_t idx) {
+      auto t = static_cast<float>(idx) / ShadowCascades;
+      auto even = distance * t;
+      auto logarithmic = distance * 0.01f * powf(100.0f, t);
+      return idx == 0 ? 0.0f : 0.5f * (even + logarithmic);
+    };
+    for (uint32_t idx = 0; idx < ShadowCascades; idx++) {
+      for (uint32_t corner = 0; corner < 8; corner++) {
+        auto &edge = edges[corner % 4];
+        auto along = std::max(forward.dot(edge), 1e-6f);
+        slices[idx].push_back(near_corners[corner % 4] +
+                              edge * (get_split(idx + corner / 4) / along));
+      }
+    }
+  }
+  if (slices[0].empty()) {
+    return false;
+  }
+
+  const auto axes = get_light_axes(direction);
+  for (uint32_t idx = 0; idx < ShadowCascades; idx++) {
+    auto &corners = slices[idx];
+    Vector3f center = Vector3f::Zero();
+    for (auto &corner : corners) {
+      center += corner / static_cast<float>(corners.size());
+    }
+    auto radius = 1e-6f;
+    for (auto &corner : corners) {
+      radius = std::max(radius, (corner - center).norm());
+    }
+    fit_sphere(axes, center, radius, scene, cascades[idx]);
+  }
+  return true;
+}
+
+auto fit_spot(const Light &light, const BoundingBox &scene, ShadowMap &map)
+    -> bool {
+  const Vector3f direction = light.direction.normalized();
+  auto far = light.range;
+  if (far <= 0.0f) {
+    if (scene.min[0] > scene.max[0]) {
+      return false;
+    }
+    for (uint32_t corner = 0; corner < 8; corner++) {
+      far = std::max(far, direction.dot(get_corner(scene, corner) -
+                                        light.position));
+    }
+    if (far <= 0.0f) {
+      return false;
+    }
+  }
+  auto near = far * 0.005f;
+  // cones wider than a hemisphere are cut at 85 degrees
+  auto slope = tanf(std::min(std::max(light.outer_angle, light.inner_angle),
+                             1.48353f));
+
+  Matrix4f light_view = Matrix4f::Identity();
+  const auto axes = get_light_axes(direction);
+  light_view.topLeftCorner<3, 3>() = axes;
+  light_view.topRightCorner<3, 1>() = -axes * light.position;
+  Matrix4f projection = Matrix4f::Zero();
+  projection(0, 0) = 1.0f / slope;
+  projection(1, 1) = 1.0f / slope;
+  // linear depth, -1 at the near plane
+  projection(2, 2) = -2.0f / (far - near);
+  projection(2, 3) = -(far + near) / (far - near);
+  projection(3, 2) = -1.0f;
+
+  map.matrix = projection * light_view;
+  map.texel_size = 2.0f * slope / static_cast<float>(ShadowMap::Size);
+  map.perspective = true;
+  return true;
+}
+
+auto get_shadow(const vector<ShadowMap> &maps, uint32_t first,
+                uint32_t count, const Vector3f &position,
+                const Vector3f &normal) -> float {
+  const auto size = static_cast<int>(ShadowMap::Size);
+  for (auto idx = first; idx < first + count; idx++) {
+    auto &map = maps[idx];
+    if (map.depth.empty()) {
+      continue;
+    }
+    const Vector4f clip = map.matrix * position.homogeneous();
+    if (map.perspective && clip[3] <= 0.0f) {
+      continue;
+    }
+    auto texel = map.perspective ? map.texel_size * clip[3] : map.texel_size;
+    const Vector4f offset = map.matrix * (position + normal * (1.5f * texel))
+                                             .homogeneous();
+    const Vector2f ndc = offset.head<2>() / offset[3];
+    auto x = static_cast<int>(floorf((ndc[0] + 1.0f) * size / 2.0f));
+    auto y = static_cast<int>(floorf((ndc[1] + 1.0f) * size / 2.0f));
+    // the filter stays inside, farther cascades take the border
+    if (x < 1 || y < 1 || x > size - 2 || y > size - 2 || offset[2] < -1.0f ||
+        offset[2] > 1.0f) {
+      continue;
+    }
+
+    auto depth = -offset[2] + 1e-4f;
+    auto lit = 0;
+    for (auto dy = -1; dy <= 1; dy++) {
+      for (auto dx = -1; dx <= 1; dx++) {
+        auto occluder = map.depth[static_cast<size_t>((x + dx) +
+                                                      (y + dy) * size)];
+        lit += depth >= occluder ? 1 : 0;
+      }
+    }
+    return static_cast<float>(lit) / 9.0f;
+  }
+  return 1.0f;
+}
+
+} // namespace RB
@@ -0,0 +1,53 @@
+#pragma once
+#include <Eigen/Core>
+#include <RenderBoy/Geometry.hpp>
+#include <RenderBoy/Light.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace RB {
+
+// The depth of the scene seen from a light through `matrix`, from world to
+// clip space, except that its third row gives the depth itself rather than
+// depth times w: linear, it interpolates exactly across triangles. Like in
+// frames, larger depths are nearer, -FLT_MAX where nothing was drawn.
+struct ShadowMap {
+  static constexpr uint32_t Size = 1024;
+
+  Eigen::Matrix4f matrix = Eigen::Matrix4f::Identity();
+  // world size of a texel, at unit distance from the light for perspective
+  // maps
+  float texel_size = 0.0f;
+  bool perspective = false;
+  // empty when nothing could be fitted, everything is then lit
+  std::vector<float> depth;
+};
+
+// directional lights get one map per cascade, from the eye outwards
+constexpr uint32_t ShadowCascades = 3;
+
+// Fits the cascades of a directional light shining along `direction` to
+// the parts of the frusta of `views` in front of the `scene` box. Slices
+// grow with the distance and each map covers the bounding sphere of its
+// slice in every view, reaching back towards the light to keep every
+// caster. False when the scene has no bounds or no view sees it.
+auto fit_cascades(const Eigen::Vector3f &direction,
+                  const std::vector<Eigen::Matrix4f> &views,
+                  const BoundingBox &scene,
+                  std::array<ShadowMap, ShadowCascades> &cascades) -> bool;
+
+// Fits the map of a spot light to its outer cone, up to its range or to the
+// far side of the `scene` box. False when neither bounds it.
+auto fit_spot(const Light &light, const BoundingBox &scene, ShadowMap &map)
+    -> bool;
+
+// Fraction of the 3x3 texels around `position` lit in the first of the
+// `count` maps from `first` covering it, 1 outside of all of them. The
+// position is pushed along the unit `normal` by about a texel against
+// acne.
+auto get_shadow(const std::vector<ShadowMap> &maps, uint32_t first,
+                uint32_t count, const Eigen::Vector3f &position,
+                const Eigen::Vector3f &normal) -> float;
+
+} // namespace RB
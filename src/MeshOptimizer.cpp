@@ -0,0 +1,297 @@
+#include "RenderBoy/MeshOptimizer.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <deque>
+
+using namespace std;
+
+namespace RB {
+
+namespace {
+
+const int32_t CacheSize = 32;
+const float CacheDecayPower = 1.5f;
+const float LastTriangleScore = 0.75f;
+const float ValenceBoostScale = 2.0f;
+const float ValenceBoostPower = 0.5f;
+
+struct VertexState {
+  int32_t cache_position = -1;
+  uint32_t remaining = 0;
+  uint32_t first_triangle = 0; // into the vertex-triangle adjacency
+  float score = 0.0f;
+};
+
+auto vertex_score(const VertexState &vertex) -> float {
+  if (vertex.remaining == 0) {
+    return -1.0f;
+  }
+
+  auto score = 0.0f;
+  if (vertex.cache_position >= 0) {
+    if (vertex.cache_position < 3) {
+      // the triangle just added: its vertices are deliberately not favoured
+      score = LastTriangleScore;
+    } else {
+      auto scale = 1.0f / static_cast<float>(CacheSize - 3);
+      score = 1.0f - static_cast<float>(vertex.cache_position - 3) * scale;
+      score = powf(score, CacheDecayPower);
+    }
+  }
+
+  // favour vertices with few triangles left, to finish them off
+  score += ValenceBoostScale *
+           powf(static_cast<float>(vertex.remaining), -ValenceBoostPower);
+  return score;
+}
+
+auto read_indices(const Geometry &geometry, vector<uint32_t> &indices)
+    -> bool {
+  auto view = geometry.get_indices();
+  if (!view || view.count < 3) {
+    return false;
+  }
+  indices.resize(view.count - view.count % 3);
+  for (uint32_t i = 0; i < indices.size(); i++) {
+    indices[i] = view.get_index(i);
+    if (indices[i] >= geometry.vertex_count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+auto forsyth_order(const vector<uint32_t> &indices, uint32_t vertex_count)
+    -> vector<uint32_t> {
+  const auto triangle_count = static_cast<uint32_t>(indices.size() / 3);
+
+  vector<VertexState> vertices(vertex_count);
+  for (auto index : indices) {
+    vertices[index].remaining++;
+  }
+  uint32_t offset = 0;
+  for (auto &vertex : vertices) {
+    vertex.first_triangle = offset;
+    offset += vertex.remaining;
+  }
+  // triangles of each vertex, the live ones first
+  vector<uint32_t> adjacency(indices.size());
+  {
+    vector<uint32_t> fill(vertex_count, 0);
+    for (uint32_t triangle = 0; triangle < triangle_count; triangle++) {
+      for (uint32_t k = 0; k < 3; k++) {
+        auto index = indices[triangle * 3 + k];
+        adjacency[vertices[index].first_triangle + fill[index]++] = triangle;
+      }
+    }
+  }
+
+  for (auto &vertex : vertices) {
+    vertex.score = vertex_score(vertex);
+  }
+  vector<float> triangle_scores(triangle_count);
+  vector<bool> emitted(triangle_count, false);
+  for (uint32_t triangle = 0; triangle < triangle_count; triangle++) {
+    triangle_scores[triangle] = vertices[indices[triangle * 3]].score +
+                                vertices[indices[triangle * 3 + 1]].score +
+                                vertices[indices[triangle * 3 + 2]].score;
+  }
+
+  vector<uint32_t> order;
+  order.reserve(triangle_count);
+  vector<uint32_t> cache, next_cache;
+  cache.reserve(CacheSize + 3);
+  next_cache.reserve(CacheSize + 3);
+  int64_t best = -1;
+  uint32_t scan = 0;
+
+  while (order.size() < triangle_count) {
+    if (best < 0) {
+      // nothing in the cache helps, take the best remaining triangle
+      auto best_score = -FLT_MAX;
+      for (auto triangle = scan; triangle < triangle_count; triangle++) {
+        if (!emitted[triangle] && triangle_scores[triangle] > best_score) {
+          best_score = triangle_scores[triangle];
+          best = triangle;
+        }
+      }
+      while (scan < triangle_count && emitted[scan]) {
+        scan++;
+      }
+    }
+
+    auto triangle = static_cast<uint32_t>(best);
+    emitted[triangle] = true;
+    order.push_back(triangle);
+
+    // retire the triangle from its vertices and put them in front
+    next_cache.clear();
+    for (uint32_t k = 0; k < 3; k++) {
+      auto index = indices[triangle * 3 + k];
+      auto &vertex = vertices[index];
+      auto begin = adjacency.begin() + vertex.first_triangle;
+      auto end = begin + vertex.remaining;
+      auto it = find(begin, end, triangle);
+      iter_swap(it, end - 1);
+      vertex.remaining--;
+      next_cache.push_back(index);
+    }
+    for (auto index : cache) {
+      if (find(next_cache.begin(), next_cache.end(), index) ==
+          next_cache.end()) {
+        next_cache.push_back(index);
+      }
+    }
+
+    for (size_t position = 0; position < next_cache.size(); position++) {
+      auto &vertex = vertices[next_cache[position]];
+      vertex.cache_position =
+          position < CacheSize ? static_cast<int32_t>(position) : -1;
+      vertex.score = vertex_score(vertex);
+    }
+    if (next_cache.size() > CacheSize) {
+      next_cache.resize(CacheSize);
+    }
+    cache.swap(next_cache);
+
+    // only triangles touching the cache changed score
+    best = -1;
+    auto best_score = -1.0f;
+    for (auto index : cache) {
+      auto &vertex = vertices[index];
+      for (uint32_t t = 0; t < vertex.remaining; t++) {
+        auto other = adjacency[vertex.first_triangle + t];
+        auto score = vertices[indices[other * 3]].score +
+                     vertices[indices[other * 3 + 1]].score +
+                     vertices[indices[other * 3 + 2]].score;
+        triangle_scores[other] = score;
+        if (score > best_score) {
+          best_score = score;
+          best = other;
+        }
+      }
+    }
+  }
+
+  return order;
+}
+
+} // namespace
+
+auto analyze_vertex_cache(const Geometry &geometry, uint32_t cache_size)
+    -> VertexCacheStats {
+  VertexCacheStats stats;
+  vector<uint32_t> indices;
+  if (!read_indices(geometry, indices)) {
+    return stats;
+  }
+
+  deque<uint32_t> fifo;
+  vector<bool> used(geometry.vertex_count, false);
+  uint32_t transformed = 0, unique = 0;
+  for (auto index : indices) {
+    if (!used[index]) {
+      used[index] = true;
+      unique++;
+    }
+    if (find(fifo.begin(), fifo.end(), index) != fifo.end()) {
+      continue;
+    }
+    transformed++;
+    fifo.push_back(index);
+    if (fifo.size() > cache_size) {
+      fifo.pop_front();
+    }
+  }
+
+  stats.acmr = static_cast<float>(transformed) /
+               static_cast<float>(indices.size() / 3);
+  stats.atvr = static_cast<float>(transformed) / static_cast<float>(unique);
+  return stats;
+}
+
+auto optimize_vertex_cache(Geometry &geometry) -> bool {
+  vector<uint32_t> indices;
+  if (!read_indices(geometry, indices)) {
+    return false;
+  }
+
+  auto order = forsyth_order(indices, geometry.vertex_count);
+
+  // new vertex numbers in order of first use; unused vertices are dropped
+  const auto unused = UINT32_MAX;
+  vector<uint32_t> remap(geometry.vertex_count, unused);
+  uint32_t vertex_count = 0;
+  vector<uint32_t> optimized;
+  optimized.reserve(indices.size());
+  for (auto triangle : order) {
+    for (uint32_t k = 0; k < 3; k++) {
+      auto index = indices[triangle * 3 + k];
+      if (remap[index] == unused) {
+        remap[index] = vertex_count++;
+      }
+      optimized.push_back(remap[index]);
+    }
+  }
+
+  auto positions = geometry.get_positions();
+  auto normals = geometry.get_normals();
+  auto uvs = geometry.get_uvs();
+  vector<Vertex> vertices(vertex_count);
+  for (uint32_t index = 0; index < geometry.vertex_count; index++) {
+    if (remap[index] == unused) {
+      continue;
+    }
+    auto &vertex = vertices[remap[index]];
+    positions.read(index, vertex.position.data());
+    if (normals) {
+      normals.read(index, vertex.normal.data());
+    }
+    if (uvs) {
+      uvs.read(index, vertex.uv.data());
+    }
+  }
+
+  geometry.buffers = move(vertices);
+  geometry.indices = move(optimized);
+  geometry.position_view = AttributeView{};
+  geometry.normal_view = AttributeView{};
+  geometry.uv_view = AttributeView{};
+  geometry.index_view = AttributeView{};
+  geometry.vertex_count = vertex_count;
+  geometry.index_count = static_cast<uint32_t>(geometry.indices.size());
+  return true;
+}
+
+auto narrow_indices(Geometry &geometry) -> bool {
+  auto view = geometry.get_indices();
+  if (!view || view.type != ComponentType::UnsignedInt ||
+      geometry.vertex_count > 65536) {
+    return false;
+  }
+
+  auto compact = make_shared<vector<uint16_t>>(view.count);
+  for (uint32_t i = 0; i < view.count; i++) {
+    auto index = view.get_index(i);
+    if (index >= geometry.vertex_count) {
+      return false;
+    }
+    (*compact)[i] = static_cast<uint16_t>(index);
+  }
+
+  AttributeView compact_view;
+  compact_view.data = reinterpret_cast<const uint8_t *>(compact->data());
+  compact_view.count = view.count;
+  compact_view.stride = sizeof(uint16_t);
+  compact_view.components = 1;
+  compact_view.type = ComponentType::UnsignedShort;
+  compact_view.owner = move(compact);
+
+  geometry.indices.clear();
+  geometry.indices.shrink_to_fit();
+  geometry.index_view = move(compact_view);
+  return true;
+}
+
+} // namespace RB
@@ -0,0 +1,114 @@
+#include "Model/AssetRegistry.hpp"
+#include <cstring>
+
+using namespace std;
+
+namespace RB {
+
+namespace {
+
+// encoded textures never collide with arrays, whose formats fit in 56 bits
+const uint64_t TextureFormat = UINT64_MAX;
+
+auto hash_bytes(const uint8_t *bytes, size_t size, uint64_t seed)
+    -> uint64_t {
+  // 8 bytes per step, mixed like the finalizer of MurmurHash3
+  const uint64_t multiplier = 0xff51afd7ed558ccdull;
+  uint64_t hash = seed ^ (size * multiplier);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * multiplier;
+    hash ^= hash >> 29u;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * multiplier;
+  }
+  hash ^= hash >> 33u;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  return hash ^ (hash >> 33u);
+}
+
+} // namespace
+
+auto AssetRegistry::instance() -> AssetRegistry & {
+  // never destroyed, models may outlive other statics
+  static auto registry = new AssetRegistry();
+  return *registry;
+}
+
+auto AssetRegistry::intern(const shared_ptr<const void> &owner,
+                           const uint8_t *&data, size_t size, uint64_t format)
+    -> shared_ptr<const void> {
+  // hashing, the expensive part, runs outside of the lock
+  auto key = hash_bytes(data, size, format);
+
+  lock_guard<std::mutex> lock(mutex);
+  auto range = entries.equal_range(key);
+  for (auto it = range.first; it != range.second; it++) {
+    auto &entry = it->second;
+    if (entry.size != size || entry.format != format) {
+      continue;
+    }
+    auto shared = entry.owner.lock();
+    if (shared == nullptr) {
+      continue;
+    }
+    if (entry.data == data) {
+      // the same array, reached through another accessor or instance
+      return shared;
+    }
+    if (memcmp(entry.data, data, size) == 0) {
+      data = entry.data;
+      shared_bytes += size;
+      return shared;
+    }
+  }
+
+  // drop the entries of unloaded models once they may outnumber live ones
+  if (entries.size() >= next_sweep) {
+    for (auto it = entries.begin(); it != entries.end();) {
+      it = it->second.owner.expired() ? entries.erase(it) : next(it);
+    }
+    next_sweep = std::max<size_t>(1024, entries.size() * 2);
+  }
+  entries.emplace(key, Entry{owner, data, size, format});
+  return owner;
+}
+
+void AssetRegistry::share(AttributeView &view) {
+  if (!view || view.owner == nullptr || view.count == 0) {
+    return;
+  }
+  auto size = static_cast<size_t>(view.count - 1) * view.stride +
+              view.element_size();
+  auto format = static_cast<uint64_t>(view.type) |
+                static_cast<uint64_t>(view.components) << 8u |
+                static_cast<uint64_t>(view.normalized ? 1 : 0) << 16u |
+                static_cast<uint64_t>(view.stride) << 24u;
+  view.owner = intern(view.owner, view.data, size, format);
+}
+
+void AssetRegistry::share(Geometry &geometry) {
+  geometry.share_storage();
+  share(geometry.position_view);
+  share(geometry.normal_view);
+  share(geometry.uv_view);
+  share(geometry.index_view);
+}
+
+auto AssetRegistry::share(const shared_ptr<LazyTexture> &texture,
+                          const uint8_t *bytes, size_t size)
+    -> shared_ptr<LazyTexture> {
+  auto owner = intern(texture, bytes, size, TextureFormat);
+  // only textures are registered with this format
+  return static_pointer_cast<LazyTexture>(const_pointer_cast<void>(owner));
+}
+
+auto AssetRegistry::get_shared_bytes() const -> size_t {
+  lock_guard<std::mutex> lock(mutex);
+  return shared_bytes;
+}
+
+} // namespace RB
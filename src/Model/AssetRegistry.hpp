@@ -0,0 +1,57 @@
+#pragma once
+#include <RenderBoy/Geometry.hpp>
+#include <RenderBoy/TextureCache.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace RB {
+
+// Content-addressed sharing between every loader of the process: arrays and
+// encoded textures whose bytes were already loaded, by this model or another
+// one still alive, are replaced with the earlier copy. Entries are keyed by
+// a hash of the bytes and checked byte for byte, and only hold weak
+// references, so the registry never keeps an asset alive.
+class AssetRegistry {
+public:
+  static auto instance() -> AssetRegistry &;
+
+  // points `view` at an identical array registered before, or registers it;
+  // views without an owner are left alone
+  void share(AttributeView &view);
+
+  // shares the storage of `geometry` between its copies, then every view of
+  // it with the other loaded geometries
+  void share(Geometry &geometry);
+
+  // the lazy texture decoding the same `size` encoded bytes at `bytes`, or
+  // `texture` once registered; `texture` keeps those bytes alive
+  auto share(const std::shared_ptr<LazyTexture> &texture,
+             const uint8_t *bytes, size_t size)
+      -> std::shared_ptr<LazyTexture>;
+
+  // bytes of the arrays and encoded textures found already loaded so far
+  auto get_shared_bytes() const -> size_t;
+
+private:
+  struct Entry {
+    std::weak_ptr<const void> owner;
+    const uint8_t *data;
+    size_t size;
+    uint64_t format; // how the bytes are read, only equal formats match
+  };
+
+  mutable std::mutex mutex;
+  std::unordered_multimap<uint64_t, Entry> entries;
+  size_t next_sweep = 1024;
+  size_t shared_bytes = 0;
+
+  // the owner of a live entry equal to `size` bytes at `data`, pointing
+  // `data` at its bytes; registers `owner` and returns it when there is none
+  auto intern(const std::shared_ptr<const void> &owner, const uint8_t *&data,
+              size_t size, uint64_t format) -> std::shared_ptr<const void>;
+};
+
+} // namespace RB
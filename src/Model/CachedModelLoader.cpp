@@ -0,0 +1,678 @@
+#include "Model/CachedModelLoader.hpp"
+#include "Model/AssetRegistry.hpp"
+#include <RenderBoy/TextureCache.hpp>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sys/stat.h>
+#include <tuple>
+
+using namespace std;
+using namespace Eigen;
+
+namespace RB {
+
+namespace {
+
+const char CacheMagic[8] = {'R', 'B', 'C', 'A', 'C', 'H', 'E', '\0'};
+// bump whenever a record layout below changes
+const uint32_t CacheVersion = 7;
+const size_t CacheAlignment = 16;
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t texture_count;
+  uint32_t material_count;
+  uint32_t mesh_count;
+  uint32_t geometry_count;
+  uint32_t dependency_count;
+  uint32_t options; // loader options the model was built with
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t source_hash;
+  uint64_t textures;
+  uint64_t materials;
+  uint64_t meshes;
+  uint64_t geometries;
+  uint64_t dependencies;
+  float box[6];
+  // ACMR and ATVR before then after optimizing the meshes
+  float vertex_cache[4];
+};
+
+// a file the source refers to, keyed like the source itself
+struct DependencyRecord {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t hash;
+  uint64_t path;
+  uint32_t path_length;
+  uint32_t reserved;
+};
+
+struct TextureRecord {
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  uint32_t reserved;
+  uint64_t data;
+};
+
+struct MaterialRecord {
+  float base_color[4];
+  float emissive[4];
+  float alpha_cutoff;
+  uint32_t alpha_mode;
+  float metallic;
+  float roughness;
+  float normal_scale;
+  float occlusion_strength;
+  // indices of the texture records, -1 when unset, in the order of
+  // get_texture_slots
+  int32_t textures[5];
+};
+
+// the texture pointers of `material`, in the order they are cached
+template <typename M>
+auto get_texture_slots(M &material)
+    -> array<decltype(&material.base_color_texture), 5> {
+  return {{&material.base_color_texture, &material.metallic_roughness_texture,
+           &material.normal_texture, &material.emissive_texture,
+           &material.occlusion_texture}};
+}
+
+struct MeshRecord {
+  float model_matrix[16];
+  float box[6];
+  uint32_t first_geometry;
+  uint32_t geometry_count;
+};
+
+// how the elements of an attribute array are stored
+struct FormatRecord {
+  uint8_t type; // ComponentType
+  uint8_t normalized;
+  uint16_t stride;
+};
+
+// offsets of packed arrays, 0 when the attribute is absent
+struct GeometryRecord {
+  uint32_t vertex_count;
+  uint32_t index_count;
+  int32_t material;
+  FormatRecord position_format;
+  FormatRecord normal_format;
+  FormatRecord uv_format;
+  FormatRecord index_format;
+  float box[6];
+  uint32_t padding;
+  uint64_t positions;
+  uint64_t normals;
+  uint64_t uvs;
+  uint64_t indices;
+};
+
+auto valid_index_format(const FormatRecord &format) -> bool {
+  auto type = static_cast<ComponentType>(format.type);
+  return (type == ComponentType::UnsignedInt ||
+          type == ComponentType::UnsignedShort ||
+          type == ComponentType::UnsignedByte) &&
+         format.stride == component_size(type);
+}
+
+auto hash_bytes(const uint8_t *bytes, size_t size) -> uint64_t {
+  // 64 bits FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+auto hash_string(const string &text) -> uint64_t {
+  return hash_bytes(reinterpret_cast<const uint8_t *>(text.data()),
+                    text.size());
+}
+
+auto hash_file(const string &file_path) -> uint64_t {
+  MappedFile file(file_path);
+  return hash_bytes(file.data(), file.size());
+}
+
+// whether the file at `file_path` still is the one `record` describes; its
+// content is only hashed when its modification time changed
+auto is_unchanged(const string &file_path, const DependencyRecord &record)
+    -> bool {
+  struct stat info {};
+  if (stat(file_path.c_str(), &info) != 0 ||
+      static_cast<uint64_t>(info.st_size) != record.size) {
+    return false;
+  }
+  if (static_cast<int64_t>(info.st_mtime) == record.mtime) {
+    return true;
+  }
+  try {
+    return hash_file(file_path) == record.hash;
+  } catch (const runtime_error &) {
+    return false;
+  }
+}
+
+void write_box(float *target, const BoundingBox &box) {
+  for (size_t i = 0; i < 3; i++) {
+    target[i] = box.min[i];
+    target[i + 3] = box.max[i];
+  }
+}
+
+auto read_box(const float *source) -> BoundingBox {
+  BoundingBox box;
+  box.min = {source[0], source[1], source[2]};
+  box.max = {source[3], source[4], source[5]};
+  return box;
+}
+
+class Blob {
+public:
+  // appends `size` bytes of `data`, or zeros without `data`
+  auto append(const void *data, size_t size) -> uint64_t {
+    bytes.resize((bytes.size() + CacheAlignment - 1) / CacheAlignment *
+                 CacheAlignment);
+    auto offset = bytes.size();
+    bytes.resize(offset + size);
+    if (data != nullptr && size > 0) {
+      memcpy(bytes.data() + offset, data, size);
+    }
+    return offset;
+  }
+
+  // packs the elements of `view` in their own type, each padded to
+  // `alignment` bytes; 4 is what glTF does for vertex attributes. Views
+  // shared by several geometries, like the instances of a mesh, are
+  // written once.
+  auto append_attribute(const AttributeView &view, FormatRecord &format,
+                        uint32_t alignment = 4) -> uint64_t {
+    if (!view) {
+      return 0;
+    }
+    auto key = make_tuple(view.data, view.count, view.stride, view.type,
+                          alignment);
+    auto written = attributes.find(key);
+    if (written != attributes.end()) {
+      format = written->second.second;
+      return written->second.first;
+    }
+    auto element_size = view.element_size();
+    auto stride = (element_size + alignment - 1) / alignment * alignment;
+    format.type = static_cast<uint8_t>(view.type);
+    format.normalized = view.normalized ? 1 : 0;
+    format.stride = static_cast<uint16_t>(stride);
+    auto offset = append(nullptr, static_cast<size_t>(view.count) * stride);
+    for (uint32_t i = 0; i < view.count; i++) {
+      memcpy(bytes.data() + offset + static_cast<size_t>(i) * stride,
+             view.get<uint8_t>(i), element_size);
+    }
+    attributes.emplace(key, make_pair(offset, format));
+    return offset;
+  }
+
+  template <typename T> auto at(uint64_t offset) -> T * {
+    return reinterpret_cast<T *>(bytes.data() + offset);
+  }
+
+  vector<uint8_t> bytes;
+
+private:
+  map<tuple<const uint8_t *, uint32_t, uint32_t, ComponentType, uint32_t>,
+      pair<uint64_t, FormatRecord>>
+      attributes;
+};
+
+} // namespace
+
+CachedModelLoader::CachedModelLoader(unique_ptr<IModelLoader> _source)
+    : source(move(_source)) {}
+
+auto CachedModelLoader::get_cache_path() const -> string {
+  auto dir_env = getenv("RENDERBOY_CACHE_DIR");
+  if (dir_env == nullptr || *dir_env == '\0') {
+    return path + ".rbcache";
+  }
+
+  // a shared directory may hold caches of files with the same name
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx",
+           static_cast<unsigned long long>(hash_string(path)));
+  auto idx = path.find_last_of('/');
+  auto base = idx == string::npos ? path : path.substr(idx + 1);
+  return string(dir_env) + "/" + base + "-" + name + ".rbcache";
+}
+
+auto CachedModelLoader::load() -> Model & { return load_cached(nullptr); }
+
+auto CachedModelLoader::load_progressive(ModelStream &stream) -> Model & {
+  return load_cached(&stream);
+}
+
+auto CachedModelLoader::load_cached(ModelStream *stream) -> Model & {
+  source->set_path(path);
+  source->set_lazy_textures(lazy_textures);
+  source->set_optimize_meshes(optimize_meshes);
+  source->set_keep_quantized(keep_quantized);
+  source->set_compact_indices(compact_indices);
+  source->set_share_assets(share_assets);
+  auto load_source = [this, stream]() -> Model & {
+    return stream == nullptr ? source->load() : source->load_progressive(*stream);
+  };
+
+  auto cache_env = getenv("RENDERBOY_MODEL_CACHE");
+  if (cache_env != nullptr && strcmp(cache_env, "off") == 0) {
+    loaded = &load_source();
+    vertex_cache_stats = source->get_vertex_cache_stats();
+    return *loaded;
+  }
+
+  struct stat info {};
+  if (stat(path.c_str(), &info) != 0) {
+    throw runtime_error("cannot open " + path);
+  }
+  SourceKey key;
+  key.size = static_cast<uint64_t>(info.st_size);
+  key.mtime = static_cast<int64_t>(info.st_mtime);
+
+  auto cache_path = get_cache_path();
+  if (read_cache(cache_path, key)) {
+    loaded = &model;
+    if (stream != nullptr) {
+      stream->add_meshes(model.meshes);
+    }
+    return model;
+  }
+
+  if (key.hash == 0) {
+    key.hash = hash_file(path);
+  }
+
+  loaded = &load_source();
+  vertex_cache_stats = source->get_vertex_cache_stats();
+  write_cache(cache_path, key, *loaded);
+  return *loaded;
+}
+
+auto CachedModelLoader::read_cache(const string &cache_path, SourceKey &key)
+    -> bool {
+  shared_ptr<MappedFile> cache;
+  try {
+    cache = make_shared<MappedFile>(cache_path);
+  } catch (const runtime_error &) {
+    return false;
+  }
+
+  auto bytes = cache->data();
+  auto size = cache->size();
+  if (size < sizeof(CacheHeader)) {
+    return false;
+  }
+
+  auto header = reinterpret_cast<const CacheHeader *>(bytes);
+  if (memcmp(header->magic, CacheMagic, sizeof(CacheMagic)) != 0 ||
+      header->version != CacheVersion || header->options != get_options() ||
+      header->source_size != key.size) {
+    return false;
+  }
+
+  // a touched but otherwise identical source keeps its cache
+  if (header->source_mtime != key.mtime) {
+    key.hash = hash_file(path);
+    if (header->source_hash != key.hash) {
+      return false;
+    }
+  }
+
+  auto in_bounds = [size](uint64_t offset, uint64_t length) {
+    return offset <= size && length <= size - offset;
+  };
+
+  // so does every external buffer and image
+  if (!in_bounds(header->dependencies,
+                 header->dependency_count * sizeof(DependencyRecord))) {
+    return false;
+  }
+  auto dependency_records =
+      reinterpret_cast<const DependencyRecord *>(bytes + header->dependencies);
+  for (uint32_t i = 0; i < header->dependency_count; i++) {
+    auto &record = dependency_records[i];
+    if (!in_bounds(record.path, record.path_length) ||
+        !is_unchanged(string(reinterpret_cast<const char *>(bytes) +
+                                 record.path,
+                             record.path_length),
+                      record)) {
+      return false;
+    }
+  }
+  if (!in_bounds(header->textures,
+                 header->texture_count * sizeof(TextureRecord)) ||
+      !in_bounds(header->materials,
+                 header->material_count * sizeof(MaterialRecord)) ||
+      !in_bounds(header->meshes, header->mesh_count * sizeof(MeshRecord)) ||
+      !in_bounds(header->geometries,
+                 header->geometry_count * sizeof(GeometryRecord))) {
+    return false;
+  }
+
+  auto texture_records =
+      reinterpret_cast<const TextureRecord *>(bytes + header->textures);
+  vector<Texture> cached_textures(header->texture_count);
+  for (uint32_t i = 0; i < header->texture_count; i++) {
+    auto &record = texture_records[i];
+    if (!in_bounds(record.data, static_cast<uint64_t>(record.width) *
+                                    record.height * record.channels)) {
+      return false;
+    }
+    auto &texture = cached_textures[i];
+    texture.width = record.width;
+    texture.height = record.height;
+    texture.channels = static_cast<uint8_t>(record.channels);
+    // textures are only ever read, the mapping itself is read-only
+    texture.data = const_cast<uint8_t *>(bytes + record.data);
+  }
+
+  auto material_records =
+      reinterpret_cast<const MaterialRecord *>(bytes + header->materials);
+  vector<Material> materials(header->material_count);
+  for (uint32_t i = 0; i < header->material_count; i++) {
+    auto &record = material_records[i];
+    auto &material = materials[i];
+    for (size_t c = 0; c < 4; c++) {
+      material.base_color[c] = record.base_color[c];
+      material.emissive[c] = record.emissive[c];
+    }
+    material.AlphaCutoff = record.alpha_cutoff;
+    material.alpha_mode = static_cast<Material::AlphaMode>(record.alpha_mode);
+    material.metallic = record.metallic;
+    material.roughness = record.roughness;
+    material.normal_scale = record.normal_scale;
+    material.occlusion_strength = record.occlusion_strength;
+    auto slots = get_texture_slots(material);
+    for (size_t t = 0; t < slots.size(); t++) {
+      auto texture_idx = record.textures[t];
+      if (texture_idx < 0) {
+        continue;
+      }
+      if (static_cast<uint32_t>(texture_idx) >= header->texture_count) {
+        return false;
+      }
+      *slots[t] = &cached_textures[static_cast<size_t>(texture_idx)];
+    }
+  }
+
+  // arrays written once for several geometries are also shared once
+  map<pair<uint64_t, uint32_t>, AttributeView> shared_views;
+  auto make_view = [&](uint64_t offset, uint32_t count, uint8_t components,
+                       const FormatRecord &format, AttributeView &view) {
+    if (offset == 0) {
+      return true;
+    }
+    auto shared = shared_views.find(make_pair(offset, count));
+    if (shared != shared_views.end() &&
+        shared->second.components == components) {
+      view = shared->second;
+      return true;
+    }
+    if (format.type > static_cast<uint8_t>(ComponentType::Byte)) {
+      return false;
+    }
+    auto type = static_cast<ComponentType>(format.type);
+    if (format.stride < components * component_size(type) ||
+        !in_bounds(offset, static_cast<uint64_t>(count) * format.stride)) {
+      return false;
+    }
+    view.owner = shared_ptr<const void>(cache, bytes + offset);
+    view.data = bytes + offset;
+    view.count = count;
+    view.stride = format.stride;
+    view.components = components;
+    view.type = type;
+    view.normalized = format.normalized != 0;
+    if (share_assets) {
+      AssetRegistry::instance().share(view);
+    }
+    shared_views[make_pair(offset, count)] = view;
+    return true;
+  };
+
+  auto geometry_records =
+      reinterpret_cast<const GeometryRecord *>(bytes + header->geometries);
+  auto mesh_records =
+      reinterpret_cast<const MeshRecord *>(bytes + header->meshes);
+  Model cached_model;
+  cached_model.box = read_box(header->box);
+  for (size_t i = 0; i < vertex_cache_stats.size(); i++) {
+    vertex_cache_stats[i].acmr = header->vertex_cache[2 * i];
+    vertex_cache_stats[i].atvr = header->vertex_cache[2 * i + 1];
+  }
+  cached_model.meshes.resize(header->mesh_count);
+  for (uint32_t i = 0; i < header->mesh_count; i++) {
+    auto &record = mesh_records[i];
+    auto &mesh = cached_model.meshes[i];
+    if (record.first_geometry > header->geometry_count ||
+        record.geometry_count > header->geometry_count - record.first_geometry) {
+      return false;
+    }
+    mesh.model_matrix = Map<const Matrix4f>(record.model_matrix);
+    mesh.box = read_box(record.box);
+
+    for (uint32_t g = 0; g < record.geometry_count; g++) {
+      auto &geometry_record = geometry_records[record.first_geometry + g];
+      Geometry geometry;
+      geometry.vertex_count = geometry_record.vertex_count;
+      geometry.index_count = geometry_record.index_count;
+      geometry.box = read_box(geometry_record.box);
+      if (geometry_record.material >= 0) {
+        if (static_cast<uint32_t>(geometry_record.material) >=
+            header->material_count) {
+          return false;
+        }
+        geometry.material =
+            materials[static_cast<size_t>(geometry_record.material)];
+      }
+
+      auto vertex_count = geometry_record.vertex_count;
+      if (geometry_record.positions == 0 ||
+          !make_view(geometry_record.positions, vertex_count, 3,
+                     geometry_record.position_format,
+                     geometry.position_view) ||
+          !make_view(geometry_record.normals, vertex_count, 3,
+                     geometry_record.normal_format, geometry.normal_view) ||
+          !make_view(geometry_record.uvs, vertex_count, 2,
+                     geometry_record.uv_format, geometry.uv_view) ||
+          (geometry_record.indices != 0 &&
+           !valid_index_format(geometry_record.index_format)) ||
+          !make_view(geometry_record.indices, geometry_record.index_count, 1,
+                     geometry_record.index_format, geometry.index_view)) {
+        return false;
+      }
+      mesh.geometries.emplace_back(move(geometry));
+    }
+  }
+
+  file = move(cache);
+  textures = move(cached_textures);
+  model = move(cached_model);
+  return true;
+}
+
+void CachedModelLoader::write_cache(const string &cache_path,
+                                    const SourceKey &key,
+                                    const Model &source_model) const {
+  Blob blob;
+  blob.append(nullptr, sizeof(CacheHeader));
+
+  map<const Texture *, int32_t> texture_ids;
+  vector<const Texture *> texture_list;
+  vector<MaterialRecord> material_records;
+  vector<MeshRecord> mesh_records;
+  vector<GeometryRecord> geometry_records;
+
+  for (auto &mesh : source_model.meshes) {
+    MeshRecord mesh_record{};
+    Map<Matrix4f>(mesh_record.model_matrix) = mesh.model_matrix;
+    write_box(mesh_record.box, mesh.box);
+    mesh_record.first_geometry =
+        static_cast<uint32_t>(geometry_records.size());
+    mesh_record.geometry_count = static_cast<uint32_t>(mesh.geometries.size());
+    mesh_records.push_back(mesh_record);
+
+    for (auto &geometry : mesh.geometries) {
+      auto &material = geometry.material;
+      MaterialRecord material_record{};
+      for (size_t c = 0; c < 4; c++) {
+        material_record.base_color[c] = material.base_color[c];
+        material_record.emissive[c] = material.emissive[c];
+      }
+      material_record.alpha_cutoff = material.AlphaCutoff;
+      material_record.alpha_mode = static_cast<uint32_t>(material.alpha_mode);
+      material_record.metallic = material.metallic;
+      material_record.roughness = material.roughness;
+      material_record.normal_scale = material.normal_scale;
+      material_record.occlusion_strength = material.occlusion_strength;
+      auto slots = get_texture_slots(material);
+      for (size_t t = 0; t < slots.size(); t++) {
+        auto texture = *slots[t];
+        material_record.textures[t] = -1;
+        if (texture == nullptr) {
+          continue;
+        }
+        auto res = texture_ids.emplace(
+            texture, static_cast<int32_t>(texture_list.size()));
+        if (res.second) {
+          texture_list.push_back(texture);
+        }
+        material_record.textures[t] = res.first->second;
+      }
+      material_records.push_back(material_record);
+
+      GeometryRecord record{};
+      record.vertex_count = geometry.vertex_count;
+      record.index_count = geometry.index_count;
+      record.material = static_cast<int32_t>(material_records.size() - 1);
+      write_box(record.box, geometry.box);
+      record.positions = blob.append_attribute(geometry.get_positions(),
+                                               record.position_format);
+      record.normals =
+          blob.append_attribute(geometry.get_normals(), record.normal_format);
+      record.uvs = blob.append_attribute(geometry.get_uvs(), record.uv_format);
+      // indices stay in their own width, tightly packed as the contexts
+      // read them
+      record.indices = blob.append_attribute(geometry.get_indices(),
+                                             record.index_format, 1);
+      geometry_records.push_back(record);
+    }
+  }
+
+  vector<TextureRecord> texture_records;
+  for (auto source_texture : texture_list) {
+    // the cache stores decoded pixels, lazy textures are decoded once here
+    auto texture = TextureCache::instance().acquire(*source_texture);
+    // rather than caching the placeholder of a texture that failed
+    auto error = TextureCache::instance().get_error(*source_texture);
+    if (error != nullptr) {
+      rethrow_exception(error);
+    }
+    TextureRecord record{};
+    record.width = texture->width;
+    record.height = texture->height;
+    record.channels = texture->channels;
+    record.data = blob.append(texture->data, static_cast<size_t>(record.width) *
+                                                 record.height *
+                                                 record.channels);
+    texture_records.push_back(record);
+  }
+
+  // unreadable dependencies are left to the loader that needed them
+  vector<DependencyRecord> dependency_records;
+  for (auto &dependency : source->get_dependencies()) {
+    struct stat info {};
+    if (stat(dependency.c_str(), &info) != 0) {
+      continue;
+    }
+    DependencyRecord record{};
+    record.size = static_cast<uint64_t>(info.st_size);
+    record.mtime = static_cast<int64_t>(info.st_mtime);
+    try {
+      record.hash = hash_file(dependency);
+    } catch (const runtime_error &) {
+      continue;
+    }
+    record.path = blob.append(dependency.data(), dependency.size());
+    record.path_length = static_cast<uint32_t>(dependency.size());
+    dependency_records.push_back(record);
+  }
+
+  CacheHeader header{};
+  memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+  header.version = CacheVersion;
+  header.options = get_options();
+  header.texture_count = static_cast<uint32_t>(texture_records.size());
+  header.material_count = static_cast<uint32_t>(material_records.size());
+  header.mesh_count = static_cast<uint32_t>(mesh_records.size());
+  header.geometry_count = static_cast<uint32_t>(geometry_records.size());
+  header.dependency_count = static_cast<uint32_t>(dependency_records.size());
+  header.source_size = key.size;
+  header.source_mtime = key.mtime;
+  header.source_hash = key.hash;
+  header.textures = blob.append(
+      texture_records.data(), texture_records.size() * sizeof(TextureRecord));
+  header.materials =
+      blob.append(material_records.data(),
+                  material_records.size() * sizeof(MaterialRecord));
+  header.meshes = blob.append(mesh_records.data(),
+                              mesh_records.size() * sizeof(MeshRecord));
+  header.geometries =
+      blob.append(geometry_records.data(),
+                  geometry_records.size() * sizeof(GeometryRecord));
+  header.dependencies =
+      blob.append(dependency_records.data(),
+                  dependency_records.size() * sizeof(DependencyRecord));
+  write_box(header.box, source_model.box);
+  for (size_t i = 0; i < vertex_cache_stats.size(); i++) {
+    header.vertex_cache[2 * i] = vertex_cache_stats[i].acmr;
+    header.vertex_cache[2 * i + 1] = vertex_cache_stats[i].atvr;
+  }
+  *blob.at<CacheHeader>(0) = header;
+
+  // write then rename, so concurrent jobs never map a partial cache
+  auto temp_path = cache_path + ".tmp" + to_string(random_device{}());
+  {
+    ofstream out(temp_path, ios::binary);
+    out.write(reinterpret_cast<const char *>(blob.bytes.data()),
+              static_cast<streamsize>(blob.bytes.size()));
+    if (!out) {
+      cout << "Cannot write model cache " << cache_path << endl;
+      remove(temp_path.c_str());
+      return;
+    }
+  }
+  if (rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+    cout << "Cannot write model cache " << cache_path << endl;
+    remove(temp_path.c_str());
+  }
+}
+
+auto CachedModelLoader::get_options() const -> uint32_t {
+  return (optimize_meshes ? 1u : 0u) | (keep_quantized ? 2u : 0u) |
+         (compact_indices ? 4u : 0u);
+}
+
+auto CachedModelLoader::get_extends() const -> BoundingBox {
+  return loaded == nullptr ? BoundingBox{} : RB::get_extends(*loaded);
+}
+
+} // namespace RB
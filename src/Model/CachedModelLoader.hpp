@@ -0,0 +1,55 @@
+#pragma once
+#include "Model/IModelLoader.hpp"
+#include "Model/MappedFile.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace RB {
+
+// Wraps another loader with a RenderBoy-native cache file. The cache holds
+// ready-to-render vertex and index arrays, decoded textures and materials,
+// and is mapped and used without any parsing. It is keyed by the source
+// path, its modification time and size, and a hash of its content, and
+// likewise by each external buffer and image the source refers to. It is
+// rebuilt from the wrapped loader whenever any key no longer matches.
+//
+// Caches are written next to the source as `<path>.rbcache`, or into
+// `$RENDERBOY_CACHE_DIR` when set. `RENDERBOY_MODEL_CACHE=off` disables them.
+class CachedModelLoader final : public IModelLoader {
+public:
+  explicit CachedModelLoader(std::unique_ptr<IModelLoader> source);
+
+  auto load() -> Model & override;
+
+  auto load_progressive(ModelStream &stream) -> Model & override;
+
+  auto get_extends() const -> BoundingBox override;
+
+private:
+  struct SourceKey {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+  };
+
+  std::unique_ptr<IModelLoader> source;
+  std::shared_ptr<MappedFile> file;
+  std::vector<Texture> textures;
+  Model model;
+  // either `model` or the one owned by `source`
+  Model *loaded = nullptr;
+
+  auto load_cached(ModelStream *stream) -> Model &;
+
+  auto get_cache_path() const -> std::string;
+
+  auto get_options() const -> uint32_t;
+
+  auto read_cache(const std::string &cache_path, SourceKey &key) -> bool;
+
+  void write_cache(const std::string &cache_path, const SourceKey &key,
+                   const Model &source_model) const;
+};
+
+} // namespace RB
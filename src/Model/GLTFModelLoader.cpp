@@ -2,12 +2,22 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "Model/GLTFModelLoader.hpp"
+#include "Model/AssetRegistry.hpp"
+#include "Model/MeshoptDecoder.hpp"
 #include "RenderBoy/Texture.hpp"
 #include <Eigen/Geometry>
 #include <RenderBoy/Camera.hpp>
+#include <RenderBoy/MeshOptimizer.hpp>
+#include <RenderBoy/TextureCache.hpp>
+#include <RenderBoy/utils.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstring>
 #include <exception>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <utility>
 #include <vector>
@@ -17,18 +27,60 @@ using namespace Eigen;
 
 namespace RB {
 
-auto GLTFModelLoader::process_sampler(const tinygltf::Sampler &gltf_sampler)
-    -> void {}
+auto GLTFModelLoader::process_sampler(
+    const tinygltf::Sampler & /*gltf_sampler*/) -> void {}
 
 auto GLTFModelLoader::process_texture(const tinygltf::Texture &gltf_texture)
     -> Texture {
-  auto &gltf_sampler =
-      gltf_model.samplers[static_cast<size_t>(gltf_texture.sampler)];
+  // the sampler is optional, and the default one repeats
+  if (gltf_texture.sampler >= 0) {
+    process_sampler(
+        gltf_model->samplers.at(static_cast<size_t>(gltf_texture.sampler)));
+  }
 
   auto &gltf_image =
-      gltf_model.images[static_cast<size_t>(gltf_texture.source)];
+      gltf_model->images.at(static_cast<size_t>(gltf_texture.source));
 
   Texture texture{};
+  auto encoded_it = encoded_images.find(gltf_texture.source);
+  if (encoded_it != encoded_images.end()) {
+    auto encoded = encoded_it->second;
+    int width = 0, height = 0, components = 0;
+    if (stbi_info_from_memory(encoded->bytes, encoded->size, &width, &height,
+                              &components) == 0) {
+      throw runtime_error("unknown image format");
+    }
+    texture.width = static_cast<uint32_t>(width);
+    texture.height = static_cast<uint32_t>(height);
+    texture.channels = 4;
+
+    // the decoder keeps the encoded bytes, and the file they may live in
+    auto file = mapped_file;
+    TextureCache::make_lazy(texture, [encoded, file](vector<unsigned char>
+                                                         &pixels,
+                                                     Texture &target) {
+      int w = 0, h = 0, comp = 0;
+      auto data = stbi_load_from_memory(encoded->bytes, encoded->size, &w, &h,
+                                        &comp, 4);
+      if (data == nullptr) {
+        // recorded by TextureCache, see TextureCache::take_errors
+        throw runtime_error(string("cannot decode texture: ") +
+                            stbi_failure_reason());
+      }
+      pixels.assign(data, data + static_cast<size_t>(w) * h * 4);
+      stbi_image_free(data);
+      target.width = static_cast<uint32_t>(w);
+      target.height = static_cast<uint32_t>(h);
+      target.channels = 4;
+    });
+    // an image already loaded, maybe by another model, is decoded once
+    if (share_assets) {
+      texture.lazy = AssetRegistry::instance().share(
+          texture.lazy, encoded->bytes, static_cast<size_t>(encoded->size));
+    }
+    return texture;
+  }
+
   texture.width = static_cast<uint32_t>(gltf_image.width);
   texture.height = static_cast<uint32_t>(gltf_image.height);
   texture.channels = static_cast<uint8_t>(gltf_image.component);
@@ -37,196 +89,481 @@ auto GLTFModelLoader::process_texture(const tinygltf::Texture &gltf_texture)
   return texture;
 }
 
-auto GLTFModelLoader::process_material(const tinygltf::Material &gltf_material)
-    -> Material {
+auto GLTFModelLoader::process_material(const tinygltf::Material &gltf_material,
+                                       bool with_textures) -> Material {
   Material material{};
 
   auto &pbrt = gltf_material.pbrMetallicRoughness;
 
-  if (pbrt.baseColorTexture.index >= 0) {
-    auto idx = static_cast<uint32_t>(pbrt.baseColorTexture.index);
-
+  // textures shared by several materials are processed once
+  auto get_texture = [&](int index) -> Texture * {
+    if (!with_textures || index < 0) {
+      return nullptr;
+    }
+    auto idx = static_cast<uint32_t>(index);
     auto tex_it = textures.find(idx);
-    if (tex_it != textures.end()) {
-      material.base_color_texture = &(tex_it->second);
-    } else {
-      auto gltf_texture = gltf_model.textures[idx];
-      auto texture = process_texture(gltf_texture);
-      auto res = textures.emplace(idx, move(texture));
-      material.base_color_texture = &(res.first->second);
+    if (tex_it == textures.end()) {
+      auto texture = process_texture(gltf_model->textures[idx]);
+      tex_it = textures.emplace(idx, move(texture)).first;
     }
-  } else {
-    for (size_t i = 0; i < 4; i++) {
-      material.base_color[i] = pbrt.baseColorFactor[i];
+    return &(tex_it->second);
+  };
+
+  // the metallic-roughness shading multiplies the factors with their
+  // textures, the other shadings draw the base color texture as is
+  for (size_t i = 0; i < 4; i++) {
+    material.base_color[i] = static_cast<float>(pbrt.baseColorFactor[i]);
+  }
+  for (size_t i = 0; i < 3; i++) {
+    material.emissive[i] =
+        static_cast<float>(gltf_material.emissiveFactor[i]);
+  }
+  if (gltf_material.alphaMode == "MASK") {
+    material.alpha_mode = Material::AlphaMode::Mask;
+  } else if (gltf_material.alphaMode == "BLEND") {
+    material.alpha_mode = Material::AlphaMode::Blend;
+  }
+  material.AlphaCutoff = static_cast<float>(gltf_material.alphaCutoff);
+  material.metallic = static_cast<float>(pbrt.metallicFactor);
+  material.roughness = static_cast<float>(pbrt.roughnessFactor);
+  material.normal_scale =
+      static_cast<float>(gltf_material.normalTexture.scale);
+  material.occlusion_strength =
+      static_cast<float>(gltf_material.occlusionTexture.strength);
+
+  material.base_color_texture = get_texture(pbrt.baseColorTexture.index);
+  material.metallic_roughness_texture =
+      get_texture(pbrt.metallicRoughnessTexture.index);
+  material.normal_texture = get_texture(gltf_material.normalTexture.index);
+  material.emissive_texture =
+      get_texture(gltf_material.emissiveTexture.index);
+  material.occlusion_texture =
+      get_texture(gltf_material.occlusionTexture.index);
+
+  return material;
+}
+
+static auto get_component_type(int component_type) -> ComponentType {
+  switch (component_type) {
+  case TINYGLTF_COMPONENT_TYPE_FLOAT:
+    return ComponentType::Float;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+    return ComponentType::UnsignedInt;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    return ComponentType::UnsignedShort;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    return ComponentType::UnsignedByte;
+  case TINYGLTF_COMPONENT_TYPE_SHORT:
+    return ComponentType::Short;
+  case TINYGLTF_COMPONENT_TYPE_BYTE:
+    return ComponentType::Byte;
+  default:
+    throw runtime_error("unknown component type");
+  }
+}
+
+auto GLTFModelLoader::get_buffer(int idx, const uint8_t *&data, size_t &size)
+    -> bool {
+  if (idx < 0 || static_cast<size_t>(idx) >= gltf_model->buffers.size()) {
+    throw runtime_error("invalid buffer");
+  }
+  auto &buffer = gltf_model->buffers[static_cast<size_t>(idx)];
+  // only the BIN chunk is left empty, decoded buffers have their bytes
+  auto embedded =
+      binary_chunk != nullptr && buffer.uri.empty() && buffer.data.empty();
+  data = embedded ? binary_chunk : buffer.data.data();
+  size = embedded ? binary_chunk_size : buffer.data.size();
+  return embedded;
+}
+
+void GLTFModelLoader::decode_compressed_views() {
+  struct Job {
+    size_t view;
+    const uint8_t *source;
+    size_t source_size;
+    size_t count;
+    size_t stride;
+    string mode;
+    string filter;
+  };
+  vector<Job> jobs;
+  for (size_t idx = 0; idx < gltf_model->bufferViews.size(); idx++) {
+    auto &buffer_view = gltf_model->bufferViews[idx];
+    auto &extensions = buffer_view.extensions;
+    auto extension_it = extensions.find("EXT_meshopt_compression");
+    if (extension_it == extensions.end()) {
+      continue;
+    }
+
+    auto &extension = extension_it->second;
+    auto number = [&extension](const char *name) -> size_t {
+      auto &value = extension.Get(name);
+      if (!value.IsNumber() || value.GetNumberAsInt() < 0) {
+        throw runtime_error(string("invalid meshopt ") + name);
+      }
+      return static_cast<size_t>(value.GetNumberAsInt());
+    };
+    Job job{};
+    job.view = idx;
+    job.count = number("count");
+    job.stride = number("byteStride");
+    job.mode = extension.Get("mode").Get<string>();
+    if (extension.Has("filter")) {
+      job.filter = extension.Get("filter").Get<string>();
+    }
+
+    auto offset = extension.Has("byteOffset") ? number("byteOffset") : 0;
+    auto length = number("byteLength");
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    get_buffer(static_cast<int>(number("buffer")), data, size);
+    if (offset > size || length > size - offset) {
+      throw runtime_error("meshopt data exceeds its buffer");
+    }
+    if (buffer_view.byteLength > job.count * job.stride) {
+      throw runtime_error("meshopt data is shorter than its buffer view");
     }
+    job.source = data + offset;
+    job.source_size = length;
+    jobs.push_back(move(job));
+  }
+  if (jobs.empty()) {
+    return;
   }
 
-  //  if (pbrt.metallicRoughnessTexture.index >= 0) {
-  //
-  //  } else {
-  //  }
-  //
-  //  if (gltf_material.normalTexture.index >= 0) {
-  //  }
-  //
-  //  if (gltf_material.emissiveTexture.index >= 0) {
-  //  }
-  //
-  //  if (gltf_material.occlusionTexture.index >= 0) {
-  //  }
+  // every view decodes into a buffer of its own, the accessors then read it
+  // like any other
+  vector<vector<unsigned char>> decoded(jobs.size());
+  vector<exception_ptr> errors(jobs.size());
+  ParallelForEach(size_t(0), jobs.size(), [&](size_t idx) {
+    try {
+      auto &job = jobs[idx];
+      auto &target = decoded[idx];
+      target.resize(job.count * job.stride);
+      if (job.mode == "ATTRIBUTES") {
+        decode_meshopt_vertices(target.data(), job.count, job.stride,
+                                job.source, job.source_size);
+        apply_meshopt_filter(job.filter, target.data(), job.count,
+                             job.stride);
+      } else if (job.mode == "TRIANGLES") {
+        decode_meshopt_triangles(target.data(), job.count, job.stride,
+                                 job.source, job.source_size);
+      } else if (job.mode == "INDICES") {
+        decode_meshopt_indices(target.data(), job.count, job.stride,
+                               job.source, job.source_size);
+      } else {
+        throw runtime_error("unknown meshopt mode " + job.mode);
+      }
+    } catch (...) {
+      errors[idx] = current_exception();
+    }
+  });
+  for (auto &error : errors) {
+    if (error) {
+      rethrow_exception(error);
+    }
+  }
 
-  return material;
+  for (size_t idx = 0; idx < jobs.size(); idx++) {
+    auto &buffer_view = gltf_model->bufferViews[jobs[idx].view];
+    buffer_view.buffer = static_cast<int>(gltf_model->buffers.size());
+    buffer_view.byteOffset = 0;
+    buffer_view.extensions.erase("EXT_meshopt_compression");
+    gltf_model->buffers.emplace_back();
+    gltf_model->buffers.back().data = move(decoded[idx]);
+  }
+}
+
+auto GLTFModelLoader::process_accessor(int idx) -> AttributeView {
+  if (idx < 0 || static_cast<size_t>(idx) >= gltf_model->accessors.size()) {
+    throw runtime_error("invalid accessor");
+  }
+  auto &accessor = gltf_model->accessors[static_cast<size_t>(idx)];
+  if (accessor.bufferView < 0) {
+    throw runtime_error("accessors without buffer view are not supported");
+  }
+  auto &buffer_view =
+      gltf_model->bufferViews[static_cast<size_t>(accessor.bufferView)];
+  const uint8_t *buffer_data = nullptr;
+  size_t buffer_size = 0;
+  auto embedded = get_buffer(buffer_view.buffer, buffer_data, buffer_size);
+  auto stride = accessor.ByteStride(buffer_view);
+  if (stride <= 0) {
+    throw runtime_error("invalid accessor stride");
+  }
+
+  AttributeView view{};
+  view.type = get_component_type(accessor.componentType);
+  view.components = static_cast<uint8_t>(tinygltf::GetNumComponentsInType(
+      static_cast<uint32_t>(accessor.type)));
+  view.normalized = accessor.normalized;
+  view.count = static_cast<uint32_t>(accessor.count);
+  view.stride = static_cast<uint32_t>(stride);
+
+  auto offset = buffer_view.byteOffset + accessor.byteOffset;
+  if (view.count > 0 &&
+      offset + static_cast<size_t>(view.count - 1) * view.stride +
+              view.element_size() >
+          buffer_size) {
+    throw runtime_error("accessor exceeds its buffer");
+  }
+  view.data = buffer_data + offset;
+  // the view shares ownership of whatever holds its buffer: the mapped file
+  // or the whole glTF model
+  if (embedded) {
+    view.owner = shared_ptr<const void>(mapped_file, view.data);
+  } else {
+    view.owner = shared_ptr<const void>(gltf_model, view.data);
+  }
+
+  return view;
 }
 
 auto GLTFModelLoader::process_primitive(const tinygltf::Primitive &primitive)
     -> Geometry {
   Geometry geometry{};
 
-  auto &accessors = gltf_model.accessors;
   auto &attributes = primitive.attributes;
 
-  const float *positions_buffer = nullptr;
-  const float *normals_buffer = nullptr;
-  const float *tex_coord_buffer = nullptr;
-
   if (primitive.indices >= 0) {
-    auto &accessor =
-        gltf_model.accessors[static_cast<uint32_t>(primitive.indices)];
-    auto &buffer_view = gltf_model.bufferViews[accessor.bufferView];
-    auto &buffer = gltf_model.buffers[buffer_view.buffer];
-    geometry.index_count = accessor.count;
-
-    auto data = &(buffer.data[accessor.byteOffset + buffer_view.byteOffset]);
-    geometry.indices.reserve(geometry.index_count);
-
-    switch (accessor.componentType) {
-    case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-      auto *buf = reinterpret_cast<const uint32_t *>(data);
-      for (size_t index = 0; index < accessor.count; index++) {
-        geometry.indices.push_back(buf[index]);
-      }
+    auto view = process_accessor(primitive.indices);
+    geometry.index_count = view.count;
+
+    switch (view.type) {
+    case ComponentType::UnsignedInt:
+    case ComponentType::UnsignedShort:
+    case ComponentType::UnsignedByte:
+      // the contexts read every index width in place
+      geometry.index_view = move(view);
       break;
-    }
-    case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
-      auto buf = reinterpret_cast<const uint16_t *>(data);
-      for (size_t index = 0; index < accessor.count; index++) {
-        geometry.indices.push_back(buf[index]);
-      }
-      break;
-    }
-    case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
-      auto buf = reinterpret_cast<const uint8_t *>(data);
-      for (size_t index = 0; index < accessor.count; index++) {
-        geometry.indices.push_back(buf[index]);
-      }
-      break;
-    }
     default:
       throw runtime_error("unknown indices type");
     }
   }
 
   {
-    auto position_it = primitive.attributes.find("POSITION");
+    auto position_it = attributes.find("POSITION");
     if (position_it == attributes.end()) {
       throw runtime_error("position attribute is required");
     }
-    assert(position_it->second > 0 &&
-           position_it->second < gltf_model.accessors.size());
-    auto idx = static_cast<uint32_t>(position_it->second);
-    auto &accessor = gltf_model.accessors[idx];
-    if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) {
-      throw runtime_error("position buffer should be of float type");
+    auto view = process_accessor(position_it->second);
+    if (view.components != 3 || view.type == ComponentType::UnsignedInt) {
+      throw runtime_error("position buffer should be of float type, or "
+                          "quantized with KHR_mesh_quantization");
     }
 
-    auto &buffer_view =
-        gltf_model.bufferViews[static_cast<uint32_t>(accessor.bufferView)];
-    auto &buffer =
-        gltf_model.buffers[static_cast<uint32_t>(buffer_view.buffer)];
-    geometry.box.min = {static_cast<float>(accessor.minValues[0]),
-                        static_cast<float>(accessor.minValues[1]),
-                        static_cast<float>(accessor.minValues[2])};
-    geometry.box.max = {static_cast<float>(accessor.maxValues[0]),
-                        static_cast<float>(accessor.maxValues[1]),
-                        static_cast<float>(accessor.maxValues[2])};
+    // the bounds of quantized positions are recomputed, normalized ones
+    // being stored unnormalized
+    auto &accessor =
+        gltf_model->accessors[static_cast<uint32_t>(position_it->second)];
+    if (view.type == ComponentType::Float && accessor.minValues.size() >= 3 &&
+        accessor.maxValues.size() >= 3) {
+      geometry.box.min = {static_cast<float>(accessor.minValues[0]),
+                          static_cast<float>(accessor.minValues[1]),
+                          static_cast<float>(accessor.minValues[2])};
+      geometry.box.max = {static_cast<float>(accessor.maxValues[0]),
+                          static_cast<float>(accessor.maxValues[1]),
+                          static_cast<float>(accessor.maxValues[2])};
+    } else {
+      for (uint32_t i = 0; i < view.count; i++) {
+        float position[3];
+        view.read(i, position);
+        for (size_t c = 0; c < 3; c++) {
+          geometry.box.min[c] = std::min(geometry.box.min[c], position[c]);
+          geometry.box.max[c] = std::max(geometry.box.max[c], position[c]);
+        }
+      }
+    }
 
-    geometry.vertex_count = static_cast<uint32_t>(accessor.count);
-    positions_buffer = reinterpret_cast<const float *>(
-        &(buffer.data[accessor.byteOffset + buffer_view.byteOffset]));
+    geometry.vertex_count = view.count;
+    geometry.position_view = move(view);
   }
 
   {
-    if (primitive.attributes.find("NORMAL") != primitive.attributes.end()) {
-      auto &accessor =
-          gltf_model.accessors[primitive.attributes.find("NORMAL")->second];
-      auto &buffer_view =
-          gltf_model.bufferViews[static_cast<uint32_t>(accessor.bufferView)];
-      auto &buffer =
-          gltf_model.buffers[static_cast<uint32_t>(buffer_view.buffer)];
-
-      normals_buffer = reinterpret_cast<const float *>(
-          &(buffer.data[accessor.byteOffset + buffer_view.byteOffset]));
+    auto normal_it = attributes.find("NORMAL");
+    if (normal_it != attributes.end()) {
+      auto view = process_accessor(normal_it->second);
+      auto quantized = (view.type == ComponentType::Short ||
+                        view.type == ComponentType::Byte) &&
+                       view.normalized;
+      if (view.components != 3 ||
+          (view.type != ComponentType::Float && !quantized)) {
+        throw runtime_error("normal buffer should be of float type, or "
+                            "normalized (signed) bytes or shorts");
+      }
+      geometry.normal_view = move(view);
     }
   }
 
   {
-    if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
-      auto &accessor =
-          gltf_model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-      auto &buffer_view =
-          gltf_model.bufferViews[static_cast<uint32_t>(accessor.bufferView)];
-      auto &buffer =
-          gltf_model.buffers[static_cast<uint32_t>(buffer_view.buffer)];
-
-      tex_coord_buffer = reinterpret_cast<const float *>(
-          &(buffer.data[accessor.byteOffset + buffer_view.byteOffset]));
+    auto tex_coord_it = attributes.find("TEXCOORD_0");
+    if (tex_coord_it != attributes.end()) {
+      auto view = process_accessor(tex_coord_it->second);
+      if (view.components != 2 || view.type == ComponentType::UnsignedInt) {
+        throw runtime_error("texture coordinate buffer should be of float "
+                            "type, or quantized with KHR_mesh_quantization");
+      }
+      geometry.uv_view = move(view);
     }
   }
 
-  for (size_t i = 0; i < geometry.vertex_count; i++) {
-    Vertex vertex{};
-    vertex.position = {positions_buffer[i * 3], positions_buffer[i * 3 + 1],
-                       positions_buffer[i * 3 + 2]};
-    if (normals_buffer != nullptr) {
-      vertex.normal = {normals_buffer[i * 3], normals_buffer[i * 3 + 1],
-                       normals_buffer[i * 3 + 2]};
-    }
-    if (tex_coord_buffer != nullptr) {
-      vertex.uv = {tex_coord_buffer[i * 2], tex_coord_buffer[i * 2 + 1]};
-    }
-    geometry.buffers.emplace_back(move(vertex));
+  if (!keep_quantized) {
+    dequantize(geometry);
   }
 
   return geometry;
 }
 
-auto GLTFModelLoader::process_mesh(const tinygltf::Mesh &gltf_mesh) -> Mesh {
-  auto &gltf_primitives = gltf_mesh.primitives;
+void GLTFModelLoader::dequantize(Geometry &geometry) {
+  auto quantized = [](const AttributeView &view) {
+    return view && view.type != ComponentType::Float;
+  };
+  if (!quantized(geometry.position_view) &&
+      !quantized(geometry.normal_view) && !quantized(geometry.uv_view)) {
+    return;
+  }
 
-  Mesh mesh{};
-  for (auto &gltf_primitive : gltf_primitives) {
-    if (gltf_primitive.mode != TINYGLTF_MODE_TRIANGLES) {
-      continue;
+  // converted into owned, interleaved floats, float attributes included;
+  // absent attributes read as zeros either way
+  geometry.buffers.resize(geometry.vertex_count);
+  for (uint32_t i = 0; i < geometry.vertex_count; i++) {
+    auto &vertex = geometry.buffers[i];
+    geometry.position_view.read(i, vertex.position.data());
+    if (geometry.normal_view) {
+      geometry.normal_view.read(i, vertex.normal.data());
     }
-    auto geometry = process_primitive(gltf_primitive);
+    if (geometry.uv_view) {
+      geometry.uv_view.read(i, vertex.uv.data());
+    }
+  }
+  geometry.position_view = {};
+  geometry.normal_view = {};
+  geometry.uv_view = {};
+}
+
+auto GLTFModelLoader::process_mesh(uint32_t mesh_idx) -> Mesh {
+  Mesh mesh{};
+  mesh.geometries = mesh_geometries[mesh_idx];
+
+  for (auto &geometry : mesh.geometries) {
     if (geometry.box.min[0] < mesh.box.min[0]) {
       mesh.box.min = geometry.box.min;
     }
     if (geometry.box.max[0] > mesh.box.max[0]) {
       mesh.box.max = geometry.box.max;
     }
+  }
+
+  return mesh;
+}
 
-    // TODO: handle material
-    if (gltf_primitive.material >= 0) {
-      auto gltf_material =
-          gltf_model.materials[static_cast<size_t>(gltf_primitive.material)];
-      geometry.material = process_material(gltf_material);
+void GLTFModelLoader::process_meshes(ModelStream *stream) {
+  struct Job {
+    uint32_t mesh;
+    const tinygltf::Primitive *primitive;
+  };
+  vector<Job> jobs;
+  // index one past the last job of each mesh
+  map<uint32_t, size_t> mesh_ends;
+
+  for (auto &instance : mesh_instances) {
+    auto res = mesh_geometries.emplace(instance.first, vector<Geometry>());
+    if (!res.second) {
+      continue;
+    }
+    for (auto &gltf_primitive : gltf_model->meshes[instance.first].primitives) {
+      if (gltf_primitive.mode == TINYGLTF_MODE_TRIANGLES) {
+        jobs.push_back({instance.first, &gltf_primitive});
+      }
     }
+    mesh_ends[instance.first] = jobs.size();
+  }
 
-    mesh.geometries.emplace_back(move(geometry));
+  // without a stream everything is one batch, with one the meshes are
+  // handed out as soon as all their primitives are converted
+  auto batch_size = jobs.size();
+  if (stream != nullptr) {
+    batch_size = std::max<size_t>(64, thread::hardware_concurrency() * 8);
   }
 
-  return mesh;
+  vector<Geometry> geometries(jobs.size());
+  vector<exception_ptr> errors(jobs.size());
+  // cache statistics before and after optimization, weighted by triangles
+  vector<array<VertexCacheStats, 2>> stats(jobs.size());
+  array<double, 4> totals = {0.0, 0.0, 0.0, 0.0};
+  double triangles = 0.0;
+  size_t next_instance = 0;
+  size_t begin = 0;
+  do {
+    auto end = std::min(begin + batch_size, jobs.size());
+    ParallelForEach(begin, end, [&](size_t idx) {
+      try {
+        auto &primitive = *jobs[idx].primitive;
+        auto &geometry = geometries[idx];
+        geometry = process_primitive(primitive);
+        if (optimize_meshes && geometry.index_count >= 3) {
+          stats[idx][0] = analyze_vertex_cache(geometry);
+          optimize_vertex_cache(geometry);
+          stats[idx][1] = analyze_vertex_cache(geometry);
+        }
+        if (compact_indices) {
+          narrow_indices(geometry);
+        }
+        // instances of the mesh then read the same memory, and so do
+        // identical arrays of other meshes and models when shared
+        if (share_assets) {
+          AssetRegistry::instance().share(geometry);
+        } else {
+          geometry.share_storage();
+        }
+        if (primitive.material >= 0) {
+          geometries[idx].material =
+              materials.at(static_cast<size_t>(primitive.material));
+        }
+      } catch (...) {
+        errors[idx] = current_exception();
+      }
+    });
+
+    // merge in job order so the result does not depend on scheduling
+    for (auto idx = begin; idx < end; idx++) {
+      if (errors[idx]) {
+        rethrow_exception(errors[idx]);
+      }
+      auto weight = static_cast<double>(geometries[idx].index_count / 3);
+      totals[0] += stats[idx][0].acmr * weight;
+      totals[1] += stats[idx][0].atvr * weight;
+      totals[2] += stats[idx][1].acmr * weight;
+      totals[3] += stats[idx][1].atvr * weight;
+      triangles += optimize_meshes ? weight : 0.0;
+      mesh_geometries[jobs[idx].mesh].emplace_back(move(geometries[idx]));
+      mesh_materials[jobs[idx].mesh].push_back(jobs[idx].primitive->material);
+    }
+
+    begin = end;
+    if (stream == nullptr) {
+      continue;
+    }
+
+    vector<Mesh> meshes;
+    while (next_instance < mesh_instances.size() &&
+           mesh_ends[mesh_instances[next_instance].first] <= end) {
+      auto &instance = mesh_instances[next_instance];
+      auto mesh = process_mesh(instance.first);
+      mesh.set_model_matrix(instance.second);
+      meshes.emplace_back(move(mesh));
+      next_instance++;
+    }
+    stream->add_meshes(move(meshes));
+  } while (begin < jobs.size());
+
+  if (triangles > 0.0) {
+    for (size_t i = 0; i < vertex_cache_stats.size(); i++) {
+      auto &average = vertex_cache_stats[i];
+      average.acmr = static_cast<float>(totals[2 * i] / triangles);
+      average.atvr = static_cast<float>(totals[2 * i + 1] / triangles);
+    }
+  }
 }
 
 auto process_camera(const tinygltf::Camera &gltf_camera) -> unique_ptr<Camera> {
@@ -294,23 +631,200 @@ void GLTFModelLoader::process_node(const tinygltf::Node &gltf_node,
   }
 
   if (gltf_node.mesh >= 0) {
-    auto &gltf_mesh = gltf_model.meshes[static_cast<uint32_t>(gltf_node.mesh)];
-
-    auto mesh = process_mesh(gltf_mesh);
-    mesh.set_model_matrix(matrix);
-    model.meshes.emplace_back(move(mesh));
+    if (static_cast<size_t>(gltf_node.mesh) >= gltf_model->meshes.size()) {
+      throw runtime_error("invalid mesh");
+    }
+    mesh_instances.emplace_back(static_cast<uint32_t>(gltf_node.mesh), matrix);
   }
 
   for (auto child : gltf_node.children) {
     if (child < 0) {
       continue;
     }
-    auto &node = gltf_model.nodes[static_cast<uint32_t>(child)];
+    auto &node = gltf_model->nodes[static_cast<uint32_t>(child)];
     process_node(node, &matrix);
   }
 }
 
-Model &GLTFModelLoader::load() {
+auto GLTFModelLoader::defer_image(tinygltf::Image *image, int image_idx,
+                                  string *err, string *warn, int req_width,
+                                  int req_height, const unsigned char *bytes,
+                                  int size, void *user_data) -> bool {
+  (void)image;
+  (void)err;
+  (void)warn;
+  (void)req_width;
+  (void)req_height;
+
+  auto self = static_cast<GLTFModelLoader *>(user_data);
+  PendingImage pending{image_idx, bytes, size, {}};
+
+  // bytes inside the mapped file stay valid, anything else is a temporary
+  auto &file = self->mapped_file;
+  if (file == nullptr || bytes < file->data() ||
+      bytes + size > file->data() + file->size()) {
+    pending.storage.assign(bytes, bytes + size);
+    pending.bytes = pending.storage.data();
+  }
+
+  self->pending_images.emplace_back(move(pending));
+  return true;
+}
+
+void GLTFModelLoader::decode_images(
+    const function<void(int image_idx)> &on_decoded) {
+  vector<string> errors(pending_images.size());
+  // a worker throwing would terminate, so failures are carried back here
+  vector<exception_ptr> exceptions(pending_images.size());
+  ParallelForEach(size_t(0), pending_images.size(), [&](size_t idx) {
+    try {
+      auto &pending = pending_images[idx];
+      auto &image = gltf_model->images.at(static_cast<size_t>(pending.idx));
+      string warn;
+      auto res = tinygltf::LoadImageData(&image, pending.idx, &errors[idx],
+                                         &warn, image.width, image.height,
+                                         pending.bytes, pending.size, nullptr);
+      if (res && on_decoded) {
+        on_decoded(pending.idx);
+      }
+    } catch (...) {
+      exceptions[idx] = current_exception();
+    }
+  });
+  pending_images.clear();
+
+  for (size_t idx = 0; idx < errors.size(); idx++) {
+    if (exceptions[idx]) {
+      rethrow_exception(exceptions[idx]);
+    }
+    if (!errors[idx].empty()) {
+      throw runtime_error(errors[idx]);
+    }
+  }
+}
+
+auto GLTFModelLoader::load_binary(tinygltf::TinyGLTF &loader, string &err,
+                                  string &warn) -> bool {
+  mapped_file = make_shared<MappedFile>(path);
+  auto bytes = mapped_file->data();
+  auto size = mapped_file->size();
+
+  auto read_u32 = [bytes](size_t offset) {
+    uint32_t value = 0;
+    memcpy(&value, bytes + offset, sizeof(value));
+    return value;
+  };
+
+  if (size < 20 || size > numeric_limits<uint32_t>::max() ||
+      memcmp(bytes, "glTF", 4) != 0) {
+    throw runtime_error("invalid glTF binary");
+  }
+
+  // the JSON chunk comes first, then an optional BIN chunk
+  size_t json_size = read_u32(12);
+  auto bin_header = 20 + json_size;
+  if (bin_header + 8 <= size && read_u32(bin_header + 4) == 0x004E4942) {
+    binary_chunk = bytes + bin_header + 8;
+    binary_chunk_size =
+        std::min<size_t>(read_u32(bin_header), size - bin_header - 8);
+  }
+
+  // tinygltf parses the JSON chunk straight from the mapping and leaves the
+  // embedded buffer empty instead of copying the BIN chunk
+  loader.SetReferenceBinaryChunk(true);
+  return loader.LoadBinaryFromMemory(gltf_model.get(), &err, &warn, bytes,
+                                     static_cast<unsigned int>(size), dir);
+}
+
+auto GLTFModelLoader::load() -> Model & { return load_scene(nullptr); }
+
+auto GLTFModelLoader::load_progressive(ModelStream &stream) -> Model & {
+  return load_scene(&stream);
+}
+
+void GLTFModelLoader::stream_textures(ModelStream &stream) {
+  // the texture slots are created up front so decoding threads only fill
+  // them in and never change the map itself
+  vector<vector<uint32_t>> image_textures(gltf_model->images.size());
+  // materials waiting for each image, and how many images each one waits
+  vector<vector<size_t>> image_materials(gltf_model->images.size());
+  unique_ptr<atomic<uint32_t>[]> pending(
+      new atomic<uint32_t>[gltf_model->materials.size()]);
+  for (size_t idx = 0; idx < gltf_model->materials.size(); idx++) {
+    auto &gltf_material = gltf_model->materials[idx];
+    array<int, 5> material_textures = {
+        gltf_material.pbrMetallicRoughness.baseColorTexture.index,
+        gltf_material.pbrMetallicRoughness.metallicRoughnessTexture.index,
+        gltf_material.normalTexture.index,
+        gltf_material.emissiveTexture.index,
+        gltf_material.occlusionTexture.index};
+    vector<int> images;
+    for (auto texture_idx : material_textures) {
+      if (texture_idx < 0) {
+        continue;
+      }
+      auto &gltf_texture =
+          gltf_model->textures.at(static_cast<size_t>(texture_idx));
+      auto image = gltf_texture.source;
+      if (image < 0 || static_cast<size_t>(image) >= image_textures.size()) {
+        throw runtime_error("invalid texture source");
+      }
+      if (find(images.begin(), images.end(), image) == images.end()) {
+        images.push_back(image);
+        image_materials[static_cast<size_t>(image)].push_back(idx);
+      }
+      auto res =
+          textures.emplace(static_cast<uint32_t>(texture_idx), Texture{});
+      if (res.second) {
+        image_textures[static_cast<size_t>(image)].push_back(
+            static_cast<uint32_t>(texture_idx));
+      }
+    }
+    pending[idx] = static_cast<uint32_t>(images.size());
+  }
+
+  // geometries, in delivery order, of each textured material
+  struct Waiting {
+    uint32_t geometry_idx;
+    Geometry *geometry;
+  };
+  vector<vector<Waiting>> material_geometries(gltf_model->materials.size());
+  uint32_t geometry_idx = 0;
+  for (size_t i = 0; i < mesh_instances.size(); i++) {
+    auto &geometry_materials = mesh_materials[mesh_instances[i].first];
+    for (size_t g = 0; g < geometry_materials.size(); g++, geometry_idx++) {
+      auto material_idx = geometry_materials[g];
+      if (material_idx >= 0 &&
+          pending[static_cast<size_t>(material_idx)] > 0) {
+        material_geometries[static_cast<size_t>(material_idx)].push_back(
+            {geometry_idx, &model.meshes[i].geometries[g]});
+      }
+    }
+  }
+
+  decode_images([&](int image_idx) {
+    auto image = static_cast<size_t>(image_idx);
+    for (auto texture_idx : image_textures[image]) {
+      textures[texture_idx] =
+          process_texture(gltf_model->textures[texture_idx]);
+    }
+    // only the thread decoding a material's last image gets past the
+    // count, so no other thread touches the material and its geometries
+    for (auto material_idx : image_materials[image]) {
+      if (pending[material_idx].fetch_sub(1, memory_order_acq_rel) != 1) {
+        continue;
+      }
+      auto material = process_material(gltf_model->materials[material_idx]);
+      materials[material_idx] = material;
+      for (auto &entry : material_geometries[material_idx]) {
+        entry.geometry->material = material;
+        stream.update_material(entry.geometry_idx, material);
+      }
+    }
+  });
+}
+
+auto GLTFModelLoader::load_scene(ModelStream *stream) -> Model & {
   tinygltf::TinyGLTF loader;
 
   string err, warn;
@@ -320,12 +834,15 @@ Model &GLTFModelLoader::load() {
     throw runtime_error("should have extension");
   }
 
+  // images are only collected while parsing, see decode_images
+  loader.SetImageLoader(&GLTFModelLoader::defer_image, this);
+
   auto ext = path.substr(ext_idx);
   auto res = false;
   if (ext == ".gltf") {
-    res = loader.LoadASCIIFromFile(&gltf_model, &err, &warn, path);
+    res = loader.LoadASCIIFromFile(gltf_model.get(), &err, &warn, path);
   } else if (ext == ".glb") {
-    res = loader.LoadBinaryFromFile(&gltf_model, &err, &warn, path);
+    res = load_binary(loader, err, warn);
   } else {
     throw runtime_error("unknown file extension");
   }
@@ -342,17 +859,19 @@ Model &GLTFModelLoader::load() {
     throw runtime_error("cannot load GLTF model");
   }
 
-  if (gltf_model.scenes.empty()) {
+  if (gltf_model->scenes.empty()) {
     throw runtime_error("no scene");
   }
 
+  decode_compressed_views();
+
   uint32_t default_scene = 0;
-  if (gltf_model.defaultScene > 0) {
-    assert(gltf_model.defaultScene < gltf_model.scenes.size());
-    default_scene = static_cast<uint32_t>(gltf_model.defaultScene);
+  if (gltf_model->defaultScene > 0) {
+    assert(gltf_model->defaultScene < gltf_model->scenes.size());
+    default_scene = static_cast<uint32_t>(gltf_model->defaultScene);
   }
 
-  auto &scene_nodes = gltf_model.scenes[default_scene].nodes;
+  auto &scene_nodes = gltf_model->scenes[default_scene].nodes;
   if (scene_nodes.empty()) {
     throw runtime_error("scene does not have any nodes");
   }
@@ -361,11 +880,43 @@ Model &GLTFModelLoader::load() {
     if (idx < 0) {
       continue;
     }
-    auto &gltf_node = gltf_model.nodes[static_cast<uint32_t>(idx)];
+    auto &gltf_node = gltf_model->nodes[static_cast<uint32_t>(idx)];
 
     process_node(gltf_node, nullptr);
   }
 
+  if (lazy_textures) {
+    // keep the encoded images, textures decode them on first use
+    for (auto &pending : pending_images) {
+      auto idx = pending.idx;
+      encoded_images[idx] = make_shared<PendingImage>(move(pending));
+    }
+    pending_images.clear();
+  }
+
+  if (stream == nullptr || lazy_textures) {
+    decode_images();
+
+    materials.reserve(gltf_model->materials.size());
+    for (auto &gltf_material : gltf_model->materials) {
+      materials.emplace_back(process_material(gltf_material));
+    }
+  } else {
+    // untextured stand-ins until the images are decoded
+    for (auto &gltf_material : gltf_model->materials) {
+      materials.push_back(process_material(gltf_material, false));
+    }
+  }
+
+  process_meshes(stream);
+
+  model.meshes.reserve(mesh_instances.size());
+  for (auto &instance : mesh_instances) {
+    auto mesh = process_mesh(instance.first);
+    mesh.set_model_matrix(instance.second);
+    model.meshes.emplace_back(move(mesh));
+  }
+
   for (auto &mesh : model.meshes) {
     if (mesh.box.min[0] < model.box.min[0]) {
       model.box.min = mesh.box.min;
@@ -375,33 +926,39 @@ Model &GLTFModelLoader::load() {
     }
   }
 
+  if (stream != nullptr) {
+    stream->all_meshes_added();
+    if (!lazy_textures) {
+      stream_textures(*stream);
+    }
+  }
+
   return model;
 }
 auto GLTFModelLoader::get_extends() const -> BoundingBox {
-  BoundingBox box{};
-  for (auto &mesh : model.meshes) {
-    for (auto &geometry : mesh.geometries) {
-      Vector4f min =
-          mesh.model_matrix * Vector4f(geometry.box.min[0], geometry.box.min[1],
-                                       geometry.box.min[2], 1.0f);
-      min /= min[3];
-      Vector4f max =
-          mesh.model_matrix * Vector4f(geometry.box.max[0], geometry.box.max[1],
-                                       geometry.box.max[2], 1.0f);
-      max /= max[3];
-      Vector4f center = (min + max) / 2.0f;
-      Vector4f distance = max - center;
-      distance[3] = 0.0f;
-      float radius = distance.norm();
-      min = center - Vector4f(radius, radius, radius, radius);
-      max = center + Vector4f(radius, radius, radius, radius);
-      for (size_t i = 0; i < 3; i++) {
-        box.min[i] = std::min(box.min[i], min[i]);
-        box.max[i] = std::max(box.max[i], max[i]);
-      }
+  return RB::get_extends(model);
+}
+
+auto GLTFModelLoader::get_dependencies() const -> vector<string> {
+  vector<string> dependencies;
+  auto add = [this, &dependencies](const string &uri) {
+    // data URIs are part of the file itself
+    if (uri.empty() || uri.compare(0, 5, "data:") == 0) {
+      return;
     }
+    auto dependency = dir + "/" + uri;
+    if (find(dependencies.begin(), dependencies.end(), dependency) ==
+        dependencies.end()) {
+      dependencies.push_back(dependency);
+    }
+  };
+  for (auto &buffer : gltf_model->buffers) {
+    add(buffer.uri);
+  }
+  for (auto &image : gltf_model->images) {
+    add(image.uri);
   }
-  return box;
+  return dependencies;
 }
 
 } // namespace RB
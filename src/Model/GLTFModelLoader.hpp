@@ -1,7 +1,14 @@
 #pragma once
 #include "Model/IModelLoader.hpp"
+#include "Model/MappedFile.hpp"
 #include "tinygltf/tiny_gltf.h"
 #include <RenderBoy/Material.hpp>
+#include <RenderBoy/ModelStream.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
 
 namespace RB {
 
@@ -9,21 +16,79 @@ class GLTFModelLoader final : public IModelLoader {
 public:
   auto load() -> Model & override;
 
+  auto load_progressive(ModelStream &stream) -> Model & override;
+
   auto get_extends() const -> BoundingBox override;
 
+  auto get_dependencies() const -> std::vector<std::string> override;
+
 private:
-  tinygltf::Model gltf_model;
+  std::shared_ptr<tinygltf::Model> gltf_model =
+      std::make_shared<tinygltf::Model>();
+  // .glb files are mapped and their BIN chunk is read in place
+  std::shared_ptr<MappedFile> mapped_file;
+  const uint8_t *binary_chunk = nullptr;
+  size_t binary_chunk_size = 0;
   std::map<uint32_t, Texture> textures;
+  std::vector<Material> materials;
   Model model;
 
+  // encoded images collected while parsing, decoded together afterwards
+  struct PendingImage {
+    int idx;
+    const unsigned char *bytes;
+    int size;
+    std::vector<unsigned char> storage;
+  };
+  std::vector<PendingImage> pending_images;
+  // with lazy textures, the encoded images by index
+  std::map<int, std::shared_ptr<const PendingImage>> encoded_images;
+
+  // meshes referenced by the scene, in traversal order, with the geometries
+  // converted from each referenced glTF mesh
+  std::vector<std::pair<uint32_t, Eigen::Matrix4f>> mesh_instances;
+  std::map<uint32_t, std::vector<Geometry>> mesh_geometries;
+  std::map<uint32_t, std::vector<int>> mesh_materials;
+
+  static auto defer_image(tinygltf::Image *image, int image_idx,
+                          std::string *err, std::string *warn, int req_width,
+                          int req_height, const unsigned char *bytes, int size,
+                          void *user_data) -> bool;
+
+  void decode_images(
+      const std::function<void(int image_idx)> &on_decoded = nullptr);
+
+  void process_meshes(ModelStream *stream);
+
+  void stream_textures(ModelStream &stream);
+
+  auto load_scene(ModelStream *stream) -> Model &;
+
+  auto load_binary(tinygltf::TinyGLTF &loader, std::string &err,
+                   std::string &warn) -> bool;
+
   void process_node(const tinygltf::Node &node,
                     const Eigen::Matrix4f *parent_transform);
 
-  auto process_mesh(const tinygltf::Mesh &gltf_mesh) -> Mesh;
+  auto process_mesh(uint32_t mesh_idx) -> Mesh;
+
+  // bytes of buffer `idx`, true when they are the mapped BIN chunk
+  auto get_buffer(int idx, const uint8_t *&data, size_t &size) -> bool;
+
+  // decodes the buffer views compressed with EXT_meshopt_compression, in
+  // parallel, and points them at the decoded bytes
+  void decode_compressed_views();
+
+  auto process_accessor(int idx) -> AttributeView;
 
   auto process_primitive(const tinygltf::Primitive &gltf_primitive) -> Geometry;
 
-  auto process_material(const tinygltf::Material &gltf_material) -> Material;
+  // turns quantized attributes into owned floats
+  static void dequantize(Geometry &geometry);
+
+  // leaves the textures out of stand-ins for materials still streaming
+  auto process_material(const tinygltf::Material &gltf_material,
+                        bool with_textures = true) -> Material;
 
   void process_sampler(const tinygltf::Sampler &gltf_sampler);
 
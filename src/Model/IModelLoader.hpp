@@ -1,12 +1,19 @@
 #pragma once
+#include <RenderBoy/MeshOptimizer.hpp>
 #include <RenderBoy/Model.hpp>
+#include <RenderBoy/ModelStream.hpp>
+#include <array>
 #include <string>
+#include <vector>
 
 namespace RB {
 
+// bounding box of every geometry of `model` in world space
+auto get_extends(const Model &model) -> BoundingBox;
+
 class IModelLoader {
 public:
-  ~IModelLoader() = default;
+  virtual ~IModelLoader() = default;
 
   void set_path(const std::string &_path) {
     this->path = _path;
@@ -19,13 +26,57 @@ public:
     }
   }
 
+  // textures decode on first use, through `TextureCache`, instead of
+  // while loading
+  void set_lazy_textures(bool enabled) { lazy_textures = enabled; }
+
+  // reorders indexed geometries for vertex cache and fetch locality
+  void set_optimize_meshes(bool enabled) { optimize_meshes = enabled; }
+
+  // quantized vertex attributes stay quantized in memory instead of being
+  // converted to floats, the contexts converting them as they fetch them
+  void set_keep_quantized(bool enabled) { keep_quantized = enabled; }
+
+  // 32 bits indices of small geometries are narrowed to 16 bits
+  void set_compact_indices(bool enabled) { compact_indices = enabled; }
+
+  // arrays and encoded images are hashed and shared with identical ones
+  // already loaded, see AssetRegistry
+  void set_share_assets(bool enabled) { share_assets = enabled; }
+
   virtual auto load() -> Model & = 0;
 
+  // Like `load`, also handing meshes and finished materials to `stream` as
+  // soon as they are ready. By default everything arrives at the end.
+  virtual auto load_progressive(ModelStream &stream) -> Model & {
+    auto &model = load();
+    stream.add_meshes(model.meshes);
+    return model;
+  }
+
   virtual auto get_extends() const -> BoundingBox = 0;
 
+  // the files besides `path` the loaded model was read from, like external
+  // buffers and images
+  virtual auto get_dependencies() const -> std::vector<std::string> {
+    return {};
+  }
+
+  // with optimized meshes, the statistics of the loaded geometries before
+  // and after their optimization, weighted by their triangles
+  auto get_vertex_cache_stats() const -> std::array<VertexCacheStats, 2> {
+    return vertex_cache_stats;
+  }
+
 protected:
   std::string dir;
   std::string path;
+  bool lazy_textures = true;
+  bool optimize_meshes = false;
+  bool keep_quantized = false;
+  bool compact_indices = false;
+  bool share_assets = false;
+  std::array<VertexCacheStats, 2> vertex_cache_stats{};
 };
 
 } // namespace RB
@@ -0,0 +1,68 @@
+#include "Model/MappedFile.hpp"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace RB {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const string &path) {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    throw runtime_error("cannot open " + path);
+  }
+  fallback.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+  bytes = fallback.data();
+  length = fallback.size();
+}
+
+MappedFile::~MappedFile() = default;
+
+#else
+
+MappedFile::MappedFile(const string &path) {
+  auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw runtime_error("cannot open " + path);
+  }
+
+  struct stat info {};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw runtime_error("cannot stat " + path);
+  }
+
+  length = static_cast<size_t>(info.st_size);
+  if (length > 0) {
+    auto address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+      close(fd);
+      throw runtime_error("cannot map " + path);
+    }
+    bytes = static_cast<const uint8_t *>(address);
+  }
+
+  // the mapping stays valid once the descriptor is closed
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (bytes != nullptr) {
+    munmap(const_cast<uint8_t *>(bytes), length);
+  }
+}
+
+#endif
+
+} // namespace RB
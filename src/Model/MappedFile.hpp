@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace RB {
+
+// Read-only view of a whole file. On POSIX systems the file is mapped, so
+// pages are only read when touched and are shared through the page cache by
+// every process mapping the same file.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+
+  MappedFile(const MappedFile &) = delete;
+  auto operator=(const MappedFile &) -> MappedFile & = delete;
+
+  ~MappedFile();
+
+  auto data() const -> const uint8_t * { return bytes; }
+
+  auto size() const -> size_t { return length; }
+
+private:
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+  std::vector<uint8_t> fallback;
+};
+
+} // namespace RB
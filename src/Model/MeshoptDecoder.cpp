@@ -0,0 +1,544 @@
+#include "Model/MeshoptDecoder.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// byte groups are unpacked with SSSE3 shuffles when the CPU has them
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RB_MESHOPT_SSSE3
+#include <tmmintrin.h>
+#endif
+
+using namespace std;
+
+namespace RB {
+
+namespace {
+
+const uint8_t VertexHeader = 0xa0;
+const uint8_t TriangleHeader = 0xe0;
+const uint8_t SequenceHeader = 0xd0;
+
+const size_t ByteGroupSize = 16;
+// a byte group never reads more than this, which the stream tail covers
+const size_t ByteGroupDecodeLimit = 24;
+const size_t VertexBlockSizeBytes = 8192;
+const size_t VertexBlockMaxSize = 256;
+const size_t TailMaxSize = 32;
+
+auto get_vertex_block_size(size_t stride) -> size_t {
+  // a block fits in the scratch buffer and is a whole number of byte groups
+  auto result = VertexBlockSizeBytes / stride;
+  result &= ~(ByteGroupSize - 1);
+  return min(result, VertexBlockMaxSize);
+}
+
+// reads `bits` wide values, most significant first; values with all bits
+// set are escapes, the actual byte following the packed values
+auto decode_bytes_group(const uint8_t *data, uint8_t *target, int bits)
+    -> const uint8_t * {
+  if (bits == 0) {
+    memset(target, 0, ByteGroupSize);
+    return data;
+  }
+  if (bits == 8) {
+    memcpy(target, data, ByteGroupSize);
+    return data + ByteGroupSize;
+  }
+
+  const auto per_byte = 8 / bits;
+  const auto escape = static_cast<uint8_t>((1 << bits) - 1);
+  auto extra = data + ByteGroupSize / static_cast<size_t>(per_byte);
+  for (size_t i = 0; i < ByteGroupSize; data++) {
+    auto byte = *data;
+    for (auto k = 0; k < per_byte; k++, i++) {
+      auto value = static_cast<uint8_t>(byte >> (8 - bits));
+      byte = static_cast<uint8_t>(byte << bits);
+      if (value == escape) {
+        value = *extra++;
+      }
+      target[i] = value;
+    }
+  }
+  return extra;
+}
+
+// two bits of header per group select its width; the stream tail makes
+// reading ByteGroupDecodeLimit bytes past each group start always safe
+template <typename Fn>
+auto decode_bytes(const uint8_t *data, const uint8_t *end, uint8_t *target,
+                  size_t size, const Fn &decode_group) -> const uint8_t * {
+  auto header = data;
+  auto header_size = (size / ByteGroupSize + 3) / 4;
+  if (static_cast<size_t>(end - data) < header_size) {
+    throw runtime_error("truncated meshopt vertex data");
+  }
+  data += header_size;
+
+  for (size_t i = 0; i < size; i += ByteGroupSize) {
+    if (static_cast<size_t>(end - data) < ByteGroupDecodeLimit) {
+      throw runtime_error("truncated meshopt vertex data");
+    }
+    auto group = i / ByteGroupSize;
+    auto mode = (header[group / 4] >> ((group % 4) * 2)) & 3;
+    data = decode_group(data, target + i, mode);
+  }
+  return data;
+}
+
+auto decode_bytes_scalar(const uint8_t *data, const uint8_t *end,
+                         uint8_t *target, size_t size) -> const uint8_t * {
+  static const int widths[] = {0, 2, 4, 8};
+  return decode_bytes(data, end, target, size,
+                      [](const uint8_t *group, uint8_t *output, int mode) {
+                        return decode_bytes_group(group, output, widths[mode]);
+                      });
+}
+
+#ifdef RB_MESHOPT_SSSE3
+
+// for each mask of escaped values among 8, where their bytes come from
+struct ShuffleTables {
+  array<array<uint8_t, 8>, 256> shuffles;
+  array<uint8_t, 256> counts;
+
+  ShuffleTables() {
+    for (uint32_t mask = 0; mask < 256; mask++) {
+      uint8_t count = 0;
+      for (uint32_t bit = 0; bit < 8; bit++) {
+        shuffles[mask][bit] = (mask & (1u << bit)) != 0 ? count++ : 0x80;
+      }
+      counts[mask] = count;
+    }
+  }
+};
+
+const ShuffleTables shuffle_tables;
+
+__attribute__((target("ssse3"))) inline auto
+decode_bytes_group_ssse3(const uint8_t *data, uint8_t *target, int mode)
+    -> const uint8_t * {
+  __m128i values;
+  const uint8_t *rest;
+  switch (mode) {
+  case 0:
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(target), _mm_setzero_si128());
+    return data;
+  case 1: {
+    // spread the 2 bits values of 4 bytes over 16, most significant first
+    int32_t packed;
+    memcpy(&packed, data, 4);
+    auto bytes = _mm_cvtsi32_si128(packed);
+    auto nibbles = _mm_unpacklo_epi8(_mm_srli_epi16(bytes, 4), bytes);
+    auto pairs = _mm_unpacklo_epi8(_mm_srli_epi16(nibbles, 2), nibbles);
+    values = _mm_and_si128(pairs, _mm_set1_epi8(3));
+    rest = data + 4;
+    break;
+  }
+  case 2: {
+    auto bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(data));
+    auto nibbles = _mm_unpacklo_epi8(_mm_srli_epi16(bytes, 4), bytes);
+    values = _mm_and_si128(nibbles, _mm_set1_epi8(15));
+    rest = data + 8;
+    break;
+  }
+  default:
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(target),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(data)));
+    return data + ByteGroupSize;
+  }
+
+  // escaped values are replaced by the following bytes, in order
+  auto escape = mode == 1 ? _mm_set1_epi8(3) : _mm_set1_epi8(15);
+  auto escaped = _mm_cmpeq_epi8(values, escape);
+  auto mask = _mm_movemask_epi8(escaped);
+  auto low = static_cast<uint8_t>(mask & 255);
+  auto high = static_cast<uint8_t>(mask >> 8);
+  auto low_shuffle = _mm_loadl_epi64(
+      reinterpret_cast<const __m128i *>(shuffle_tables.shuffles[low].data()));
+  auto high_shuffle = _mm_add_epi8(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i *>(
+          shuffle_tables.shuffles[high].data())),
+      _mm_set1_epi8(static_cast<char>(shuffle_tables.counts[low])));
+  auto shuffle = _mm_unpacklo_epi64(low_shuffle, high_shuffle);
+  auto extra = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(rest)), shuffle);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(target),
+                   _mm_or_si128(_mm_andnot_si128(escaped, values), extra));
+  return rest + shuffle_tables.counts[low] + shuffle_tables.counts[high];
+}
+
+__attribute__((target("ssse3"))) auto
+decode_bytes_ssse3(const uint8_t *data, const uint8_t *end, uint8_t *target,
+                   size_t size) -> const uint8_t * {
+  return decode_bytes(data, end, target, size, decode_bytes_group_ssse3);
+}
+
+#endif
+
+using DecodeBytes = const uint8_t *(*)(const uint8_t *, const uint8_t *,
+                                       uint8_t *, size_t);
+
+auto get_decode_bytes() -> DecodeBytes {
+#ifdef RB_MESHOPT_SSSE3
+  if (__builtin_cpu_supports("ssse3")) {
+    return decode_bytes_ssse3;
+  }
+#endif
+  return decode_bytes_scalar;
+}
+
+auto decode_vertex_block(const uint8_t *data, const uint8_t *end,
+                         uint8_t *target, size_t count, size_t stride,
+                         uint8_t *last_vertex, DecodeBytes decode)
+    -> const uint8_t * {
+  array<array<uint8_t, VertexBlockMaxSize>, 4> deltas;
+  auto aligned_count = (count + ByteGroupSize - 1) & ~(ByteGroupSize - 1);
+
+  // byte k of every vertex is stored together, as zigzag deltas; the
+  // stride being a multiple of 4, columns are undone 4 at a time, with
+  // bytewise arithmetic on 32 bits words
+  for (size_t k = 0; k < stride; k += 4) {
+    for (size_t c = 0; c < 4; c++) {
+      data = decode(data, end, deltas[c].data(), aligned_count);
+    }
+    uint32_t previous;
+    memcpy(&previous, last_vertex + k, 4);
+    auto output = target + k;
+    for (size_t i = 0; i < count; i++, output += stride) {
+      auto delta = static_cast<uint32_t>(deltas[0][i]) |
+                   static_cast<uint32_t>(deltas[1][i]) << 8 |
+                   static_cast<uint32_t>(deltas[2][i]) << 16 |
+                   static_cast<uint32_t>(deltas[3][i]) << 24;
+      auto sign = (delta & 0x01010101u) * 0xffu;
+      delta = ((delta >> 1) & 0x7f7f7f7fu) ^ sign;
+      previous = (((delta & 0x7f7f7f7fu) + (previous & 0x7f7f7f7fu)) ^
+                  ((delta ^ previous) & 0x80808080u));
+      memcpy(output, &previous, 4);
+    }
+  }
+
+  memcpy(last_vertex, target + (count - 1) * stride, stride);
+  return data;
+}
+
+auto decode_vbyte(const uint8_t *&data) -> uint32_t {
+  uint32_t lead = *data++;
+  if (lead < 128) {
+    return lead;
+  }
+
+  auto result = lead & 127;
+  auto shift = 7u;
+  for (auto i = 0; i < 4; i++) {
+    uint32_t group = *data++;
+    result |= (group & 127) << shift;
+    shift += 7;
+    if (group < 128) {
+      break;
+    }
+  }
+  return result;
+}
+
+auto unzigzag(uint32_t value) -> uint32_t {
+  return (value >> 1) ^ (0u - (value & 1));
+}
+
+// an index stored as a zigzag delta from the previous one
+auto decode_index(const uint8_t *&data, uint32_t last) -> uint32_t {
+  return last + unzigzag(decode_vbyte(data));
+}
+
+void write_index(uint8_t *target, size_t idx, size_t stride, uint32_t index) {
+  if (stride == 2) {
+    auto value = static_cast<uint16_t>(index);
+    memcpy(target + idx * 2, &value, 2);
+  } else {
+    memcpy(target + idx * 4, &index, 4);
+  }
+}
+
+// FIFOs of the triangle codec, which must evolve exactly like the encoder's
+struct TriangleState {
+  array<array<uint32_t, 2>, 16> edges;
+  array<uint32_t, 16> vertices;
+  size_t edge_offset = 0;
+  size_t vertex_offset = 0;
+
+  TriangleState() {
+    for (auto &edge : edges) {
+      edge = {UINT32_MAX, UINT32_MAX};
+    }
+    vertices.fill(UINT32_MAX);
+  }
+
+  void push_edge(uint32_t a, uint32_t b) {
+    edges[edge_offset] = {a, b};
+    edge_offset = (edge_offset + 1) & 15;
+  }
+
+  void push_vertex(uint32_t v, bool advance = true) {
+    vertices[vertex_offset] = v;
+    vertex_offset = (vertex_offset + (advance ? 1 : 0)) & 15;
+  }
+
+  auto edge(size_t back) const -> const array<uint32_t, 2> & {
+    return edges[(edge_offset - 1 - back) & 15];
+  }
+
+  auto vertex(size_t back) const -> uint32_t {
+    return vertices[(vertex_offset - back) & 15];
+  }
+};
+
+template <typename T> auto round_to(float value) -> T {
+  return static_cast<T>(
+      static_cast<int>(value + (value >= 0.0f ? 0.5f : -0.5f)));
+}
+
+template <typename T> void decode_octahedral(T *data, size_t count) {
+  const auto max = static_cast<float>((1 << (sizeof(T) * 8 - 1)) - 1);
+  for (size_t i = 0; i < count; i++, data += 4) {
+    // z is stored as the scale that encodes 1
+    auto x = static_cast<float>(data[0]);
+    auto y = static_cast<float>(data[1]);
+    auto z = static_cast<float>(data[2]) - fabsf(x) - fabsf(y);
+
+    // unfold the lower hemisphere
+    auto t = min(z, 0.0f);
+    x += x >= 0.0f ? t : -t;
+    y += y >= 0.0f ? t : -t;
+
+    auto scale = max / sqrtf(x * x + y * y + z * z);
+    data[0] = round_to<T>(x * scale);
+    data[1] = round_to<T>(y * scale);
+    data[2] = round_to<T>(z * scale);
+  }
+}
+
+void decode_quaternion(int16_t *data, size_t count) {
+  const auto scale = 1.0f / sqrtf(2.0f);
+  for (size_t i = 0; i < count; i++, data += 4) {
+    // the high bits of the last component hold the scale, the low two the
+    // index of the largest component, which is left out
+    auto range = scale / static_cast<float>(data[3] | 3);
+    auto x = static_cast<float>(data[0]) * range;
+    auto y = static_cast<float>(data[1]) * range;
+    auto z = static_cast<float>(data[2]) * range;
+    auto w = sqrtf(max(1.0f - x * x - y * y - z * z, 0.0f));
+
+    auto largest = data[3] & 3;
+    data[(largest + 1) & 3] = round_to<int16_t>(x * 32767.0f);
+    data[(largest + 2) & 3] = round_to<int16_t>(y * 32767.0f);
+    data[(largest + 3) & 3] = round_to<int16_t>(z * 32767.0f);
+    data[(largest + 0) & 3] = round_to<int16_t>(w * 32767.0f);
+  }
+}
+
+void decode_exponential(uint8_t *data, size_t count) {
+  for (size_t i = 0; i < count; i++, data += 4) {
+    // 24 bits signed mantissa and 8 bits signed exponent
+    uint32_t value;
+    memcpy(&value, data, 4);
+    auto mantissa = static_cast<int32_t>(value << 8) >> 8;
+    auto exponent = static_cast<int32_t>(value) >> 24;
+    auto decoded = ldexpf(static_cast<float>(mantissa), exponent);
+    memcpy(data, &decoded, 4);
+  }
+}
+
+} // namespace
+
+void decode_meshopt_vertices(uint8_t *target, size_t count, size_t stride,
+                             const uint8_t *source, size_t size) {
+  if (stride == 0 || stride > 256 || stride % 4 != 0) {
+    throw runtime_error("invalid meshopt vertex stride");
+  }
+  auto end = source + size;
+  if (size < 1 + stride) {
+    throw runtime_error("truncated meshopt vertex data");
+  }
+  if ((source[0] & 0xf0) != VertexHeader || (source[0] & 0x0f) > 0) {
+    throw runtime_error("unsupported meshopt vertex data");
+  }
+
+  // deltas of the first block are taken from the tail
+  array<uint8_t, 256> last_vertex;
+  memcpy(last_vertex.data(), end - stride, stride);
+
+  static const auto decode = get_decode_bytes();
+  auto data = source + 1;
+  auto block_size = get_vertex_block_size(stride);
+  for (size_t offset = 0; offset < count; offset += block_size) {
+    auto block_count = min(block_size, count - offset);
+    data = decode_vertex_block(data, end, target + offset * stride,
+                               block_count, stride, last_vertex.data(),
+                               decode);
+  }
+
+  if (static_cast<size_t>(end - data) != max(stride, TailMaxSize)) {
+    throw runtime_error("invalid meshopt vertex data size");
+  }
+}
+
+void decode_meshopt_triangles(uint8_t *target, size_t count, size_t stride,
+                              const uint8_t *source, size_t size) {
+  if (count % 3 != 0 || (stride != 2 && stride != 4)) {
+    throw runtime_error("invalid meshopt triangle layout");
+  }
+  // a byte per triangle and a table of 16 bytes at least
+  if (size < 1 + count / 3 + 16) {
+    throw runtime_error("truncated meshopt triangle data");
+  }
+  if ((source[0] & 0xf0) != TriangleHeader || (source[0] & 0x0f) > 1) {
+    throw runtime_error("unsupported meshopt triangle data");
+  }
+  const auto version = source[0] & 0x0f;
+  const auto max_cached = version >= 1 ? 13 : 15;
+
+  TriangleState state;
+  uint32_t next = 0, last = 0;
+  auto code = source + 1;
+  auto data = code + count / 3;
+  // a triangle reads 16 bytes at most, the table makes that always safe
+  auto data_end = source + size - 16;
+  auto table = data_end;
+
+  for (size_t i = 0; i < count; i += 3) {
+    if (data > data_end) {
+      throw runtime_error("truncated meshopt triangle data");
+    }
+
+    auto code_triangle = *code++;
+    uint32_t a, b, c;
+    if (code_triangle < 0xf0) {
+      // an edge from the FIFO and a third vertex
+      auto &edge = state.edge(code_triangle >> 4);
+      a = edge[0];
+      b = edge[1];
+      auto fec = code_triangle & 15;
+      if (fec < max_cached) {
+        c = fec == 0 ? next++ : state.vertex(static_cast<size_t>(fec) + 1);
+        state.push_vertex(c, fec == 0);
+      } else {
+        // 13 and 14 are the last free index -1 and +1
+        c = fec != 15 ? last + static_cast<uint32_t>(fec - (fec ^ 3))
+                      : decode_index(data, last);
+        last = c;
+        state.push_vertex(c);
+      }
+      state.push_edge(c, b);
+      state.push_edge(a, c);
+    } else {
+      int feb, fec, fea;
+      if (code_triangle < 0xfe) {
+        auto code_aux = table[code_triangle & 15];
+        fea = 0;
+        feb = code_aux >> 4;
+        fec = code_aux & 15;
+      } else {
+        auto code_aux = *data++;
+        fea = code_triangle == 0xfe ? 0 : 15;
+        feb = code_aux >> 4;
+        fec = code_aux & 15;
+        if (code_aux == 0) {
+          next = 0;
+        }
+      }
+
+      // new vertices take the next numbers in order, before free indices
+      a = fea == 0 ? next++ : 0;
+      b = feb == 0 ? next++ : state.vertex(static_cast<size_t>(feb));
+      c = fec == 0 ? next++ : state.vertex(static_cast<size_t>(fec));
+      if (fea == 15) {
+        last = a = decode_index(data, last);
+      }
+      if (feb == 15) {
+        last = b = decode_index(data, last);
+      }
+      if (fec == 15) {
+        last = c = decode_index(data, last);
+      }
+
+      state.push_vertex(a);
+      state.push_vertex(b, feb == 0 || feb == 15);
+      state.push_vertex(c, fec == 0 || fec == 15);
+      state.push_edge(b, a);
+      state.push_edge(c, b);
+      state.push_edge(a, c);
+    }
+
+    write_index(target, i, stride, a);
+    write_index(target, i + 1, stride, b);
+    write_index(target, i + 2, stride, c);
+  }
+
+  if (data != data_end) {
+    throw runtime_error("invalid meshopt triangle data size");
+  }
+}
+
+void decode_meshopt_indices(uint8_t *target, size_t count, size_t stride,
+                            const uint8_t *source, size_t size) {
+  if (stride != 2 && stride != 4) {
+    throw runtime_error("invalid meshopt index stride");
+  }
+  // a byte per index and a tail of 4 bytes at least
+  if (size < 1 + count + 4) {
+    throw runtime_error("truncated meshopt index data");
+  }
+  if ((source[0] & 0xf0) != SequenceHeader || (source[0] & 0x0f) > 1) {
+    throw runtime_error("unsupported meshopt index data");
+  }
+
+  // deltas are taken from one of two baselines, picked by the low bit
+  auto data = source + 1;
+  auto data_end = source + size - 4;
+  array<uint32_t, 2> last = {0, 0};
+  for (size_t i = 0; i < count; i++) {
+    if (data >= data_end) {
+      throw runtime_error("truncated meshopt index data");
+    }
+    auto value = decode_vbyte(data);
+    auto &baseline = last[value & 1];
+    baseline += unzigzag(value >> 1);
+    write_index(target, i, stride, baseline);
+  }
+
+  if (data != data_end) {
+    throw runtime_error("invalid meshopt index data size");
+  }
+}
+
+void apply_meshopt_filter(const string &filter, uint8_t *data, size_t count,
+                          size_t stride) {
+  if (filter.empty() || filter == "NONE") {
+    return;
+  }
+  if (filter == "OCTAHEDRAL") {
+    if (stride == 4) {
+      decode_octahedral(reinterpret_cast<int8_t *>(data), count);
+    } else if (stride == 8) {
+      decode_octahedral(reinterpret_cast<int16_t *>(data), count);
+    } else {
+      throw runtime_error("invalid stride for the octahedral filter");
+    }
+  } else if (filter == "QUATERNION") {
+    if (stride != 8) {
+      throw runtime_error("invalid stride for the quaternion filter");
+    }
+    decode_quaternion(reinterpret_cast<int16_t *>(data), count);
+  } else if (filter == "EXPONENTIAL") {
+    if (stride % 4 != 0) {
+      throw runtime_error("invalid stride for the exponential filter");
+    }
+    decode_exponential(data, count * stride / 4);
+  } else {
+    throw runtime_error("unknown meshopt filter " + filter);
+  }
+}
+
+} // namespace RB
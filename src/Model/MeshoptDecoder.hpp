@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace RB {
+
+// Decoders for the bitstreams of EXT_meshopt_compression. Each fills
+// `count` elements of `stride` bytes at `target` from the `size` bytes at
+// `source`, and throws on malformed or truncated data.
+
+// "ATTRIBUTES" mode: `stride` is a multiple of 4, at most 256
+void decode_meshopt_vertices(uint8_t *target, size_t count, size_t stride,
+                             const uint8_t *source, size_t size);
+
+// "TRIANGLES" mode: `count` is a multiple of 3, `stride` is 2 or 4
+void decode_meshopt_triangles(uint8_t *target, size_t count, size_t stride,
+                              const uint8_t *source, size_t size);
+
+// "INDICES" mode: `stride` is 2 or 4
+void decode_meshopt_indices(uint8_t *target, size_t count, size_t stride,
+                            const uint8_t *source, size_t size);
+
+// Undoes the "OCTAHEDRAL", "QUATERNION" or "EXPONENTIAL" filter over
+// decoded vertices in place; "NONE" does nothing.
+void apply_meshopt_filter(const std::string &filter, uint8_t *data,
+                          size_t count, size_t stride);
+
+} // namespace RB
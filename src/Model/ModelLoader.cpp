@@ -1,11 +1,41 @@
+#include "Model/CachedModelLoader.hpp"
 #include "Model/GLTFModelLoader.hpp"
+#include <Eigen/Core>
 #include <RenderBoy/ModelLoader.hpp>
 #include <exception>
 
 using namespace std;
+using namespace Eigen;
 
 namespace RB {
 
+auto get_extends(const Model &model) -> BoundingBox {
+  BoundingBox box{};
+  for (auto &mesh : model.meshes) {
+    for (auto &geometry : mesh.geometries) {
+      Vector4f min =
+          mesh.model_matrix * Vector4f(geometry.box.min[0], geometry.box.min[1],
+                                       geometry.box.min[2], 1.0f);
+      min /= min[3];
+      Vector4f max =
+          mesh.model_matrix * Vector4f(geometry.box.max[0], geometry.box.max[1],
+                                       geometry.box.max[2], 1.0f);
+      max /= max[3];
+      Vector4f center = (min + max) / 2.0f;
+      Vector4f distance = max - center;
+      distance[3] = 0.0f;
+      float radius = distance.norm();
+      min = center - Vector4f(radius, radius, radius, radius);
+      max = center + Vector4f(radius, radius, radius, radius);
+      for (size_t i = 0; i < 3; i++) {
+        box.min[i] = std::min(box.min[i], min[i]);
+        box.max[i] = std::max(box.max[i], max[i]);
+      }
+    }
+  }
+  return box;
+}
+
 ModelLoader::~ModelLoader() = default;
 
 ModelLoader::ModelLoader(const string &path) {
@@ -16,17 +46,51 @@ ModelLoader::ModelLoader(const string &path) {
 
   auto ext = path.substr(ext_idx);
   if (ext == ".gltf" || ext == ".glb") {
-    impl.reset(new GLTFModelLoader);
+    impl.reset(new CachedModelLoader(
+        unique_ptr<IModelLoader>(new GLTFModelLoader)));
   } else {
     throw runtime_error("unsupported model format");
   }
   impl->set_path(path);
 }
 
+void ModelLoader::set_lazy_textures(bool enabled) {
+  impl->set_lazy_textures(enabled);
+}
+
+void ModelLoader::set_optimize_meshes(bool enabled) {
+  impl->set_optimize_meshes(enabled);
+}
+
+void ModelLoader::set_keep_quantized(bool enabled) {
+  impl->set_keep_quantized(enabled);
+}
+
+void ModelLoader::set_compact_indices(bool enabled) {
+  impl->set_compact_indices(enabled);
+}
+
+void ModelLoader::set_share_assets(bool enabled) {
+  impl->set_share_assets(enabled);
+}
+
 auto ModelLoader::load() -> Model & { return impl->load(); }
 
+auto ModelLoader::load_async() -> shared_ptr<ModelStream> {
+  auto stream = make_shared<ModelStream>();
+  auto loader = impl;
+  stream->start(
+      [loader](ModelStream &target) { loader->load_progressive(target); });
+  return stream;
+}
+
 auto ModelLoader::get_extends() const -> BoundingBox {
   return impl->get_extends();
 };
 
+auto ModelLoader::get_vertex_cache_stats() const
+    -> array<VertexCacheStats, 2> {
+  return impl->get_vertex_cache_stats();
+}
+
 } // namespace RB
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "Model/IModelLoader.hpp"
+#include <RenderBoy/ModelStream.hpp>
+#include <algorithm>
+
+using namespace std;
+
+namespace RB {
+
+ModelStream::~ModelStream() {
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+void ModelStream::start(function<void(ModelStream &)> task) {
+  // the task usually holds the loader owning the textures, keep it with us
+  loader = move(task);
+  worker = thread([this]() {
+    exception_ptr failure;
+    try {
+      loader(*this);
+    } catch (...) {
+      failure = current_exception();
+    }
+
+    {
+      lock_guard<std::mutex> lock(mutex);
+      error = failure;
+      meshes_complete = true;
+      done = true;
+    }
+    finished.notify_all();
+  });
+}
+
+void ModelStream::add_meshes(vector<Mesh> meshes) {
+  if (meshes.empty()) {
+    return;
+  }
+
+  auto chunk = make_unique<Model>();
+  chunk->meshes = move(meshes);
+  uint32_t geometry_count = 0;
+  for (auto &mesh : chunk->meshes) {
+    geometry_count += static_cast<uint32_t>(mesh.geometries.size());
+  }
+  chunk->box = RB::get_extends(*chunk);
+
+  lock_guard<std::mutex> lock(mutex);
+  auto first = first_geometries.empty() ? 0u : first_geometries.back();
+  first_geometries.push_back(first + geometry_count);
+  chunks.emplace_back(move(chunk));
+}
+
+void ModelStream::all_meshes_added() {
+  lock_guard<std::mutex> lock(mutex);
+  meshes_complete = true;
+}
+
+void ModelStream::update_material(uint32_t geometry_idx,
+                                  const Material &material) {
+  lock_guard<std::mutex> lock(mutex);
+  updates.push_back({geometry_idx, material});
+}
+
+auto ModelStream::poll(Context &context) -> bool {
+  unique_lock<std::mutex> lock(mutex);
+  // chunks never move once published, so they can be used unlocked
+  for (auto idx = added.size(); idx < chunks.size(); idx++) {
+    added.push_back(chunks[idx].get());
+  }
+  vector<MaterialUpdate> pending(updates.begin() + applied_updates,
+                                 updates.end());
+  applied_updates = updates.size();
+  auto first_geometries_copy = first_geometries;
+  auto failure = error;
+  auto complete = done;
+  lock.unlock();
+
+  for (auto idx = handles.size(); idx < added.size(); idx++) {
+    handles.push_back(context.add(*added[idx]));
+  }
+
+  for (auto &update : pending) {
+    // chunk `i` holds geometries [first_geometries[i - 1], first_geometries[i])
+    auto it = upper_bound(first_geometries_copy.begin(),
+                          first_geometries_copy.end(), update.geometry_idx);
+    if (it == first_geometries_copy.end()) {
+      continue;
+    }
+    auto chunk_idx = static_cast<size_t>(it - first_geometries_copy.begin());
+    auto geometry_idx =
+        update.geometry_idx -
+        (chunk_idx == 0 ? 0 : first_geometries_copy[chunk_idx - 1]);
+    context.update_material(handles[chunk_idx], geometry_idx, update.material);
+
+    // keep the chunk in sync for anyone adding it again
+    for (auto &mesh : added[chunk_idx]->meshes) {
+      if (geometry_idx < mesh.geometries.size()) {
+        mesh.geometries[geometry_idx].material = update.material;
+        break;
+      }
+      geometry_idx -= static_cast<uint32_t>(mesh.geometries.size());
+    }
+  }
+
+  if (failure) {
+    rethrow_exception(failure);
+  }
+  return complete;
+}
+
+void ModelStream::wait() {
+  unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this]() { return done; });
+  if (error) {
+    rethrow_exception(error);
+  }
+}
+
+auto ModelStream::has_all_meshes() const -> bool {
+  lock_guard<std::mutex> lock(mutex);
+  return meshes_complete;
+}
+
+auto ModelStream::get_extends() const -> BoundingBox {
+  lock_guard<std::mutex> lock(mutex);
+  BoundingBox box;
+  for (auto &chunk : chunks) {
+    for (size_t i = 0; i < 3; i++) {
+      box.min[i] = std::min(box.min[i], chunk->box.min[i]);
+      box.max[i] = std::max(box.max[i], chunk->box.max[i]);
+    }
+  }
+  return box;
+}
+
+} // namespace RB
@@ -0,0 +1,145 @@
+#include "RenderBoy/TextureCache.hpp"
+
+using namespace std;
+
+namespace RB {
+
+namespace {
+
+// keeps the decoded pixels next to the texture pointing at them
+struct DecodedTexture {
+  Texture texture;
+  vector<unsigned char> pixels;
+};
+
+} // namespace
+
+LazyTexture::~LazyTexture() { TextureCache::instance().forget(*this); }
+
+auto TextureCache::instance() -> TextureCache & {
+  // never destroyed, textures may outlive other statics
+  static auto cache = new TextureCache();
+  return *cache;
+}
+
+void TextureCache::set_budget(size_t bytes) {
+  lock_guard<std::mutex> lock(mutex);
+  budget = bytes;
+  evict();
+}
+
+auto TextureCache::get_budget() const -> size_t {
+  lock_guard<std::mutex> lock(mutex);
+  return budget;
+}
+
+auto TextureCache::get_resident_bytes() const -> size_t {
+  lock_guard<std::mutex> lock(mutex);
+  return resident_bytes;
+}
+
+void TextureCache::make_lazy(Texture &texture, TextureDecoder decoder) {
+  texture.data = nullptr;
+  texture.lazy = make_shared<LazyTexture>();
+  texture.lazy->decoder = move(decoder);
+}
+
+auto TextureCache::acquire(const Texture &texture)
+    -> shared_ptr<const Texture> {
+  if (texture.lazy == nullptr) {
+    return shared_ptr<const Texture>(shared_ptr<const Texture>(), &texture);
+  }
+
+  auto &lazy = *texture.lazy;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    if (lazy.resident != nullptr) {
+      touch(lazy);
+      return lazy.resident;
+    }
+  }
+
+  // decode outside of the cache lock so different textures decode in
+  // parallel, while threads wanting the same one wait for the first
+  lock_guard<std::mutex> decoding(lazy.decoding);
+  {
+    lock_guard<std::mutex> lock(mutex);
+    if (lazy.resident != nullptr) {
+      touch(lazy);
+      return lazy.resident;
+    }
+  }
+
+  auto decoded = make_shared<DecodedTexture>();
+  exception_ptr error;
+  try {
+    lazy.decoder(decoded->pixels, decoded->texture);
+  } catch (...) {
+    error = current_exception();
+    decoded->texture = Texture{};
+    decoded->texture.width = decoded->texture.height = 1;
+    decoded->texture.channels = 4;
+    decoded->pixels.assign(4, 255);
+  }
+  decoded->texture.data = decoded->pixels.data();
+  shared_ptr<const Texture> resident(decoded, &decoded->texture);
+
+  lock_guard<std::mutex> lock(mutex);
+  lazy.error = error;
+  if (error != nullptr) {
+    errors.push_back(error);
+  }
+  lazy.resident = resident;
+  lazy.bytes = decoded->pixels.size();
+  resident_bytes += lazy.bytes;
+  touch(lazy);
+  evict();
+  return resident;
+}
+
+auto TextureCache::get_error(const Texture &texture) const -> exception_ptr {
+  if (texture.lazy == nullptr) {
+    return nullptr;
+  }
+  lock_guard<std::mutex> lock(mutex);
+  return texture.lazy->error;
+}
+
+auto TextureCache::take_errors() -> vector<exception_ptr> {
+  lock_guard<std::mutex> lock(mutex);
+  vector<exception_ptr> taken;
+  taken.swap(errors);
+  return taken;
+}
+
+void TextureCache::touch(LazyTexture &lazy) {
+  if (lazy.listed) {
+    lru.splice(lru.begin(), lru, lazy.position);
+  } else {
+    lru.push_front(&lazy);
+    lazy.listed = true;
+  }
+  lazy.position = lru.begin();
+}
+
+void TextureCache::evict() {
+  // the most recent texture stays even if it alone exceeds the budget
+  while (resident_bytes > budget && lru.size() > 1) {
+    auto &lazy = *lru.back();
+    lru.pop_back();
+    lazy.listed = false;
+    lazy.resident.reset();
+    resident_bytes -= lazy.bytes;
+    lazy.bytes = 0;
+  }
+}
+
+void TextureCache::forget(LazyTexture &lazy) {
+  lock_guard<std::mutex> lock(mutex);
+  if (lazy.listed) {
+    lru.erase(lazy.position);
+    resident_bytes -= lazy.bytes;
+  }
+}
+
+} // namespace RB
@@ -1,8 +1,19 @@
 #define CATCH_CONFIG_MAIN
 #include "catch2/catch.hpp"
 #include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <RenderBoy/Camera.hpp>
+#include <RenderBoy/Context.hpp>
 #include <RenderBoy/Frame.hpp>
+#include <RenderBoy/MeshOptimizer.hpp>
+#include <RenderBoy/ModelLoader.hpp>
+#include <RenderBoy/TextureCache.hpp>
+#include <algorithm>
 #include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <utime.h>
 
 using namespace Eigen;
 using namespace RB;
@@ -25,3 +36,1068 @@ TEST_CASE("Frame", "SetColor") {
   REQUIRE(1.0f == colors[idx + 1]);
   REQUIRE(1.0f == colors[idx + 3]);
 }
+
+static auto make_quad_model(const std::array<float, 4> &color) -> Model {
+  Geometry geometry{};
+  geometry.buffers.resize(4);
+  geometry.buffers[0].position = {-1.0f, -1.0f, 0.0f};
+  geometry.buffers[1].position = {1.0f, -1.0f, 0.0f};
+  geometry.buffers[2].position = {1.0f, 1.0f, 0.0f};
+  geometry.buffers[3].position = {-1.0f, 1.0f, 0.0f};
+  geometry.indices = {0, 1, 2, 0, 2, 3};
+  geometry.vertex_count = 4;
+  geometry.index_count = 6;
+  geometry.material.base_color = color;
+
+  Model model{};
+  model.meshes.emplace_back();
+  model.meshes.back().geometries.emplace_back(std::move(geometry));
+  return model;
+}
+
+TEST_CASE("Context incremental updates", "[Context]") {
+  auto red = make_quad_model({1.0f, 0.0f, 0.0f, 1.0f});
+  auto green = make_quad_model({0.0f, 1.0f, 0.0f, 1.0f});
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+
+  auto handle = context.add(red);
+  context.draw();
+  const auto center = (8 + 8 * 16) * 4;
+  REQUIRE(1.0f == context.get_colors()[center]);
+
+  Material material{};
+  material.base_color = {0.0f, 0.0f, 1.0f, 1.0f};
+  context.update_material(handle, 0, material);
+  context.draw();
+  REQUIRE(1.0f == context.get_colors()[center + 2]);
+
+  Matrix4f away = Matrix4f::Identity();
+  away(0, 3) = 4.0f;
+  context.update_transform(handle, away);
+  context.draw();
+  REQUIRE(0.0f == context.get_colors()[center + 2]);
+
+  context.remove(handle);
+  auto other = context.add(green);
+  REQUIRE(other == handle);
+  context.draw();
+  REQUIRE(1.0f == context.get_colors()[center + 1]);
+  REQUIRE_THROWS(context.remove(handle + 1));
+}
+
+TEST_CASE("Context command buffers", "[Context]") {
+  auto red = make_quad_model({1.0f, 0.0f, 0.0f, 1.0f});
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.set_view(Matrix4f::Identity());
+  auto handle = context.add(red);
+
+  std::vector<CommandBuffer> buffers(2);
+  std::thread first([&buffers]() {
+    buffers[0].set_viewport(16, 16);
+    buffers[0].clear({0.0f, 0.0f, 1.0f, 1.0f});
+  });
+  std::thread second([&buffers, handle]() {
+    Matrix4f left = Matrix4f::Identity();
+    left(0, 0) = 0.5f;
+    left(0, 3) = -0.5f;
+    buffers[1].set_transform(left);
+    buffers[1].draw(handle, 0);
+  });
+  first.join();
+  second.join();
+
+  context.submit(buffers);
+  auto &colors = context.get_colors();
+  const auto left_pixel = (2 + 8 * 16) * 4;
+  const auto right_pixel = (13 + 8 * 16) * 4;
+  REQUIRE(1.0f == colors[left_pixel]);
+  REQUIRE(1.0f == colors[right_pixel + 2]);
+  REQUIRE(0.0f == colors[right_pixel]);
+}
+
+TEST_CASE("Context frames in flight", "[Context]") {
+  auto red = make_quad_model({1.0f, 0.0f, 0.0f, 1.0f});
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_frames_in_flight(2);
+  context.add(red);
+
+  context.set_view(Matrix4f::Identity());
+  auto first = context.draw_async();
+  Matrix4f away = Matrix4f::Identity();
+  away(0, 3) = 4.0f;
+  context.set_view(away);
+  auto second = context.draw_async();
+
+  const auto center = (8 + 8 * 16) * 4;
+  REQUIRE(0.0f == context.wait(second)[center]);
+  REQUIRE(1.0f == context.wait(first)[center]);
+
+  context.draw_async();
+  REQUIRE_THROWS(context.wait(first));
+}
+
+TEST_CASE("Context multi-view drawing", "[Context]") {
+  auto red = make_quad_model({1.0f, 0.0f, 0.0f, 1.0f});
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.add(red);
+
+  Matrix4f away = Matrix4f::Identity();
+  away(0, 3) = 4.0f;
+  std::vector<Frame> frames;
+  context.draw_views({Matrix4f::Identity(), away}, frames);
+
+  REQUIRE(2 == frames.size());
+  REQUIRE(1.0f == frames[0].getColor(8 + 8 * 16)[0]);
+  REQUIRE(0.0f == frames[1].getColor(8 + 8 * 16)[0]);
+
+  // a highlight the sun only sends back towards the first view's eye, the
+  // second one looking from 60 degrees aside
+  auto white = make_quad_model({1.0f, 1.0f, 1.0f, 1.0f});
+  for (auto &vertex : white.meshes[0].geometries[0].buffers) {
+    vertex.normal = {0.0f, 0.0f, -1.0f};
+  }
+  Context lit(Context::Type::SoftwareRasterizer);
+  lit.view_port(16, 16);
+  auto handle = lit.add(white);
+  auto sun = Light::Direction();
+  sun.direction = {0.0f, 0.0f, 1.0f};
+  lit.set_lights({sun});
+  Matrix4f aside = Matrix4f::Identity();
+  aside.topLeftCorner<3, 3>() =
+      AngleAxisf(PI / 3.0f, Vector3f::UnitY()).toRotationMatrix();
+
+  // a black diffuse, or a metal, reflects nothing but the highlight
+  auto material = white.meshes[0].geometries[0].material;
+  material.metallic = 1.0f;
+  material.roughness = 0.3f;
+  for (auto shading :
+       {Material::Shading::Phong, Material::Shading::MetallicRoughness}) {
+    material.shading = shading;
+    material.base_color[0] = shading == Material::Shading::Phong ? 0.0f : 1.0f;
+    lit.update_material(handle, 0, material);
+    lit.draw_views({Matrix4f::Identity(), aside}, frames);
+    auto facing = frames[0].getColor(8 + 8 * 16)[0];
+    REQUIRE(facing > 0.9f);
+    REQUIRE(frames[1].getColor(8 + 8 * 16)[0] < facing * 0.5f);
+  }
+}
+
+TEST_CASE("Context lighting", "[Context]") {
+  // facing the eye of the identity view, which looks down +z
+  auto quad = make_quad_model({0.5f, 0.0f, 0.0f, 1.0f});
+  for (auto &vertex : quad.meshes[0].geometries[0].buffers) {
+    vertex.normal = {0.0f, 0.0f, -1.0f};
+  }
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+  auto handle = context.add(quad);
+  auto ambient = Light::Ambient();
+  ambient.intensity = 0.2f;
+  auto sun = Light::Direction();
+  sun.direction = {0.0f, 0.0f, 1.0f};
+  context.set_lights({ambient, sun});
+
+  const auto center = (8 + 8 * 16) * 4;
+  auto material = quad.meshes[0].geometries[0].material;
+  material.specular = {0.0f, 0.0f, 0.0f};
+  for (auto shading : {Material::Shading::Phong, Material::Shading::Gouraud}) {
+    material.shading = shading;
+    context.update_material(handle, 0, material);
+    context.draw();
+    REQUIRE(std::abs(context.get_colors()[center] - 0.6f) < 1e-4f);
+    REQUIRE(0.0f == context.get_colors()[center + 1]);
+  }
+
+  // a highlight towards the eye, fully lit by a shiny white specular
+  material.shading = Material::Shading::Phong;
+  material.specular = {1.0f, 1.0f, 1.0f};
+  context.update_material(handle, 0, material);
+  context.draw();
+  REQUIRE(1.0f == context.get_colors()[center]);
+  REQUIRE(std::abs(context.get_colors()[center + 1] - 1.0f) < 1e-3f);
+
+  material.shading = Material::Shading::Normal;
+  context.update_material(handle, 0, material);
+  context.draw();
+  REQUIRE(0.5f == context.get_colors()[center]);
+  REQUIRE(0.0f == context.get_colors()[center + 2]);
+}
+
+TEST_CASE("Context metallic-roughness", "[Context]") {
+  auto quad = make_quad_model({0.5f, 0.5f, 0.5f, 1.0f});
+  for (auto &vertex : quad.meshes[0].geometries[0].buffers) {
+    vertex.normal = {0.0f, 0.0f, -1.0f};
+  }
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+  auto handle = context.add(quad);
+
+  const auto center = (8 + 8 * 16) * 4;
+  auto material = quad.meshes[0].geometries[0].material;
+  material.shading = Material::Shading::MetallicRoughness;
+  material.metallic = 0.0f;
+  material.emissive = {0.25f, 0.0f, 0.0f, 1.0f};
+  context.update_material(handle, 0, material);
+  context.draw();
+  REQUIRE(0.25f == context.get_colors()[center]);
+  REQUIRE(0.0f == context.get_colors()[center + 1]);
+
+  // a rough dielectric facing the sun reflects mostly its albedo
+  material.emissive = {0.0f, 0.0f, 0.0f, 0.0f};
+  context.update_material(handle, 0, material);
+  auto sun = Light::Direction();
+  sun.direction = {0.0f, 0.0f, 1.0f};
+  context.set_lights({sun});
+  context.draw();
+  auto lit = context.get_colors()[center];
+  REQUIRE(lit > 0.45f);
+  REQUIRE(lit < 0.6f);
+
+  // an evenly grey environment, mirrored by a smooth metal
+  std::vector<uint8_t> grey(32 * 16 * 4, 128);
+  Texture environment;
+  environment.width = 32;
+  environment.height = 16;
+  environment.channels = 4;
+  environment.data = grey.data();
+  context.set_lights({});
+  context.set_environment(&environment);
+  context.draw();
+  auto diffuse = context.get_colors()[center];
+  material.metallic = 1.0f;
+  material.roughness = 0.0f;
+  material.base_color = {1.0f, 1.0f, 1.0f, 1.0f};
+  context.update_material(handle, 0, material);
+  context.draw();
+  auto mirrored = context.get_colors()[center];
+  REQUIRE(diffuse > 0.2f);
+  REQUIRE(diffuse < 0.3f);
+  REQUIRE(std::abs(mirrored - 128.0f / 255.0f) < 0.02f);
+
+  context.set_environment(nullptr);
+  context.draw();
+  REQUIRE(0.0f == context.get_colors()[center]);
+}
+
+TEST_CASE("Context shadow maps", "[Context]") {
+  // a small quad floating in front of a wall, both facing the eye
+  auto wall = make_quad_model({0.5f, 0.5f, 0.5f, 1.0f});
+  auto occluder = make_quad_model({0.5f, 0.5f, 0.5f, 1.0f});
+  for (auto &vertex : wall.meshes[0].geometries[0].buffers) {
+    vertex.position[2] = 0.5f;
+    vertex.normal = {0.0f, 0.0f, -1.0f};
+  }
+  for (auto &vertex : occluder.meshes[0].geometries[0].buffers) {
+    vertex.position = {vertex.position[0] * 0.25f - 0.5f,
+                       vertex.position[1] * 0.25f, -0.5f};
+    vertex.normal = {0.0f, 0.0f, -1.0f};
+  }
+  wall.meshes[0].geometries[0].box = {{-1.0f, -1.0f, 0.5f},
+                                      {1.0f, 1.0f, 0.5f}};
+  occluder.meshes[0].geometries[0].box = {{-0.75f, -0.25f, -0.5f},
+                                          {-0.25f, 0.25f, -0.5f}};
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(32, 32);
+  context.set_view(Matrix4f::Identity());
+  for (auto model : {&wall, &occluder}) {
+    auto handle = context.add(*model);
+    auto material = model->meshes[0].geometries[0].material;
+    material.shading = Material::Shading::Phong;
+    material.specular = {0.0f, 0.0f, 0.0f};
+    context.update_material(handle, 0, material);
+  }
+
+  // the occluder's shadow falls around x = 0.5, y = 0 on the wall
+  const auto shadowed = (24 + 16 * 32) * 4;
+  const auto lit = (24 + 28 * 32) * 4;
+  auto sun = Light::Direction();
+  sun.direction = Vector3f(1.0f, 0.0f, 1.0f).normalized();
+  context.set_lights({sun});
+  context.draw();
+  REQUIRE(context.get_colors()[shadowed] > 0.3f);
+
+  sun.cast_shadows = true;
+  context.set_lights({sun});
+  context.draw();
+  REQUIRE(0.0f == context.get_colors()[shadowed]);
+  REQUIRE(context.get_colors()[lit] > 0.3f);
+
+  // the cascades also cover views other than the first, which here sees
+  // nothing in front of it
+  Matrix4f past = Matrix4f::Identity();
+  past(2, 3) = -4.0f;
+  std::vector<Frame> frames;
+  context.draw_views({past, Matrix4f::Identity()}, frames);
+  REQUIRE(0.0f == frames[1].getColor(24 + 16 * 32)[0]);
+  REQUIRE(frames[1].getColor(24 + 28 * 32)[0] > 0.3f);
+
+  // a spot behind the occluder, along the same direction
+  auto spot = Light::Spot();
+  spot.position = {-1.5f, 0.0f, -1.5f};
+  spot.direction = sun.direction;
+  spot.intensity = 10.0f;
+  spot.cast_shadows = true;
+  context.set_lights({spot});
+  context.draw();
+  REQUIRE(0.0f == context.get_colors()[shadowed]);
+  REQUIRE(context.get_colors()[lit] > 0.3f);
+}
+
+TEST_CASE("Context tiled lights", "[Context]") {
+  auto quad = make_quad_model({1.0f, 1.0f, 1.0f, 1.0f});
+  for (auto &vertex : quad.meshes[0].geometries[0].buffers) {
+    vertex.normal = {0.0f, 0.0f, -1.0f};
+  }
+  quad.meshes[0].geometries[0].material.shading = Material::Shading::Phong;
+  quad.meshes[0].geometries[0].material.specular = {0.0f, 0.0f, 0.0f};
+
+  // 2 by 2 tiles, a short ranged light over their shared corner and many
+  // others out of view
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(128, 128);
+  context.set_view(Matrix4f::Identity());
+  context.add(quad);
+  std::vector<Light> lights;
+  auto light = Light::Point();
+  light.position = {0.0f, 0.0f, -0.1f};
+  light.intensity = 0.01f;
+  light.range = 0.5f;
+  lights.push_back(light);
+  for (int i = 0; i < 1000; i++) {
+    light.position = {4.0f + static_cast<float>(i), 0.0f, -0.1f};
+    lights.push_back(light);
+  }
+  context.set_lights(lights);
+  context.draw();
+
+  auto &colors = context.get_colors();
+  auto red = [&colors](int x, int y) { return colors[(x + y * 128) * 4]; };
+  REQUIRE(red(60, 60) > 0.25f);
+  REQUIRE(std::abs(red(60, 60) - red(68, 60)) < 1e-3f);
+  REQUIRE(std::abs(red(60, 60) - red(60, 68)) < 1e-3f);
+  REQUIRE(std::abs(red(60, 60) - red(68, 68)) < 1e-3f);
+  // beyond the range, within the tiles the light was assigned to
+  REQUIRE(0.0f == red(4, 4));
+  REQUIRE(0.0f == red(123, 123));
+}
+
+TEST_CASE("Context deferred lighting", "[Context]") {
+  // a Phong wall, half hidden by a metallic-roughness quad, and an unlit
+  // one in front of both
+  auto wall = make_quad_model({0.5f, 0.25f, 0.125f, 1.0f});
+  auto metal = make_quad_model({0.8f, 0.8f, 0.8f, 1.0f});
+  auto unlit = make_quad_model({0.0f, 1.0f, 0.0f, 1.0f});
+  for (auto &vertex : wall.meshes[0].geometries[0].buffers) {
+    vertex.position[2] = 0.5f;
+    vertex.normal = {0.0f, 0.0f, -1.0f};
+  }
+  for (auto &vertex : metal.meshes[0].geometries[0].buffers) {
+    vertex.position[0] = std::min(vertex.position[0], 0.0f);
+    vertex.normal = Vector3f(0.3f, 0.0f, -1.0f).normalized();
+  }
+  for (auto &vertex : unlit.meshes[0].geometries[0].buffers) {
+    vertex.position = {vertex.position[0] * 0.25f, vertex.position[1] * 0.25f,
+                       -0.5f};
+  }
+  wall.meshes[0].geometries[0].material.shading = Material::Shading::Phong;
+  wall.meshes[0].geometries[0].material.specular = {0.5f, 0.5f, 0.5f};
+  wall.meshes[0].geometries[0].material.shininess = 16.0f;
+  auto &pbr = metal.meshes[0].geometries[0].material;
+  pbr.shading = Material::Shading::MetallicRoughness;
+  pbr.metallic = 0.5f;
+  pbr.roughness = 0.5f;
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(96, 96);
+  context.set_view(Matrix4f::Identity());
+  for (auto model : {&wall, &metal, &unlit}) {
+    context.add(*model);
+  }
+  auto ambient = Light::Ambient();
+  ambient.intensity = 0.2f;
+  auto sun = Light::Direction();
+  sun.direction = Vector3f(0.5f, -0.5f, 1.0f).normalized();
+  auto point = Light::Point();
+  point.position = {0.5f, 0.5f, -0.2f};
+  point.range = 0.6f;
+  point.intensity = 0.1f;
+  context.set_lights({ambient, sun, point});
+
+  context.draw();
+  const auto forward = context.get_colors();
+  // the G-buffer rounds colors and factors to 8 bits
+  auto matches = [&forward](const std::vector<float> &colors) {
+    for (size_t idx = 0; idx < forward.size(); idx++) {
+      if (std::abs(colors[idx] - forward[idx]) > 0.02f) {
+        return false;
+      }
+    }
+    return true;
+  };
+  context.set_deferred(true);
+  context.draw();
+  REQUIRE(matches(context.get_colors()));
+  const auto center = (48 + 48 * 96) * 4;
+  REQUIRE(1.0f == context.get_colors()[center + 1]);
+  REQUIRE(0.0f == context.get_colors()[center]);
+
+  // frames in flight light their own G-buffers
+  context.set_frames_in_flight(2);
+  auto first = context.draw_async();
+  auto second = context.draw_async();
+  REQUIRE(matches(context.wait(first)));
+  REQUIRE(matches(context.wait(second)));
+}
+
+TEST_CASE("Context deferred perspective", "[Context]") {
+  // a floor seen at an angle through a 60 degree lens, under a point light
+  auto floor = make_quad_model({1.0f, 1.0f, 1.0f, 1.0f});
+  auto &geometry = floor.meshes[0].geometries[0];
+  for (auto &vertex : geometry.buffers) {
+    vertex.position = {vertex.position[0], 0.0f, -vertex.position[1]};
+    vertex.normal = {0.0f, 1.0f, 0.0f};
+  }
+  geometry.box = {{-1.0f, 0.0f, -1.0f}, {1.0f, 0.0f, 1.0f}};
+  geometry.material.shading = Material::Shading::Phong;
+  geometry.material.specular = {0.0f, 0.0f, 0.0f};
+
+  Camera camera;
+  camera.setProjection(60.0f, 1.0f, 0.1f, 10.0f);
+  camera.lookAt({0.0f, 1.0f, -2.0f}, {0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f});
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(96, 96);
+  context.set_view(camera.getCullingProjectionMatrix() *
+                   camera.getViewMatrix().inverse());
+  context.add(floor);
+  auto point = Light::Point();
+  point.position = {0.0f, 0.5f, 0.0f};
+  point.range = 1.0f;
+  context.set_lights({point});
+
+  context.draw();
+  const auto forward = context.get_colors();
+  auto brightest = 0.0f;
+  for (size_t idx = 0; idx < forward.size(); idx += 4) {
+    brightest = std::max(brightest, forward[idx]);
+  }
+  REQUIRE(brightest > 0.5f);
+  context.set_deferred(true);
+  context.draw();
+  auto &deferred = context.get_colors();
+  auto difference = 0.0f;
+  for (size_t idx = 0; idx < forward.size(); idx++) {
+    difference = std::max(difference, std::abs(deferred[idx] - forward[idx]));
+  }
+  // forward pixels are shaded where the snapped triangles put them, up to
+  // a pixel off the centers the G-buffer positions are rebuilt at
+  REQUIRE(difference < 0.1f);
+}
+
+TEST_CASE("Context transparency", "[Context]") {
+  // a red wall behind a masked quad, then two blended ones added from the
+  // nearest
+  auto wall = make_quad_model({1.0f, 0.0f, 0.0f, 1.0f});
+  auto masked = make_quad_model({1.0f, 1.0f, 1.0f, 0.25f});
+  auto blue = make_quad_model({0.0f, 0.0f, 1.0f, 0.5f});
+  auto green = make_quad_model({0.0f, 1.0f, 0.0f, 0.5f});
+  auto place = [](Model &model, float z, Material::AlphaMode mode) {
+    auto &geometry = model.meshes[0].geometries[0];
+    for (auto &vertex : geometry.buffers) {
+      vertex.position[2] = z;
+    }
+    geometry.box = {{-1.0f, -1.0f, z}, {1.0f, 1.0f, z}};
+    geometry.material.alpha_mode = mode;
+  };
+  place(wall, 0.5f, Material::AlphaMode::Opaque);
+  place(masked, -0.75f, Material::AlphaMode::Mask);
+  place(blue, -0.5f, Material::AlphaMode::Blend);
+  place(green, 0.0f, Material::AlphaMode::Blend);
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+  context.add(wall);
+  auto masked_handle = context.add(masked);
+  context.add(blue);
+  context.add(green);
+
+  // green over red, then blue over both
+  const auto center = (8 + 8 * 16) * 4;
+  for (auto deferred : {false, true}) {
+    context.set_deferred(deferred);
+    context.draw();
+    auto colors = context.get_colors();
+    REQUIRE(std::abs(colors[center] - 0.25f) < 1e-6f);
+    REQUIRE(std::abs(colors[center + 1] - 0.25f) < 1e-6f);
+    REQUIRE(std::abs(colors[center + 2] - 0.5f) < 1e-6f);
+  }
+
+  // unsorted, the red wall still shows through the same quarter
+  context.set_transparency(Context::Transparency::WeightedBlended);
+  context.draw();
+  auto colors = context.get_colors();
+  REQUIRE(std::abs(colors[center] - 0.25f) < 1e-6f);
+  REQUIRE(std::abs(colors[center + 1] + colors[center + 2] - 0.75f) < 1e-5f);
+  REQUIRE(colors[center + 2] > colors[center + 1]);
+
+  // drawing views weights them even when sorting is asked for
+  context.set_transparency(Context::Transparency::Sorted);
+  Matrix4f away = Matrix4f::Identity();
+  away(0, 3) = 4.0f;
+  std::vector<Frame> frames;
+  context.draw_views({Matrix4f::Identity(), away}, frames);
+  for (uint32_t c = 0; c < 4; c++) {
+    REQUIRE(std::abs(frames[0].getColors()[center + c] - colors[center + c]) <
+            1e-6f);
+  }
+  context.set_transparency(Context::Transparency::WeightedBlended);
+
+  // a masked quad reaching its cutoff hides everything behind it
+  auto material = masked.meshes[0].geometries[0].material;
+  material.AlphaCutoff = 0.25f;
+  context.update_material(masked_handle, 0, material);
+  context.draw();
+  REQUIRE(1.0f == context.get_colors()[center + 1]);
+  REQUIRE(0.25f == context.get_colors()[center + 3]);
+}
+
+TEST_CASE("Context multisampling", "[Context]") {
+  // the lower right half of the screen, cut along its diagonal
+  auto triangle = make_quad_model({1.0f, 0.0f, 0.0f, 1.0f});
+  auto &geometry = triangle.meshes[0].geometries[0];
+  geometry.indices = {0, 1, 2};
+  geometry.index_count = 3;
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+  context.add(triangle);
+  const auto inside = (12 + 4 * 16) * 4;
+  const auto outside = (4 + 12 * 16) * 4;
+  const auto edge = (8 + 8 * 16) * 4;
+
+  context.draw();
+  auto colors = context.get_colors();
+  REQUIRE((0.0f == colors[edge] || 1.0f == colors[edge]));
+
+  // half of the samples of each pixel on the diagonal are covered
+  for (auto samples : {4u, 8u}) {
+    context.set_samples(samples);
+    context.draw();
+    colors = context.get_colors();
+    REQUIRE(1.0f == colors[inside]);
+    REQUIRE(0.0f == colors[outside]);
+    REQUIRE(0.5f == colors[edge]);
+    REQUIRE(1.0f == colors[edge + 3]);
+  }
+  auto fence = context.draw_async();
+  REQUIRE(0.5f == context.wait(fence)[edge]);
+
+  REQUIRE_THROWS(context.set_samples(3));
+}
+
+TEST_CASE("Context post effects", "[Context]") {
+  auto triangle = make_quad_model({1.0f, 0.0f, 0.0f, 1.0f});
+  auto &geometry = triangle.meshes[0].geometries[0];
+  geometry.indices = {0, 1, 2};
+  geometry.index_count = 3;
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+  context.add(triangle);
+  const auto inside = (12 + 4 * 16) * 4;
+  const auto outside = (4 + 12 * 16) * 4;
+
+  // the per pixel effects, in one sweep
+  context.set_post_effects(
+      {PostEffect::ToneMapping(), PostEffect::EncodeSRGB()});
+  context.draw();
+  const auto mapped = 2.54f / 3.16f;
+  const auto encoded = 1.055f * powf(mapped, 1.0f / 2.4f) - 0.055f;
+  REQUIRE(std::abs(context.get_colors()[inside] - encoded) < 1e-5f);
+  REQUIRE(0.0f == context.get_colors()[outside]);
+
+  // the staircase of the diagonal is smoothed out, the rest is untouched
+  context.set_post_effects({PostEffect::FXAA()});
+  context.draw();
+  auto colors = context.get_colors();
+  REQUIRE(1.0f == colors[inside]);
+  REQUIRE(0.0f == colors[outside]);
+  auto blended = 0;
+  for (uint32_t i = 0; i < 16; i++) {
+    auto value = colors[(i + i * 16) * 4];
+    blended += value > 0.0f && value < 1.0f ? 1 : 0;
+  }
+  REQUIRE(blended > 8);
+
+  // drawing views leaves the last frame drawn untouched
+  Matrix4f away = Matrix4f::Identity();
+  away(0, 3) = 4.0f;
+  std::vector<Frame> frames;
+  context.draw_views({Matrix4f::Identity(), away}, frames);
+  REQUIRE(colors == context.get_colors());
+  REQUIRE(colors == frames[0].getColors());
+  REQUIRE(0.0f == frames[1].getColors()[inside]);
+
+  // the frame's corners darken, and blocks of 2x2 pixels become one
+  context.set_post_effects(
+      {PostEffect::Downscale(2), PostEffect::Vignette(0.5f)});
+  auto fence = context.draw_async();
+  auto &small = context.wait(fence);
+  REQUIRE(8 * 8 * 4 == small.size());
+  REQUIRE(small[(7 + 0 * 8) * 4] < small[(5 + 2 * 8) * 4]);
+  REQUIRE(0.0f < small[(5 + 2 * 8) * 4]);
+
+  context.set_post_effects({});
+  context.draw();
+  REQUIRE(16 * 16 * 4 == context.get_colors().size());
+}
+
+TEST_CASE("Context normal maps", "[Context]") {
+  auto quad = make_quad_model({1.0f, 1.0f, 1.0f, 1.0f});
+  auto &buffers = quad.meshes[0].geometries[0].buffers;
+  const std::array<float, 2> uvs[] = {
+      {0.0f, 0.0f}, {1.0f, 0.0f}, {1.0f, 1.0f}, {0.0f, 1.0f}};
+  for (size_t idx = 0; idx < buffers.size(); idx++) {
+    buffers[idx].normal = {0.0f, 0.0f, -1.0f};
+    buffers[idx].uv = uvs[idx];
+  }
+  auto material = quad.meshes[0].geometries[0].material;
+  material.shading = Material::Shading::Normal;
+  quad.meshes[0].geometries[0].material = material;
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+  auto handle = context.add(quad);
+  const auto center = (8 + 8 * 16) * 4;
+  context.draw();
+  REQUIRE(0.5f == context.get_colors()[center]);
+  REQUIRE(0.0f == context.get_colors()[center + 2]);
+
+  // bent all the way towards the tangent, along which u grows
+  uint8_t texel[] = {255, 128, 128};
+  Texture normal_map;
+  normal_map.width = 1;
+  normal_map.height = 1;
+  normal_map.channels = 3;
+  normal_map.data = texel;
+  material.normal_texture = &normal_map;
+  context.update_material(handle, 0, material);
+  context.draw();
+  auto colors = context.get_colors();
+  REQUIRE(colors[center] > 0.99f);
+  REQUIRE(std::abs(colors[center + 1] - 0.5f) < 0.01f);
+  REQUIRE(std::abs(colors[center + 2] - 0.5f) < 0.01f);
+
+  // flattened back by the scale
+  material.normal_scale = 0.0f;
+  context.update_material(handle, 0, material);
+  context.draw();
+  REQUIRE(std::abs(context.get_colors()[center] - 0.5f) < 0.01f);
+  REQUIRE(context.get_colors()[center + 2] < 0.01f);
+}
+
+// writes a red quad as glTF with an external buffer, returns its path
+static auto write_quad_gltf() -> std::string {
+  const float positions[] = {-1.0f, -1.0f, 0.0f, 1.0f, -1.0f, 0.0f,
+                             1.0f,  1.0f,  0.0f, -1.0f, 1.0f, 0.0f};
+  const uint16_t indices[] = {0, 1, 2, 0, 2, 3};
+  std::ofstream bin("stream_quad.bin", std::ios::binary);
+  bin.write(reinterpret_cast<const char *>(positions), sizeof(positions));
+  bin.write(reinterpret_cast<const char *>(indices), sizeof(indices));
+
+  std::ofstream gltf("stream_quad.gltf");
+  gltf << R"({"asset": {"version": "2.0"}, "scene": 0,
+    "scenes": [{"nodes": [0]}], "nodes": [{"mesh": 0}],
+    "meshes": [{"primitives": [
+      {"attributes": {"POSITION": 0}, "indices": 1, "material": 0}]}],
+    "materials": [{"pbrMetallicRoughness": {"baseColorFactor": [1, 0, 0, 1]}}],
+    "buffers": [{"uri": "stream_quad.bin", "byteLength": 60}],
+    "bufferViews": [{"buffer": 0, "byteLength": 48},
+                    {"buffer": 0, "byteOffset": 48, "byteLength": 12}],
+    "accessors": [
+      {"bufferView": 0, "componentType": 5126, "count": 4, "type": "VEC3",
+       "min": [-1, -1, 0], "max": [1, 1, 0]},
+      {"bufferView": 1, "componentType": 5123, "count": 6, "type": "SCALAR"}]
+  })";
+  return "stream_quad.gltf";
+}
+
+TEST_CASE("ModelLoader streaming", "[ModelLoader]") {
+  auto path = write_quad_gltf();
+
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+
+  ModelLoader loader(path);
+  auto stream = loader.load_async();
+  stream->wait();
+  REQUIRE(stream->poll(context));
+  REQUIRE(stream->has_all_meshes());
+  REQUIRE(1 == stream->get_handles().size());
+
+  context.draw();
+  const auto center = (8 + 8 * 16) * 4;
+  REQUIRE(1.0f == context.get_colors()[center]);
+
+  // the second load comes from the cache written by the first one
+  ModelLoader cached(path);
+  auto &model = cached.load();
+  REQUIRE(1 == model.meshes.size());
+  REQUIRE(6 == model.meshes[0].geometries[0].get_indices().count);
+  REQUIRE(1.0f == model.meshes[0].geometries[0].material.base_color[0]);
+}
+
+TEST_CASE("ModelLoader cache dependencies", "[ModelLoader]") {
+  auto path = write_quad_gltf();
+  ModelLoader first(path);
+  first.load();
+
+  // the same quad at half the size, in a buffer of the same size; edits
+  // within a second of the first load keep its mtime, so it is set apart
+  const float positions[] = {-0.5f, -0.5f, 0.0f, 0.5f, -0.5f, 0.0f,
+                             0.5f,  0.5f,  0.0f, -0.5f, 0.5f, 0.0f};
+  const uint16_t indices[] = {0, 1, 2, 0, 2, 3};
+  {
+    std::ofstream bin("stream_quad.bin", std::ios::binary);
+    bin.write(reinterpret_cast<const char *>(positions), sizeof(positions));
+    bin.write(reinterpret_cast<const char *>(indices), sizeof(indices));
+  }
+  utimbuf times{1000, 1000};
+  REQUIRE(0 == utime("stream_quad.bin", &times));
+
+  // an edited buffer misses the cache the first load wrote
+  ModelLoader second(path);
+  auto &model = second.load();
+  float position[3];
+  model.meshes[0].geometries[0].get_positions().read(2, position);
+  REQUIRE(0.5f == position[0]);
+}
+
+TEST_CASE("ModelLoader streamed textures", "[ModelLoader]") {
+  write_quad_gltf();
+  // a white pixel, textured onto the quad through `sampler`
+  auto write_textured = [](const std::string &sampler) {
+    std::ofstream gltf("textured_quad.gltf");
+    gltf << R"({"asset": {"version": "2.0"}, "scene": 0,
+      "scenes": [{"nodes": [0]}], "nodes": [{"mesh": 0}],
+      "meshes": [{"primitives": [
+        {"attributes": {"POSITION": 0}, "indices": 1, "material": 0}]}],
+      "materials": [{"pbrMetallicRoughness":
+        {"baseColorTexture": {"index": 0}}}],
+      "textures": [{"source": 0)"
+         << sampler << R"(}],
+      "images": [{"uri": "data:image/png;base64,)"
+         << "iVBORw0KGgoAAAANSUhEUgAAAAEAAAABCAYAAAAfFcSJAAAADUlEQVR42mP8"
+         << "/5+hHgAHggJ/PchI7wAAAABJRU5ErkJggg==" << R"("}],
+      "buffers": [{"uri": "stream_quad.bin", "byteLength": 60}],
+      "bufferViews": [{"buffer": 0, "byteLength": 48},
+                      {"buffer": 0, "byteOffset": 48, "byteLength": 12}],
+      "accessors": [
+        {"bufferView": 0, "componentType": 5126, "count": 4, "type": "VEC3",
+         "min": [-1, -1, 0], "max": [1, 1, 0]},
+        {"bufferView": 1, "componentType": 5123, "count": 6,
+         "type": "SCALAR"}]
+    })";
+  };
+
+  // the sampler is optional
+  write_textured("");
+  ModelLoader loader("textured_quad.gltf");
+  auto stream = loader.load_async();
+  stream->wait();
+  REQUIRE(stream->has_all_meshes());
+
+  // textures are processed on the decoding threads, whose errors reach the
+  // stream instead of terminating
+  write_textured(R"(, "sampler": 3)");
+  ModelLoader broken("textured_quad.gltf");
+  REQUIRE_THROWS(broken.load_async()->wait());
+}
+
+TEST_CASE("TextureCache residency", "[TextureCache]") {
+  auto &cache = TextureCache::instance();
+  auto budget = cache.get_budget();
+  cache.set_budget(64);
+
+  int decodes = 0;
+  auto decoder = [&decodes](std::vector<unsigned char> &pixels,
+                            Texture &texture) {
+    decodes++;
+    texture.width = 4;
+    texture.height = 4;
+    texture.channels = 4;
+    pixels.assign(64, static_cast<unsigned char>(decodes));
+  };
+  Texture first, second;
+  TextureCache::make_lazy(first, decoder);
+  TextureCache::make_lazy(second, decoder);
+  REQUIRE(0 == decodes);
+
+  auto resident = cache.acquire(first);
+  cache.acquire(first);
+  REQUIRE(1 == decodes);
+  REQUIRE(64 == cache.get_resident_bytes());
+
+  // over budget: the least recently used texture goes, but stays valid for
+  // whoever still holds it
+  cache.acquire(second);
+  REQUIRE(2 == decodes);
+  REQUIRE(64 == cache.get_resident_bytes());
+  REQUIRE(1 == resident->data[0]);
+
+  cache.acquire(first);
+  REQUIRE(3 == decodes);
+
+  // failures are recorded, the texture being drawn as a white pixel
+  Texture broken;
+  TextureCache::make_lazy(broken, [](std::vector<unsigned char> &, Texture &) {
+    throw std::runtime_error("corrupt");
+  });
+  auto placeholder = cache.acquire(broken);
+  REQUIRE(1 == placeholder->width);
+  REQUIRE(255 == placeholder->data[0]);
+  REQUIRE(cache.get_error(broken) != nullptr);
+  REQUIRE(nullptr == cache.get_error(first));
+  REQUIRE(1 == cache.take_errors().size());
+  REQUIRE(cache.take_errors().empty());
+
+  cache.set_budget(budget);
+}
+
+TEST_CASE("MeshOptimizer vertex cache", "[MeshOptimizer]") {
+  // a 32x32 grid whose triangles come in a scattered order
+  const uint32_t size = 33;
+  Geometry geometry{};
+  geometry.buffers.resize(size * size);
+  for (uint32_t y = 0; y < size; y++) {
+    for (uint32_t x = 0; x < size; x++) {
+      geometry.buffers[y * size + x].position = {static_cast<float>(x),
+                                                 static_cast<float>(y), 0.0f};
+    }
+  }
+  const uint32_t quads = (size - 1) * (size - 1);
+  for (uint32_t i = 0; i < quads; i++) {
+    auto quad = (i * 37) % quads;
+    auto corner = quad / (size - 1) * size + quad % (size - 1);
+    geometry.indices.insert(geometry.indices.end(),
+                            {corner, corner + 1, corner + size + 1, corner,
+                             corner + size + 1, corner + size});
+  }
+  geometry.vertex_count = size * size;
+  geometry.index_count = static_cast<uint32_t>(geometry.indices.size());
+
+  auto before = analyze_vertex_cache(geometry);
+  REQUIRE(optimize_vertex_cache(geometry));
+  auto after = analyze_vertex_cache(geometry);
+  REQUIRE(quads * 6 == geometry.get_indices().count);
+  REQUIRE(size * size == geometry.vertex_count);
+  REQUIRE(after.acmr < before.acmr);
+  REQUIRE(after.acmr < 1.0f);
+  // vertices are numbered in order of first use
+  REQUIRE(0 == *geometry.get_indices().get<uint32_t>(0));
+}
+
+TEST_CASE("MeshOptimizer narrow indices", "[MeshOptimizer]") {
+  auto model = make_quad_model({1.0f, 0.0f, 0.0f, 1.0f});
+  auto &geometry = model.meshes[0].geometries[0];
+  REQUIRE(narrow_indices(geometry));
+  auto indices = geometry.get_indices();
+  REQUIRE(ComponentType::UnsignedShort == indices.type);
+  REQUIRE(6 == indices.count);
+  REQUIRE(3 == indices.get_index(5));
+  REQUIRE_FALSE(narrow_indices(geometry));
+
+  // 16 bits indices are drawn in place
+  Context context(Context::Type::SoftwareRasterizer);
+  context.view_port(16, 16);
+  context.set_view(Matrix4f::Identity());
+  context.add(model);
+  context.draw();
+  REQUIRE(1.0f == context.get_colors()[(8 + 8 * 16) * 4]);
+}
+
+// the quad of `write_quad_gltf` with positions stored as normalized shorts
+static auto write_quantized_quad_gltf() -> std::string {
+  const int16_t positions[] = {-32767, -32767, 0, 0, 32767, -32767, 0, 0,
+                               32767,  32767,  0, 0, -32767, 32767, 0, 0};
+  const uint16_t indices[] = {0, 1, 2, 0, 2, 3};
+  std::ofstream bin("quantized_quad.bin", std::ios::binary);
+  bin.write(reinterpret_cast<const char *>(positions), sizeof(positions));
+  bin.write(reinterpret_cast<const char *>(indices), sizeof(indices));
+
+  std::ofstream gltf("quantized_quad.gltf");
+  gltf << R"({"asset": {"version": "2.0"}, "scene": 0,
+    "extensionsUsed": ["KHR_mesh_quantization"],
+    "extensionsRequired": ["KHR_mesh_quantization"],
+    "scenes": [{"nodes": [0]}], "nodes": [{"mesh": 0}],
+    "meshes": [{"primitives": [
+      {"attributes": {"POSITION": 0}, "indices": 1, "material": 0}]}],
+    "materials": [{"pbrMetallicRoughness": {"baseColorFactor": [1, 0, 0, 1]}}],
+    "buffers": [{"uri": "quantized_quad.bin", "byteLength": 44}],
+    "bufferViews": [{"buffer": 0, "byteLength": 32, "byteStride": 8},
+                    {"buffer": 0, "byteOffset": 32, "byteLength": 12}],
+    "accessors": [
+      {"bufferView": 0, "componentType": 5122, "normalized": true,
+       "count": 4, "type": "VEC3",
+       "min": [-32767, -32767, 0], "max": [32767, 32767, 0]},
+      {"bufferView": 1, "componentType": 5123, "count": 6, "type": "SCALAR"}]
+  })";
+  return "quantized_quad.gltf";
+}
+
+TEST_CASE("ModelLoader quantized attributes", "[ModelLoader]") {
+  auto path = write_quantized_quad_gltf();
+
+  for (auto keep_quantized : {false, true}) {
+    ModelLoader loader(path);
+    loader.set_keep_quantized(keep_quantized);
+    auto &model = loader.load();
+    auto &geometry = model.meshes[0].geometries[0];
+    auto positions = geometry.get_positions();
+    REQUIRE((keep_quantized ? ComponentType::Short : ComponentType::Float) ==
+            positions.type);
+    float position[3];
+    positions.read(2, position);
+    REQUIRE(1.0f == position[0]);
+    REQUIRE(1.0f == geometry.box.max[1]);
+
+    Context context(Context::Type::SoftwareRasterizer);
+    context.view_port(16, 16);
+    context.set_view(Matrix4f::Identity());
+    context.add(model);
+    context.draw();
+    REQUIRE(1.0f == context.get_colors()[(8 + 8 * 16) * 4]);
+  }
+}
+
+// the quad of `write_quad_gltf` compressed with EXT_meshopt_compression
+static auto write_meshopt_quad_gltf() -> std::string {
+  const uint8_t vertices[] = {
+      0xa0, 0x00, 0x00, 0x00, 0x01, 0x33, 0x00, 0x00, 0x00, 0xff, 0xff, 0x00,
+      0x00, 0x00, 0x01, 0x0c, 0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xbf,
+      0x00, 0x00, 0x80, 0xbf, 0x00, 0x00, 0x00, 0x00};
+  const uint8_t triangles[] = {0xe1, 0xf0, 0x00, 0x00, 0x76, 0x87, 0x56,
+                               0x67, 0x78, 0xa9, 0x86, 0x65, 0x89, 0x68,
+                               0x98, 0x01, 0x69, 0x00, 0x00, 0x00};
+  std::ofstream bin("meshopt_quad.bin", std::ios::binary);
+  bin.write(reinterpret_cast<const char *>(vertices), sizeof(vertices));
+  bin.write(reinterpret_cast<const char *>(triangles), sizeof(triangles));
+
+  std::ofstream gltf("meshopt_quad.gltf");
+  gltf << R"({"asset": {"version": "2.0"}, "scene": 0,
+    "extensionsUsed": ["EXT_meshopt_compression"],
+    "extensionsRequired": ["EXT_meshopt_compression"],
+    "scenes": [{"nodes": [0]}], "nodes": [{"mesh": 0}],
+    "meshes": [{"primitives": [
+      {"attributes": {"POSITION": 0}, "indices": 1, "material": 0}]}],
+    "materials": [{"pbrMetallicRoughness": {"baseColorFactor": [1, 0, 0, 1]}}],
+    "buffers": [{"uri": "meshopt_quad.bin", "byteLength": 76},
+                {"byteLength": 60,
+                 "extensions": {"EXT_meshopt_compression": {"fallback": true}}}],
+    "bufferViews": [
+      {"buffer": 1, "byteLength": 48, "byteStride": 12,
+       "extensions": {"EXT_meshopt_compression": {
+         "buffer": 0, "byteLength": 56, "byteStride": 12, "count": 4,
+         "mode": "ATTRIBUTES"}}},
+      {"buffer": 1, "byteOffset": 48, "byteLength": 12,
+       "extensions": {"EXT_meshopt_compression": {
+         "buffer": 0, "byteOffset": 56, "byteLength": 19, "byteStride": 2,
+         "count": 6, "mode": "TRIANGLES"}}}],
+    "accessors": [
+      {"bufferView": 0, "componentType": 5126, "count": 4, "type": "VEC3",
+       "min": [-1, -1, 0], "max": [1, 1, 0]},
+      {"bufferView": 1, "componentType": 5123, "count": 6, "type": "SCALAR"}]
+  })";
+  return "meshopt_quad.gltf";
+}
+
+TEST_CASE("ModelLoader meshopt compression", "[ModelLoader]") {
+  ModelLoader loader(write_meshopt_quad_gltf());
+  auto &model = loader.load();
+  auto &geometry = model.meshes[0].geometries[0];
+  REQUIRE(4 == geometry.vertex_count);
+
+  const uint32_t expected[] = {0, 1, 2, 0, 2, 3};
+  auto indices = geometry.get_indices();
+  REQUIRE(6 == indices.count);
+  for (uint32_t i = 0; i < 6; i++) {
+    REQUIRE(expected[i] == indices.get_index(i));
+  }
+  float position[3];
+  geometry.get_positions().read(2, position);
+  REQUIRE(1.0f == position[0]);
+  REQUIRE(1.0f == position[1]);
+}
+
+// the quad of `write_quad_gltf` drawn by two nodes
+static auto write_instanced_quad_gltf() -> std::string {
+  write_quad_gltf();
+  std::ofstream gltf("instanced_quad.gltf");
+  gltf << R"({"asset": {"version": "2.0"}, "scene": 0,
+    "scenes": [{"nodes": [0, 1]}],
+    "nodes": [{"mesh": 0}, {"mesh": 0, "translation": [3, 0, 0]}],
+    "meshes": [{"primitives": [
+      {"attributes": {"POSITION": 0}, "indices": 1, "material": 0}]}],
+    "materials": [{"pbrMetallicRoughness": {"baseColorFactor": [1, 0, 0, 1]}}],
+    "buffers": [{"uri": "stream_quad.bin", "byteLength": 60}],
+    "bufferViews": [{"buffer": 0, "byteLength": 48},
+                    {"buffer": 0, "byteOffset": 48, "byteLength": 12}],
+    "accessors": [
+      {"bufferView": 0, "componentType": 5126, "count": 4, "type": "VEC3",
+       "min": [-1, -1, 0], "max": [1, 1, 0]},
+      {"bufferView": 1, "componentType": 5123, "count": 6, "type": "SCALAR"}]
+  })";
+  return "instanced_quad.gltf";
+}
+
+TEST_CASE("ModelLoader shared assets", "[ModelLoader]") {
+  auto path = write_instanced_quad_gltf();
+
+  // optimized geometries are converted once, for both instances
+  ModelLoader optimized(path);
+  optimized.set_optimize_meshes(true);
+  auto &model = optimized.load();
+  REQUIRE(2 == model.meshes.size());
+  REQUIRE(model.meshes[0].geometries[0].get_positions().data ==
+          model.meshes[1].geometries[0].get_positions().data);
+
+  // the two triangles transform their 4 vertices once, before and after, and
+  // a load from the cache reports the same
+  auto stats = optimized.get_vertex_cache_stats();
+  REQUIRE(2.0f == Approx(stats[0].acmr));
+  REQUIRE(2.0f == Approx(stats[1].acmr));
+  REQUIRE(1.0f == Approx(stats[1].atvr));
+  ModelLoader cached(path);
+  cached.set_optimize_meshes(true);
+  cached.load();
+  REQUIRE(stats[1].acmr == cached.get_vertex_cache_stats()[1].acmr);
+
+  // models loading the same arrays, from the source or the cache, share them
+  ModelLoader first(path);
+  first.set_share_assets(true);
+  auto &geometry = first.load().meshes[0].geometries[0];
+  ModelLoader second(path);
+  second.set_share_assets(true);
+  auto &other = second.load().meshes[1].geometries[0];
+  REQUIRE(geometry.get_positions().data == other.get_positions().data);
+  REQUIRE(geometry.get_indices().data == other.get_indices().data);
+}
@@ -1357,6 +1357,18 @@ class TinyGLTF {
     store_original_json_for_extras_and_extensions_ = enabled;
   }
 
+  ///
+  /// Leave `Buffer::data` of the GLB-embedded buffer empty instead of copying
+  /// the BIN chunk. The bytes passed to `LoadBinaryFromMemory()` must then
+  /// outlive every use of that buffer, and the caller reads the BIN chunk
+  /// from them directly.
+  ///
+  void SetReferenceBinaryChunk(const bool enabled) {
+    reference_binary_chunk_ = enabled;
+  }
+
+  bool GetReferenceBinaryChunk() const { return reference_binary_chunk_; }
+
   bool GetStoreOriginalJSONForExtrasAndExtensions() const {
     return store_original_json_for_extras_and_extensions_;
   }
@@ -1375,6 +1387,7 @@ class TinyGLTF {
   const unsigned char *bin_data_ = nullptr;
   size_t bin_size_ = 0;
   bool is_binary_ = false;
+  bool reference_binary_chunk_ = false;
 
   bool serialize_default_values_ = false;  ///< Serialize default values?
 
@@ -3829,7 +3842,8 @@ static bool ParseBuffer(Buffer *buffer, std::string *err, const json &o,
                         FsCallbacks *fs, const std::string &basedir,
                         bool is_binary = false,
                         const unsigned char *bin_data = nullptr,
-                        size_t bin_size = 0) {
+                        size_t bin_size = 0,
+                        bool reference_bin_data = false) {
   size_t byteLength;
   if (!ParseUnsignedProperty(&byteLength, err, o, "byteLength", true,
                              "Buffer")) {
@@ -3840,6 +3854,25 @@ static bool ParseBuffer(Buffer *buffer, std::string *err, const json &o,
   buffer->uri.clear();
   ParseStringProperty(&buffer->uri, err, o, "uri", false, "Buffer");
 
+  // A placeholder for data compressed with EXT_meshopt_compression has
+  // neither uri nor bytes: whoever decodes the bufferViews fills it in.
+  if (buffer->uri.empty()) {
+    json_const_iterator extensions_it, meshopt_it;
+    bool fallback = false;
+    if (FindMember(o, "extensions", extensions_it) &&
+        FindMember(GetValue(extensions_it), "EXT_meshopt_compression",
+                   meshopt_it) &&
+        ParseBooleanProperty(&fallback, nullptr, GetValue(meshopt_it),
+                             "fallback", false) &&
+        fallback) {
+      buffer->data.clear();
+      ParseStringProperty(&buffer->name, err, o, "name", false);
+      ParseExtensionsProperty(&buffer->extensions, err, o);
+      ParseExtrasProperty(&buffer->extras, o);
+      return true;
+    }
+  }
+
   // having an empty uri for a non embedded image should not be valid
   if (!is_binary && buffer->uri.empty()) {
     if (err) {
@@ -3900,6 +3933,10 @@ static bool ParseBuffer(Buffer *buffer, std::string *err, const json &o,
         return false;
       }
 
+      if (reference_bin_data) {
+        return true;
+      }
+
       // Read buffer data
       buffer->data.resize(static_cast<size_t>(byteLength));
       memcpy(&(buffer->data.at(0)), bin_data, static_cast<size_t>(byteLength));
@@ -5451,7 +5488,8 @@ bool TinyGLTF::LoadFromString(Model *model, std::string *err, std::string *warn,
       Buffer buffer;
       if (!ParseBuffer(&buffer, err, o,
                        store_original_json_for_extras_and_extensions_, &fs,
-                       base_dir, is_binary_, bin_data_, bin_size_)) {
+                       base_dir, is_binary_, bin_data_, bin_size_,
+                       reference_binary_chunk_)) {
         return false;
       }
 
@@ -5724,6 +5762,10 @@ bool TinyGLTF::LoadFromString(Model *model, std::string *err, std::string *warn,
           return false;
         }
         const Buffer &buffer = model->buffers[size_t(bufferView.buffer)];
+        const unsigned char *buffer_data = buffer.data.data();
+        if (is_binary_ && reference_binary_chunk_ && buffer.uri.empty()) {
+          buffer_data = bin_data_;
+        }
 
         if (*LoadImageData == nullptr) {
           if (err) {
@@ -5733,7 +5775,7 @@ bool TinyGLTF::LoadFromString(Model *model, std::string *err, std::string *warn,
         }
         bool ret = LoadImageData(
             &image, idx, err, warn, image.width, image.height,
-            &buffer.data[bufferView.byteOffset],
+            buffer_data + bufferView.byteOffset,
             static_cast<int>(bufferView.byteLength), load_image_user_data_);
         if (!ret) {
           return false;